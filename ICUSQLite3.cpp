@@ -37,9 +37,26 @@
 #endif
 
 #include "ICUSQLite3.h"
+#include "ICUSQLite3Admission.h"
+#include "ICUSQLite3ChangeStream.h"
+#include "ICUSQLite3Busy.h"
+#include "ICUSQLite3Cache.h"
+#include "ICUSQLite3Catalog.h"
+#include "ICUSQLite3Control.h"
+#include "ICUSQLite3Checkpoint.h"
+#include "ICUSQLite3Collation.h"
+#include "ICUSQLite3Internal.h"
+#include "ICUSQLite3Prefetch.h"
+#include "ICUSQLite3Backup.h"
+#include "ICUSQLite3Transcode.h"
 
 #include <assert.h>
 
+//	STL
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
 //	SQLite3 and/or SQLite3 + ICU extensions
 #if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
 	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
@@ -98,7 +115,13 @@
 	#define ICUSQLITE_BACKUP_FLAG	ICUSQLITE_SUPPORT_NONE
 #endif	//	SQLITE_VERSION_NUMBER < 3006011
 
-#define ICUSQLITE_SUPPORTED_FLAGS	(ICUSQLITE_ENC_FLAG | ICUSQLITE_LOAD_EXT_FLAG | ICUSQLITE_INC_BLOB_FLAG | ICUSQLITE_SAVEPOINT_FLAG | ICUSQLITE_BACKUP_FLAG)
+#if ICUSQLITE_HAVE_SESSION
+	#define ICUSQLITE_SESSION_FLAG	ICUSQLITE_SUPPORT_SESSION
+#else	//	ICUSQLITE_HAVE_SESSION
+	#define ICUSQLITE_SESSION_FLAG	ICUSQLITE_SUPPORT_NONE
+#endif	//	!ICUSQLITE_HAVE_SESSION
+
+#define ICUSQLITE_SUPPORTED_FLAGS	(ICUSQLITE_ENC_FLAG | ICUSQLITE_LOAD_EXT_FLAG | ICUSQLITE_INC_BLOB_FLAG | ICUSQLITE_SAVEPOINT_FLAG | ICUSQLITE_BACKUP_FLAG | ICUSQLITE_SESSION_FLAG)
 
 ///////////////////////////////////////////////////////////////////////////////
 //	Utility functions
@@ -183,6 +206,215 @@ static double IcuSqlite3Atof(
 	return (double)((sign < 0) ? -v1 : v1);
 }
 
+static bool IcuSqlite3IsReadOnlyOpen(
+	const int flags)
+{
+	return (flags & ICUSQLITE_OPEN_READONLY) && 
+		!(flags & (ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE));
+}
+
+//
+//	Single owner connections: debug builds check the caller owns it
+//
+#if defined(NDEBUG)
+	#define ICUSQLITE_ASSERT_OWNER()
+#else	//	defined(NDEBUG)
+	#define ICUSQLITE_ASSERT_OWNER()	assert(IsOwnedByCurrentThread())
+#endif	//	!defined(NDEBUG)
+
+//
+//	Build a "file:" URI with immutable=1 for |utf8Filename|. Characters
+//	that have meaning in a URI are %-escaped; an existing URI just gets
+//	the extra query parameter.
+//
+static std::string IcuSqlite3MakeImmutableUri(
+	const std::string& utf8Filename)
+{
+	if(0 == utf8Filename.compare(0, 5, "file:")) {
+		return utf8Filename + 
+			((std::string::npos == utf8Filename.find('?')) ? "?immutable=1" : "&immutable=1");
+	}
+
+	static const char hex[] = "0123456789ABCDEF";
+	std::string uri = "file:";
+	uri.reserve(utf8Filename.length() + 20);
+
+#if defined(WIN32)
+	if(utf8Filename.length() > 1 && ':' == utf8Filename[1]) {
+		uri += "///";	//	drive letter paths must be absolute URIs
+	}
+#endif	//	defined(WIN32)
+
+	for(std::string::const_iterator it = utf8Filename.begin(); it != utf8Filename.end(); ++it) {
+		const unsigned char c = static_cast<unsigned char>(*it);
+		switch(c) {
+			case '?' :
+			case '#' :
+			case '%' :
+				uri += '%';
+				uri += hex[c >> 4];
+				uri += hex[c & 0x0f];
+				break;
+
+#if defined(WIN32)
+			case '\\' :
+				uri += '/';
+				break;
+#endif	//	defined(WIN32)
+
+			default :
+				uri += static_cast<char>(c);
+				break;
+		}
+	}
+
+	uri += "?immutable=1";
+	return uri;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3OpenProfile
+///////////////////////////////////////////////////////////////////////////////
+
+//
+//	PRAGMAs carried by IcuSqlite3OpenProfile, in the order they are
+//	applied. page_size must come first: it is only honored before anything
+//	writes the database header. |echoes| marks PRAGMAs that report the
+//	effective value when set; the others are read back explicitly.
+//
+static const struct IcuSqlite3ProfilePragma {
+	const char*							name;
+	int64_t IcuSqlite3OpenProfile::*	member;
+	bool								echoes;
+} s_profilePragmas[] = {
+	{ "page_size",			&IcuSqlite3OpenProfile::pageSize,			false },
+	{ "synchronous",		&IcuSqlite3OpenProfile::synchronous,		false },
+	{ "cache_size",			&IcuSqlite3OpenProfile::cacheSize,			false },
+	{ "temp_store",			&IcuSqlite3OpenProfile::tempStore,			false },
+	{ "mmap_size",			&IcuSqlite3OpenProfile::mmapSize,			true },
+	{ "wal_autocheckpoint",	&IcuSqlite3OpenProfile::walAutoCheckpoint,	true },
+	{ "locking_mode",		&IcuSqlite3OpenProfile::lockingMode,		true },
+	{ "journal_size_limit",	&IcuSqlite3OpenProfile::journalSizeLimit,	true },
+};
+
+IcuSqlite3OpenProfile::IcuSqlite3OpenProfile()
+	: synchronous(ICUSQLITE_PRAGMA_UNSET)
+	, cacheSize(ICUSQLITE_PRAGMA_UNSET)
+	, tempStore(ICUSQLITE_PRAGMA_UNSET)
+	, mmapSize(ICUSQLITE_PRAGMA_UNSET)
+	, pageSize(ICUSQLITE_PRAGMA_UNSET)
+	, walAutoCheckpoint(ICUSQLITE_PRAGMA_UNSET)
+	, lockingMode(ICUSQLITE_PRAGMA_UNSET)
+	, journalSizeLimit(ICUSQLITE_PRAGMA_UNSET)
+{
+}
+
+/*static*/
+IcuSqlite3OpenProfile IcuSqlite3OpenProfile::BulkLoad()
+{
+	//
+	//	A crash mid-load means re-running the load, so trade durability
+	//	for throughput: no fsync, one big cache, exclusive lock held for
+	//	the life of the connection and infrequent checkpoints.
+	//
+	IcuSqlite3OpenProfile profile;
+	profile.synchronous			= ICUSQLITE_SYNCHRONOUS_OFF;
+	profile.cacheSize			= -(256 * 1024);	//	256 MiB
+	profile.tempStore			= ICUSQLITE_TEMP_STORE_MEMORY;
+	profile.pageSize			= 16384;
+	profile.walAutoCheckpoint	= 16384;
+	profile.lockingMode			= ICUSQLITE_LOCKING_MODE_EXCLUSIVE;
+	profile.journalSizeLimit	= (64 * 1024 * 1024);
+	return profile;
+}
+
+/*static*/
+IcuSqlite3OpenProfile IcuSqlite3OpenProfile::OLTP()
+{
+	//
+	//	NORMAL is durable under WAL up to the last checkpointed commit and
+	//	avoids an fsync per transaction; keep the WAL short so readers
+	//	don't walk long frame chains.
+	//
+	IcuSqlite3OpenProfile profile;
+	profile.synchronous			= ICUSQLITE_SYNCHRONOUS_NORMAL;
+	profile.cacheSize			= -(64 * 1024);		//	64 MiB
+	profile.tempStore			= ICUSQLITE_TEMP_STORE_MEMORY;
+	profile.mmapSize			= ICUSQLITE_READONLY_MMAP_SIZE;
+	profile.walAutoCheckpoint	= 1000;
+	profile.lockingMode			= ICUSQLITE_LOCKING_MODE_NORMAL;
+	profile.journalSizeLimit	= (64 * 1024 * 1024);
+	return profile;
+}
+
+/*static*/
+IcuSqlite3OpenProfile IcuSqlite3OpenProfile::ReadMostlyAnalytics()
+{
+	IcuSqlite3OpenProfile profile;
+	profile.synchronous			= ICUSQLITE_SYNCHRONOUS_NORMAL;
+	profile.cacheSize			= -(512 * 1024);	//	512 MiB
+	profile.tempStore			= ICUSQLITE_TEMP_STORE_MEMORY;
+	profile.mmapSize			= (1024 * 1024 * 1024);
+	profile.walAutoCheckpoint	= 4000;
+	profile.lockingMode			= ICUSQLITE_LOCKING_MODE_NORMAL;
+	profile.journalSizeLimit	= (64 * 1024 * 1024);
+	return profile;
+}
+
+bool IcuSqlite3OpenProfile::IsEmpty() const
+{
+	for(size_t i = 0; i < sizeof(s_profilePragmas) / sizeof(s_profilePragmas[0]); ++i) {
+		if(ICUSQLITE_PRAGMA_UNSET != this->*s_profilePragmas[i].member) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//
+//	Collects the rows produced by a PRAGMA batch: every PRAGMA that
+//	reports a value returns a single row with a column named after it.
+//
+struct IcuSqlite3PragmaBatchResults {
+	IcuSqlite3OpenProfile	effective;
+	std::string				journalMode;
+};
+
+static int IcuSqlite3PragmaBatchCallback(
+	void* userData, int cols, char** values, char** names)
+{
+	IcuSqlite3PragmaBatchResults* results = 
+		static_cast<IcuSqlite3PragmaBatchResults*>(userData);
+
+	for(int col = 0; col < cols; ++col) {
+		if(nullptr == names[col] || nullptr == values[col]) {
+			continue;
+		}
+
+		if(0 == strcmp("journal_mode", names[col])) {
+			results->journalMode = values[col];
+			continue;
+		}
+
+		for(size_t i = 0; i < sizeof(s_profilePragmas) / sizeof(s_profilePragmas[0]); ++i) {
+			if(0 != strcmp(s_profilePragmas[i].name, names[col])) {
+				continue;
+			}
+
+			int64_t value;
+			if(&IcuSqlite3OpenProfile::lockingMode == s_profilePragmas[i].member) {
+				value = (0 == sqlite3_stricmp("exclusive", values[col])) ?
+					ICUSQLITE_LOCKING_MODE_EXCLUSIVE : ICUSQLITE_LOCKING_MODE_NORMAL;
+			} else {
+				value = static_cast<int64_t>(strtoll(values[col], nullptr, 10));
+			}
+			results->effective.*s_profilePragmas[i].member = value;
+			break;
+		}
+	}
+	return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //	IcuSqlite3StatementBuffer
 ///////////////////////////////////////////////////////////////////////////////
@@ -215,14 +447,163 @@ const char* IcuSqlite3StatementBuffer::Format(
 	return m_buffer;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3FunctionCall
+///////////////////////////////////////////////////////////////////////////////
+/*static*/
+void* IcuSqlite3FunctionCall::GetUserData(
+	void* ctxt)
+{
+	return sqlite3_user_data((sqlite3_context*)ctxt);
+}
+
+/*static*/
+int32_t IcuSqlite3FunctionCall::GetInt(
+	void* value)
+{
+	return sqlite3_value_int((sqlite3_value*)value);
+}
+
+/*static*/
+int64_t IcuSqlite3FunctionCall::GetInt64(
+	void* value)
+{
+	return sqlite3_value_int64((sqlite3_value*)value);
+}
+
+/*static*/
+double IcuSqlite3FunctionCall::GetDouble(
+	void* value)
+{
+	return sqlite3_value_double((sqlite3_value*)value);
+}
+
+/*static*/
+const char* IcuSqlite3FunctionCall::GetText(
+	void* value, int& len)
+{
+	//	text first, then its length (see http://www.sqlite.org/c3ref/value_blob.html)
+	const char* text = reinterpret_cast<const char*>(
+		sqlite3_value_text((sqlite3_value*)value));
+	len = sqlite3_value_bytes((sqlite3_value*)value);
+	return text;
+}
+
+/*static*/
+const unsigned char* IcuSqlite3FunctionCall::GetBlob(
+	void* value, int& len)
+{
+	const unsigned char* blob = static_cast<const unsigned char*>(
+		sqlite3_value_blob((sqlite3_value*)value));
+	len = sqlite3_value_bytes((sqlite3_value*)value);
+	return blob;
+}
+
+/*static*/
+bool IcuSqlite3FunctionCall::IsNull(
+	void* value)
+{
+	return SQLITE_NULL == sqlite3_value_type((sqlite3_value*)value);
+}
+
+/*static*/
+UnicodeString IcuSqlite3FunctionCall::GetUnicodeString(
+	void* value, const bool utf16)
+{
+	//
+	//	Ask for the encoding the function was registered with; that is
+	//	the one SQLite already has the argument in
+	//
+	sqlite3_value* v = (sqlite3_value*)value;
+	if(utf16) {
+		const UChar* text = reinterpret_cast<const UChar*>(sqlite3_value_text16(v));
+		return UnicodeString(text, sqlite3_value_bytes16(v) / sizeof(UChar));
+	}
+
+	const char* text = reinterpret_cast<const char*>(sqlite3_value_text(v));
+	return IcuSqlite3FromUtf8(text, sqlite3_value_bytes(v));
+}
+
+/*static*/
+void IcuSqlite3FunctionCall::SetResult(
+	void* ctxt, const int32_t i, const bool /*utf16*/)
+{
+	sqlite3_result_int((sqlite3_context*)ctxt, i);
+}
+
+/*static*/
+void IcuSqlite3FunctionCall::SetResult(
+	void* ctxt, const int64_t i, const bool /*utf16*/)
+{
+	sqlite3_result_int64((sqlite3_context*)ctxt, i);
+}
+
+/*static*/
+void IcuSqlite3FunctionCall::SetResult(
+	void* ctxt, const double d, const bool /*utf16*/)
+{
+	sqlite3_result_double((sqlite3_context*)ctxt, d);
+}
+
+/*static*/
+void IcuSqlite3FunctionCall::SetResult(
+	void* ctxt, const bool b, const bool /*utf16*/)
+{
+	sqlite3_result_int((sqlite3_context*)ctxt, b ? 1 : 0);
+}
+
+/*static*/
+void IcuSqlite3FunctionCall::SetResult(
+	void* ctxt, const char* str, const bool /*utf16*/)
+{
+	if(nullptr == str) {
+		sqlite3_result_null((sqlite3_context*)ctxt);
+	} else {
+		sqlite3_result_text((sqlite3_context*)ctxt, str, -1, SQLITE_TRANSIENT);
+	}
+}
+
+/*static*/
+void IcuSqlite3FunctionCall::SetResult(
+	void* ctxt, const std::string& str, const bool /*utf16*/)
+{
+	sqlite3_result_text((sqlite3_context*)ctxt, str.data(), 
+		static_cast<int>(str.length()), SQLITE_TRANSIENT);
+}
+
+/*static*/
+void IcuSqlite3FunctionCall::SetResult(
+	void* ctxt, const UnicodeString& str, const bool utf16)
+{
+	if(utf16) {
+#ifdef WORDS_BIGENDIAN
+		sqlite3_result_text16be((sqlite3_context*)ctxt, str.getBuffer(), 
+			str.length() * sizeof(UChar), SQLITE_TRANSIENT);
+#else
+		sqlite3_result_text16le((sqlite3_context*)ctxt, str.getBuffer(), 
+			str.length()*sizeof(UChar), SQLITE_TRANSIENT);
+#endif
+		return;
+	}
+
+	int32_t len;
+	char* utf8 = IcuSqlite3ToUtf8Malloc(str, len);
+	if(nullptr == utf8) {
+		sqlite3_result_error_nomem((sqlite3_context*)ctxt);
+		return;
+	}
+	sqlite3_result_text((sqlite3_context*)ctxt, utf8, len, sqlite3_free);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //	IcuSqlite3ResultSet - public
 ///////////////////////////////////////////////////////////////////////////////
 IcuSqlite3FunctionContext::IcuSqlite3FunctionContext(
-	void* ctxt, int argCount, void** args)
+	void* ctxt, int argCount, void** args, const bool utf16 /*= false*/)
 	: m_ctxt(ctxt)
 	, m_argCount(argCount)
 	, m_args(args)
+	, m_utf16(utf16)
 {
 }
 
@@ -244,8 +625,7 @@ const unsigned char* IcuSqlite3FunctionContext::GetAsBlob(
 UnicodeString IcuSqlite3FunctionContext::GetArgAsUnicodeString(
 	const unsigned int n)
 {
-	return UnicodeString(reinterpret_cast<const UChar*>(
-		sqlite3_value_text16((sqlite3_value*)m_args[n])));
+	return IcuSqlite3FunctionCall::GetUnicodeString(m_args[n], m_utf16);
 }
 
 int32_t IcuSqlite3FunctionContext::GetArgAsInt(
@@ -269,13 +649,7 @@ double IcuSqlite3FunctionContext::GetArgAsDouble(
 void IcuSqlite3FunctionContext::SetResult(
 	const UnicodeString& str)
 {
-#ifdef WORDS_BIGENDIAN
-	sqlite3_result_text16be((sqlite3_context*)m_ctxt, str.getBuffer(), 
-		str.length() * sizeof(UChar), SQLITE_TRANSIENT);
-#else
-	sqlite3_result_text16le((sqlite3_context*)m_ctxt, str.getBuffer(), 
-		str.length()*sizeof(UChar), SQLITE_TRANSIENT);
-#endif
+	IcuSqlite3FunctionCall::SetResult(m_ctxt, str, m_utf16);
 }
 
 void IcuSqlite3FunctionContext::SetResult(
@@ -302,6 +676,74 @@ void IcuSqlite3FunctionContext::SetNullResult()
 	sqlite3_result_null((sqlite3_context*)m_ctxt);
 }
 
+IcuSqlite3Utf8View IcuSqlite3FunctionContext::GetArgAsUtf8(
+	const unsigned int n)
+{
+	IcuSqlite3Utf8View view;
+	view.data = IcuSqlite3FunctionCall::GetText(m_args[n], view.length);
+	return view;
+}
+
+IcuSqlite3BlobView IcuSqlite3FunctionContext::GetArgAsBlobView(
+	const unsigned int n)
+{
+	IcuSqlite3BlobView view;
+	view.data = IcuSqlite3FunctionCall::GetBlob(m_args[n], view.length);
+	view.null = IcuSqlite3FunctionCall::IsNull(m_args[n]);
+	return view;
+}
+
+bool IcuSqlite3FunctionContext::GetArgAsUnicodeStringAlias(
+	const unsigned int n, UnicodeString& alias)
+{
+	sqlite3_value* value = (sqlite3_value*)m_args[n];
+	const UChar* utf16 = static_cast<const UChar*>(sqlite3_value_text16(value));
+	if(nullptr == utf16) {
+		alias.remove();
+		return false;
+	}
+
+	alias.setTo(false, utf16, sqlite3_value_bytes16(value) / sizeof(UChar));
+	return true;
+}
+
+void* IcuSqlite3FunctionContext::AllocResult(
+	const size_t bytes)
+{
+	return sqlite3_malloc64(bytes);
+}
+
+void* IcuSqlite3FunctionContext::ResizeResult(
+	void* buffer, const size_t bytes)
+{
+	return sqlite3_realloc64(buffer, bytes);
+}
+
+void IcuSqlite3FunctionContext::SetOwnedResult(
+	char* utf8, const size_t length)
+{
+	sqlite3_result_text64((sqlite3_context*)m_ctxt, utf8, length, 
+		sqlite3_free, SQLITE_UTF8);
+}
+
+void IcuSqlite3FunctionContext::SetOwnedBlobResult(
+	void* blob, const size_t length)
+{
+	sqlite3_result_blob64((sqlite3_context*)m_ctxt, blob, length, sqlite3_free);
+}
+
+void IcuSqlite3FunctionContext::SetStaticResult(
+	const char* utf8, const int length /*= -1*/)
+{
+	sqlite3_result_text((sqlite3_context*)m_ctxt, utf8, length, SQLITE_STATIC);
+}
+
+void* IcuSqlite3FunctionContext::GetAggregateContext(
+	const int bytes)
+{
+	return sqlite3_aggregate_context((sqlite3_context*)m_ctxt, bytes);
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //	IcuSqlite3ResultSet - public
@@ -313,6 +755,7 @@ IcuSqlite3ResultSet::IcuSqlite3ResultSet()
 	, m_first(true)
 	, m_cols(0)
 	, m_ownStmt(false)
+	, m_utf16(false)
 {
 }
 
@@ -331,10 +774,12 @@ IcuSqlite3ResultSet::IcuSqlite3ResultSet(
 	m_first		= resultSet.m_first;
 	m_cols		= resultSet.m_cols;
 	m_ownStmt	= resultSet.m_ownStmt;
+	m_utf16		= resultSet.m_utf16;
 }
 
 IcuSqlite3ResultSet::IcuSqlite3ResultSet(
-	void* db, void* stmt, bool eof, bool first, bool ownStmt /*= true*/)
+	void* db, void* stmt, bool eof, bool first, bool ownStmt /*= true*/,
+	bool utf16 /*= false*/)
 	: m_util(nullptr)
 {
 	m_db		= db;
@@ -343,6 +788,7 @@ IcuSqlite3ResultSet::IcuSqlite3ResultSet(
 	m_first		= first;
 	m_cols		= sqlite3_column_count((sqlite3_stmt*)m_stmt);
 	m_ownStmt	= ownStmt;
+	m_utf16		= utf16;
 }
 
 /*virtual*/
@@ -373,6 +819,7 @@ IcuSqlite3ResultSet& IcuSqlite3ResultSet::operator=(
 		m_first		= resultSet.m_first;
 		m_cols		= resultSet.m_cols;
 		m_ownStmt	= resultSet.m_ownStmt;
+		m_utf16		= resultSet.m_utf16;
 	}
 	
 	return *this;	
@@ -543,8 +990,19 @@ UnicodeString IcuSqlite3ResultSet::GetString(
 	if(nullptr == m_stmt || colIdx < 0 || colIdx > m_cols - 1) {
 		return defVal;
 	}
-	return reinterpret_cast<const UChar*>(
-		sqlite3_column_text16((sqlite3_stmt*)m_stmt, colIdx));
+
+	//
+	//	Read the cell in the database's own encoding so SQLite never
+	//	converts and caches a second copy of it
+	//
+	sqlite3_stmt* stmt = (sqlite3_stmt*)m_stmt;
+	if(m_utf16) {
+		const UChar* utf16 = static_cast<const UChar*>(sqlite3_column_text16(stmt, colIdx));
+		return UnicodeString(utf16, sqlite3_column_bytes16(stmt, colIdx) / sizeof(UChar));
+	}
+
+	const char* utf8 = (const char*)sqlite3_column_text(stmt, colIdx);
+	return IcuSqlite3FromUtf8(utf8, sqlite3_column_bytes(stmt, colIdx));
 }
 
 UnicodeString IcuSqlite3ResultSet::GetString(
@@ -710,7 +1168,7 @@ UnicodeString IcuSqlite3ResultSet::GetSQL() const
 	UnicodeString sql;
 	const char* sqlUtf8 = GetRawSQL();
 	if(sqlUtf8) {
-		sql = UnicodeString::fromUTF8(sqlUtf8);
+		sql = IcuSqlite3FromUtf8(sqlUtf8);
 	}
 	return sql;
 }
@@ -809,8 +1267,8 @@ int IcuSqlite3Table::FindColumnIndex(
 	//	m_results always contains UTF-8 char*'s so we'll need to convert
 	//	colName -> UTF-8 for lookup
 	//
-	std::string utf8ColName;
-	return FindColumnIndex(colName.toUTF8String(utf8ColName).data());
+	IcuSqlite3Utf8 utf8ColName(colName);
+	return FindColumnIndex(utf8ColName.c_str());
 }
 
 UnicodeString IcuSqlite3Table::GetColumnName(
@@ -820,7 +1278,7 @@ UnicodeString IcuSqlite3Table::GetColumnName(
 		return "";
 	}
 	const char* name = m_results[colIdx];
-	return UnicodeString::fromUTF8(name);
+	return IcuSqlite3FromUtf8(name);
 }
 
 /*
@@ -829,7 +1287,7 @@ UnicodeString IcuSqlite3Table::GetAsString(
 {
 	const char* val = GetValue(colIdx);
 	return (nullptr == val) ? UNICODE_STRING_SIMPLE :
-		UnicodeString::fromUTF8(val);
+		IcuSqlite3FromUtf8(val);
 }
 
 UnicodeString IcuSqlite3Table::GetAsString(
@@ -895,7 +1353,7 @@ UnicodeString IcuSqlite3Table::GetString(
 	const int colIdx, const UnicodeString& defVal /*= ""*/) const
 {
 	const char* val = GetValue(colIdx);
-	return (nullptr != val) ? UnicodeString::fromUTF8(val) : defVal;
+	return (nullptr != val) ? IcuSqlite3FromUtf8(val) : defVal;
 }
 
 UnicodeString IcuSqlite3Table::GetString(
@@ -946,7 +1404,7 @@ int64_t IcuSqlite3Table::GetDateTime64(
 				m_util = new ICUSQLite3Utility();
 			}
 			UDate d = 0;
-			if(m_util->Parse(d, UnicodeString::fromUTF8(val))) {
+			if(m_util->Parse(d, IcuSqlite3FromUtf8(val))) {
 				UErrorCode ec = U_ZERO_ERROR;
 				int64_t r64 = utmscale_fromInt64(static_cast<int64_t>(d), UDTS_ICU4C_TIME, &ec);
 				if(U_SUCCESS(ec)) {
@@ -1036,7 +1494,7 @@ UDate IcuSqlite3Table::GetDateTimeUDate(
 	//		
 	//		if(U_SUCCESS(ec)) {
 	//			sdf.setLenient(TRUE);
-	//			UDate d = sdf.parse(UnicodeString::fromUTF8(val), ec);
+	//			UDate d = sdf.parse(IcuSqlite3FromUtf8(val), ec);
 	//			if(U_SUCCESS(ec)) {
 	//				result = d;
 	//			}
@@ -1110,6 +1568,7 @@ void IcuSqlite3Table::Finalize()
 IcuSqlite3Statement::IcuSqlite3Statement()
 	: m_db(nullptr)
 	, m_stmt(nullptr)
+	, m_utf16(false)
 	, m_util(nullptr)
 {
 }
@@ -1120,15 +1579,17 @@ IcuSqlite3Statement::IcuSqlite3Statement(
 {
 	m_db	= stmt.m_db;
 	m_stmt	= stmt.m_stmt;
+	m_utf16	= stmt.m_utf16;
 
 	//	only one obj can own a statement
 	const_cast<IcuSqlite3Statement&>(stmt).m_stmt = nullptr;
 }
 
 IcuSqlite3Statement::IcuSqlite3Statement(
-	void* db, void* stmt)
+	void* db, void* stmt, const bool utf16 /*= false*/)
 	: m_db(db)
 	, m_stmt(stmt)
+	, m_utf16(utf16)
 	, m_util(nullptr)
 {
 }
@@ -1150,6 +1611,7 @@ IcuSqlite3Statement& IcuSqlite3Statement::operator=(
 
 		m_db	= stmt.m_db;
 		m_stmt	= stmt.m_stmt;
+		m_utf16	= stmt.m_utf16;
 		
 		//	only one obj can own a statement
 		const_cast<IcuSqlite3Statement&>(stmt).m_stmt = nullptr;
@@ -1183,10 +1645,10 @@ IcuSqlite3ResultSet IcuSqlite3Statement::ExecuteQuery()
 
 	switch(sqlite3_step((sqlite3_stmt*)m_stmt)) {
 		case SQLITE_DONE : 
-			return IcuSqlite3ResultSet(m_db, m_stmt, true, true, false);
+			return IcuSqlite3ResultSet(m_db, m_stmt, true, true, false, m_utf16);
 		
 		case SQLITE_ROW :
-			return IcuSqlite3ResultSet(m_db, m_stmt, false, true, false);
+			return IcuSqlite3ResultSet(m_db, m_stmt, false, true, false, m_utf16);
 	}
 
 	//	something went wrong
@@ -1267,26 +1729,41 @@ int IcuSqlite3Statement::GetParamIndex(
 		return 0;
 	}
 	
-	std::string utf8ParamName;
-	return sqlite3_bind_parameter_index((sqlite3_stmt*)m_stmt, 
-		paramName.toUTF8String(utf8ParamName).data());
+	IcuSqlite3Utf8 utf8ParamName(paramName);
+	return sqlite3_bind_parameter_index((sqlite3_stmt*)m_stmt, utf8ParamName);
 }
 
 UnicodeString IcuSqlite3Statement::GetParamName(
 	const int paramIdx)
 {
 	return (nullptr == m_stmt) ? "" : 
-		UnicodeString::fromUTF8(
+		IcuSqlite3FromUtf8(
 			sqlite3_bind_parameter_name((sqlite3_stmt*)m_stmt, paramIdx));
 }
 
 bool IcuSqlite3Statement::Bind(
 	const int paramIdx, const UnicodeString& paramValue)
 {
-	return (nullptr != m_stmt && 
-		SQLITE_OK == sqlite3_bind_text16((sqlite3_stmt*)m_stmt, paramIdx, 
-			(const void*)paramValue.getBuffer(), 
-			paramValue.length() * sizeof(UChar), SQLITE_TRANSIENT));
+	if(nullptr == m_stmt) {
+		return false;
+	}
+
+	//
+	//	Hand SQLite text in the database's encoding: a UTF-16 database
+	//	takes (a copy of) the string as is, a UTF-8 one gets a converted
+	//	copy it can own rather than one it converts again when storing
+	//
+	if(m_utf16) {
+		return SQLITE_OK == sqlite3_bind_text16((sqlite3_stmt*)m_stmt, paramIdx,
+			paramValue.getBuffer(), paramValue.length() * sizeof(UChar), 
+			SQLITE_TRANSIENT);
+	}
+
+	int32_t len;
+	char* utf8 = IcuSqlite3ToUtf8Malloc(paramValue, len);
+	return nullptr != utf8 &&
+		SQLITE_OK == sqlite3_bind_text((sqlite3_stmt*)m_stmt, paramIdx, 
+			utf8, len, sqlite3_free);
 }
 
 bool IcuSqlite3Statement::Bind(
@@ -1464,7 +1941,7 @@ UnicodeString IcuSqlite3Statement::GetSQL() const
 	if(nullptr != m_stmt) {
 		const char* utf8Sql = sqlite3_sql((sqlite3_stmt*)m_stmt);
 		if(nullptr != utf8Sql) {
-			sql = UnicodeString::fromUTF8(utf8Sql);
+			sql = IcuSqlite3FromUtf8(utf8Sql);
 		}
 	}
 #endif	//	SQLITE_VERSION_NUMBER >= 3005003
@@ -1490,22 +1967,67 @@ void IcuSqlite3Statement::Finalize()
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3RetryPolicy / IcuSqlite3RetryMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3RetryPolicy::IcuSqlite3RetryPolicy()
+	: maxAttempts(8)
+	, initialDelayMs(1)
+	, maxDelayMs(50)
+	, multiplier(2.0)
+	, jitter(0.5)
+	, type(ICUSQLITE_TRANSACTION_DEFERRED)
+	, escalate(true)
+{
+}
+
+IcuSqlite3RetryMetrics::IcuSqlite3RetryMetrics()
+	: transactions(0)
+	, commits(0)
+	, attempts(0)
+	, retries(0)
+	, conflicts(0)
+	, busy(0)
+	, escalations(0)
+	, failures(0)
+	, lastErrorCode(0)
+{
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //	IcuSqlite3Database
 ///////////////////////////////////////////////////////////////////////////////
 IcuSqlite3Database::IcuSqlite3Database()
 	: m_db(nullptr)
-	, m_busyTimeout(60000)	//	60 sec
+	, m_mmapSize(ICUSQLITE_READONLY_MMAP_SIZE)
 	, m_encrypted(false)
+	, m_utf16(false)
+	, m_traceMask(0)
+	, m_resultCache(nullptr)
+	, m_savepointDepth(0)
+	, m_threadingMode(ICUSQLITE_THREADING_SERIALIZED)
+	, m_configuredThreadingMode(ICUSQLITE_THREADING_SERIALIZED)
+	, m_counted(false)
+	, m_owner(std::thread::id())
 {
 }
 
 IcuSqlite3Database::IcuSqlite3Database(
 	const IcuSqlite3Database& db)
+	: m_db(nullptr)		//	settings only; the connection isn't shared
+	, m_busyPolicy(db.m_busyPolicy)
+	, m_mmapSize(db.m_mmapSize)
+	, m_encrypted(db.m_encrypted)
+	, m_utf16(db.m_utf16)
+	, m_openProfile(db.m_openProfile)
+	, m_traceMask(0)
+	, m_resultCache(nullptr)
+	, m_savepointDepth(0)
+	, m_threadingMode(db.m_configuredThreadingMode)
+	, m_configuredThreadingMode(db.m_configuredThreadingMode)
+	, m_counted(false)
+	, m_owner(std::thread::id())
 {
-	m_db			= db.m_db;
-	m_busyTimeout	= db.m_busyTimeout;
-	m_encrypted		= db.m_encrypted;
 }
 
 /*virtual*/
@@ -1519,9 +2041,13 @@ IcuSqlite3Database& IcuSqlite3Database::operator=(
 {
 	if(&db != this) {
 		if(nullptr == m_db) {
-			m_db			= db.m_db;
-			m_busyTimeout	= db.m_busyTimeout;
+			m_busyPolicy	= db.m_busyPolicy;
+			m_mmapSize		= db.m_mmapSize;
 			m_encrypted		= db.m_encrypted;
+			m_utf16			= db.m_utf16;
+			m_openProfile	= db.m_openProfile;
+			m_threadingMode	= db.m_configuredThreadingMode;
+			m_configuredThreadingMode	= db.m_configuredThreadingMode;
 		} else {
 			assert(false);
 		}
@@ -1536,7 +2062,7 @@ bool IcuSqlite3Database::Open(
 	const int extFlags /*= ICUSQLITE_EXT_OPEN_DEFAULT*/)
 {
 	std::string utf8Key;
-	key.toUTF8String(utf8Key);
+	IcuSqlite3ToUtf8(key, utf8Key);
 	int keyLen = static_cast<int>(utf8Key.length());
 
 	return Open(filename, flags, extFlags, 
@@ -1552,15 +2078,39 @@ bool IcuSqlite3Database::Open(
 	const int keyLen /*= 0*/)
 {
 	std::string utf8Filename;
-	filename.toUTF8String(utf8Filename);
+	IcuSqlite3ToUtf8(filename, utf8Filename);
+
+	const bool readOnly = IcuSqlite3IsReadOnlyOpen(flags);
+
+	int openFlags = flags;
+	m_threadingMode = (flags & ICUSQLITE_OPEN_NOMUTEX) ? 
+		ICUSQLITE_THREADING_SINGLE_OWNER : m_configuredThreadingMode;
+	if(ICUSQLITE_THREADING_SINGLE_OWNER == m_threadingMode) {
+		openFlags = (openFlags & ~SQLITE_OPEN_FULLMUTEX) | SQLITE_OPEN_NOMUTEX;
+	} else {
+		openFlags = (openFlags & ~SQLITE_OPEN_NOMUTEX) | SQLITE_OPEN_FULLMUTEX;
+	}
+
+	if(readOnly && (extFlags & ICUSQLITE_EXT_OPEN_IMMUTABLE)) {
+		//
+		//	immutable=1 tells SQLite the file cannot change underneath us:
+		//	no locking and no change detection on each read transaction.
+		//
+		utf8Filename = IcuSqlite3MakeImmutableUri(utf8Filename);
+		openFlags |= SQLITE_OPEN_URI;
+	}
 
 	int rc = sqlite3_open_v2(utf8Filename.data(),
-		(sqlite3**)&m_db, flags, nullptr);
+		(sqlite3**)&m_db, openFlags, nullptr);
 	
 	if(SQLITE_OK != rc) {
 		Close();
 		return false;
 	}
+
+	++ms_openConnections[m_threadingMode];
+	m_counted	= true;
+	m_owner		= std::this_thread::get_id();
 	
 #if defined(ICUSQLITE3_ANDROID) || defined(ICUSQLITE3_IOS)
 	//	:TODO: expose this API & call wrapper
@@ -1589,39 +2139,66 @@ bool IcuSqlite3Database::Open(
 	}
 #endif	//	ICUSQLITE_HAVE_CODEC
 
-    if((extFlags & 1) == ICUSQLITE_OPEN_READONLY){
-        return true;
-    }
-    
-	SetBusyTimeout(m_busyTimeout);
+	if(readOnly) {
+		//
+		//	Read-only profile: nothing here can create or convert a
+		//	database, so skip the busy timeout and schema probes. Page
+		//	reads go through mmap (not with a codec, which must decrypt
+		//	each page) and query_only is pinned so a stray write fails
+		//	fast instead of contending for locks.
+		//
+		if(!m_encrypted && m_mmapSize > 0 && !SetMmapSize(m_mmapSize)) {
+			Close();
+			return false;
+		}
 
-	//
-	//	If this was a newly created database, set the encoding to
-	//	UTF-16 if asked
-	//
-	int schemaVersion = 0;
-	if(!ExecuteScalar("PRAGMA schema_version;", schemaVersion)) {
-		Close();
-		return false;
-	}
+		if(-1 == ExecuteUpdate("PRAGMA query_only=1;")) {
+			Close();
+			return false;
+		}
 
-	if((extFlags & ICUSQLITE_EXT_OPEN_UTF16) && 0 == schemaVersion)	{
-		ExecuteUpdate("PRAGMA encoding=\"UTF-16\";");
-	}
-	
-	if((extFlags & ICUSQLITE_EXT_OPEN_FK)) {
-		ExecuteUpdate("PRAGMA foreign_keys=ON;");
-	}
+		if(!m_openProfile.IsEmpty() && 
+			!ApplyPragmaBatch(m_openProfile, ICUSQLITE_EXT_OPEN_NONE, false, nullptr))
+		{
+			Close();
+			return false;
+		}
+	} else {
+		SetBusyPolicy(m_busyPolicy);
 
-	if((extFlags & ICUSQLITE_EXT_OPEN_WAL)) {
-		std::string walModeCheck;
-		ExecuteScalar("PRAGMA journal_mode=WAL;", walModeCheck);
-		if("wal" != walModeCheck) {
+		//
+		//	A newly created database is the only chance to set encoding
+		//	and page_size
+		//
+		int schemaVersion = 0;
+		if(!ExecuteScalar("PRAGMA schema_version;", schemaVersion)) {
+			Close();
+			return false;
+		}
+
+		//
+		//	Encoding, profile, foreign keys and WAL all go in one batch
+		//
+		if(!ApplyPragmaBatch(m_openProfile, extFlags, 0 == schemaVersion, nullptr)) {
 			Close();
 			return false;
 		}
 	}
 	
+	if(!DetectEncoding()) {
+		Close();
+		return false;
+	}
+
+	//
+	//	SORTKEY() is there on every connection, CreateCollation() or not
+	//
+	m_collators.reset(new IcuSqlite3CollatorPool(m_db, m_utf16));
+	if(!m_collators->RegisterSortKey()) {
+		Close();
+		return false;
+	}
+
 	//	:TODO: integrity check if requested
 	
 	//	:TODO: implement optional integrity check, see http://www.netmite.com/android/mydroid/frameworks/base/core/jni/android_database_SQLiteDatabase.cpp
@@ -1638,19 +2215,71 @@ bool IcuSqlite3Database::Open(
 void IcuSqlite3Database::Close()
 {
 	if(nullptr != m_db) {
-	
-#if SQLITE_VERSION_NUMBER >= 3006000
 		//
-		//	Finalize any unfished prepared statements
+		//	Prefetchers step their statements from their own threads; stop
+		//	them before the statements are finalized below
 		//
-		sqlite3_stmt* stmt;
-		while(0 != (stmt = sqlite3_next_stmt((sqlite3*)m_db, 0))) {
-			sqlite3_finalize(stmt);
+		std::vector<IcuSqlite3PrefetchResultSet*> prefetchers;
+		{
+			IcuSqlite3DbLock lock(m_db);
+			prefetchers.assign(m_prefetchers.begin(), m_prefetchers.end());
 		}
-#endif	//	SQLITE_VERSION_NUMBER >= 3006000
+		for(size_t n = 0; n < prefetchers.size(); ++n) {
+			prefetchers[n]->Finalize();		//	unregisters itself
+		}
+
+		//
+		//	Backup jobs hold a sqlite3_backup on this connection (and may
+		//	be stepping it from their own thread), which sqlite3_close()
+		//	refuses with SQLITE_BUSY
+		//
+		std::vector<IcuSqlite3BackupJob*> backupJobs;
+		{
+			IcuSqlite3DbLock lock(m_db);
+			backupJobs.assign(m_backupJobs.begin(), m_backupJobs.end());
+			m_backupJobs.clear();
+		}
+		for(size_t n = 0; n < backupJobs.size(); ++n) {
+			backupJobs[n]->Abandon();
+		}
+
+		StopCheckpointScheduler();
+		ClearAdmissionPolicy();
+		StopChangeStream();
+		if(nullptr != m_resultCache) {
+			m_resultCache->Detach();	//	finalizes its statements
+		}
+		m_busyHandler.reset();
+		m_control.reset();
+		m_catalog.reset();
+		m_savepointDepth = 0;
+	
+#if SQLITE_VERSION_NUMBER >= 3006000
+		//
+		//	Finalize any unfished prepared statements
+		//
+		sqlite3_stmt* stmt;
+		while(0 != (stmt = sqlite3_next_stmt((sqlite3*)m_db, 0))) {
+			sqlite3_finalize(stmt);
+		}
+#endif	//	SQLITE_VERSION_NUMBER >= 3006000
 		sqlite3_close((sqlite3*)m_db);
 		m_db = nullptr;
 		m_encrypted = false;
+		m_utf16 = false;
+
+		if(m_counted) {
+			--ms_openConnections[m_threadingMode];
+			m_counted = false;
+		}
+		m_owner			= std::thread::id();
+		m_threadingMode	= m_configuredThreadingMode;
+
+		//	only now that SQLite can no longer call them
+		m_collators.reset();
+		m_authorizer.reset();
+		m_tracer.reset();
+		m_traceMask = 0;
 	}
 }
 
@@ -1659,7 +2288,7 @@ bool IcuSqlite3Database::Backup(
 	const UnicodeString& sourceDatabase /*= "main"*/)
 {
 	std::string utf8TargetKey;
-	targetKey.toUTF8String(utf8TargetKey);
+	IcuSqlite3ToUtf8(targetKey, utf8TargetKey);
 	int targetKeyLen = static_cast<int>(utf8TargetKey.length());
 	const unsigned char* tk = (targetKeyLen > 0) ? 
 		reinterpret_cast<const unsigned char*>(utf8TargetKey.data()) : nullptr;
@@ -1678,7 +2307,7 @@ bool IcuSqlite3Database::Backup(
 	}
 
 	std::string utf8TargetFilename;
-	targetFilename.toUTF8String(utf8TargetFilename);
+	IcuSqlite3ToUtf8(targetFilename, utf8TargetFilename);
 
 	sqlite3* dest;
 	int rc = sqlite3_open(utf8TargetFilename.data(), &dest);
@@ -1698,7 +2327,7 @@ bool IcuSqlite3Database::Backup(
 #endif	//	ICUSQLITE_HAVE_CODEC
 
 	std::string utf8SourceDatabase;
-	sourceDatabase.toUTF8String(utf8SourceDatabase);
+	IcuSqlite3ToUtf8(sourceDatabase, utf8SourceDatabase);
 
 	sqlite3_backup* backup = sqlite3_backup_init(dest, "main", (sqlite3*)m_db,
 		utf8SourceDatabase.data());
@@ -1728,7 +2357,7 @@ EIcuSqlite3RestoreResults IcuSqlite3Database::Restore(
 	const UnicodeString& targetDatabase /*= "main"*/)
 {
 	std::string utf8SourceKey;
-	sourceKey.toUTF8String(utf8SourceKey);
+	IcuSqlite3ToUtf8(sourceKey, utf8SourceKey);
 	int sourceKeyLen = static_cast<int>(utf8SourceKey.length());
 	const unsigned char* sk = 
 		reinterpret_cast<const unsigned char*>(utf8SourceKey.data());
@@ -1747,7 +2376,7 @@ EIcuSqlite3RestoreResults IcuSqlite3Database::Restore(
 	}
 
 	std::string utf8SourceFilename;
-	sourceFilename.toUTF8String(utf8SourceFilename);
+	IcuSqlite3ToUtf8(sourceFilename, utf8SourceFilename);
 
 	sqlite3* src;
 	int rc = sqlite3_open(utf8SourceFilename.data(), &src);
@@ -1767,7 +2396,7 @@ EIcuSqlite3RestoreResults IcuSqlite3Database::Restore(
 #endif	//	ICUSQLITE_HAVE_CODEC
 
 	std::string utf8TargetDatabase;
-	targetDatabase.toUTF8String(utf8TargetDatabase);
+	IcuSqlite3ToUtf8(targetDatabase, utf8TargetDatabase);
 
 	sqlite3_backup* backup = sqlite3_backup_init((sqlite3*)m_db, 
 		utf8TargetDatabase.data(), src, "main");
@@ -1805,41 +2434,40 @@ EIcuSqlite3RestoreResults IcuSqlite3Database::Restore(
 bool IcuSqlite3Database::Begin(
 	const EIcuSqlite3TransTypes type /*= ICUSQLITE_TRANSACTION_DEFAULT*/)
 {
-	switch(type) {
-		case ICUSQLITE_TRANSACTION_DEFERRED :
-			return (-1 != ExecuteUpdate("BEGIN DEFFERED TRANSACTION;"));
-
-		case ICUSQLITE_TRANSACTION_IMMEDIATE :
-			return (-1 != ExecuteUpdate("BEGIN IMMEDIATE TRANSACTION;"));
-	
-		case ICUSQLITE_TRANSACTION_EXCLUSIVE :
-			return (-1 != ExecuteUpdate("BEGIN EXCLUSIVE TRANSACTION;"));
-
-		default :
-			return (-1 != ExecuteUpdate("BEGIN TRANSACTION;"));
-	}
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3ControlStatements* control = GetControlStatements();
+	return (nullptr != control && SQLITE_OK == control->Begin(type));
 }
 
 bool IcuSqlite3Database::Commit()
 {
-	return (-1 != ExecuteUpdate("COMMIT TRANSACTION;"));
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3ControlStatements* control = GetControlStatements();
+	return (nullptr != control && SQLITE_OK == control->Commit());
 }
 
 bool IcuSqlite3Database::Rollback(
 	const UnicodeString& savepointName /*= ""*/)
 {
+	if(savepointName.isEmpty()) {
+		IcuSqlite3DbLock lock(m_db);
+		InvalidateSchemaCatalog();
+		IcuSqlite3ControlStatements* control = GetControlStatements();
+		return (nullptr != control && SQLITE_OK == control->Rollback());
+	}
+
 	std::string sql = "ROLLBACK TRANSACTION";
 
 #if SQLITE_VERSION_NUMBER >= 3006008	
 	if(!savepointName.isEmpty()) {
-		std::string utf8SavepointName;
 		sql += " TO ";
-		sql += savepointName.toUTF8String(utf8SavepointName);	
+		IcuSqlite3ToUtf8(savepointName, sql);
 	}
 #endif	//	SQLITE_VERSION_NUMBER >= 3006008
 
 	sql += ";";
 	
+	InvalidateSchemaCatalog();
 	return (-1 != ExecuteUpdate(sql.data()));
 }
 
@@ -1852,13 +2480,200 @@ bool IcuSqlite3Database::IsAutoCommitMode() const
 	return 0 != sqlite3_get_autocommit((sqlite3*)m_db);
 }
 
+/*static*/
+EIcuSqlite3ErrorClass IcuSqlite3Database::ClassifyError(
+	const int extendedCode)
+{
+	switch(extendedCode & 0xff) {
+		case SQLITE_OK :
+		case SQLITE_ROW :
+		case SQLITE_DONE :
+			return ICUSQLITE_ERROR_CLASS_NONE;
+
+		case SQLITE_BUSY :
+#if defined(SQLITE_BUSY_SNAPSHOT)
+			if(SQLITE_BUSY_SNAPSHOT == extendedCode) {
+				return ICUSQLITE_ERROR_CLASS_CONFLICT;
+			}
+#endif	//	defined(SQLITE_BUSY_SNAPSHOT)
+			return ICUSQLITE_ERROR_CLASS_BUSY;
+
+		case SQLITE_LOCKED :
+			return ICUSQLITE_ERROR_CLASS_BUSY;
+
+		default :
+			return ICUSQLITE_ERROR_CLASS_FATAL;
+	}
+}
+
+bool IcuSqlite3Database::GetRetryMetrics(
+	IcuSqlite3RetryMetrics& metrics) const
+{
+	IcuSqlite3DbLock lock(m_db);
+	metrics = m_retryMetrics;
+	return true;
+}
+
+void IcuSqlite3Database::ResetRetryMetrics()
+{
+	IcuSqlite3DbLock lock(m_db);
+	m_retryMetrics = IcuSqlite3RetryMetrics();
+}
+
+bool IcuSqlite3Database::BeginRetryAttempt(
+	const IcuSqlite3RetryPolicy& policy, IcuSqlite3RetryAttempt& attempt)
+{
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3ControlStatements* control = GetControlStatements();
+	if(nullptr == control) {
+		attempt.done = true;
+		return false;
+	}
+
+	if(0 == attempt.attempt) {
+		++m_retryMetrics.transactions;
+		attempt.type	= policy.type;
+		attempt.rng		= static_cast<uint64_t>(IcuSqlite3BusyHandler::NowUs()) ^ 
+			reinterpret_cast<uintptr_t>(&attempt);
+
+		if(m_savepointDepth > 0 || !IsAutoCommitMode()) {
+			attempt.level = m_savepointDepth + 1;
+		}
+	}
+	++m_retryMetrics.attempts;
+
+	int rc;
+	if(attempt.level > 0) {
+		rc = control->Savepoint(attempt.level);
+		if(SQLITE_OK == rc) {
+			++m_savepointDepth;
+			return true;
+		}
+		attempt.done = true;
+	} else {
+		rc = control->Begin(attempt.type);
+		if(SQLITE_OK == rc) {
+			return true;
+		}
+		RetryOrFail(sqlite3_extended_errcode((sqlite3*)m_db), policy, attempt);
+		return false;
+	}
+
+	++m_retryMetrics.failures;
+	m_retryMetrics.lastErrorCode = sqlite3_extended_errcode((sqlite3*)m_db);
+	return false;
+}
+
+void IcuSqlite3Database::EndRetryAttempt(
+	const bool workOk, const IcuSqlite3RetryPolicy& policy, 
+	IcuSqlite3RetryAttempt& attempt)
+{
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3ControlStatements* control = GetControlStatements();
+	if(nullptr == control) {
+		attempt.done = true;
+		return;
+	}
+
+	if(attempt.level > 0) {
+		attempt.done = true;
+		--m_savepointDepth;
+		if(workOk && SQLITE_OK == control->Release(attempt.level)) {
+			attempt.succeeded = true;
+			++m_retryMetrics.commits;
+			return;
+		}
+
+		m_retryMetrics.lastErrorCode = sqlite3_extended_errcode((sqlite3*)m_db);
+		++m_retryMetrics.failures;
+		InvalidateSchemaCatalog();
+		if(SQLITE_OK == control->RollbackTo(attempt.level)) {
+			control->Release(attempt.level);
+		}
+		return;
+	}
+
+	if(workOk) {
+		if(SQLITE_OK == control->Commit()) {
+			attempt.done		= true;
+			attempt.succeeded	= true;
+			++m_retryMetrics.commits;
+			return;
+		}
+	}
+
+	//
+	//	Grab the code before ROLLBACK replaces it. A failed statement may
+	//	have ended the transaction already (e.g. SQLITE_FULL).
+	//
+	const int code = sqlite3_extended_errcode((sqlite3*)m_db);
+	if(!IsAutoCommitMode()) {
+		InvalidateSchemaCatalog();
+		control->Rollback();
+	}
+
+	if(!workOk && ICUSQLITE_ERROR_CLASS_NONE == ClassifyError(code)) {
+		//
+		//	|work| gave up on its own (no SQLite error): not ours to retry
+		//
+		attempt.done = true;
+		++m_retryMetrics.failures;
+		m_retryMetrics.lastErrorCode = code;
+		return;
+	}
+
+	RetryOrFail(code, policy, attempt);
+}
+
+void IcuSqlite3Database::RetryOrFail(
+	const int code, const IcuSqlite3RetryPolicy& policy, 
+	IcuSqlite3RetryAttempt& attempt)
+{
+	m_retryMetrics.lastErrorCode = code;
+
+	switch(ClassifyError(code)) {
+		case ICUSQLITE_ERROR_CLASS_CONFLICT :
+			++m_retryMetrics.conflicts;
+			if(policy.escalate && ICUSQLITE_TRANSACTION_IMMEDIATE != attempt.type && 
+				ICUSQLITE_TRANSACTION_EXCLUSIVE != attempt.type)
+			{
+				//
+				//	Take the write lock up front so the next attempt's
+				//	snapshot cannot go stale before its first write
+				//
+				attempt.type = ICUSQLITE_TRANSACTION_IMMEDIATE;
+				++m_retryMetrics.escalations;
+			}
+			break;
+
+		case ICUSQLITE_ERROR_CLASS_BUSY :
+			++m_retryMetrics.busy;
+			break;
+
+		default :
+			attempt.done = true;
+			++m_retryMetrics.failures;
+			return;
+	}
+
+	if(++attempt.attempt >= policy.maxAttempts) {
+		attempt.done = true;
+		++m_retryMetrics.failures;
+		return;
+	}
+
+	++m_retryMetrics.retries;
+	std::this_thread::sleep_for(std::chrono::microseconds(IcuSqlite3BackoffDelayUs(
+		policy.initialDelayMs, policy.maxDelayMs, policy.multiplier, policy.jitter,
+		attempt.attempt - 1, attempt.rng)));
+}
+
 bool IcuSqlite3Database::Savepoint(
 	const UnicodeString& savepointName)
 {
 #if SQLITE_VERSION_NUMBER >= 3006008
 	std::string sql = "SAVEPOINT ";
-	std::string utf8SavepointName;
-	sql += savepointName.toUTF8String(utf8SavepointName);
+	IcuSqlite3ToUtf8(savepointName, sql);
 	sql += ";";
 	return (-1 != ExecuteUpdate(sql.data()));
 #endif	//	SQLITE_VERSION_NUMBER >= 3006008
@@ -1870,67 +2685,131 @@ bool IcuSqlite3Database::ReleaseSavepoint(
 {
 #if SQLITE_VERSION_NUMBER >= 3006008
 	std::string sql = "RELEASE SAVEPOINT ";
-	std::string utf8SavepointName;
-	sql += savepointName.toUTF8String(utf8SavepointName);
+	IcuSqlite3ToUtf8(savepointName, sql);
 	sql += ";";
 	return (-1 != ExecuteUpdate(sql.data()));
 #endif	//	SQLITE_VERSION_NUMBER >= 3006008
 	return false;
 }
 
+IcuSqlite3ControlStatements* IcuSqlite3Database::GetControlStatements()
+{
+	if(nullptr == m_db) {
+		return nullptr;
+	}
+	ICUSQLITE_ASSERT_OWNER();
+
+	if(nullptr == m_control.get()) {
+		m_control.reset(new IcuSqlite3ControlStatements(m_db));
+	}
+	return m_control.get();
+}
+
 // ...
 
+IcuSqlite3SchemaCatalog* IcuSqlite3Database::GetSchemaCatalog() const
+{
+	if(nullptr == m_db) {
+		return nullptr;
+	}
+
+	if(nullptr == m_catalog.get()) {
+		m_catalog.reset(new IcuSqlite3SchemaCatalog(m_db));
+	}
+	return m_catalog.get();
+}
+
+void IcuSqlite3Database::InvalidateSchemaCatalog()
+{
+	//
+	//	A rollback can take schema_version back to a value the catalog
+	//	already saw with different contents
+	//
+	if(nullptr != m_catalog.get()) {
+		m_catalog->Invalidate();
+	}
+}
+
 bool IcuSqlite3Database::TableExists(
 	const UnicodeString& tableName, 
 	const UnicodeString& dbName /*= ""*/) const
 {
-	int result = 0;
-	const char* sqlBuf;
-	IcuSqlite3StatementBuffer sql;
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
 	std::string tableNameBuf;
+	std::string dbNameBuf;
+	return nullptr != catalog && catalog->HasTable(
+		IcuSqlite3ToUtf8(dbName, dbNameBuf), IcuSqlite3ToUtf8(tableName, tableNameBuf));
+}
 
-	if(dbName.isEmpty()) {
-		sqlBuf = sql.Format(
-			"SELECT COUNT(*)\
-			 FROM sqlite_master \
-			 WHERE type='table' AND name LIKE '%s';",
-			tableName.toUTF8String(tableNameBuf).c_str());
-	} else {
-		std::string dbNameBuf;
-		sqlBuf = sql.Format(
-			"SELECT COUNT(*)\
-			 FROM %s.sqlite_master \
-			 WHERE type='table' AND name LIKE '%s';",
-			dbName.toUTF8String(dbNameBuf).c_str(), 
-			tableName.toUTF8String(tableNameBuf).c_str());
+bool IcuSqlite3Database::TableExists(
+	const char* tableName, const char* dbName /*= nullptr*/) const
+{
+	if(nullptr == tableName) {
+		return false;
 	}
 
-	return ExecuteScalar(sqlBuf, result) && result > 0;
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
+	return nullptr != catalog && catalog->HasTable(
+		(nullptr != dbName) ? dbName : "", tableName);
 }
 
-bool IcuSqlite3Database::TableExists(
-	const char* tableName, const char* dbName /*= nullptr*/) const
+bool IcuSqlite3Database::IndexExists(
+	const UnicodeString& indexName, 
+	const UnicodeString& dbName /*= ""*/) const
+{
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
+	std::string indexNameBuf;
+	std::string dbNameBuf;
+	return nullptr != catalog && catalog->HasIndex(
+		IcuSqlite3ToUtf8(dbName, dbNameBuf), IcuSqlite3ToUtf8(indexName, indexNameBuf));
+}
+
+bool IcuSqlite3Database::ColumnExists(
+	const UnicodeString& tableName, const UnicodeString& columnName,
+	const UnicodeString& dbName /*= ""*/) const
+{
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
+	std::string tableNameBuf;
+	std::string columnNameBuf;
+	std::string dbNameBuf;
+	return nullptr != catalog && catalog->HasColumn(
+		IcuSqlite3ToUtf8(dbName, dbNameBuf), IcuSqlite3ToUtf8(tableName, tableNameBuf),
+		IcuSqlite3ToUtf8(columnName, columnNameBuf));
+}
+
+bool IcuSqlite3Database::GetColumnNames(
+	const UnicodeString& tableName, std::vector<std::string>& columnNames,
+	const UnicodeString& dbName /*= ""*/) const
 {
-	return TableExists(UnicodeString::fromUTF8(tableName),
-		UnicodeString::fromUTF8(dbName));
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
+	if(nullptr == catalog) {
+		columnNames.clear();
+		return false;
+	}
+
+	std::string tableNameBuf;
+	std::string dbNameBuf;
+	return catalog->GetColumns(IcuSqlite3ToUtf8(dbName, dbNameBuf), 
+		IcuSqlite3ToUtf8(tableName, tableNameBuf), columnNames);
 }
 
 void IcuSqlite3Database::GetDatabaseNames(
 	std::set<std::string>& dbNames, 
 	std::set<std::string>& dbFiles) const
 {
-	dbNames.clear();
-	dbFiles.clear();
-
-	//	buffers for uni -> utf-8 names
-	std::string utf8DbName;
-	std::string utf8DbFile;
-
-	IcuSqlite3ResultSet results = ExecuteQuery("PRAGMA database_list;");
-	while(results.NextRow()) {
-		dbNames.insert(results.GetString(1).toUTF8String(utf8DbName));
-		dbFiles.insert(results.GetString(2).toUTF8String(utf8DbFile));
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
+	if(nullptr == catalog) {
+		dbNames.clear();
+		dbFiles.clear();
+		return;
 	}
+	catalog->GetDatabases(dbNames, dbFiles);
 }
 
 bool IcuSqlite3Database::Attach(
@@ -1940,38 +2819,29 @@ bool IcuSqlite3Database::Attach(
 	std::string utf8;
 	return (-1 != ExecuteUpdate(IcuSqlite3StatementBuffer().Format(
 		"ATTACH DATABASE '%s' "
-		"AS %s;", dbPath.toUTF8String(utf8).c_str(), asName.c_str())));
+		"AS %s;", IcuSqlite3ToUtf8(dbPath, utf8).c_str(), asName.c_str())));
 }
 
 bool IcuSqlite3Database::IsAttached(
 	const std::string& alias) const
 {
-	IcuSqlite3ResultSet results = ExecuteQuery("PRAGMA database_list;");
-	std::string utf8;	//	temp conversion buffer
-	while(results.NextRow()) {
-		if(alias == results.GetString(1).toUTF8String(utf8)) {
-			return true;
-		}
-		utf8.clear();	//	ready for next conversion
-	}
-	return false;
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
+	return nullptr != catalog && catalog->HasDatabase(alias);
 }
 
 int IcuSqlite3Database::GetAttachedCount() const
 {
-	IcuSqlite3ResultSet results = ExecuteQuery("PRAGMA database_list;");
-	int count = 0;
-	while(results.NextRow()) {
-		++count;
-	}
-	return count;
+	IcuSqlite3DbLock lock(m_db);
+	IcuSqlite3SchemaCatalog* catalog = GetSchemaCatalog();
+	return (nullptr != catalog) ? catalog->GetDatabaseCount() : 0;
 }
 
 int IcuSqlite3Database::ExecuteUpdate(
 	const UnicodeString& sql)
 {
-	std::string utf8Sql;
-	return ExecuteUpdate(sql.toUTF8String(utf8Sql).data());
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteUpdate(utf8Sql.c_str());
 }
 
 int IcuSqlite3Database::ExecuteUpdate(
@@ -1980,6 +2850,7 @@ int IcuSqlite3Database::ExecuteUpdate(
 	if(nullptr == m_db) {
 		return -1;
 	}
+	ICUSQLITE_ASSERT_OWNER();
 
 	char* err = nullptr;
 	if(SQLITE_OK == sqlite3_exec((sqlite3*)m_db, sql, 0, 0, &err)) {
@@ -2000,16 +2871,26 @@ int IcuSqlite3Database::ExecuteUpdate(
 IcuSqlite3ResultSet IcuSqlite3Database::ExecuteQuery(
 	const UnicodeString& sql) const
 {
-	sqlite3_stmt* stmt = 
-		static_cast<sqlite3_stmt*>(Prepare(sql.getBuffer(), sql.length() * sizeof(UChar)));
+	//
+	//	SQLite compiles UTF-8; converting here is cheaper than letting
+	//	sqlite3_prepare16() do it with a fresh allocation every time
+	//
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteQuery(utf8Sql.c_str());
+}
+
+IcuSqlite3ResultSet IcuSqlite3Database::ExecuteQuery(
+	const char* sql) const
+{
+	sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(Prepare(sql));
 
 	if(nullptr == stmt) {
 		return IcuSqlite3ResultSet(m_db, stmt, true);
 	}
 
 	switch(sqlite3_step(stmt)) {
-		case SQLITE_DONE :	return IcuSqlite3ResultSet(m_db, stmt, true);
-		case SQLITE_ROW :	return IcuSqlite3ResultSet(m_db, stmt, false);
+		case SQLITE_DONE :	return IcuSqlite3ResultSet(m_db, stmt, true, true, true, m_utf16);
+		case SQLITE_ROW :	return IcuSqlite3ResultSet(m_db, stmt, false, true, true, m_utf16);
 	}
 
 	//	something went wrong
@@ -2017,22 +2898,23 @@ IcuSqlite3ResultSet IcuSqlite3Database::ExecuteQuery(
 	return IcuSqlite3ResultSet(m_db, nullptr, true);
 }
 
-IcuSqlite3ResultSet IcuSqlite3Database::ExecuteQuery(
-	const char* sql) const
-{
-	return ExecuteQuery(UnicodeString::fromUTF8(sql));
-}
-
 IcuSqlite3ResultSet IcuSqlite3Database::ExecuteQuery(
 	const IcuSqlite3StatementBuffer& sql) const
 {
-	return ExecuteQuery(UnicodeString::fromUTF8(static_cast<const char*>(sql)));
+	return ExecuteQuery(static_cast<const char*>(sql));
 }
 
 // ...
 
 bool IcuSqlite3Database::ExecuteScalar(
 	const UnicodeString& sql, UnicodeString& result) const
+{
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteScalar(utf8Sql.c_str(), result);
+}
+
+bool IcuSqlite3Database::ExecuteScalar(
+	const char* sql, UnicodeString& result) const
 {
 	IcuSqlite3ResultSet r = ExecuteQuery(sql);
 	if(!r.Eof() && r.GetColumnCount() > 0) {
@@ -2043,13 +2925,14 @@ bool IcuSqlite3Database::ExecuteScalar(
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const char* sql, UnicodeString& result) const
+	const UnicodeString& sql, int32_t& result) const
 {
-	return ExecuteScalar(UnicodeString::fromUTF8(sql), result);
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteScalar(utf8Sql.c_str(), result);
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const UnicodeString& sql, int32_t& result) const
+	const char* sql, int32_t& result) const
 {
 	IcuSqlite3ResultSet r = ExecuteQuery(sql);
 	if(!r.Eof() && r.GetColumnCount() > 0) {
@@ -2060,13 +2943,14 @@ bool IcuSqlite3Database::ExecuteScalar(
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const char* sql, int32_t& result) const
+	const UnicodeString& sql, int64_t& result) const
 {
-	return ExecuteScalar(UnicodeString::fromUTF8(sql), result);
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteScalar(utf8Sql.c_str(), result);
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const UnicodeString& sql, int64_t& result) const
+	const char* sql, int64_t& result) const
 {
 	IcuSqlite3ResultSet r = ExecuteQuery(sql);
 	if(!r.Eof() && r.GetColumnCount() > 0) {
@@ -2077,13 +2961,14 @@ bool IcuSqlite3Database::ExecuteScalar(
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const char* sql, int64_t& result) const
+	const UnicodeString& sql, double& result) const
 {
-	return ExecuteScalar(UnicodeString::fromUTF8(sql), result);
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteScalar(utf8Sql.c_str(), result);
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const UnicodeString& sql, double& result) const
+	const char* sql, double& result) const
 {
 	IcuSqlite3ResultSet r = ExecuteQuery(sql);
 	if(!r.Eof() && r.GetColumnCount() > 0) {
@@ -2094,13 +2979,14 @@ bool IcuSqlite3Database::ExecuteScalar(
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const char* sql, double& result) const
+	const UnicodeString& sql, bool& result) const
 {
-	return ExecuteScalar(UnicodeString::fromUTF8(sql), result);
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteScalar(utf8Sql.c_str(), result);
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const UnicodeString& sql, bool& result) const
+	const char* sql, bool& result) const
 {
 	IcuSqlite3ResultSet r = ExecuteQuery(sql);
 	if(!r.Eof() && r.GetColumnCount() > 0) {
@@ -2111,13 +2997,14 @@ bool IcuSqlite3Database::ExecuteScalar(
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const char* sql, bool& result) const
+	const UnicodeString& sql, std::string& result) const
 {
-	return ExecuteScalar(UnicodeString::fromUTF8(sql), result);
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteScalar(utf8Sql.c_str(), result);
 }
 
 bool IcuSqlite3Database::ExecuteScalar(
-	const UnicodeString& sql, std::string& result) const
+	const char* sql, std::string& result) const
 {
 	IcuSqlite3ResultSet r = ExecuteQuery(sql);
 	if(!r.Eof() && r.GetColumnCount() > 0) {
@@ -2127,14 +3014,15 @@ bool IcuSqlite3Database::ExecuteScalar(
 	return false;
 }
 
-bool IcuSqlite3Database::ExecuteScalar(
-	const char* sql, std::string& result) const
+bool IcuSqlite3Database::ExecuteScalarDateTime(
+	const UnicodeString& sql, UDate& result)
 {
-	return ExecuteScalar(UnicodeString::fromUTF8(sql), result);
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteScalarDateTime(utf8Sql.c_str(), result);
 }
 
 bool IcuSqlite3Database::ExecuteScalarDateTime(
-	const UnicodeString& sql, UDate& result)
+	const char* sql, UDate& result)
 {
 	IcuSqlite3ResultSet r = ExecuteQuery(sql);
 	if(!r.Eof() && r.GetColumnCount() > 0) {
@@ -2144,18 +3032,11 @@ bool IcuSqlite3Database::ExecuteScalarDateTime(
 	return false;
 }
 
-bool IcuSqlite3Database::ExecuteScalarDateTime(
-	const char* sql, UDate& result)
-{
-	return ExecuteScalarDateTime(UnicodeString::fromUTF8(sql), result);
-}
-
 IcuSqlite3Table IcuSqlite3Database::GetTable(
 	const UnicodeString& sql) const
 {
-	std::string utf8SqlBuf;
-	return GetTable(
-		static_cast<const char*>(sql.toUTF8String(utf8SqlBuf).data()));
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return GetTable(utf8Sql.c_str());
 }
 
 IcuSqlite3Table IcuSqlite3Database::GetTable(
@@ -2188,19 +3069,19 @@ IcuSqlite3Table IcuSqlite3Database::GetTable(
 IcuSqlite3Statement IcuSqlite3Database::PrepareStatement(
 	const UnicodeString& sql) const
 {
-	if(nullptr == m_db) {
-		return IcuSqlite3Statement(nullptr, nullptr);
-	}
-
-	sqlite3_stmt* stmt = (sqlite3_stmt*)Prepare(sql.getBuffer(), 
-		sql.length() * sizeof(UChar));
-	return IcuSqlite3Statement(m_db, stmt);
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return PrepareStatement(utf8Sql.c_str());
 }
 
 IcuSqlite3Statement IcuSqlite3Database::PrepareStatement(
 	const char* sql) const
 {
-	return PrepareStatement(UnicodeString::fromUTF8(sql));
+	if(nullptr == m_db) {
+		return IcuSqlite3Statement(nullptr, nullptr);
+	}
+
+	sqlite3_stmt* stmt = (sqlite3_stmt*)Prepare(sql);
+	return IcuSqlite3Statement(m_db, stmt, m_utf16);
 }
 
 IcuSqlite3Statement IcuSqlite3Database::PrepareStatement(
@@ -2222,88 +3103,489 @@ int64_t IcuSqlite3Database::GetChanges() const
 bool IcuSqlite3Database::SetBusyTimeout(
 	const int ms)
 {
-	if(nullptr != m_db &&
-		(SQLITE_OK == sqlite3_busy_timeout((sqlite3*)m_db, ms)))
-	{
-		m_busyTimeout = ms;
+	IcuSqlite3BusyPolicy policy = m_busyPolicy;
+	policy.timeoutMs = (ms > 0) ? ms : 0;	//	not the policy's "forever"
+	return SetBusyPolicy(policy);
+}
+
+bool IcuSqlite3Database::SetBusyPolicy(
+	const IcuSqlite3BusyPolicy& policy)
+{
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
+	m_busyPolicy = policy;
+	if(nullptr != m_busyHandler.get()) {
+		m_busyHandler->SetPolicy(policy);	//	keeps metrics and any budget
 		return true;
 	}
-	return false;
+
+	std::unique_ptr<IcuSqlite3BusyHandler> handler(
+		new IcuSqlite3BusyHandler(m_db, policy));
+	if(!handler->Install()) {
+		return false;
+	}
+	m_busyHandler = std::move(handler);
+	return true;
 }
 
-bool IcuSqlite3Database::CreateScalarFunction(
-	const char* funcName, const int args, IcuSqlite3ScalarFunction* func)
-{	
-	typedef void (*XFUNC)(sqlite3_context*, int, sqlite3_value**);
-	typedef void (*XDESTROY)(void*);
+bool IcuSqlite3Database::GetBusyMetrics(
+	IcuSqlite3BusyMetrics& metrics) const
+{
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr == m_busyHandler.get()) {
+		return false;
+	}
+	m_busyHandler->GetMetrics(metrics);
+	return true;
+}
 
-	return (nullptr != func && nullptr != m_db && 
-		(SQLITE_OK == sqlite3_create_function_v2(
-			(sqlite3*)m_db,
-			funcName,
-			args,
-#ifdef WORDS_BIGENDIAN
-			SQLITE_UTF16BE,
-#else
-			SQLITE_UTF16LE,
-#endif
-			func,
-			(XFUNC)xFunc,
-			nullptr,
-			nullptr,
-			(XDESTROY)xDestroyScalar)));
+void IcuSqlite3Database::ResetBusyMetrics()
+{
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr != m_busyHandler.get()) {
+		m_busyHandler->ResetMetrics();
+	}
 }
 
-bool IcuSqlite3Database::CreateAggregateFunction(
-	const char* funcName, const int args, IcuSqlite3AggregateFunction* func)
+bool IcuSqlite3Database::SetMmapSize(
+	const int64_t bytes)
 {
-	typedef void (*XSTEP)(sqlite3_context*, int, sqlite3_value**);
-	typedef void (*XFINAL)(sqlite3_context*);
-	typedef void (*XDESTROY)(void*);
+	m_mmapSize = bytes;
+	if(nullptr == m_db) {
+		return true;	//	applied at Open()
+	}
 
-	return (nullptr != func && nullptr != m_db && 
-		(SQLITE_OK == sqlite3_create_function_v2(
-			(sqlite3*)m_db,
-			funcName,
+	return (-1 != ExecuteUpdate(IcuSqlite3StatementBuffer().Format(
+		"PRAGMA mmap_size=%lld;", static_cast<long long>(bytes))));
+}
+
+bool IcuSqlite3Database::ApplyOpenProfile(
+	const IcuSqlite3OpenProfile& profile, 
+	IcuSqlite3OpenProfile* effective /*= nullptr*/)
+{
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	int schemaVersion = 1;
+	if(ICUSQLITE_PRAGMA_UNSET != profile.pageSize && !IsReadOnly() &&
+		!ExecuteScalar("PRAGMA schema_version;", schemaVersion))
+	{
+		return false;
+	}
+
+	return ApplyPragmaBatch(profile, ICUSQLITE_EXT_OPEN_NONE, 
+		0 == schemaVersion, effective);
+}
+
+bool IcuSqlite3Database::IsReadOnly(
+	const char* dbName /*= "main"*/) const
+{
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	return 1 == sqlite3_db_readonly((sqlite3*)m_db, dbName);
+}
+
+bool IcuSqlite3Database::SetThreadingMode(
+	const EIcuSqlite3ThreadingMode mode)
+{
+	if(nullptr != m_db || mode < 0 || mode >= ICUSQLITE_THREADING_MODE_COUNT) {
+		return false;	//	the mutex is chosen at open
+	}
+	m_configuredThreadingMode	= mode;
+	m_threadingMode				= mode;
+	return true;
+}
+
+bool IcuSqlite3Database::AcquireOwnership()
+{
+	if(ICUSQLITE_THREADING_SINGLE_OWNER != m_threadingMode) {
+		return true;
+	}
+
+	std::thread::id unowned;
+	const std::thread::id self = std::this_thread::get_id();
+	return m_owner.compare_exchange_strong(unowned, self) || self == unowned;
+}
+
+void IcuSqlite3Database::ReleaseOwnership()
+{
+	if(ICUSQLITE_THREADING_SINGLE_OWNER != m_threadingMode) {
+		return;
+	}
+
+	std::thread::id self = std::this_thread::get_id();
+	m_owner.compare_exchange_strong(self, std::thread::id());
+}
+
+bool IcuSqlite3Database::IsOwnedByCurrentThread() const
+{
+	return ICUSQLITE_THREADING_SINGLE_OWNER != m_threadingMode || 
+		m_owner.load() == std::this_thread::get_id();
+}
+
+//
+//	EIcuSqlite3FunctionFlags -> SQLITE_* function flags
+//
+static int IcuSqlite3FunctionFlags(
+	const int flags)
+{
+	int sqliteFlags = 0;
+#if SQLITE_VERSION_NUMBER >= 3008003
+	if((flags & ICUSQLITE_FUNCTION_DETERMINISTIC)) {
+		sqliteFlags |= SQLITE_DETERMINISTIC;
+	}
+#endif	//	SQLITE_VERSION_NUMBER >= 3008003
+#if SQLITE_VERSION_NUMBER >= 3031000
+	if((flags & ICUSQLITE_FUNCTION_DIRECTONLY)) {
+		sqliteFlags |= SQLITE_DIRECTONLY;
+	}
+	if((flags & ICUSQLITE_FUNCTION_INNOCUOUS)) {
+		sqliteFlags |= SQLITE_INNOCUOUS;
+	}
+#endif	//	SQLITE_VERSION_NUMBER >= 3031000
+	return sqliteFlags;
+}
+
+bool IcuSqlite3Database::CreateScalarFunction(
+	const char* funcName, const int args, IcuSqlite3ScalarFunction* func,
+	const int flags /*= ICUSQLITE_FUNCTION_NONE*/)
+{	
+	typedef void (*XFUNC)(sqlite3_context*, int, sqlite3_value**);
+	typedef void (*XDESTROY)(void*);
+
+	return (nullptr != func && nullptr != m_db && 
+		(SQLITE_OK == sqlite3_create_function_v2(
+			(sqlite3*)m_db,
+			funcName,
 			args,
-#ifdef WORDS_BIGENDIAN
-			SQLITE_UTF16BE,
-#else
-			SQLITE_UTF16LE,
-#endif
+			(m_utf16 ? SQLITE_UTF16 : SQLITE_UTF8) | IcuSqlite3FunctionFlags(flags),
 			func,
+			m_utf16 ? (XFUNC)xFunc16 : (XFUNC)xFunc,
+			nullptr,
 			nullptr,
-			(XSTEP)xStep,
-			(XFINAL)xFinalize,
+			(XDESTROY)xDestroyScalar)));
+}
+
+bool IcuSqlite3Database::CreateAggregateFunction(
+	const char* funcName, const int args, IcuSqlite3AggregateFunction* func,
+	const int flags /*= ICUSQLITE_FUNCTION_NONE*/)
+{
+	typedef void (*XSTEP)(sqlite3_context*, int, sqlite3_value**);
+	typedef void (*XFINAL)(sqlite3_context*);
+	typedef void (*XDESTROY)(void*);
+
+	return (nullptr != func && nullptr != m_db && 
+		(SQLITE_OK == sqlite3_create_function_v2(
+			(sqlite3*)m_db,
+			funcName,
+			args,
+			(m_utf16 ? SQLITE_UTF16 : SQLITE_UTF8) | IcuSqlite3FunctionFlags(flags),
+			func,
+			nullptr,
+			m_utf16 ? (XSTEP)xStep16 : (XSTEP)xStep,
+			m_utf16 ? (XFINAL)xFinalize16 : (XFINAL)xFinalize,
 			(XDESTROY)xDestroyAggregate)));
 }
 
+bool IcuSqlite3Database::CreateWindowFunction(
+	const char* funcName, const int args, IcuSqlite3WindowFunction* func,
+	const int flags /*= ICUSQLITE_FUNCTION_NONE*/)
+{
+#if SQLITE_VERSION_NUMBER >= 3025000
+	typedef void (*XSTEP)(sqlite3_context*, int, sqlite3_value**);
+	typedef void (*XFINAL)(sqlite3_context*);
+	typedef void (*XDESTROY)(void*);
+
+	//
+	//	Registered as its IcuSqlite3AggregateFunction base so xStep /
+	//	xFinalize / xDestroyAggregate are shared with plain aggregates
+	//
+	IcuSqlite3AggregateFunction* aggregate = func;
+	return (nullptr != func && nullptr != m_db && 
+		(SQLITE_OK == sqlite3_create_window_function(
+			(sqlite3*)m_db,
+			funcName,
+			args,
+			(m_utf16 ? SQLITE_UTF16 : SQLITE_UTF8) | IcuSqlite3FunctionFlags(flags),
+			aggregate,
+			m_utf16 ? (XSTEP)xStep16 : (XSTEP)xStep,
+			m_utf16 ? (XFINAL)xFinalize16 : (XFINAL)xFinalize,
+			m_utf16 ? (XFINAL)xValue16 : (XFINAL)xValue,
+			m_utf16 ? (XSTEP)xInverse16 : (XSTEP)xInverse,
+			(XDESTROY)xDestroyAggregate)));
+#else
+	return false;
+#endif	//	SQLITE_VERSION_NUMBER >= 3025000
+}
+
+bool IcuSqlite3Database::CreateCollation(
+	const char* name, const Locale& locale,
+	const Collator::ECollationStrength strength /*= Collator::TERTIARY*/)
+{
+	if(nullptr == m_db || nullptr == m_collators.get() || nullptr == name) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
+	return m_collators->Register(name, locale, strength);
+}
+
+static int IcuSqlite3AuthorizerCallback(
+	void* userData, int action, const char* arg1, const char* arg2,
+	const char* dbName, const char* triggerOrView)
+{
+	return static_cast<IcuSqlite3Authorizer*>(userData)->Authorize(
+		static_cast<EIcuSqlite3AuthAction>(action), arg1, arg2, dbName, triggerOrView);
+}
+
+bool IcuSqlite3Database::SetAuthorizer(
+	IcuSqlite3Authorizer* authorizer)
+{
+	std::unique_ptr<IcuSqlite3Authorizer> owned(authorizer);
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
+	if(SQLITE_OK != sqlite3_set_authorizer((sqlite3*)m_db, 
+		(nullptr != authorizer) ? IcuSqlite3AuthorizerCallback : nullptr, authorizer))
+	{
+		return false;
+	}
+
+	m_authorizer = std::move(owned);
+	return true;
+}
+
+#if SQLITE_VERSION_NUMBER >= 3014000
+static int IcuSqlite3TraceCallback(
+	unsigned type, void* ctxt, void* p, void* x)
+{
+	static_cast<IcuSqlite3Tracer*>(ctxt)->Trace(static_cast<EIcuSqlite3TraceEvent>(type), p, x);
+	return 0;
+}
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+
+bool IcuSqlite3Database::SetTracer(
+	IcuSqlite3Tracer* tracer, const unsigned mask)
+{
+	std::unique_ptr<IcuSqlite3Tracer> owned(tracer);
+	if(nullptr == m_db) {
+		return false;
+	}
+
+#if SQLITE_VERSION_NUMBER >= 3014000
+	IcuSqlite3DbLock lock(m_db);
+	m_tracer.swap(owned);	//	the old one goes once the new one is in
+	m_traceMask = (nullptr != tracer) ? mask : 0;
+	return InstallTracer();
+#else
+	return false;
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+}
+
+//
+//	The statement trace is shared: the admission controller, then the
+//	change stream, then the user's tracer, each forwarding to the next
+//
+bool IcuSqlite3Database::InstallTracer()
+{
+#if SQLITE_VERSION_NUMBER >= 3014000
+	IcuSqlite3Tracer* tracer	= m_tracer.get();
+	unsigned mask				= m_traceMask;
+	if(nullptr != m_changeStream.get()) {
+		m_changeStream->SetTracer(tracer, mask);
+		tracer	= m_changeStream.get();
+		mask	= m_changeStream->GetTraceMask();
+	}
+
+	if(nullptr != m_admission.get()) {
+		m_admission->SetTracer(tracer, mask);
+		return true;
+	}
+	return SQLITE_OK == sqlite3_trace_v2((sqlite3*)m_db, mask,
+		(0 != mask) ? IcuSqlite3TraceCallback : nullptr, tracer);
+#else
+	return false;
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+}
+
+//
+//	Authorizer installed for the length of PrepareWithReadSet()
+//
+struct IcuSqlite3ReadSetCollector
+{
+	IcuSqlite3Authorizer*									chained;
+	std::vector<std::pair<std::string, std::string> >*		tables;
+	std::vector<std::string>*								functions;
+};
+
+static int IcuSqlite3ReadSetCallback(
+	void* userData, int action, const char* arg1, const char* arg2,
+	const char* dbName, const char* triggerOrView)
+{
+	IcuSqlite3ReadSetCollector* collector = static_cast<IcuSqlite3ReadSetCollector*>(userData);
+
+	if(SQLITE_READ == action && nullptr != arg1) {
+		const std::pair<std::string, std::string> table(
+			(nullptr != dbName) ? dbName : "main", arg1);
+		if(std::find(collector->tables->begin(), collector->tables->end(), table) == 
+			collector->tables->end())
+		{
+			collector->tables->push_back(table);
+		}
+	} else if(SQLITE_FUNCTION == action && nullptr != arg2) {
+		const std::string name(arg2);
+		if(std::find(collector->functions->begin(), collector->functions->end(), name) == 
+			collector->functions->end())
+		{
+			collector->functions->push_back(name);
+		}
+	}
+
+	if(nullptr != collector->chained) {
+		return collector->chained->Authorize(static_cast<EIcuSqlite3AuthAction>(action), 
+			arg1, arg2, dbName, triggerOrView);
+	}
+	return SQLITE_OK;
+}
+
+void* IcuSqlite3Database::PrepareWithReadSet(
+	const char* sql, const int len,
+	std::vector<std::pair<std::string, std::string> >& tables,
+	std::vector<std::string>& functions)
+{
+	if(nullptr == m_db) {
+		return nullptr;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
+	ICUSQLITE_ASSERT_OWNER();
+
+	IcuSqlite3ReadSetCollector collector;
+	collector.chained	= m_authorizer.get();
+	collector.tables	= &tables;
+	collector.functions	= &functions;
+
+	sqlite3* db = (sqlite3*)m_db;
+	sqlite3_set_authorizer(db, IcuSqlite3ReadSetCallback, &collector);
+
+	sqlite3_stmt* stmt = nullptr;
+	const int rc = sqlite3_prepare_v2(db, sql, len, &stmt, nullptr);
+
+	sqlite3_set_authorizer(db, 
+		(nullptr != m_authorizer.get()) ? IcuSqlite3AuthorizerCallback : nullptr, m_authorizer.get());
+
+	if(SQLITE_OK != rc) {
+		sqlite3_finalize(stmt);
+		return nullptr;
+	}
+	return stmt;
+}
+
+bool IcuSqlite3Database::SetAdmissionPolicy(
+	const IcuSqlite3AdmissionPolicy& policy)
+{
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
+	ClearAdmissionPolicy();
+	if(policy.maxSteps <= 0 && policy.maxMs <= 0) {
+		return true;	//	no limits, nothing to install
+	}
+
+	std::unique_ptr<IcuSqlite3AdmissionController> admission(
+		new IcuSqlite3AdmissionController(m_db, policy, nullptr, 0));
+	if(!admission->Install()) {
+		return false;
+	}
+
+	m_admission = std::move(admission);
+	InstallTracer();	//	chains the stream / user tracer behind it
+	return true;
+}
+
+void IcuSqlite3Database::ClearAdmissionPolicy()
+{
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr == m_admission.get()) {
+		return;
+	}
+	m_admission.reset();	//	uninstalls its handlers
+	InstallTracer();
+}
+
+bool IcuSqlite3Database::GetAdmissionMetrics(
+	IcuSqlite3AdmissionMetrics& metrics) const
+{
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr == m_admission.get()) {
+		return false;
+	}
+	m_admission->GetMetrics(metrics);
+	return true;
+}
+
+bool IcuSqlite3Database::RegisterFunction(
+	const char* funcName, const int args, const int flags, void* userData,
+	void (*xFunc8)(void*, int, void**), void (*xFunc16)(void*, int, void**),
+	void (*xDestroy)(void*))
+{
+	typedef void (*XFUNC)(sqlite3_context*, int, sqlite3_value**);
+
+	if(nullptr == m_db) {
+		xDestroy(userData);
+		return false;
+	}
+
+	//	xDestroy is also called by SQLite if registration fails
+	return SQLITE_OK == sqlite3_create_function_v2(
+		(sqlite3*)m_db,
+		funcName,
+		args,
+		(m_utf16 ? SQLITE_UTF16 : SQLITE_UTF8) | IcuSqlite3FunctionFlags(flags),
+		userData,
+		m_utf16 ? (XFUNC)xFunc16 : (XFUNC)xFunc8,
+		nullptr,
+		nullptr,
+		xDestroy);
+}
+
 // ...
 
 bool IcuSqlite3Database::ReKey(
 	const char* key)
 {
-#if ICUSQLITE_HAVE_CODEC
-	sqlite3_mutex* mutex = sqlite3_db_mutex((sqlite3*)m_db);
-	sqlite3_mutex_enter(mutex);
-	int r = sqlite3_rekey(
-		(sqlite3*)m_db,
-		reinterpret_cast<const void*>(key),
+	return ReKey(reinterpret_cast<const unsigned char*>(key), 
 		static_cast<int>(strlen(key)));
-	sqlite3_mutex_leave(mutex);
-	return SQLITE_OK == r;
-#else
-	return false;
-#endif
 }
 
 bool IcuSqlite3Database::ReKey(
 	const unsigned char* keyBuf, const int keyLen)
 {
+#if ICUSQLITE_HAVE_CODEC
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
 	return SQLITE_OK == sqlite3_rekey(
 		(sqlite3*)m_db,
 		reinterpret_cast<const void*>(keyBuf),
 		keyLen);
+#else
+	(void)keyBuf;
+	(void)keyLen;
+	return false;
+#endif
 }
 
 int IcuSqlite3Database::GetLimit(
@@ -2326,113 +3608,349 @@ int IcuSqlite3Database::SetLimit(
 	return sqlite3_limit((sqlite3*)m_db, (int)limit, value);
 }
 
-int IcuSqlite3Database::GetLastErrorCode(
-	const bool extended /*= false*/) const
+int IcuSqlite3Database::GetLastErrorCode(
+	const bool extended /*= false*/) const
+{
+	if(nullptr == m_db) {
+		return 0;
+	}
+	
+	return (extended) ? 
+		sqlite3_extended_errcode((sqlite3*)m_db) :
+		sqlite3_errcode((sqlite3*)m_db);
+}
+
+UnicodeString IcuSqlite3Database::GetDatabaseFileName(
+	const UnicodeString& dbName) const
+{
+	if(nullptr == m_db) {
+		return UNICODE_STRING_SIMPLE("");
+	}
+
+	std::string utf8Temp;
+	const char* fileName = sqlite3_db_filename((sqlite3*)m_db, IcuSqlite3ToUtf8(dbName, utf8Temp).c_str());
+	return IcuSqlite3FromUtf8(fileName);
+}
+
+UnicodeString IcuSqlite3Database::GetLastErrorMessage() const
+{
+	if(nullptr == m_db) {
+		return UNICODE_STRING_SIMPLE("");
+	}
+	
+	const UChar* errMsg = (const UChar*)(sqlite3_errmsg16((sqlite3*)m_db));
+	return UnicodeString(errMsg, -1);
+}
+
+int IcuSqlite3Database::GetLastSystemErrorCode() const
+{
+	if(!IsOpen()) {
+		return -1;
+	}
+	int err = 0;
+	if(SQLITE_OK != sqlite3_file_control((sqlite3*)m_db, nullptr, SQLITE_LAST_ERRNO, &err)) {
+		return -2;
+	}
+	return err;
+}
+
+//...
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Database - private
+///////////////////////////////////////////////////////////////////////////////
+void* IcuSqlite3Database::Prepare(
+	const UChar* sql, const int32_t sqlLen /*= -1*/) const
+{
+	if(nullptr == m_db) {
+		return nullptr;
+	}
+	ICUSQLITE_ASSERT_OWNER();
+
+	const UChar* tail = nullptr;
+	sqlite3_stmt* stmt;
+
+	if(SQLITE_OK != sqlite3_prepare16_v2((sqlite3*)m_db, (void*)sql, sqlLen, 
+		&stmt, (const void**)&tail)) 
+	{
+		return nullptr;
+	}
+
+	return stmt;
+}
+
+void* IcuSqlite3Database::Prepare(
+	const char* sql, const int32_t sqlLen /*= -1*/) const
+{
+	if(nullptr == m_db) {
+		return nullptr;
+	}
+	ICUSQLITE_ASSERT_OWNER();
+
+	sqlite3_stmt* stmt;
+	if(SQLITE_OK != sqlite3_prepare_v2((sqlite3*)m_db, sql, sqlLen, &stmt, nullptr)) {
+		return nullptr;
+	}
+
+	return stmt;
+}
+
+bool IcuSqlite3Database::ApplyPragmaBatch(
+	const IcuSqlite3OpenProfile& profile, const int extFlags,
+	const bool newDatabase, IcuSqlite3OpenProfile* effective)
+{
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	//
+	//	Build a single script: setters first (encoding and page_size ahead
+	//	of anything that may write the header), then read backs for the
+	//	PRAGMAs that don't echo their value. sqlite3_exec() hands every
+	//	resulting row to one callback.
+	//
+	std::string batch;
+	std::string readBack;
+	IcuSqlite3StatementBuffer buf;
+
+	if((extFlags & ICUSQLITE_EXT_OPEN_UTF16) && newDatabase) {
+		batch += "PRAGMA encoding=\"UTF-16\";";
+	}
+
+	for(size_t i = 0; i < sizeof(s_profilePragmas) / sizeof(s_profilePragmas[0]); ++i) {
+		const IcuSqlite3ProfilePragma& pragma = s_profilePragmas[i];
+		const int64_t value = profile.*pragma.member;
+		if(ICUSQLITE_PRAGMA_UNSET == value) {
+			continue;
+		}
+
+		if(&IcuSqlite3OpenProfile::pageSize == pragma.member && !newDatabase) {
+			continue;	//	fixed once the database exists
+		}
+
+		if(&IcuSqlite3OpenProfile::lockingMode == pragma.member) {
+			batch += (ICUSQLITE_LOCKING_MODE_EXCLUSIVE == value) ?
+				"PRAGMA locking_mode=EXCLUSIVE;" : "PRAGMA locking_mode=NORMAL;";
+		} else {
+			batch += buf.Format("PRAGMA %s=%lld;", pragma.name, static_cast<long long>(value));
+		}
+
+		if(!pragma.echoes) {
+			readBack += buf.Format("PRAGMA %s;", pragma.name);
+		}
+	}
+
+	if((extFlags & ICUSQLITE_EXT_OPEN_FK)) {
+		batch += "PRAGMA foreign_keys=ON;";
+	}
+
+	if((extFlags & ICUSQLITE_EXT_OPEN_WAL)) {
+		batch += "PRAGMA journal_mode=WAL;";
+	}
+
+	batch += readBack;
+	if(batch.empty()) {
+		return true;
+	}
+
+	IcuSqlite3PragmaBatchResults results;
+	char* err = nullptr;
+	if(SQLITE_OK != sqlite3_exec((sqlite3*)m_db, batch.c_str(), 
+		IcuSqlite3PragmaBatchCallback, &results, &err))
+	{
+		sqlite3_free(err);
+		return false;
+	}
+
+	if(nullptr != effective) {
+		*effective = results.effective;
+	}
+
+	if((extFlags & ICUSQLITE_EXT_OPEN_WAL) && "wal" != results.journalMode) {
+		return false;
+	}
+
+	//
+	//	Verify. mmap_size may legitimately come back smaller: it is capped
+	//	by SQLITE_MAX_MMAP_SIZE and disabled by some VFSs and codecs.
+	//
+	for(size_t i = 0; i < sizeof(s_profilePragmas) / sizeof(s_profilePragmas[0]); ++i) {
+		const IcuSqlite3ProfilePragma& pragma = s_profilePragmas[i];
+		const int64_t requested = profile.*pragma.member;
+		const int64_t actual = results.effective.*pragma.member;
+		if(ICUSQLITE_PRAGMA_UNSET == requested || 
+			(&IcuSqlite3OpenProfile::pageSize == pragma.member && !newDatabase))
+		{
+			continue;
+		}
+
+		if(&IcuSqlite3OpenProfile::mmapSize == pragma.member) {
+			if(ICUSQLITE_PRAGMA_UNSET != actual && actual > requested) {
+				return false;
+			}
+		} else if(requested != actual) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool IcuSqlite3Database::DetectEncoding()
+{
+	//
+	//	Fixed once the database has content (and shared by everything
+	//	attached to it), so once per Open() is enough
+	//
+	std::string encoding;
+	if(!ExecuteScalar("PRAGMA encoding;", encoding)) {
+		return false;
+	}
+
+#ifdef WORDS_BIGENDIAN
+	m_utf16 = ("UTF-16be" == encoding);
+#else
+	m_utf16 = ("UTF-16le" == encoding);
+#endif
+	return true;
+}
+
+static void IcuSqlite3CallScalar(
+	void* ctxt, int argCount, void** args, const bool utf16)
+{
+	IcuSqlite3ScalarFunction* sqlFunc = 
+		reinterpret_cast<IcuSqlite3ScalarFunction*>(sqlite3_user_data(
+			(sqlite3_context*)ctxt));
+	if(nullptr != sqlFunc) {
+		IcuSqlite3FunctionContext context(ctxt, argCount, args, utf16);
+		sqlFunc->Scalar(&context);
+	}
+}
+
+static void IcuSqlite3CallStep(
+	void* ctxt, int argCount, void** args, const bool utf16)
+{
+	IcuSqlite3AggregateFunction* sqlFunc = 
+		reinterpret_cast<IcuSqlite3AggregateFunction*>(sqlite3_user_data(
+			(sqlite3_context*)ctxt));
+	if(nullptr != sqlFunc) {
+		IcuSqlite3FunctionContext context(ctxt, argCount, args, utf16);
+		sqlFunc->Step(&context);
+	}
+}
+
+static void IcuSqlite3CallFinalize(
+	void* ctxt, const bool utf16)
+{
+	IcuSqlite3AggregateFunction* sqlFunc = 
+		reinterpret_cast<IcuSqlite3AggregateFunction*>(sqlite3_user_data(
+			(sqlite3_context*)ctxt));
+	if(nullptr != sqlFunc) {
+		IcuSqlite3FunctionContext context(ctxt, 0, nullptr, utf16);
+		sqlFunc->Finalize(&context);
+	}
+}
+
+static IcuSqlite3WindowFunction* IcuSqlite3GetWindowFunction(
+	void* ctxt)
+{
+	return static_cast<IcuSqlite3WindowFunction*>(
+		reinterpret_cast<IcuSqlite3AggregateFunction*>(sqlite3_user_data(
+			(sqlite3_context*)ctxt)));
+}
+
+static void IcuSqlite3CallValue(
+	void* ctxt, const bool utf16)
 {
-	if(nullptr == m_db) {
-		return 0;
+	IcuSqlite3WindowFunction* sqlFunc = IcuSqlite3GetWindowFunction(ctxt);
+	if(nullptr != sqlFunc) {
+		IcuSqlite3FunctionContext context(ctxt, 0, nullptr, utf16);
+		sqlFunc->Value(&context);
 	}
-	
-	return (extended) ? 
-		sqlite3_extended_errcode((sqlite3*)m_db) :
-		sqlite3_errcode((sqlite3*)m_db);
 }
 
-UnicodeString IcuSqlite3Database::GetDatabaseFileName(
-	const UnicodeString& dbName) const
+static void IcuSqlite3CallInverse(
+	void* ctxt, int argCount, void** args, const bool utf16)
 {
-	if(nullptr == m_db) {
-		return UNICODE_STRING_SIMPLE("");
+	IcuSqlite3WindowFunction* sqlFunc = IcuSqlite3GetWindowFunction(ctxt);
+	if(nullptr != sqlFunc) {
+		IcuSqlite3FunctionContext context(ctxt, argCount, args, utf16);
+		sqlFunc->Inverse(&context);
 	}
-
-	std::string utf8Temp;
-	const char* fileName = sqlite3_db_filename((sqlite3*)m_db, dbName.toUTF8String(utf8Temp).c_str());
-	return UnicodeString::fromUTF8(fileName);
 }
 
-UnicodeString IcuSqlite3Database::GetLastErrorMessage() const
+//
+//	UTF-8 and native UTF-16 entry points; which pair is registered
+//	depends on the database encoding (see IsUtf16())
+//
+/*static*/
+void IcuSqlite3Database::xFunc(
+	void* ctxt, int argCount, void** args)
 {
-	if(nullptr == m_db) {
-		return UNICODE_STRING_SIMPLE("");
-	}
-	
-	const UChar* errMsg = (const UChar*)(sqlite3_errmsg16((sqlite3*)m_db));
-	return UnicodeString(errMsg, -1);
+	IcuSqlite3CallScalar(ctxt, argCount, args, false);
 }
 
-int IcuSqlite3Database::GetLastSystemErrorCode() const
+/*static*/
+void IcuSqlite3Database::xFunc16(
+	void* ctxt, int argCount, void** args)
 {
-	if(!IsOpen()) {
-		return -1;
-	}
-	int err = 0;
-	if(SQLITE_OK != sqlite3_file_control((sqlite3*)m_db, nullptr, SQLITE_LAST_ERRNO, &err)) {
-		return -2;
-	}
-	return err;
+	IcuSqlite3CallScalar(ctxt, argCount, args, true);
 }
 
-//...
+/*static*/
+void IcuSqlite3Database::xStep(
+	void* ctxt, int argCount, void** args)
+{
+	IcuSqlite3CallStep(ctxt, argCount, args, false);
+}
 
-///////////////////////////////////////////////////////////////////////////////
-//	IcuSqlite3Database - private
-///////////////////////////////////////////////////////////////////////////////
-void* IcuSqlite3Database::Prepare(
-	const UChar* sql, const int32_t sqlLen /*= -1*/) const
+/*static*/
+void IcuSqlite3Database::xStep16(
+	void* ctxt, int argCount, void** args)
 {
-	if(nullptr == m_db) {
-		return nullptr;
-	}
+	IcuSqlite3CallStep(ctxt, argCount, args, true);
+}
 
-	const UChar* tail = nullptr;
-	sqlite3_stmt* stmt;
+/*static*/
+void IcuSqlite3Database::xFinalize(
+	void* ctxt)
+{
+	IcuSqlite3CallFinalize(ctxt, false);
+}
 
-	if(SQLITE_OK != sqlite3_prepare16_v2((sqlite3*)m_db, (void*)sql, sqlLen, 
-		&stmt, (const void**)&tail)) 
-	{
-		return nullptr;
-	}
+/*static*/
+void IcuSqlite3Database::xFinalize16(
+	void* ctxt)
+{
+	IcuSqlite3CallFinalize(ctxt, true);
+}
 
-	return stmt;
+/*static*/
+void IcuSqlite3Database::xValue(
+	void* ctxt)
+{
+	IcuSqlite3CallValue(ctxt, false);
 }
 
 /*static*/
-void IcuSqlite3Database::xFunc(
-	void* ctxt, int argCount, void** args)
+void IcuSqlite3Database::xValue16(
+	void* ctxt)
 {
-	IcuSqlite3ScalarFunction* sqlFunc = 
-		reinterpret_cast<IcuSqlite3ScalarFunction*>(sqlite3_user_data(
-			(sqlite3_context*)ctxt));
-	if(nullptr != sqlFunc) {
-		IcuSqlite3FunctionContext context(ctxt, argCount, args);
-		sqlFunc->Scalar(&context);
-	}
+	IcuSqlite3CallValue(ctxt, true);
 }
 
 /*static*/
-void IcuSqlite3Database::xStep(
+void IcuSqlite3Database::xInverse(
 	void* ctxt, int argCount, void** args)
 {
-	IcuSqlite3AggregateFunction* sqlFunc = 
-		reinterpret_cast<IcuSqlite3AggregateFunction*>(sqlite3_user_data(
-			(sqlite3_context*)ctxt));
-	if(nullptr != sqlFunc) {
-		IcuSqlite3FunctionContext context(ctxt, argCount, args);
-		sqlFunc->Step(&context);
-	}
+	IcuSqlite3CallInverse(ctxt, argCount, args, false);
 }
 
 /*static*/
-void IcuSqlite3Database::xFinalize(
-	void* ctxt)
+void IcuSqlite3Database::xInverse16(
+	void* ctxt, int argCount, void** args)
 {
-	IcuSqlite3AggregateFunction* sqlFunc = 
-		reinterpret_cast<IcuSqlite3AggregateFunction*>(sqlite3_user_data(
-			(sqlite3_context*)ctxt));
-	if(nullptr != sqlFunc) {
-		IcuSqlite3FunctionContext context(ctxt, 0, nullptr);
-		sqlFunc->Finalize(&context);
-	}
+	IcuSqlite3CallInverse(ctxt, argCount, args, true);
 }
 
 /*static*/
@@ -2458,10 +3976,22 @@ void IcuSqlite3Database::xDestroyAggregate(
 ///////////////////////////////////////////////////////////////////////////////
 
 #if !defined(SQLITE_OMIT_SHARED_CACHE)
-bool IcuSqlite3Database::ms_sharedCacheEnabled	= false;
+std::atomic<bool> IcuSqlite3Database::ms_sharedCacheEnabled(false);
 #endif
 
-int	IcuSqlite3Database::ms_supportFlags			= ICUSQLITE_SUPPORTED_FLAGS;
+const int IcuSqlite3Database::ms_supportFlags			= ICUSQLITE_SUPPORTED_FLAGS;
+
+std::atomic<int> IcuSqlite3Database::ms_openConnections[ICUSQLITE_THREADING_MODE_COUNT] = {};
+
+/*static*/
+int IcuSqlite3Database::GetOpenConnectionCount(
+	const EIcuSqlite3ThreadingMode mode)
+{
+	if(mode < 0 || mode >= ICUSQLITE_THREADING_MODE_COUNT) {
+		return 0;
+	}
+	return ms_openConnections[mode].load();
+}
 
 /*static*/
 bool IcuSqlite3Database::InitializeSQLite()
@@ -2516,14 +4046,14 @@ bool IcuSqlite3Database::EnableSharedCache(
 /*static*/
 UnicodeString IcuSqlite3Database::GetVersion()
 {
-	return UnicodeString::fromUTF8(sqlite3_libversion());
+	return IcuSqlite3FromUtf8(sqlite3_libversion());
 }
 
 /*static*/
 UnicodeString IcuSqlite3Database::GetSourceId()
 {
 #if SQLITE_VERSION_NUMBER >= 3006018
-	return UnicodeString::fromUTF8(sqlite3_sourceid());
+	return IcuSqlite3FromUtf8(sqlite3_sourceid());
 #else	//	SQLITE_VERSION_NUMBER >= 3006018
 	return "";
 #endif	//	SQLITE_VERSION_NUMBER < 3006018
@@ -2537,18 +4067,127 @@ bool IcuSqlite3Database::HasSupport(
 }
 
 bool IcuSqlite3Database::WALCheckpoint(
-	const char* dbName /*= nullptr*/, const EIcuSqlite3WALCheckpoint checkpointType /*= ICUSQLITE_WAL_CHECKPOINT_PASSIVE*/) const
+	const char* dbName /*= nullptr*/, const EIcuSqlite3WALCheckpoint checkpointType /*= ICUSQLITE_WAL_CHECKPOINT_PASSIVE*/,
+	int* logFrames /*= nullptr*/, int* checkpointedFrames /*= nullptr*/) const
 {
 	int mode;
 	switch(checkpointType) {
 		case ICUSQLITE_WAL_CHECKPOINT_PASSIVE	: mode = SQLITE_CHECKPOINT_PASSIVE; break;
 		case ICUSQLITE_WAL_CHECKPOINT_FULL		: mode = SQLITE_CHECKPOINT_FULL; break;
 		case ICUSQLITE_WAL_CHECKPOINT_RESTART	: mode = SQLITE_CHECKPOINT_RESTART; break;
+		case ICUSQLITE_WAL_CHECKPOINT_TRUNCATE	: mode = SQLITE_CHECKPOINT_TRUNCATE; break;
 		
 		default : 
 			return false;
 	}
-	return (SQLITE_OK == ::sqlite3_wal_checkpoint_v2((sqlite3*)m_db, dbName, mode, nullptr, nullptr));
+	return (SQLITE_OK == ::sqlite3_wal_checkpoint_v2((sqlite3*)m_db, dbName, mode, logFrames, checkpointedFrames));
+}
+
+bool IcuSqlite3Database::StartCheckpointScheduler(
+	const IcuSqlite3CheckpointPolicy& policy /*= IcuSqlite3CheckpointPolicy()*/)
+{
+	//
+	//	The scheduler opens its own connection, which we have no key for
+	//
+	if(nullptr == m_db || m_encrypted) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr != m_checkpointScheduler.get()) {
+		return false;
+	}
+
+	std::string journalMode;
+	if(!ExecuteScalar("PRAGMA journal_mode;", journalMode) || "wal" != journalMode) {
+		return false;
+	}
+
+	const char* filename = sqlite3_db_filename((sqlite3*)m_db, "main");
+	if(nullptr == filename || '\0' == filename[0]) {
+		return false;	//	temp / in-memory
+	}
+
+	std::unique_ptr<IcuSqlite3CheckpointScheduler> scheduler(
+		new IcuSqlite3CheckpointScheduler(m_db, policy));
+	if(!scheduler->Start(filename)) {
+		return false;
+	}
+
+	m_checkpointScheduler = std::move(scheduler);
+	return true;
+}
+
+void IcuSqlite3Database::StopCheckpointScheduler()
+{
+	//
+	//	Joined outside the lock; the worker may be waiting on it
+	//
+	std::unique_ptr<IcuSqlite3CheckpointScheduler> scheduler;
+	{
+		IcuSqlite3DbLock lock(m_db);
+		scheduler = std::move(m_checkpointScheduler);
+	}
+}
+
+bool IcuSqlite3Database::GetCheckpointMetrics(
+	IcuSqlite3CheckpointMetrics& metrics) const
+{
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr == m_checkpointScheduler.get()) {
+		return false;
+	}
+	m_checkpointScheduler->GetMetrics(metrics);
+	return true;
+}
+
+bool IcuSqlite3Database::StartChangeStream(
+	IcuSqlite3ChangeListener* listener,
+	const IcuSqlite3ChangeStreamOptions& options /*= IcuSqlite3ChangeStreamOptions()*/)
+{
+	if(nullptr == m_db) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr != m_changeStream.get() || nullptr != m_resultCache) {
+		return false;
+	}
+
+	std::unique_ptr<IcuSqlite3ChangeStream> stream(
+		new IcuSqlite3ChangeStream(m_db, listener, options));
+	if(!stream->Start()) {
+		return false;
+	}
+
+	m_changeStream = std::move(stream);
+	InstallTracer();	//	tells when a COMMIT has gone through
+	return true;
+}
+
+void IcuSqlite3Database::StopChangeStream()
+{
+	//
+	//	Unhooks, then drains the queue; the drain runs listener callbacks,
+	//	so it happens outside the lock
+	//
+	std::unique_ptr<IcuSqlite3ChangeStream> stream;
+	{
+		IcuSqlite3DbLock lock(m_db);
+		stream = std::move(m_changeStream);
+		InstallTracer();
+	}
+}
+
+bool IcuSqlite3Database::GetChangeStreamMetrics(
+	IcuSqlite3ChangeStreamMetrics& metrics) const
+{
+	IcuSqlite3DbLock lock(m_db);
+	if(nullptr == m_changeStream.get()) {
+		return false;
+	}
+	m_changeStream->GetMetrics(metrics);
+	return true;
 }
 
 #if defined(ICUSQLITE3_ANDROID) || defined(ICUSQLITE3_IOS)
@@ -2676,3 +4315,176 @@ int64_t IcuSqlite3Transaction::GetLastRowId() const
 {
 	return m_db->GetLastRowId();
 }
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Savepoint
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3Savepoint::IcuSqlite3Savepoint(
+	IcuSqlite3Database* db,
+	const EIcuSqlite3TransTypes type /*= ICUSQLITE_TRANSACTION_DEFAULT*/,
+	const bool commitOnDestroy /*= true*/)
+	: m_db(db)
+	, m_level(0)
+	, m_ok(false)
+	, m_open(false)
+	, m_commitOnDestroy(commitOnDestroy)
+{
+	assert(nullptr != db);
+
+	IcuSqlite3DbLock lock(m_db->m_db);
+	IcuSqlite3ControlStatements* control = m_db->GetControlStatements();
+	if(nullptr == control) {
+		return;
+	}
+
+	if(0 == m_db->m_savepointDepth && m_db->IsAutoCommitMode()) {
+		m_open = m_db->Begin(type);
+	} else {
+		m_level	= m_db->m_savepointDepth + 1;
+		m_open	= (SQLITE_OK == control->Savepoint(m_level));
+	}
+
+	if(m_open) {
+		++m_db->m_savepointDepth;
+	}
+	m_ok = m_open;
+}
+
+IcuSqlite3Savepoint::~IcuSqlite3Savepoint()
+{
+	if(m_open) {
+		if(m_ok && m_commitOnDestroy) {
+			Commit();
+		}
+		if(m_open) {	//	not committing, or the commit failed
+			Rollback();
+		}
+	}
+}
+
+bool IcuSqlite3Savepoint::Commit()
+{
+	if(!m_open) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db->m_db);
+	bool ret;
+	if(0 == m_level) {
+		ret = m_db->Commit();
+	} else {
+		IcuSqlite3ControlStatements* control = m_db->GetControlStatements();
+		ret = (nullptr != control && SQLITE_OK == control->Release(m_level));
+	}
+
+	if(ret) {
+		Close();
+	}
+	return ret;
+}
+
+bool IcuSqlite3Savepoint::Rollback()
+{
+	if(!m_open) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(m_db->m_db);
+	bool ret;
+	if(0 == m_level) {
+		ret = m_db->Rollback();
+	} else {
+		//
+		//	ROLLBACK TO leaves the savepoint on the stack; RELEASE it so
+		//	the enclosing scope carries on as if this one never ran
+		//
+		m_db->InvalidateSchemaCatalog();
+		IcuSqlite3ControlStatements* control = m_db->GetControlStatements();
+		ret = (nullptr != control && 
+			SQLITE_OK == control->RollbackTo(m_level) &&
+			SQLITE_OK == control->Release(m_level));
+	}
+
+	//
+	//	Even if it failed the scope is over; the statement that failed
+	//	most likely ended the transaction already
+	//
+	Close();
+	return ret;
+}
+
+void IcuSqlite3Savepoint::Close()
+{
+	assert(m_db->m_savepointDepth == ((0 == m_level) ? 1 : m_level));	//	innermost scope
+
+	m_open	= false;
+	m_ok	= false;
+	if(m_db->m_savepointDepth > 0) {
+		--m_db->m_savepointDepth;
+	}
+}
+
+bool IcuSqlite3Savepoint::Execute(
+	const UnicodeString& sql)
+{
+	if(!m_ok) {
+		return false;
+	}
+	m_ok = (-1 != m_db->ExecuteUpdate(sql));
+	return m_ok;
+}
+
+bool IcuSqlite3Savepoint::Execute(
+	const char* sql)
+{
+	if(!m_ok) {
+		return false;
+	}
+	m_ok = (-1 != m_db->ExecuteUpdate(sql));
+	return m_ok;
+}
+
+bool IcuSqlite3Savepoint::Execute(
+	IcuSqlite3Statement& stmt)
+{
+	if(!m_ok) {
+		return false;
+	}
+	m_ok = (-1 != stmt.ExecuteUpdate());
+	return m_ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3BusyBudget
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3BusyBudget::IcuSqlite3BusyBudget(
+	IcuSqlite3Database* db, const int ms)
+	: m_db(db)
+	, m_deadlineUs(0)
+	, m_previousUs(0)
+{
+	assert(nullptr != m_db);
+
+	IcuSqlite3BusyHandler* handler = m_db->m_busyHandler.get();
+	if(nullptr != handler) {
+		m_deadlineUs = IcuSqlite3BusyHandler::NowUs() + static_cast<int64_t>(std::max(ms, 0)) * 1000;
+		m_previousUs = handler->GetBudgetDeadline();
+		if(0 != m_previousUs && m_previousUs < m_deadlineUs) {
+			m_deadlineUs = m_previousUs;	//	can't extend an outer budget
+		}
+		handler->SetBudgetDeadline(m_deadlineUs);
+	}
+}
+
+IcuSqlite3BusyBudget::~IcuSqlite3BusyBudget()
+{
+	IcuSqlite3BusyHandler* handler = m_db->m_busyHandler.get();
+	if(nullptr != handler && 0 != m_deadlineUs) {
+		handler->SetBudgetDeadline(m_previousUs);
+	}
+}
+
+bool IcuSqlite3BusyBudget::IsExhausted() const
+{
+	return 0 != m_deadlineUs && IcuSqlite3BusyHandler::NowUs() >= m_deadlineUs;
+}
@@ -38,17 +38,28 @@
 //	ICU
 #include <unicode/utypes.h>
 #include <unicode/unistr.h>
+#include <unicode/coll.h>
 
 //	STL
+#include <atomic>
 #include <set>
 #include <vector>
 #include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
 
 #include "ICUSQLite3Def.h"
 #include "ICUSQLite3Utility.h"
 
 const int ICUSQLITE_COLUMN_IDX_INVALID	= (-1);
 
+//
+//	Default mmap_size applied to read-only connections (see Open())
+//
+const int64_t ICUSQLITE_READONLY_MMAP_SIZE	= (256 * 1024 * 1024);
+
 //	:TODO: make all of these singular:
 enum EIcuSqlite3ColumnTypes {
 	ICUSQLITE_COLUMN_TYPE_INVALID	= 0,
@@ -71,18 +82,29 @@ enum EIcuSqlite3OpenFlags {
 	ICUSQLITE_OPEN_READONLY		= 0x00000001,
 	ICUSQLITE_OPEN_READWRITE	= 0x00000002,
 	ICUSQLITE_OPEN_CREATE		= 0x00000004,
+	ICUSQLITE_OPEN_URI			= 0x00000040,
 	ICUSQLITE_OPEN_NOMUTEX		= 0x00008000,
 	ICUSQLITE_OPEN_FULLMUTEX	= 0x00010000,
 	ICUSQLITE_OPEN_SHAREDCACHE	= 0x00020000,
 	ICUSQLITE_OPEN_PRIVATECACHE	= 0x00040000,
 };
 
+//
+//	See IcuSqlite3Database::SetThreadingMode()
+//
+enum EIcuSqlite3ThreadingMode {
+	ICUSQLITE_THREADING_SERIALIZED		= 0,	//	any thread, any time; FULLMUTEX
+	ICUSQLITE_THREADING_SINGLE_OWNER	= 1,	//	one owning thread at a time; NOMUTEX
+	ICUSQLITE_THREADING_MODE_COUNT,
+};
+
 enum EIcuSqlite3ExtOpenFlags {
 	ICUSQLITE_EXT_OPEN_NONE		= 0x00000000,
 	ICUSQLITE_EXT_OPEN_UTF16	= 0x00000001,
 	ICUSQLITE_EXT_OPEN_ICUEXT	= 0x00000002,	//	ICU extensions (e.g.: LOWER(s, locale), etc.)
 	ICUSQLITE_EXT_OPEN_FK		= 0x00000004,	//	enable foreign keys at open
 	ICUSQLITE_EXT_OPEN_WAL		= 0x00000008,	//	Utilize WAL mode
+	ICUSQLITE_EXT_OPEN_IMMUTABLE	= 0x00000010,	//	read-only: open via immutable=1 URI (file must never change)
 
 	ICUSQLITE_EXT_OPEN_DEFAULT = (ICUSQLITE_EXT_OPEN_ICUEXT | ICUSQLITE_EXT_OPEN_FK),
 };
@@ -95,6 +117,7 @@ enum EIcuSqlite3SupportFlags {
 	ICUSQLITE_SUPPORT_INC_BLOB		= 0x00000008,
 	ICUSQLITE_SUPPORT_SAVEPOINT		= 0x00000010,
 	ICUSQLITE_SUPPORT_BACKUP		= 0x00000020,
+	ICUSQLITE_SUPPORT_SESSION		= 0x00000040,
 };
 
 enum EIcuSqlite3RestoreResults {
@@ -139,6 +162,371 @@ enum EIcuSqlite3WALCheckpoint {
 	ICUSQLITE_WAL_CHECKPOINT_PASSIVE	= 0,
 	ICUSQLITE_WAL_CHECKPOINT_FULL		= 1,
 	ICUSQLITE_WAL_CHECKPOINT_RESTART	= 2,
+	ICUSQLITE_WAL_CHECKPOINT_TRUNCATE	= 3,
+};
+
+//
+//	When the background checkpoint scheduler runs. See 
+//	IcuSqlite3Database::StartCheckpointScheduler()
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3CheckpointPolicy
+{
+	IcuSqlite3CheckpointPolicy();
+
+	int							frameThreshold;	//	PASSIVE once this many frames await checkpointing
+	int							maxIntervalMs;	//	PASSIVE at least this often while frames are pending
+	int							idleMs;			//	no commits for this long counts as idle...
+	EIcuSqlite3WALCheckpoint	idleMode;		//	...and gets this checkpoint (RESTART/TRUNCATE)
+	int							busyTimeoutMs;	//	how long idleMode may wait on readers/writers
+	int							pollMs;			//	scheduler wake up interval
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3CheckpointMetrics
+{
+	IcuSqlite3CheckpointMetrics();
+
+	int64_t	walFrames;				//	frames in the WAL as of the last commit
+	int64_t	checkpointedFrames;		//	frames copied back by the last checkpoint
+	int64_t	checkpointLag;			//	frames not yet checkpointed
+	int64_t	walBytes;				//	approximate WAL content size
+	int64_t	checkpoints;			//	completed checkpoints, all modes
+	int64_t	idleCheckpoints;		//	...of which were idle escalations
+	int64_t	busyCheckpoints;		//	checkpoints that returned SQLITE_BUSY
+	int64_t	lastCheckpointUs;		//	duration of the last checkpoint
+	int64_t	maxCheckpointUs;		//	slowest checkpoint
+	int64_t	msSinceCheckpoint;		//	time since the last completed checkpoint
+};
+
+//
+//	Per statement limits enforced through the progress handler. A
+//	statement over budget is stopped with SQLITE_INTERRUPT.
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3AdmissionPolicy
+{
+	IcuSqlite3AdmissionPolicy();
+
+	int64_t		maxSteps;		//	VM instructions per statement, 0 = unlimited
+	int			maxMs;			//	wall clock per statement from its first step, 0 = unlimited
+	int			checkInterval;	//	VM instructions between checks (granularity of both limits)
+};
+
+enum EIcuSqlite3AdmissionCutoff {
+	ICUSQLITE_ADMISSION_CUTOFF_NONE		= 0,
+	ICUSQLITE_ADMISSION_CUTOFF_STEPS	= 1,
+	ICUSQLITE_ADMISSION_CUTOFF_DEADLINE	= 2,
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3AdmissionMetrics
+{
+	IcuSqlite3AdmissionMetrics();
+
+	int64_t						statements;			//	statements started under the policy
+	int64_t						stepCutoffs;
+	int64_t						deadlineCutoffs;
+
+	//
+	//	The most recent statement cut off
+	//
+	EIcuSqlite3AdmissionCutoff	lastCutoff;
+	std::string					lastCutoffSql;
+	int64_t						lastCutoffSteps;
+	int64_t						lastCutoffMs;
+};
+
+//
+//	How a connection waits out SQLITE_BUSY: retry with exponentially
+//	growing, jittered sleeps until timeoutMs has been spent on one lock
+//	wait (or maxRetries retries, if set). See also IcuSqlite3BusyBudget.
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3BusyPolicy
+{
+	IcuSqlite3BusyPolicy();
+
+	int			timeoutMs;			//	per lock wait, 0 = fail at once, < 0 = forever
+	int			maxRetries;			//	0 = limited by timeoutMs only
+	int			initialDelayMs;		//	first sleep
+	int			maxDelayMs;			//	sleeps stop growing here
+	double		multiplier;			//	growth per retry
+	double		jitter;				//	0.0 - 1.0: up to this fraction of each sleep is randomized
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3BusyMetrics
+{
+	IcuSqlite3BusyMetrics();
+
+	int64_t		busyEvents;			//	lock waits begun (SQLITE_BUSY seen)
+	int64_t		retries;
+	int64_t		waitUs;				//	total time slept
+	int64_t		maxWaitUs;			//	longest single lock wait
+	int64_t		timeouts;			//	gave up: timeoutMs / maxRetries spent
+	int64_t		budgetCutoffs;		//	gave up: an IcuSqlite3BusyBudget ran out
+};
+
+//
+//	What an (extended) result code means for a write transaction, see
+//	IcuSqlite3Database::ClassifyError()
+//
+enum EIcuSqlite3ErrorClass {
+	ICUSQLITE_ERROR_CLASS_NONE		= 0,	//	not an error
+	ICUSQLITE_ERROR_CLASS_CONFLICT	= 1,	//	SQLITE_BUSY_SNAPSHOT: another writer committed after our read began
+	ICUSQLITE_ERROR_CLASS_BUSY		= 2,	//	SQLITE_BUSY / SQLITE_LOCKED: lock contention
+	ICUSQLITE_ERROR_CLASS_FATAL		= 3,	//	anything else; retrying won't help
+};
+
+//
+//	See IcuSqlite3Database::RunInTransaction()
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3RetryPolicy
+{
+	IcuSqlite3RetryPolicy();
+
+	int						maxAttempts;		//	including the first
+	int						initialDelayMs;		//	backoff between attempts
+	int						maxDelayMs;
+	double					multiplier;
+	double					jitter;				//	0.0 - 1.0
+	EIcuSqlite3TransTypes	type;				//	first attempt's BEGIN
+	bool					escalate;			//	BEGIN IMMEDIATE after a conflict
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3RetryMetrics
+{
+	IcuSqlite3RetryMetrics();
+
+	int64_t		transactions;		//	RunInTransaction() calls
+	int64_t		commits;
+	int64_t		attempts;
+	int64_t		retries;
+	int64_t		conflicts;			//	ICUSQLITE_ERROR_CLASS_CONFLICT seen
+	int64_t		busy;				//	ICUSQLITE_ERROR_CLASS_BUSY seen
+	int64_t		escalations;		//	switched to BEGIN IMMEDIATE
+	int64_t		failures;			//	gave up or fatal
+	int			lastErrorCode;		//	extended code of the last failed attempt
+};
+
+//
+//	Internal: one RunInTransaction() call
+//
+struct IcuSqlite3RetryAttempt
+{
+	IcuSqlite3RetryAttempt() : attempt(0), type(ICUSQLITE_TRANSACTION_DEFAULT), 
+		level(0), rng(0), done(false), succeeded(false) {}
+
+	int						attempt;
+	EIcuSqlite3TransTypes	type;
+	int						level;		//	> 0: savepoint inside someone else's transaction
+	uint64_t				rng;
+	bool					done;
+	bool					succeeded;
+};
+
+//
+//	Change data capture, see IcuSqlite3Database::StartChangeStream()
+//
+enum EIcuSqlite3ChangeOp {
+	ICUSQLITE_CHANGE_DELETE		= 9,
+	ICUSQLITE_CHANGE_INSERT		= 18,
+	ICUSQLITE_CHANGE_UPDATE		= 23,
+};
+
+//
+//	Names point at strings the stream keeps until it is stopped
+//
+struct IcuSqlite3Change
+{
+	EIcuSqlite3ChangeOp		op;
+	const char*				dbName;		//	"main", "temp" or an attached name
+	const char*				table;
+	int64_t					rowid;		//	INSERT: the new row, else the row before the change
+	int64_t					newRowid;	//	UPDATE: the row after (differs if the rowid changed), else rowid
+};
+
+struct IcuSqlite3ChangedTable
+{
+	const char*				dbName;
+	const char*				table;
+};
+
+//
+//	Everything one transaction changed. If it changed more than
+//	maxChangesPerBatch rows |truncated| is set and |changes| holds only
+//	the first ones; |tables| is always complete.
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ChangeBatch
+{
+	IcuSqlite3ChangeBatch();
+	void Clear();
+
+	int64_t									sequence;	//	1, 2, ... per published batch
+	bool									truncated;
+	bool									lostBefore;	//	batches were dropped (queue full) before this one
+	std::vector<IcuSqlite3Change>			changes;
+	std::vector<IcuSqlite3ChangedTable>		tables;
+};
+
+class IcuSqlite3ChangeListener
+{
+public:
+	virtual ~IcuSqlite3ChangeListener() {}
+
+	//
+	//	Called on the stream's consumer thread, one batch at a time in
+	//	commit order. |batch| is only valid for the call.
+	//
+	virtual void OnChanges(const IcuSqlite3ChangeBatch& batch) = 0;
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ChangeStreamOptions
+{
+	IcuSqlite3ChangeStreamOptions();
+
+	int			queueBatches;			//	committed batches that may wait for the consumer
+	int			maxChangesPerBatch;		//	rows recorded per transaction (buffer preallocated)
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ChangeStreamMetrics
+{
+	IcuSqlite3ChangeStreamMetrics();
+
+	int64_t		batches;				//	published
+	int64_t		changes;				//	rows recorded in published batches
+	int64_t		truncatedBatches;
+	int64_t		droppedBatches;			//	committed while the queue was full
+	int64_t		queuedBatches;			//	waiting for the consumer now
+};
+
+enum EIcuSqlite3Synchronous {
+	ICUSQLITE_SYNCHRONOUS_OFF		= 0,
+	ICUSQLITE_SYNCHRONOUS_NORMAL	= 1,
+	ICUSQLITE_SYNCHRONOUS_FULL		= 2,
+	ICUSQLITE_SYNCHRONOUS_EXTRA		= 3,
+};
+
+enum EIcuSqlite3TempStore {
+	ICUSQLITE_TEMP_STORE_DEFAULT	= 0,
+	ICUSQLITE_TEMP_STORE_FILE		= 1,
+	ICUSQLITE_TEMP_STORE_MEMORY		= 2,
+};
+
+enum EIcuSqlite3LockingMode {
+	ICUSQLITE_LOCKING_MODE_NORMAL		= 0,
+	ICUSQLITE_LOCKING_MODE_EXCLUSIVE	= 1,
+};
+
+//
+//	User function registration flags. Flags the linked SQLite predates
+//	are ignored.
+//
+enum EIcuSqlite3FunctionFlags {
+	ICUSQLITE_FUNCTION_NONE				= 0x00000000,
+	ICUSQLITE_FUNCTION_DETERMINISTIC	= 0x00000001,	//	same args, same result: constant calls are factored out, usable in indexes on expressions (3.8.3+)
+	ICUSQLITE_FUNCTION_DIRECTONLY		= 0x00000002,	//	only callable from top level SQL, never from triggers / views / schema (3.31+)
+	ICUSQLITE_FUNCTION_INNOCUOUS		= 0x00000004,	//	no side effects, may be used by the schema of an untrusted database (3.31+)
+};
+
+//
+//	Authorizer action codes (SQLITE_CREATE_INDEX, etc.)
+//
+enum EIcuSqlite3AuthAction {
+	ICUSQLITE_AUTH_COPY					= 0,
+	ICUSQLITE_AUTH_CREATE_INDEX			= 1,
+	ICUSQLITE_AUTH_CREATE_TABLE			= 2,
+	ICUSQLITE_AUTH_CREATE_TEMP_INDEX	= 3,
+	ICUSQLITE_AUTH_CREATE_TEMP_TABLE	= 4,
+	ICUSQLITE_AUTH_CREATE_TEMP_TRIGGER	= 5,
+	ICUSQLITE_AUTH_CREATE_TEMP_VIEW		= 6,
+	ICUSQLITE_AUTH_CREATE_TRIGGER		= 7,
+	ICUSQLITE_AUTH_CREATE_VIEW			= 8,
+	ICUSQLITE_AUTH_DELETE				= 9,
+	ICUSQLITE_AUTH_DROP_INDEX			= 10,
+	ICUSQLITE_AUTH_DROP_TABLE			= 11,
+	ICUSQLITE_AUTH_DROP_TEMP_INDEX		= 12,
+	ICUSQLITE_AUTH_DROP_TEMP_TABLE		= 13,
+	ICUSQLITE_AUTH_DROP_TEMP_TRIGGER	= 14,
+	ICUSQLITE_AUTH_DROP_TEMP_VIEW		= 15,
+	ICUSQLITE_AUTH_DROP_TRIGGER			= 16,
+	ICUSQLITE_AUTH_DROP_VIEW			= 17,
+	ICUSQLITE_AUTH_INSERT				= 18,
+	ICUSQLITE_AUTH_PRAGMA				= 19,
+	ICUSQLITE_AUTH_READ					= 20,
+	ICUSQLITE_AUTH_SELECT				= 21,
+	ICUSQLITE_AUTH_TRANSACTION			= 22,
+	ICUSQLITE_AUTH_UPDATE				= 23,
+	ICUSQLITE_AUTH_ATTACH				= 24,
+	ICUSQLITE_AUTH_DETACH				= 25,
+	ICUSQLITE_AUTH_ALTER_TABLE			= 26,
+	ICUSQLITE_AUTH_REINDEX				= 27,
+	ICUSQLITE_AUTH_ANALYZE				= 28,
+	ICUSQLITE_AUTH_CREATE_VTABLE		= 29,
+	ICUSQLITE_AUTH_DROP_VTABLE			= 30,
+	ICUSQLITE_AUTH_FUNCTION				= 31,
+	ICUSQLITE_AUTH_SAVEPOINT			= 32,
+	ICUSQLITE_AUTH_RECURSIVE			= 33,
+};
+
+enum EIcuSqlite3AuthResult {
+	ICUSQLITE_AUTH_OK		= 0,	//	allow
+	ICUSQLITE_AUTH_DENY		= 1,	//	fail the prepare with SQLITE_AUTH
+	ICUSQLITE_AUTH_IGNORE	= 2,	//	READ: column reads as NULL; DELETE: truncate optimization off; else skip
+};
+
+//
+//	Trace events (SQLITE_TRACE_STMT, etc.)
+//
+enum EIcuSqlite3TraceEvent {
+	ICUSQLITE_TRACE_STMT	= 0x01,	//	p: statement, x: SQL text (UTF-8)
+	ICUSQLITE_TRACE_PROFILE	= 0x02,	//	p: statement, x: int64_t* nanoseconds
+	ICUSQLITE_TRACE_ROW		= 0x04,	//	p: statement
+	ICUSQLITE_TRACE_CLOSE	= 0x08,	//	p: connection
+};
+
+//
+//	Marks an IcuSqlite3OpenProfile member that should be left at
+//	SQLite's (compile time) default
+//
+const int64_t ICUSQLITE_PRAGMA_UNSET	= U_INT64_MIN;
+
+//
+//	A bundle of tuning PRAGMAs. See IcuSqlite3Database::SetOpenProfile()
+//	and IcuSqlite3Database::ApplyOpenProfile().
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3OpenProfile
+{
+	IcuSqlite3OpenProfile();
+
+	//
+	//	Built in profiles
+	//
+	static IcuSqlite3OpenProfile BulkLoad();			//	throughput over durability
+	static IcuSqlite3OpenProfile OLTP();				//	small, frequent transactions (pair with WAL)
+	static IcuSqlite3OpenProfile ReadMostlyAnalytics();	//	large scans, rare writes
+
+	bool IsEmpty() const;
+
+	int64_t	synchronous;		//	EIcuSqlite3Synchronous
+	int64_t	cacheSize;			//	> 0 pages, < 0 KiB
+	int64_t	tempStore;			//	EIcuSqlite3TempStore
+	int64_t	mmapSize;			//	bytes
+	int64_t	pageSize;			//	bytes; only applies to a new (empty) database
+	int64_t	walAutoCheckpoint;	//	pages, 0 disables
+	int64_t	lockingMode;		//	EIcuSqlite3LockingMode
+	int64_t	journalSizeLimit;	//	bytes, -1 for no limit
+};
+
+//
+//	Time spent converting strings between UTF-16 (the API) and UTF-8 (SQLite
+//	storage, file names, ...). Only collected when built with
+//	ICUSQLITE_TRANSCODE_STATS=1, as the timing itself isn't free.
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3TranscodeStats
+{
+	IcuSqlite3TranscodeStats();
+
+	int64_t	toUtf8Calls;
+	int64_t	toUtf8Units;		//	UTF-16 code units converted
+	int64_t	toUtf16Calls;
+	int64_t	toUtf16Bytes;		//	UTF-8 bytes converted
+	int64_t	nanoseconds;		//	both directions
 };
 
 class ICUSQLITE_DLLIMPEXP IcuSqlite3StatementBuffer
@@ -158,11 +546,37 @@ private:
 	char*	m_buffer;
 };
 
+//
+//	Non owning views of an argument SQLite holds; valid until the function
+//	returns or the same argument is read as another type. A NULL argument
+//	gives data == nullptr.
+//
+struct IcuSqlite3Utf8View
+{
+	const char*		data;
+	int				length;		//	bytes
+
+	bool IsNull() const { return nullptr == data; }
+};
+
+//
+//	A zero-length blob has no data either; only |null| tells it from NULL
+//
+struct IcuSqlite3BlobView
+{
+	const unsigned char*	data;
+	int						length;
+	bool					null;
+
+	bool IsNull() const { return null; }
+};
+
 class ICUSQLITE_DLLIMPEXP IcuSqlite3FunctionContext
 {
 public:
 	//IcuSqlite3FunctionContext(sqlite3_context* pContext, int argCount, sqlite3_value** ppArgs);
-	IcuSqlite3FunctionContext(void* ctxt, int argCount, void** args);
+	IcuSqlite3FunctionContext(void* ctxt, int argCount, void** args,
+		const bool utf16 = false);
 	int GetArgCount() const;
 	const unsigned char* GetAsBlob(const unsigned int n, int& len);
 	UnicodeString GetArgAsUnicodeString(const unsigned int n);
@@ -176,10 +590,67 @@ public:
 	void SetResult(int64_t i);
 	void SetResult(double d);
 	void SetNullResult();
+
+	//
+	//	Zero copy arguments. The alias is a read-only UnicodeString over
+	//	SQLite's UTF-16 text (converted in place by SQLite if the function
+	//	was registered as UTF-8); copy it to keep it past the call.
+	//
+	IcuSqlite3Utf8View GetArgAsUtf8(const unsigned int n);
+	IcuSqlite3BlobView GetArgAsBlobView(const unsigned int n);
+	bool GetArgAsUnicodeStringAlias(const unsigned int n, UnicodeString& alias);	//	false if NULL
+
+	//
+	//	Results SQLite takes ownership of rather than copying. Buffers come
+	//	from AllocResult() / ResizeResult() and are released by SQLite (also
+	//	if setting the result fails). Static results must outlive the
+	//	statement.
+	//
+	void* AllocResult(const size_t bytes);
+	void* ResizeResult(void* buffer, const size_t bytes);
+	void SetOwnedResult(char* utf8, const size_t length);
+	void SetOwnedBlobResult(void* blob, const size_t length);
+	void SetStaticResult(const char* utf8, const int length = -1);
+
+	//
+	//	Aggregate / window functions: memory private to the group (or
+	//	window partition) being computed, zeroed on first use and freed by
+	//	SQLite after Finalize(). |bytes| = 0 returns nullptr if nothing was
+	//	allocated yet.
+	//
+	void* GetAggregateContext(const int bytes);
+
+	//
+	//	Per group C++ state: constructed by the first call in a group;
+	//	release it from Finalize().
+	//
+	template<typename T>
+	T* GetAggregateState()
+	{
+		T** state = static_cast<T**>(GetAggregateContext(sizeof(T*)));
+		if(nullptr == state) {
+			return nullptr;	//	out of memory
+		}
+		if(nullptr == *state) {
+			*state = new T();
+		}
+		return *state;
+	}
+
+	template<typename T>
+	void ReleaseAggregateState()
+	{
+		T** state = static_cast<T**>(GetAggregateContext(0));
+		if(nullptr != state) {
+			delete *state;
+			*state = nullptr;
+		}
+	}
 private:
 	void*			m_ctxt;
 	int				m_argCount;
 	void**			m_args;
+	bool			m_utf16;		//	function registered as native UTF-16
 };
 
 class IcuSqlite3ScalarFunction
@@ -190,6 +661,11 @@ public:
 	virtual void Scalar(IcuSqlite3FunctionContext* pContext) = 0;
 };
 
+//
+//	One instance serves every group of every statement using the function,
+//	so running state belongs in pContext->GetAggregateState<>() (or
+//	GetAggregateContext()), not in members.
+//
 class IcuSqlite3AggregateFunction
 {
 public:
@@ -199,9 +675,239 @@ public:
 	virtual void Finalize(IcuSqlite3FunctionContext* pContext) = 0;
 };
 
-//	:TODO: IcuSqlite3Authorizer
-//	:TODO: IcuSqlite3Hook
-//	:TODO: IcuSqlite3Collation
+//
+//	Aggregate usable as a window function (SQLite 3.25+). As the frame
+//	slides SQLite calls Step() for rows entering it, Inverse() for rows
+//	leaving it and Value() for the current result, so each row costs
+//	O(1) rather than recomputing the frame. Finalize() sets the last
+//	result and releases the state.
+//
+class IcuSqlite3WindowFunction : public IcuSqlite3AggregateFunction
+{
+public:
+	virtual void Value(IcuSqlite3FunctionContext* pContext) = 0;
+	virtual void Inverse(IcuSqlite3FunctionContext* pContext) = 0;
+};
+
+//
+//	Plain (non virtual) sqlite3_value / sqlite3_context access used by the
+//	IcuSqlite3Database::CreateFunction<>() trampolines, which are compiled
+//	into the caller and can't see sqlite3.h.
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3FunctionCall
+{
+	static void* GetUserData(void* ctxt);
+
+	static int32_t GetInt(void* value);
+	static int64_t GetInt64(void* value);
+	static double GetDouble(void* value);
+	static const char* GetText(void* value, int& len);	//	UTF-8, nullptr for NULL
+	static const unsigned char* GetBlob(void* value, int& len);
+	static bool IsNull(void* value);
+	static UnicodeString GetUnicodeString(void* value, const bool utf16);
+
+	static void SetResult(void* ctxt, const int32_t i, const bool utf16);
+	static void SetResult(void* ctxt, const int64_t i, const bool utf16);
+	static void SetResult(void* ctxt, const double d, const bool utf16);
+	static void SetResult(void* ctxt, const bool b, const bool utf16);
+	static void SetResult(void* ctxt, const char* str, const bool utf16);	//	nullptr = NULL
+	static void SetResult(void* ctxt, const std::string& str, const bool utf16);
+	static void SetResult(void* ctxt, const UnicodeString& str, const bool utf16);
+
+	//
+	//	Every other integer type (long long, size_t, ...); unsigned values
+	//	past int64_t's range become REAL
+	//
+	template<typename T>
+	static typename std::enable_if<std::is_integral<T>::value>::type SetResult(
+		void* ctxt, const T i, const bool utf16)
+	{
+		if(std::is_unsigned<T>::value && 0 != (static_cast<uint64_t>(i) >> 63)) {
+			SetResult(ctxt, static_cast<double>(i), utf16);
+		} else {
+			SetResult(ctxt, static_cast<int64_t>(i), utf16);
+		}
+	}
+};
+
+//
+//	Argument conversions for CreateFunction<>(): integers of any type,
+//	double, bool, const char* (UTF-8 owned by SQLite, valid for the call;
+//	nullptr for NULL), IcuSqlite3Utf8View, IcuSqlite3BlobView, std::string
+//	and UnicodeString. The UTF-8 ones (const char*, IcuSqlite3Utf8View,
+//	std::string) read sqlite3_value_text(), so on a UTF-16 database SQLite
+//	converts (and allocates) the text first. UnicodeString reads the
+//	database's own encoding and converts only on UTF-8 databases. The
+//	std::string and UnicodeString copies always allocate.
+//
+template<typename T, typename Enable = void> struct IcuSqlite3FunctionArg;
+
+//
+//	Integer types other than int32_t / int64_t (long long, size_t, ...)
+//	truncate the 64-bit value like a cast would
+//
+template<typename T> struct IcuSqlite3FunctionArg<T, 
+	typename std::enable_if<std::is_integral<T>::value>::type>
+{
+	static T Get(void* value, const bool) { return static_cast<T>(IcuSqlite3FunctionCall::GetInt64(value)); }
+};
+
+template<> struct IcuSqlite3FunctionArg<int32_t>
+{
+	static int32_t Get(void* value, const bool) { return IcuSqlite3FunctionCall::GetInt(value); }
+};
+
+template<> struct IcuSqlite3FunctionArg<int64_t>
+{
+	static int64_t Get(void* value, const bool) { return IcuSqlite3FunctionCall::GetInt64(value); }
+};
+
+template<> struct IcuSqlite3FunctionArg<double>
+{
+	static double Get(void* value, const bool) { return IcuSqlite3FunctionCall::GetDouble(value); }
+};
+
+template<> struct IcuSqlite3FunctionArg<bool>
+{
+	static bool Get(void* value, const bool) { return 0 != IcuSqlite3FunctionCall::GetInt64(value); }
+};
+
+template<> struct IcuSqlite3FunctionArg<const char*>
+{
+	static const char* Get(void* value, const bool)
+	{
+		int len;
+		return IcuSqlite3FunctionCall::GetText(value, len);
+	}
+};
+
+template<> struct IcuSqlite3FunctionArg<std::string>
+{
+	static std::string Get(void* value, const bool)
+	{
+		int len;
+		const char* text = IcuSqlite3FunctionCall::GetText(value, len);
+		return (nullptr != text) ? std::string(text, len) : std::string();
+	}
+};
+
+template<> struct IcuSqlite3FunctionArg<IcuSqlite3Utf8View>
+{
+	static IcuSqlite3Utf8View Get(void* value, const bool)
+	{
+		IcuSqlite3Utf8View view;
+		view.data = IcuSqlite3FunctionCall::GetText(value, view.length);
+		return view;
+	}
+};
+
+template<> struct IcuSqlite3FunctionArg<IcuSqlite3BlobView>
+{
+	static IcuSqlite3BlobView Get(void* value, const bool)
+	{
+		IcuSqlite3BlobView view;
+		view.data = IcuSqlite3FunctionCall::GetBlob(value, view.length);
+		view.null = IcuSqlite3FunctionCall::IsNull(value);
+		return view;
+	}
+};
+
+template<> struct IcuSqlite3FunctionArg<UnicodeString>
+{
+	static UnicodeString Get(void* value, const bool utf16)
+	{
+		return IcuSqlite3FunctionCall::GetUnicodeString(value, utf16);
+	}
+};
+
+template<int...> struct IcuSqlite3ArgIndices {};
+
+template<int N, int... I> struct IcuSqlite3MakeArgIndices
+	: IcuSqlite3MakeArgIndices<N - 1, N - 1, I...> {};
+
+template<int... I> struct IcuSqlite3MakeArgIndices<0, I...>
+{
+	typedef IcuSqlite3ArgIndices<I...> Type;
+};
+
+template<typename R> struct IcuSqlite3FunctionInvoker
+{
+	template<typename F, typename... A>
+	static void Invoke(void* ctxt, const bool utf16, F& func, A&&... args)
+	{
+		IcuSqlite3FunctionCall::SetResult(ctxt, func(std::forward<A>(args)...), utf16);
+	}
+};
+
+template<> struct IcuSqlite3FunctionInvoker<void>
+{
+	template<typename F, typename... A>
+	static void Invoke(void*, const bool, F& func, A&&... args)
+	{
+		func(std::forward<A>(args)...);	//	result stays NULL
+	}
+};
+
+template<typename Signature> struct IcuSqlite3FunctionBinder;
+
+template<typename R, typename... Args>
+struct IcuSqlite3FunctionBinder<R(Args...)>
+{
+	enum { ARITY = sizeof...(Args) };
+
+	template<typename F, bool UTF16>
+	static void Call(void* ctxt, int /*argCount*/, void** args)
+	{
+		F& func = *static_cast<F*>(IcuSqlite3FunctionCall::GetUserData(ctxt));
+		Unpack<F, UTF16>(ctxt, func, args,
+			typename IcuSqlite3MakeArgIndices<sizeof...(Args)>::Type());
+	}
+
+	template<typename F>
+	static void Destroy(void* userData)
+	{
+		delete static_cast<F*>(userData);
+	}
+
+private:
+	template<typename F, bool UTF16, int... I>
+	static void Unpack(void* ctxt, F& func, void** args, IcuSqlite3ArgIndices<I...>)
+	{
+		(void)args;	//	unused for nullary functions
+		IcuSqlite3FunctionInvoker<R>::Invoke(ctxt, UTF16, func,
+			IcuSqlite3FunctionArg<typename std::decay<Args>::type>::Get(args[I], UTF16)...);
+	}
+};
+
+//
+//	Consulted while statements are prepared (not per row), so it adds no
+//	cost to execution. Arguments are UTF-8 and may be nullptr; see
+//	http://www.sqlite.org/c3ref/c_alter_table.html for what each action
+//	passes.
+//
+class IcuSqlite3Authorizer
+{
+public:
+	virtual ~IcuSqlite3Authorizer() {}
+
+	virtual EIcuSqlite3AuthResult Authorize(const EIcuSqlite3AuthAction action,
+		const char* arg1, const char* arg2, const char* dbName,
+		const char* triggerOrView) = 0;
+};
+
+//
+//	Statement tracing; see http://www.sqlite.org/c3ref/c_trace.html.
+//	Install it with IcuSqlite3Database::SetTracer(), not on the raw
+//	handle: admission control shares the connection's trace hook and
+//	forwards the events asked for.
+//
+class IcuSqlite3Tracer
+{
+public:
+	virtual ~IcuSqlite3Tracer() {}
+
+	virtual void Trace(const EIcuSqlite3TraceEvent event, void* p, void* x) = 0;
+};
 
 class ICUSQLITE_DLLIMPEXP IcuSqlite3ResultSet
 {
@@ -210,7 +916,7 @@ public:
 	IcuSqlite3ResultSet(const IcuSqlite3ResultSet& resultSet);
 	
 	IcuSqlite3ResultSet(void* db, void* stmt, bool eof, bool first = true,
-		bool ownStmt = true);
+		bool ownStmt = true, bool utf16 = false);
 		
 	IcuSqlite3ResultSet& operator=(const IcuSqlite3ResultSet& resultSet);
 	
@@ -271,6 +977,7 @@ private:
 	bool				m_first;
 	int					m_cols;
 	bool				m_ownStmt;
+	bool				m_utf16;		//	database stores native UTF-16
 	ICUSQLite3Utility*	m_util;
 };
 
@@ -369,7 +1076,7 @@ public:
 	IcuSqlite3Statement();
 	IcuSqlite3Statement(const IcuSqlite3Statement& stmt);
 	IcuSqlite3Statement& operator=(const IcuSqlite3Statement& stmt);
-	IcuSqlite3Statement(void* db, void* stmt);
+	IcuSqlite3Statement(void* db, void* stmt, const bool utf16 = false);
 	
 	virtual ~IcuSqlite3Statement();
 	
@@ -418,11 +1125,46 @@ public:
 private:
 	void*				m_db;
 	void*				m_stmt;
+	bool				m_utf16;		//	database stores native UTF-16
 	ICUSQLite3Utility*	m_util;
+
+	friend class IcuSqlite3PrefetchResultSet;
 };
 
 //	:TODO: IcuSqlite3Blob
 
+class IcuSqlite3CheckpointScheduler;
+class IcuSqlite3CollatorPool;
+class IcuSqlite3AdmissionController;
+class IcuSqlite3ChangeStream;
+class IcuSqlite3BusyHandler;
+class IcuSqlite3ControlStatements;
+class IcuSqlite3SchemaCatalog;
+class IcuSqlite3ResultCache;
+class IcuSqlite3PrefetchResultSet;
+class IcuSqlite3BackupJob;
+
+//
+//	Threading:
+//
+//	ICUSQLITE_THREADING_SERIALIZED (the default) opens with FULLMUTEX. Any
+//	thread may use the connection; SQLite serializes API calls and the
+//	wrapper guards its own state (lazily created helpers, policies,
+//	hooks, savepoint depth, metrics) with the same connection mutex.
+//
+//	ICUSQLITE_THREADING_SINGLE_OWNER opens with NOMUTEX: no locking at all,
+//	in SQLite or here. The thread that opened the connection owns it;
+//	ownership can be handed to another thread with ReleaseOwnership() /
+//	AcquireOwnership(). Debug builds assert that calls come from the
+//	owner. Objects that drive the connection from their own thread
+//	(IcuSqlite3BackupJob::RunAsync()) refuse single owner connections.
+//
+//	Opening with ICUSQLITE_OPEN_NOMUTEX selects single owner mode for that
+//	connection; Close() goes back to the mode set with SetThreadingMode().
+//
+//	Copies take the settings (threading mode, busy policy, open profile)
+//	but never the connection; a copy starts out closed.
+//
 class ICUSQLITE_DLLIMPEXP IcuSqlite3Database
 {
 public:
@@ -439,6 +1181,21 @@ public:
 		const int keyLen = 0);
 	
 	bool IsOpen() const { return (nullptr != m_db); }
+	bool IsReadOnly(const char* dbName = "main") const;
+
+	//
+	//	Takes effect at the next Open()
+	//
+	bool SetThreadingMode(const EIcuSqlite3ThreadingMode mode);
+	EIcuSqlite3ThreadingMode GetThreadingMode() const { return m_threadingMode; }
+
+	//
+	//	Single owner mode only (always true / no-ops when serialized).
+	//	AcquireOwnership() fails while another thread owns the connection.
+	//
+	bool AcquireOwnership();
+	void ReleaseOwnership();
+	bool IsOwnedByCurrentThread() const;
 
 	void Close();
 	
@@ -463,12 +1220,43 @@ public:
 	bool Rollback(const UnicodeString& savepointName = "");
 	
 	bool IsAutoCommitMode() const;
+
+	//
+	//	Run |work| (callable as bool(IcuSqlite3Database&)) in a write
+	//	transaction, committing if it returns true. When it, its BEGIN or
+	//	the COMMIT fails with a BUSY / LOCKED / BUSY_SNAPSHOT code the
+	//	transaction is rolled back and |work| runs again after a backoff,
+	//	up to maxAttempts times; after a BUSY_SNAPSHOT conflict (a deferred
+	//	transaction that could not upgrade to a write) it begins IMMEDIATE
+	//	instead. |work| must therefore be safe to repeat, and it should
+	//	return false as soon as a statement fails.
+	//
+	//	Inside a transaction begun elsewhere, |work| runs once in a
+	//	savepoint; retrying is up to the owner of that transaction.
+	//
+	template<typename F>
+	bool RunInTransaction(F work, const IcuSqlite3RetryPolicy& policy = IcuSqlite3RetryPolicy());
+
+	bool GetRetryMetrics(IcuSqlite3RetryMetrics& metrics) const;
+	void ResetRetryMetrics();
+
+	static EIcuSqlite3ErrorClass ClassifyError(const int extendedCode);
 	
 	bool Savepoint(const UnicodeString& savepointName);
 	bool ReleaseSavepoint(const UnicodeString& savepointName);
 	
+	//
+	//	Schema lookups are answered from a per connection catalog, reloaded
+	//	for a database only when its PRAGMA schema_version changes. Names
+	//	match case-insensitively (ASCII); an empty dbName means "main".
+	//
 	bool TableExists(const UnicodeString& tableName, const UnicodeString& dbName = "") const;
 	bool TableExists(const char* tableName, const char* dbName = nullptr) const;
+	bool IndexExists(const UnicodeString& indexName, const UnicodeString& dbName = "") const;
+	bool ColumnExists(const UnicodeString& tableName, const UnicodeString& columnName,
+		const UnicodeString& dbName = "") const;
+	bool GetColumnNames(const UnicodeString& tableName, std::vector<std::string>& columnNames,
+		const UnicodeString& dbName = "") const;
 	
 	//	:TODO: TableExists(name, std::set<UnicodeString>& dbNames)
 	
@@ -525,16 +1313,139 @@ public:
 	//	:TODO: GetBlob();
 	
 	void Interrupt();
+
+	//
+	//	Lock waits go through a backoff busy handler (IcuSqlite3BusyPolicy)
+	//	that keeps IcuSqlite3BusyMetrics. SetBusyTimeout() only changes the
+	//	policy's timeoutMs; as with sqlite3_busy_timeout() a negative |ms|
+	//	means don't wait (SetBusyPolicy() with timeoutMs < 0 waits forever).
+	//	Both persist across Close() / Open().
+	//
 	bool SetBusyTimeout(const int ms);
+	int GetBusyTimeout() const { return m_busyPolicy.timeoutMs; }
+	bool SetBusyPolicy(const IcuSqlite3BusyPolicy& policy);
+	const IcuSqlite3BusyPolicy& GetBusyPolicy() const { return m_busyPolicy; }
+	bool GetBusyMetrics(IcuSqlite3BusyMetrics& metrics) const;
+	void ResetBusyMetrics();
+
+	//
+	//	mmap_size used for memory-mapped page reads. Applied by Open() to
+	//	read-only connections; takes effect immediately if already open.
+	//
+	bool SetMmapSize(const int64_t bytes);
+	int64_t GetMmapSize() const { return m_mmapSize; }
+
+	//
+	//	Profile applied by Open(), together with the PRAGMAs implied by
+	//	extFlags, in a single batch. Open() fails if an effective value
+	//	does not match the profile.
+	//
+	void SetOpenProfile(const IcuSqlite3OpenProfile& profile) { m_openProfile = profile; }
+	const IcuSqlite3OpenProfile& GetOpenProfile() const { return m_openProfile; }
+
+	//
+	//	Apply |profile| to an open connection. Returns false if the batch
+	//	fails or any value did not take; |effective| (optional) receives
+	//	the values SQLite reports after the batch. A failed apply may leave
+	//	part of the profile in effect.
+	//
+	bool ApplyOpenProfile(const IcuSqlite3OpenProfile& profile,
+		IcuSqlite3OpenProfile* effective = nullptr);
 	
+	//
+	//	|flags| is a combination of EIcuSqlite3FunctionFlags
+	//
 	bool CreateScalarFunction(const char* funcName, const int args, 
-		IcuSqlite3ScalarFunction* func);
+		IcuSqlite3ScalarFunction* func, const int flags = ICUSQLITE_FUNCTION_NONE);
 	bool CreateAggregateFunction(const char* funcName, const int args, 
-		IcuSqlite3AggregateFunction* func);
+		IcuSqlite3AggregateFunction* func, const int flags = ICUSQLITE_FUNCTION_NONE);
+	bool CreateWindowFunction(const char* funcName, const int args,
+		IcuSqlite3WindowFunction* func, const int flags = ICUSQLITE_FUNCTION_NONE);
 
-	//	:TODO: SetAuthorizer()
-	//	:TODO: SetHook(hookFunc, type)
-	//	:TODO: SetCollation()
+	//
+	//	Typed scalar function. Arguments are unpacked straight from the
+	//	sqlite3_value array into |func|'s parameters and its return value
+	//	set as the result, with no IcuSqlite3FunctionContext or virtual
+	//	call in between. See IcuSqlite3FunctionArg for the parameter types;
+	//	results may be any of them (or void for NULL).
+	//
+	//		db.CreateFunction<int64_t(int64_t, int64_t)>("add",
+	//			[](int64_t a, int64_t b) { return a + b; },
+	//			ICUSQLITE_FUNCTION_DETERMINISTIC | ICUSQLITE_FUNCTION_INNOCUOUS);
+	//
+	template<typename Signature, typename F>
+	bool CreateFunction(const char* funcName, F func, const int flags = ICUSQLITE_FUNCTION_NONE)
+	{
+		typedef IcuSqlite3FunctionBinder<Signature> Binder;
+		return RegisterFunction(funcName, Binder::ARITY, flags, new F(func),
+			&Binder::template Call<F, false>, &Binder::template Call<F, true>,
+			&Binder::template Destroy<F>);
+	}
+
+	//
+	//	Locale aware collation: ORDER BY x COLLATE name. Comparisons run
+	//	on the stored text directly (Collator::compareUTF8() on UTF-8
+	//	databases). Every open connection also has SORTKEY(text, locale
+	//	[, strength]), which returns the binary sort key of an ICU collator
+	//	on that locale ('primary' ... 'identical', default 'tertiary') for
+	//	indexing large tables:
+	//
+	//		CREATE INDEX byName ON people(SORTKEY(name, 'de'));
+	//		SELECT * FROM people ORDER BY SORTKEY(name, 'de');
+	//
+	//	SORTKEY() takes a locale, not a collation name, so the key only
+	//	depends on its arguments and is safe in indexes.
+	//
+	//	Collators are created once per locale / strength per connection.
+	//	SORTKEY() creates at most 16 collators of its own; after that it
+	//	raises an SQL error for any locale / strength not yet in use.
+	//
+	bool CreateCollation(const char* name, const Locale& locale,
+		const Collator::ECollationStrength strength = Collator::TERTIARY);
+
+	//
+	//	Takes ownership of |authorizer|; nullptr removes it. Already
+	//	prepared statements are not re-checked.
+	//
+	bool SetAuthorizer(IcuSqlite3Authorizer* authorizer);
+
+	//
+	//	Takes ownership of |tracer|, which gets the EIcuSqlite3TraceEvent
+	//	events in |mask|; nullptr removes it
+	//
+	bool SetTracer(IcuSqlite3Tracer* tracer, const unsigned mask);
+
+	//
+	//	Statement admission control: statements exceeding the policy's
+	//	VM step budget or deadline are interrupted, and reported by
+	//	GetAdmissionMetrics(). Nothing is installed (so nothing is paid)
+	//	unless a limit is set; ClearAdmissionPolicy() removes it again.
+	//
+	bool SetAdmissionPolicy(const IcuSqlite3AdmissionPolicy& policy);
+	void ClearAdmissionPolicy();
+	bool GetAdmissionMetrics(IcuSqlite3AdmissionMetrics& metrics) const;
+
+	//
+	//	Change data capture. Row changes are collected per transaction
+	//	(update / preupdate hook) and published once the commit has gone
+	//	through, via a lock-free queue to a consumer thread calling
+	//	|listener|, which must outlive the stream. Rolled back transactions
+	//	and savepoints (ROLLBACK TO) are discarded; a COMMIT that fails
+	//	(SQLITE_BUSY) publishes nothing, and its retry the whole batch. The
+	//	committing thread never waits on the consumer: if the queue is full
+	//	the batch is dropped and the next one flagged lostBefore.
+	//
+	//	Rows a failing statement undoes itself (its statement rollback) are
+	//	still reported. Takes over the connection's update, commit and
+	//	rollback hooks until stopped, and follows the statement trace next
+	//	to any SetTracer() tracer; fails while an IcuSqlite3ResultCache is
+	//	attached.
+	//
+	bool StartChangeStream(IcuSqlite3ChangeListener* listener,
+		const IcuSqlite3ChangeStreamOptions& options = IcuSqlite3ChangeStreamOptions());
+	void StopChangeStream();	//	delivers queued batches first
+	bool IsChangeStreamRunning() const { return nullptr != m_changeStream.get(); }
+	bool GetChangeStreamMetrics(IcuSqlite3ChangeStreamMetrics& metrics) const;
 	
 	void GetMetaData(const UnicodeString& dbName, 
 		const UnicodeString& tableName, const UnicodeString& colName,
@@ -550,6 +1461,14 @@ public:
 	bool ReKey(const unsigned char* keyBuf, const int keyLen);
 	
 	bool IsEncrypted() const { return m_encrypted; }
+
+	//
+	//	True if the database text encoding is UTF-16 in host byte order.
+	//	Column access and user functions then use SQLite's UTF-16 entry
+	//	points, otherwise its UTF-8 ones, so SQLite never converts (and
+	//	caches) a second copy of each value. Detected at Open().
+	//
+	bool IsUtf16() const { return m_utf16; }
 	
 	//	:TODO: static GetLimitName(id)
 	UnicodeString GetDatabaseFileName(const UnicodeString& dbName) const;
@@ -570,6 +1489,11 @@ public:
 	static bool ShutdownSQLite();
 	static bool Randomness(unsigned char* randBuf, const int bufLen);
 	static bool EnableSharedCache(const bool enable);
+
+	//
+	//	Connections open right now, per threading mode
+	//
+	static int GetOpenConnectionCount(const EIcuSqlite3ThreadingMode mode);
 	
 	static bool IsSharedCacheEnabled()
 	{ 
@@ -583,6 +1507,9 @@ public:
 	static UnicodeString GetVersion();
 	static UnicodeString GetSourceId();
 	static bool HasSupport(const EIcuSqlite3SupportFlags supportFor);
+
+	static bool GetTranscodeStats(IcuSqlite3TranscodeStats& stats);	//	false if not collected
+	static void ResetTranscodeStats();
 	
 //	static bool Config(const EIcuSqlite3Config configOpt, ...);
 	
@@ -593,35 +1520,127 @@ public:
 	int RecoverMemory();
 
 	bool WALCheckpoint(
-		const char* dbName = nullptr, const EIcuSqlite3WALCheckpoint checkpointType = ICUSQLITE_WAL_CHECKPOINT_PASSIVE) const;
+		const char* dbName = nullptr, const EIcuSqlite3WALCheckpoint checkpointType = ICUSQLITE_WAL_CHECKPOINT_PASSIVE,
+		int* logFrames = nullptr, int* checkpointedFrames = nullptr) const;
+
+	//
+	//	Background WAL checkpoints. The scheduler checkpoints "main" from
+	//	its own connection, driven by this connection's commits (it takes
+	//	over the WAL hook, replacing wal_autocheckpoint for "main" until
+	//	stopped; ATTACHed WAL databases keep the wal_autocheckpoint
+	//	behaviour). Requires WAL mode and an unencrypted, file backed
+	//	database.
+	//
+	bool StartCheckpointScheduler(
+		const IcuSqlite3CheckpointPolicy& policy = IcuSqlite3CheckpointPolicy());
+	void StopCheckpointScheduler();
+	bool IsCheckpointSchedulerRunning() const { return nullptr != m_checkpointScheduler.get(); }
+	bool GetCheckpointMetrics(IcuSqlite3CheckpointMetrics& metrics) const;
 protected:
+	friend class IcuSqlite3BackupJob;
+	friend class IcuSqlite3Exporter;
+	friend class IcuSqlite3Importer;
+	friend class IcuSqlite3Session;
+	friend class IcuSqlite3Changeset;
+	friend class IcuSqlite3BusyBudget;
+	friend class IcuSqlite3Savepoint;
+	friend class IcuSqlite3ShardExecutor;
+	friend class IcuSqlite3PrefetchResultSet;
+	friend class IcuSqlite3AsyncWorker;
+	friend class IcuSqlite3ResultCache;
+	friend struct IcuSqlite3ResultCacheState;
+
 	void* GetDatabaseHandle() const { return m_db; }
 
-	//	:TODO: collation stuffs
-	
+	//
+	//	Prepares |sql| (a sqlite3_stmt*, nullptr on failure) and reports
+	//	the (schema, table) pairs it reads - views expanded, triggers not -
+	//	and the SQL functions it calls. Any installed authorizer still has
+	//	the final say.
+	//
+	void* PrepareWithReadSet(const char* sql, const int len,
+		std::vector<std::pair<std::string, std::string> >& tables,
+		std::vector<std::string>& functions);
+
 	
 private:
 	void*			m_db;
-	int				m_busyTimeout;
+	IcuSqlite3BusyPolicy	m_busyPolicy;
+	int64_t			m_mmapSize;
 	bool			m_encrypted;
+	bool			m_utf16;
+
+	IcuSqlite3OpenProfile	m_openProfile;
+
+	std::unique_ptr<IcuSqlite3CheckpointScheduler>	m_checkpointScheduler;
+	std::unique_ptr<IcuSqlite3CollatorPool>			m_collators;
+	std::unique_ptr<IcuSqlite3Authorizer>			m_authorizer;
+	std::unique_ptr<IcuSqlite3Tracer>				m_tracer;
+	unsigned										m_traceMask;	//	events m_tracer asked for
+	std::unique_ptr<IcuSqlite3AdmissionController>	m_admission;
+	std::unique_ptr<IcuSqlite3ChangeStream>			m_changeStream;
+	std::unique_ptr<IcuSqlite3BusyHandler>			m_busyHandler;
+	std::unique_ptr<IcuSqlite3ControlStatements>	m_control;
+	mutable std::unique_ptr<IcuSqlite3SchemaCatalog>	m_catalog;	//	lazily, by const lookups
+	IcuSqlite3ResultCache*							m_resultCache;	//	attached, holds the update hook
+	std::set<IcuSqlite3PrefetchResultSet*>			m_prefetchers;	//	running; Close() stops them
+	std::set<IcuSqlite3BackupJob*>					m_backupJobs;	//	begun; Close() cancels them
+	int												m_savepointDepth;	//	open IcuSqlite3Savepoint scopes
+	IcuSqlite3RetryMetrics							m_retryMetrics;
+
+	EIcuSqlite3ThreadingMode						m_threadingMode;		//	of the open connection
+	EIcuSqlite3ThreadingMode						m_configuredThreadingMode;	//	SetThreadingMode()
+	bool											m_counted;		//	in ms_openConnections
+	std::atomic<std::thread::id>					m_owner;		//	single owner mode
 
 #if !defined(SQLITE_OMIT_SHARED_CACHE)
-	static bool		ms_sharedCacheEnabled;
+	static std::atomic<bool>	ms_sharedCacheEnabled;
 #endif	//	!defined(SQLITE_OMIT_SHARED_CACHE)
 
-	static int		ms_supportFlags;
+	static const int			ms_supportFlags;
+	static std::atomic<int>		ms_openConnections[ICUSQLITE_THREADING_MODE_COUNT];
 
 	IcuSqlite3Database(const IcuSqlite3Database& db);
 	IcuSqlite3Database& operator=(const IcuSqlite3Database& db);
+
+	bool InstallTracer();
 	
 	//	:TODO: give these better, more descriptive names:
 	static void xFunc(void* ctxt, int argCount, void** args);
 	static void xStep(void* ctxt, int argCount, void** args);
 	static void xFinalize(void* ctxt);
+	static void xFunc16(void* ctxt, int argCount, void** args);
+	static void xStep16(void* ctxt, int argCount, void** args);
+	static void xFinalize16(void* ctxt);
+	static void xValue(void* ctxt);
+	static void xValue16(void* ctxt);
+	static void xInverse(void* ctxt, int argCount, void** args);
+	static void xInverse16(void* ctxt, int argCount, void** args);
 	static void xDestroyScalar(void* userData);
 	static void xDestroyAggregate(void* userData);
 
+	bool RegisterFunction(const char* funcName, const int args, const int flags,
+		void* userData, void (*xFunc8)(void*, int, void**),
+		void (*xFunc16)(void*, int, void**), void (*xDestroy)(void*));
+
 	void* Prepare(const UChar* sql, const int32_t sqlLen = -1) const;
+	void* Prepare(const char* sql, const int32_t sqlLen = -1) const;
+
+	bool DetectEncoding();
+
+	IcuSqlite3ControlStatements* GetControlStatements();
+	IcuSqlite3SchemaCatalog* GetSchemaCatalog() const;
+	void InvalidateSchemaCatalog();
+
+	bool BeginRetryAttempt(const IcuSqlite3RetryPolicy& policy, IcuSqlite3RetryAttempt& attempt);
+	void EndRetryAttempt(const bool workOk, const IcuSqlite3RetryPolicy& policy, 
+		IcuSqlite3RetryAttempt& attempt);
+	void RetryOrFail(const int code, const IcuSqlite3RetryPolicy& policy, 
+		IcuSqlite3RetryAttempt& attempt);
+
+	bool ApplyPragmaBatch(const IcuSqlite3OpenProfile& profile,
+		const int extFlags, const bool newDatabase, 
+		IcuSqlite3OpenProfile* effective);
 };
 
 class ICUSQLITE_DLLIMPEXP IcuSqlite3Transaction
@@ -659,5 +1678,103 @@ private:
 	IcuSqlite3Transaction& operator=(const IcuSqlite3Transaction& t);	//	prevent assign
 };
 
+//
+//	A nestable transaction scope. The outermost scope on a connection in
+//	autocommit mode runs BEGIN / COMMIT; every other scope (including one
+//	opened inside a transaction begun elsewhere) is a SAVEPOINT, so a
+//	failure can be undone without losing the enclosing work:
+//
+//		IcuSqlite3Savepoint batch(&db);
+//		for(...) {
+//			IcuSqlite3Savepoint row(&db);
+//			row.Execute(insert);		//	a bad row rolls back just itself
+//		}
+//
+//	On destruction a scope commits (RELEASE) if every Execute() succeeded
+//	and commitOnDestroy is set, else rolls back. Control statements are
+//	prepared once per connection and reused. Scopes must end in reverse
+//	order of creation.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3Savepoint
+{
+public:
+	explicit IcuSqlite3Savepoint(IcuSqlite3Database* db,
+		const EIcuSqlite3TransTypes type = ICUSQLITE_TRANSACTION_DEFAULT,
+		const bool commitOnDestroy = true);
+	~IcuSqlite3Savepoint();
+
+	//
+	//	Both end the scope. Rollback() of an inner scope undoes only its
+	//	own changes.
+	//
+	bool Commit();
+	bool Rollback();
+
+	bool IsOk() const { return m_ok; }
+	bool IsOpen() const { return m_open; }
+	bool IsOutermost() const { return 0 == m_level; }
+	int GetLevel() const { return m_level; }	//	0 = BEGIN, 1... = savepoint depth
+
+	bool Execute(const UnicodeString& sql);
+	bool Execute(const char* sql);
+	bool Execute(IcuSqlite3Statement& stmt);
+
+private:
+	IcuSqlite3Database*	m_db;
+	int					m_level;
+	bool				m_ok;
+	bool				m_open;
+	const bool			m_commitOnDestroy;
+
+	void Close();
+
+	static void* operator new(size_t size);	//	this obj must be created on the stack
+	static void operator delete(void* p);
+	IcuSqlite3Savepoint(const IcuSqlite3Savepoint&);	//	prevent copy
+	IcuSqlite3Savepoint& operator=(const IcuSqlite3Savepoint&);	//	prevent assign
+};
+
+//
+//	Caps the time the connection may spend waiting on locks while this
+//	object is in scope, across all statements run meanwhile:
+//
+//		IcuSqlite3BusyBudget budget(&db, 20);	//	20ms of lock waits, then SQLITE_BUSY
+//		db.ExecuteUpdate(...);
+//
+//	Nested budgets can only shorten an outer one. Meant for the thread
+//	using the connection; it applies to the connection as a whole.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3BusyBudget
+{
+public:
+	IcuSqlite3BusyBudget(IcuSqlite3Database* db, const int ms);
+	~IcuSqlite3BusyBudget();
+
+	bool IsExhausted() const;
+
+private:
+	IcuSqlite3Database*	m_db;
+	int64_t				m_deadlineUs;
+	int64_t				m_previousUs;
+
+	static void* operator new(size_t size);	//	this obj must be created on the stack
+	static void operator delete(void* p);
+	IcuSqlite3BusyBudget(const IcuSqlite3BusyBudget&);	//	prevent copy
+	IcuSqlite3BusyBudget& operator=(const IcuSqlite3BusyBudget&);	//	prevent assign
+};
+
+template<typename F>
+bool IcuSqlite3Database::RunInTransaction(
+	F work, const IcuSqlite3RetryPolicy& policy /*= IcuSqlite3RetryPolicy()*/)
+{
+	IcuSqlite3RetryAttempt attempt;
+	while(!attempt.done) {
+		if(BeginRetryAttempt(policy, attempt)) {
+			const bool workOk = work(*this);
+			EndRetryAttempt(workOk, policy, attempt);
+		}
+	}
+	return attempt.succeeded;
+}
 
 #endif	//	!__ICU_SQLITE3_H__
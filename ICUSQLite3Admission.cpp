@@ -0,0 +1,250 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Admission.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3AdmissionPolicy / IcuSqlite3AdmissionMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3AdmissionPolicy::IcuSqlite3AdmissionPolicy()
+	: maxSteps(0)
+	, maxMs(0)
+	, checkInterval(1000)
+{
+}
+
+IcuSqlite3AdmissionMetrics::IcuSqlite3AdmissionMetrics()
+	: statements(0)
+	, stepCutoffs(0)
+	, deadlineCutoffs(0)
+	, lastCutoff(ICUSQLITE_ADMISSION_CUTOFF_NONE)
+	, lastCutoffSteps(0)
+	, lastCutoffMs(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3AdmissionController
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3AdmissionController::IcuSqlite3AdmissionController(
+	void* db, const IcuSqlite3AdmissionPolicy& policy,
+	IcuSqlite3Tracer* tracer, const unsigned traceMask)
+	: m_db(db)
+	, m_policy(policy)
+	, m_installed(false)
+	, m_tracer(tracer)
+	, m_traceMask(traceMask)
+	, m_statements(0)
+	, m_stepCutoffs(0)
+	, m_deadlineCutoffs(0)
+	, m_lastCutoff(ICUSQLITE_ADMISSION_CUTOFF_NONE)
+	, m_lastCutoffSteps(0)
+	, m_lastCutoffMs(0)
+{
+	if(m_policy.checkInterval <= 0) {
+		m_policy.checkInterval = 1000;
+	}
+}
+
+IcuSqlite3AdmissionController::~IcuSqlite3AdmissionController()
+{
+	if(m_installed) {
+		sqlite3_progress_handler((sqlite3*)m_db, 0, nullptr, nullptr);
+#if SQLITE_VERSION_NUMBER >= 3014000
+		sqlite3_trace_v2((sqlite3*)m_db, 0, nullptr, nullptr);
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+	}
+}
+
+bool IcuSqlite3AdmissionController::Install()
+{
+#if SQLITE_VERSION_NUMBER >= 3014000
+	if(SQLITE_OK != sqlite3_trace_v2((sqlite3*)m_db, GetTraceMask(),
+		TraceCallback, this))
+	{
+		return false;
+	}
+	sqlite3_progress_handler((sqlite3*)m_db, m_policy.checkInterval, 
+		ProgressCallback, this);
+	m_installed = true;
+	return true;
+#else
+	return false;	//	no way to tell where a statement starts
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+}
+
+void IcuSqlite3AdmissionController::SetTracer(
+	IcuSqlite3Tracer* tracer, const unsigned traceMask)
+{
+	m_tracer	= tracer;
+	m_traceMask	= traceMask;
+#if SQLITE_VERSION_NUMBER >= 3014000
+	if(m_installed) {
+		sqlite3_trace_v2((sqlite3*)m_db, GetTraceMask(), TraceCallback, this);
+	}
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+}
+
+void IcuSqlite3AdmissionController::GetMetrics(
+	IcuSqlite3AdmissionMetrics& metrics) const
+{
+	metrics.statements		= m_statements;
+	metrics.stepCutoffs		= m_stepCutoffs;
+	metrics.deadlineCutoffs	= m_deadlineCutoffs;
+
+	std::lock_guard<std::mutex> lock(m_lastLock);
+	metrics.lastCutoff		= m_lastCutoff;
+	metrics.lastCutoffSql	= m_lastCutoffSql;
+	metrics.lastCutoffSteps	= m_lastCutoffSteps;
+	metrics.lastCutoffMs	= m_lastCutoffMs;
+}
+
+unsigned IcuSqlite3AdmissionController::GetTraceMask() const
+{
+	return SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE | 
+		((nullptr != m_tracer) ? m_traceMask : 0);
+}
+
+/*static*/
+int IcuSqlite3AdmissionController::TraceCallback(
+	unsigned type, void* ctxt, void* p, void* x)
+{
+	IcuSqlite3AdmissionController* controller = 
+		static_cast<IcuSqlite3AdmissionController*>(ctxt);
+
+	if(SQLITE_TRACE_STMT == type) {
+		//
+		//	Trigger programs are reported as "-- TRIGGER name" against the
+		//	statement running them and are charged to it. Statements run
+		//	from a user function are "-- " prefixed too, but start a budget
+		//	of their own.
+		//
+		const char* sql = static_cast<const char*>(x);
+		if(nullptr == sql || '-' != sql[0] || '-' != sql[1] || !controller->IsActive(p)) {
+			controller->Begin(p);
+		}
+	} else if(SQLITE_TRACE_PROFILE == type) {
+		controller->End(p);
+	}
+
+	if(nullptr != controller->m_tracer && 0 != (type & controller->m_traceMask)) {
+		controller->m_tracer->Trace(static_cast<EIcuSqlite3TraceEvent>(type), p, x);
+	}
+	return 0;
+}
+
+/*static*/
+int IcuSqlite3AdmissionController::ProgressCallback(
+	void* ctxt)
+{
+	return static_cast<IcuSqlite3AdmissionController*>(ctxt)->Charge();
+}
+
+void IcuSqlite3AdmissionController::Begin(
+	void* stmt)
+{
+	End(stmt);	//	restarted without finishing (reset before its first step)
+
+	Budget budget;
+	budget.stmt		= stmt;
+	budget.steps	= 0;
+	budget.start	= Clock::now();
+	budget.cutOff	= false;
+	m_active.push_back(budget);
+	m_statements.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool IcuSqlite3AdmissionController::IsActive(
+	void* stmt) const
+{
+	for(size_t n = 0; n < m_active.size(); ++n) {
+		if(stmt == m_active[n].stmt) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void IcuSqlite3AdmissionController::End(
+	void* stmt)
+{
+	for(size_t n = m_active.size(); n > 0; --n) {
+		if(stmt == m_active[n - 1].stmt) {
+			m_active.erase(m_active.begin() + static_cast<std::ptrdiff_t>(n - 1));
+			return;
+		}
+	}
+}
+
+int IcuSqlite3AdmissionController::Charge()
+{
+	if(m_active.empty() || m_active.back().cutOff) {
+		return 0;
+	}
+
+	Budget& budget = m_active.back();
+	budget.steps += m_policy.checkInterval;
+	if(m_policy.maxSteps > 0 && budget.steps > m_policy.maxSteps) {
+		m_stepCutoffs.fetch_add(1, std::memory_order_relaxed);
+		Cutoff(budget, ICUSQLITE_ADMISSION_CUTOFF_STEPS, -1);
+		return 1;
+	}
+
+	if(m_policy.maxMs > 0) {
+		const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+			Clock::now() - budget.start).count();
+		if(ms > m_policy.maxMs) {
+			m_deadlineCutoffs.fetch_add(1, std::memory_order_relaxed);
+			Cutoff(budget, ICUSQLITE_ADMISSION_CUTOFF_DEADLINE, ms);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void IcuSqlite3AdmissionController::Cutoff(
+	Budget& budget, const EIcuSqlite3AdmissionCutoff reason, const int64_t ms)
+{
+	//	still live: SQLITE_TRACE_PROFILE ends the budget before finalize
+	const char* sql = sqlite3_sql((sqlite3_stmt*)budget.stmt);
+
+	std::lock_guard<std::mutex> lock(m_lastLock);
+	m_lastCutoff		= reason;
+	m_lastCutoffSql		= (nullptr != sql) ? sql : "";
+	m_lastCutoffSteps	= budget.steps;
+	m_lastCutoffMs		= (ms >= 0) ? ms : 
+		std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - budget.start).count();
+
+	//	the statement is finished; charge nothing else to it
+	budget.cutOff = true;
+}
@@ -0,0 +1,111 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_ADMISSION_H__
+#define __ICU_SQLITE3_ADMISSION_H__
+
+//
+//	Internal: used by IcuSqlite3Database, not part of the public API
+//
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//
+//	Owns the connection's progress handler and statement trace while an
+//	IcuSqlite3AdmissionPolicy is set. SQLITE_TRACE_STMT starts a budget
+//	(step count and clock) for each statement and SQLITE_TRACE_PROFILE
+//	ends it, so a statement run from a user function gets its own budget
+//	and the caller's resumes untouched. The progress handler charges
+//	checkInterval steps per call to the most recently started statement
+//	and stops it (non zero return -> SQLITE_INTERRUPT) once over budget.
+//
+//	Events the connection's IcuSqlite3Tracer asked for are forwarded to
+//	it; the owner reinstalls the tracer alone once this is destroyed.
+//
+class IcuSqlite3AdmissionController
+{
+public:
+	IcuSqlite3AdmissionController(void* db, const IcuSqlite3AdmissionPolicy& policy,
+		IcuSqlite3Tracer* tracer, const unsigned traceMask);
+	~IcuSqlite3AdmissionController();
+
+	bool Install();
+	void SetTracer(IcuSqlite3Tracer* tracer, const unsigned traceMask);
+
+	void GetMetrics(IcuSqlite3AdmissionMetrics& metrics) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Budget
+	{
+		void*				stmt;
+		int64_t				steps;
+		Clock::time_point	start;
+		bool				cutOff;		//	charge nothing else to it
+	};
+
+	void*							m_db;
+	IcuSqlite3AdmissionPolicy		m_policy;
+	bool							m_installed;
+	IcuSqlite3Tracer*				m_tracer;
+	unsigned						m_traceMask;
+
+	//
+	//	Connection thread only. Statements started and not yet finished,
+	//	most recent (the one charged) last.
+	//
+	std::vector<Budget>				m_active;
+
+	std::atomic<int64_t>			m_statements;
+	std::atomic<int64_t>			m_stepCutoffs;
+	std::atomic<int64_t>			m_deadlineCutoffs;
+
+	mutable std::mutex				m_lastLock;
+	EIcuSqlite3AdmissionCutoff		m_lastCutoff;
+	std::string						m_lastCutoffSql;
+	int64_t							m_lastCutoffSteps;
+	int64_t							m_lastCutoffMs;
+
+	static int TraceCallback(unsigned type, void* ctxt, void* p, void* x);
+	static int ProgressCallback(void* ctxt);
+
+	unsigned GetTraceMask() const;
+	bool IsActive(void* stmt) const;
+	void Begin(void* stmt);
+	void End(void* stmt);
+	int Charge();
+	void Cutoff(Budget& budget, const EIcuSqlite3AdmissionCutoff reason, const int64_t ms);
+
+	IcuSqlite3AdmissionController(const IcuSqlite3AdmissionController&);	//	prevent copy
+	IcuSqlite3AdmissionController& operator=(const IcuSqlite3AdmissionController&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_ADMISSION_H__
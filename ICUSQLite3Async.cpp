@@ -0,0 +1,331 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Async.h"
+#include "ICUSQLite3Internal.h"
+
+#include <assert.h>
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+static void IcuSqlite3AtomicMax(std::atomic<int64_t>& value, const int64_t candidate)
+{
+	int64_t cur = value.load();
+	while(candidate > cur && !value.compare_exchange_weak(cur, candidate)) {
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3AsyncMetrics / IcuSqlite3AsyncRows
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3AsyncMetrics::IcuSqlite3AsyncMetrics()
+	: tasks(0)
+	, queueDepth(0)
+	, maxQueueDepth(0)
+	, queueWaitUs(0)
+	, maxQueueWaitUs(0)
+	, runUs(0)
+{
+}
+
+IcuSqlite3AsyncRows::IcuSqlite3AsyncRows()
+	: rc(SQLITE_OK)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3AsyncWorker
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3AsyncWorker::IcuSqlite3AsyncWorker(
+	IcuSqlite3Database& db)
+	: m_db(db)
+	, m_running(false)
+	, m_stop(false)
+	, m_completed(0)
+	, m_maxQueueDepth(0)
+	, m_queueWaitUs(0)
+	, m_maxQueueWaitUs(0)
+	, m_runUs(0)
+{
+}
+
+IcuSqlite3AsyncWorker::~IcuSqlite3AsyncWorker()
+{
+	//
+	//	The thread runs member code until it exits, so it must be joined
+	//	here -- which it can't do itself
+	//
+	assert(!IsWorkerThread());
+	Stop();
+}
+
+bool IcuSqlite3AsyncWorker::Start()
+{
+	if(m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if(!m_stop) {
+				return m_running;
+			}
+		}
+
+		//	stopped from the worker thread; join what's left of it first
+		if(IsWorkerThread()) {
+			return false;
+		}
+		m_thread.join();
+	}
+
+	if(!m_db.IsOpen()) {
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = false;
+	}
+
+	std::promise<bool> started;
+	std::future<bool> result = started.get_future();
+	m_thread = std::thread(&IcuSqlite3AsyncWorker::Run, this, &started);
+	if(!result.get()) {
+		m_thread.join();
+		return false;
+	}
+	return true;
+}
+
+void IcuSqlite3AsyncWorker::Stop()
+{
+	if(!m_thread.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	if(IsWorkerThread()) {
+		//
+		//	Stop() from a task / inline completion; the thread winds down
+		//	once this task returns and is joined by the next Start(),
+		//	Stop() or the destructor
+		//
+		return;
+	}
+	m_thread.join();
+}
+
+bool IcuSqlite3AsyncWorker::Post(
+	Task task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if(!m_running) {
+			return false;
+		}
+
+		//
+		//	Accepted while stopping, too: Stop() drains the queue, and a
+		//	queued task may still have follow up work (Finalize() etc.)
+		//
+		QueuedTask queued;
+		queued.task		= std::move(task);
+		queued.postedUs	= IcuSqlite3NowUs();
+		m_tasks.push_back(std::move(queued));
+		IcuSqlite3AtomicMax(m_maxQueueDepth, static_cast<int64_t>(m_tasks.size()));
+	}
+	m_wake.notify_one();
+	return true;
+}
+
+void IcuSqlite3AsyncWorker::SetResumeDispatcher(
+	const Dispatcher& dispatcher)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_dispatcher = dispatcher;
+}
+
+void IcuSqlite3AsyncWorker::Dispatch(
+	std::function<void()> completion)
+{
+	Dispatcher dispatcher;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		dispatcher = m_dispatcher;
+	}
+
+	if(dispatcher) {
+		dispatcher(std::move(completion));
+	} else {
+		completion();
+	}
+}
+
+void IcuSqlite3AsyncWorker::GetMetrics(
+	IcuSqlite3AsyncMetrics& metrics) const
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		metrics.queueDepth = static_cast<int64_t>(m_tasks.size());
+	}
+	metrics.tasks			= m_completed;
+	metrics.maxQueueDepth	= m_maxQueueDepth;
+	metrics.queueWaitUs		= m_queueWaitUs;
+	metrics.maxQueueWaitUs	= m_maxQueueWaitUs;
+	metrics.runUs			= m_runUs;
+}
+
+void IcuSqlite3AsyncWorker::Run(
+	std::promise<bool>* started)
+{
+	//
+	//	A single owner connection belongs to this thread until it exits
+	//
+	if(!m_db.AcquireOwnership()) {
+		started->set_value(false);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_running = true;
+	}
+	started->set_value(true);
+
+	for(;;) {
+		QueuedTask queued;
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_wake.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+			if(m_tasks.empty()) {
+				m_running = false;	//	stopping, drained
+				break;
+			}
+			queued = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+
+		const int64_t start		= IcuSqlite3NowUs();
+		const int64_t waitUs	= start - queued.postedUs;
+		m_queueWaitUs += waitUs;
+		IcuSqlite3AtomicMax(m_maxQueueWaitUs, waitUs);
+
+		queued.task();
+
+		m_runUs += IcuSqlite3NowUs() - start;
+		++m_completed;
+	}
+
+	m_db.ReleaseOwnership();
+}
+
+void* IcuSqlite3AsyncWorker::Prepare(
+	const std::string& sql, IcuSqlite3AsyncRows& status)
+{
+	sqlite3* db			= (sqlite3*)m_db.GetDatabaseHandle();
+	sqlite3_stmt* stmt	= nullptr;
+
+	status.rows.Reset(0);
+	status.rc = SQLITE_OK;
+	status.error.clear();
+
+	if(nullptr == db) {
+		status.rc		= SQLITE_MISUSE;
+		status.error	= "database is not open";
+		return nullptr;
+	}
+
+	const int rc = sqlite3_prepare_v2(db, sql.c_str(), static_cast<int>(sql.size()), &stmt, nullptr);
+	if(SQLITE_OK != rc) {
+		status.rc		= sqlite3_extended_errcode(db);
+		status.error	= sqlite3_errmsg(db);
+		sqlite3_finalize(stmt);
+		return nullptr;
+	}
+
+	if(nullptr == stmt) {
+		status.rc		= SQLITE_MISUSE;
+		status.error	= "empty statement";
+	}
+	return stmt;
+}
+
+bool IcuSqlite3AsyncWorker::StepRows(
+	void* stmt, const int maxRows, IcuSqlite3AsyncRows& out)
+{
+	sqlite3_stmt* s	= (sqlite3_stmt*)stmt;
+	const int limit	= (maxRows > 0) ? maxRows : 1;
+
+	out.rows.Reset(sqlite3_column_count(s));		//	keeps capacity
+	out.rows.Reserve(limit);
+	out.rc = SQLITE_OK;
+	out.error.clear();
+
+	int n = 0;
+	int r = SQLITE_ROW;
+	while(n < limit && SQLITE_ROW == (r = sqlite3_step(s))) {
+		out.rows.AppendRow(stmt);
+		++n;
+	}
+
+	if(SQLITE_ROW == r) {
+		return true;
+	}
+
+	if(SQLITE_DONE != r) {
+		sqlite3* db	= sqlite3_db_handle(s);
+		out.rc		= sqlite3_extended_errcode(db);
+		out.error	= sqlite3_errmsg(db);
+	}
+	return false;
+}
+
+void IcuSqlite3AsyncWorker::Finalize(
+	void* stmt)
+{
+	if(nullptr == stmt) {
+		return;
+	}
+
+	if(IsWorkerThread() || !Post([stmt] { sqlite3_finalize((sqlite3_stmt*)stmt); })) {
+		sqlite3_finalize((sqlite3_stmt*)stmt);
+	}
+}
+
+/*static*/ void IcuSqlite3AsyncWorker::SetNotRunning(
+	IcuSqlite3AsyncRows& rows)
+{
+	rows.rows.Reset(0);
+	rows.rc		= SQLITE_MISUSE;
+	rows.error	= "async worker is not running";
+}
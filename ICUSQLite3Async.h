@@ -0,0 +1,505 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_ASYNC_H__
+#define __ICU_SQLITE3_ASYNC_H__
+
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Chunk.h"
+
+//	STL
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+//
+//	C++20 coroutine support (IcuSqlite3AsyncDatabase) is only compiled in
+//	when the compiler provides it; the worker below is plain C++11
+//
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && defined(__has_include)
+	#if __has_include(<coroutine>)
+		#define ICUSQLITE_HAVE_COROUTINES	1
+		#include <coroutine>
+		#include <exception>
+	#endif	//	__has_include(<coroutine>)
+#endif	//	defined(__cpp_impl_coroutine)
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3AsyncMetrics
+{
+	IcuSqlite3AsyncMetrics();
+
+	int64_t		tasks;				//	completed
+	int64_t		queueDepth;			//	waiting right now
+	int64_t		maxQueueDepth;
+	int64_t		queueWaitUs;		//	summed time from Post() to start
+	int64_t		maxQueueWaitUs;
+	int64_t		runUs;				//	summed time running tasks
+};
+
+//
+//	One block of a streamed query. rc is SQLITE_OK on every block but
+//	possibly the last, which carries the error (and may have no rows).
+//
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3AsyncRows
+{
+	IcuSqlite3AsyncRows();
+
+	bool IsOk() const { return 0 == rc; }
+
+	IcuSqlite3Chunk		rows;
+	int					rc;
+	std::string			error;
+};
+
+//
+//	Thread that owns all SQLite work for one connection. Tasks run one at
+//	a time, in Post() order. A single owner connection is taken over by
+//	the worker: release it (ReleaseOwnership()) before Start(), and the
+//	worker hands it back at Stop().
+//
+//	Completions go through the resume dispatcher. Without one they run
+//	inline on the worker, which then does no other SQLite work until the
+//	completion returns; set one to move them onto your own executor.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3AsyncWorker
+{
+public:
+	typedef std::function<void()>						Task;
+	typedef std::function<void(std::function<void()>)>	Dispatcher;
+
+	explicit IcuSqlite3AsyncWorker(IcuSqlite3Database& db);
+	~IcuSqlite3AsyncWorker();	//	Stop(); never from the worker thread
+
+	bool Start();
+
+	//
+	//	Runs what is already queued, then joins. From the worker thread (a
+	//	task or inline completion) it only asks the worker to stop; the
+	//	thread is joined by the next Start(), Stop() or the destructor.
+	//
+	void Stop();
+
+	bool IsRunning() const { return m_running; }
+	bool IsWorkerThread() const { return std::this_thread::get_id() == m_thread.get_id(); }
+	IcuSqlite3Database& GetDatabase() { return m_db; }
+
+	//
+	//	false if the worker isn't running; the task is not run
+	//
+	bool Post(Task task);
+
+	void SetResumeDispatcher(const Dispatcher& dispatcher);
+	void Dispatch(std::function<void()> completion);
+
+	void GetMetrics(IcuSqlite3AsyncMetrics& metrics) const;
+
+	//
+	//	Statement helpers for streamed queries; call on the worker thread
+	//
+	void* Prepare(const std::string& sql, IcuSqlite3AsyncRows& status);
+	bool StepRows(void* stmt, const int maxRows, IcuSqlite3AsyncRows& out);	//	true if more rows may follow
+
+	//
+	//	Finalizes on the worker; safe from any thread. If the worker has
+	//	stopped the statement is finalized in place.
+	//
+	void Finalize(void* stmt);
+
+	//
+	//	Marks |rows| as failed because the worker isn't running
+	//
+	static void SetNotRunning(IcuSqlite3AsyncRows& rows);
+
+private:
+	struct QueuedTask
+	{
+		Task		task;
+		int64_t		postedUs;
+	};
+
+	IcuSqlite3Database&			m_db;
+	std::thread					m_thread;
+	std::atomic<bool>			m_running;
+
+	mutable std::mutex			m_lock;
+	std::condition_variable		m_wake;
+	std::deque<QueuedTask>		m_tasks;
+	bool						m_stop;
+	Dispatcher					m_dispatcher;
+
+	std::atomic<int64_t>		m_completed;
+	std::atomic<int64_t>		m_maxQueueDepth;
+	std::atomic<int64_t>		m_queueWaitUs;
+	std::atomic<int64_t>		m_maxQueueWaitUs;
+	std::atomic<int64_t>		m_runUs;
+
+	void Run(std::promise<bool>* started);
+
+	IcuSqlite3AsyncWorker(const IcuSqlite3AsyncWorker&);	//	prevent copy
+	IcuSqlite3AsyncWorker& operator=(const IcuSqlite3AsyncWorker&);	//	prevent assign
+};
+
+#if defined(ICUSQLITE_HAVE_COROUTINES)
+
+//
+//	Shared by an IcuSqlite3AsyncCall and the task it posted. Once the
+//	awaiting coroutine abandons the call its work doesn't start and the
+//	coroutine isn't resumed.
+//
+class IcuSqlite3AsyncCallState
+{
+public:
+	IcuSqlite3AsyncCallState() : m_abandoned(false), m_running(false) {}
+
+	//
+	//	Worker side: false if the call was abandoned; else the work may
+	//	touch the coroutine frame until EndWork()
+	//
+	bool BeginWork()
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_running = !m_abandoned;
+		return m_running;
+	}
+
+	void EndWork()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_running = false;
+		}
+		m_done.notify_all();
+	}
+
+	bool IsAbandoned() const
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		return m_abandoned;
+	}
+
+	//
+	//	Coroutine side, before its frame goes away: waits out work that
+	//	is already running
+	//
+	void Abandon()
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_abandoned = true;
+		m_done.wait(lock, [this] { return !m_running; });
+	}
+
+private:
+	mutable std::mutex			m_lock;
+	std::condition_variable		m_done;
+	bool						m_abandoned;
+	bool						m_running;
+
+	IcuSqlite3AsyncCallState(const IcuSqlite3AsyncCallState&);	//	prevent copy
+	IcuSqlite3AsyncCallState& operator=(const IcuSqlite3AsyncCallState&);	//	prevent assign
+};
+
+//
+//	Promise base for coroutines that may be destroyed while suspended in
+//	an IcuSqlite3AsyncCall: call AbandonCall() before destroy()
+//
+struct IcuSqlite3AsyncPromiseBase
+{
+	void AbandonCall()
+	{
+		if(inFlight) {
+			inFlight->Abandon();
+		}
+	}
+
+	std::shared_ptr<IcuSqlite3AsyncCallState>	inFlight;	//	last call awaited
+};
+
+//
+//	Awaitable that runs |work| on the worker and resumes the awaiting
+//	coroutine (through the dispatcher) with its result. If the worker
+//	isn't running the coroutine isn't suspended and gets |failed|.
+//
+template<typename R>
+class IcuSqlite3AsyncCall
+{
+public:
+	IcuSqlite3AsyncCall(IcuSqlite3AsyncWorker& worker, std::function<R()> work, const R& failed)
+		: m_worker(worker)
+		, m_work(std::move(work))
+		, m_result(failed)
+	{
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	template<typename P>
+	bool await_suspend(std::coroutine_handle<P> awaiting)
+	{
+		std::shared_ptr<IcuSqlite3AsyncCallState> state(new IcuSqlite3AsyncCallState());
+		if constexpr(std::is_base_of<IcuSqlite3AsyncPromiseBase, P>::value) {
+			awaiting.promise().inFlight = state;
+		}
+
+		//
+		//	Once posted the coroutine may resume (and destroy this awaiter)
+		//	at any moment; touch nothing after Post()
+		//
+		IcuSqlite3AsyncWorker& worker	= m_worker;
+		std::coroutine_handle<> handle	= awaiting;
+		return worker.Post([this, state, handle, &worker] {
+			if(!state->BeginWork()) {
+				return;
+			}
+			m_result = m_work();
+			state->EndWork();
+
+			worker.Dispatch([state, handle] {
+				if(!state->IsAbandoned()) {
+					handle.resume();
+				}
+			});
+		});
+	}
+
+	R await_resume() { return std::move(m_result); }
+
+private:
+	IcuSqlite3AsyncWorker&	m_worker;
+	std::function<R()>		m_work;
+	R						m_result;
+};
+
+//
+//	Asynchronous generator: the body co_awaits freely and co_yields
+//	values; the consumer pulls them with
+//
+//		while(co_await gen.Next()) { use(gen.GetValue()); }
+//
+//	A yielded value is only valid until the next Next().
+//
+template<typename T>
+class IcuSqlite3AsyncGenerator
+{
+public:
+	struct promise_type : public IcuSqlite3AsyncPromiseBase
+	{
+		promise_type() : current(nullptr) {}
+
+		//
+		//	Hands control straight back to whoever awaits Next()
+		//
+		struct YieldAwaiter
+		{
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept
+			{
+				return self.promise().consumer;
+			}
+			void await_resume() const noexcept {}
+		};
+
+		IcuSqlite3AsyncGenerator get_return_object()
+		{
+			return IcuSqlite3AsyncGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() const noexcept { return std::suspend_always(); }
+		YieldAwaiter final_suspend() const noexcept { return YieldAwaiter(); }
+		YieldAwaiter yield_value(T& value) noexcept
+		{
+			current = &value;
+			return YieldAwaiter();
+		}
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+
+		T*							current;
+		std::coroutine_handle<>		consumer;
+	};
+
+	struct NextAwaiter
+	{
+		bool await_ready() const noexcept { return !producer || producer.done(); }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			producer.promise().consumer	= awaiting;
+			producer.promise().current	= nullptr;
+			return producer;
+		}
+		bool await_resume() const noexcept
+		{
+			return producer && !producer.done() && nullptr != producer.promise().current;
+		}
+
+		std::coroutine_handle<promise_type>	producer;
+	};
+
+	IcuSqlite3AsyncGenerator(IcuSqlite3AsyncGenerator&& gen) noexcept
+		: m_handle(gen.m_handle)
+	{
+		gen.m_handle = nullptr;
+	}
+
+	//
+	//	Dropping the generator mid stream waits for a step already running
+	//	on the worker; the rest of the call is cancelled
+	//
+	~IcuSqlite3AsyncGenerator()
+	{
+		if(m_handle) {
+			m_handle.promise().AbandonCall();
+			m_handle.destroy();
+		}
+	}
+
+	NextAwaiter Next() { return NextAwaiter { m_handle }; }
+	T& GetValue() { return *m_handle.promise().current; }
+
+private:
+	std::coroutine_handle<promise_type>	m_handle;
+
+	explicit IcuSqlite3AsyncGenerator(std::coroutine_handle<promise_type> handle)
+		: m_handle(handle)
+	{
+	}
+
+	IcuSqlite3AsyncGenerator(const IcuSqlite3AsyncGenerator&);	//	prevent copy
+	IcuSqlite3AsyncGenerator& operator=(const IcuSqlite3AsyncGenerator&);	//	prevent assign
+};
+
+//
+//	Awaitable front end to a connection. Every call runs on the worker;
+//	the awaiting coroutine resumes when it's done.
+//
+//		IcuSqlite3AsyncDatabase async(db);
+//		async.Start();
+//		int changed = co_await async.ExecuteUpdate("DELETE FROM log WHERE ...;");
+//
+//		auto rows = async.ExecuteQuery("SELECT * FROM events;");
+//		while(co_await rows.Next()) {
+//			const IcuSqlite3AsyncRows& block = rows.GetValue();
+//			...
+//		}
+//
+//	The database and this object must outlive any call in flight; a
+//	dropped generator cancels its own.
+//
+class IcuSqlite3AsyncDatabase
+{
+public:
+	explicit IcuSqlite3AsyncDatabase(IcuSqlite3Database& db) : m_worker(db) {}
+
+	bool Start() { return m_worker.Start(); }
+	void Stop() { m_worker.Stop(); }
+	void SetResumeDispatcher(const IcuSqlite3AsyncWorker::Dispatcher& dispatcher) { m_worker.SetResumeDispatcher(dispatcher); }
+	void GetMetrics(IcuSqlite3AsyncMetrics& metrics) const { m_worker.GetMetrics(metrics); }
+	IcuSqlite3AsyncWorker& GetWorker() { return m_worker; }
+
+	IcuSqlite3AsyncCall<int> ExecuteUpdate(std::string sql)
+	{
+		IcuSqlite3Database& db = m_worker.GetDatabase();
+		return IcuSqlite3AsyncCall<int>(m_worker, [&db, sql] { return db.ExecuteUpdate(sql.c_str()); }, -1);
+	}
+
+	IcuSqlite3AsyncCall<bool> Begin(const EIcuSqlite3TransTypes type = ICUSQLITE_TRANSACTION_DEFAULT)
+	{
+		IcuSqlite3Database& db = m_worker.GetDatabase();
+		return IcuSqlite3AsyncCall<bool>(m_worker, [&db, type] { return db.Begin(type); }, false);
+	}
+
+	IcuSqlite3AsyncCall<bool> Commit()
+	{
+		IcuSqlite3Database& db = m_worker.GetDatabase();
+		return IcuSqlite3AsyncCall<bool>(m_worker, [&db] { return db.Commit(); }, false);
+	}
+
+	IcuSqlite3AsyncCall<bool> Rollback()
+	{
+		IcuSqlite3Database& db = m_worker.GetDatabase();
+		return IcuSqlite3AsyncCall<bool>(m_worker, [&db] { return db.Rollback(); }, false);
+	}
+
+	IcuSqlite3AsyncCall<bool> Backup(const UnicodeString& targetFilename,
+		const UnicodeString& sourceDatabase = "main")
+	{
+		IcuSqlite3Database& db = m_worker.GetDatabase();
+		return IcuSqlite3AsyncCall<bool>(m_worker, 
+			[&db, targetFilename, sourceDatabase] { return db.Backup(targetFilename, nullptr, 0, sourceDatabase); }, 
+			false);
+	}
+
+	//
+	//	Streams the result in blocks of up to rowsPerBlock rows; each block
+	//	is stepped on the worker while the consumer is suspended
+	//
+	IcuSqlite3AsyncGenerator<IcuSqlite3AsyncRows> ExecuteQuery(std::string sql, const int rowsPerBlock = 256)
+	{
+		IcuSqlite3AsyncRows block;
+		void* stmt = co_await IcuSqlite3AsyncCall<void*>(m_worker, 
+			[this, &sql, &block] { return m_worker.Prepare(sql, block); }, nullptr);
+		if(nullptr == stmt) {
+			if(block.IsOk()) {
+				IcuSqlite3AsyncWorker::SetNotRunning(block);
+			}
+			co_yield block;
+			co_return;
+		}
+
+		//
+		//	Finalizes even if the consumer drops the generator mid stream
+		//
+		struct StatementGuard
+		{
+			IcuSqlite3AsyncWorker&	worker;
+			void*					stmt;
+			~StatementGuard() { worker.Finalize(stmt); }
+		} guard { m_worker, stmt };
+
+		for(;;) {
+			const int more = co_await IcuSqlite3AsyncCall<int>(m_worker, 
+				[this, stmt, rowsPerBlock, &block] { return m_worker.StepRows(stmt, rowsPerBlock, block) ? 1 : 0; }, -1);
+			if(more < 0) {
+				IcuSqlite3AsyncWorker::SetNotRunning(block);
+			}
+			if(block.rows.GetRowCount() > 0 || !block.IsOk()) {
+				co_yield block;
+			}
+			if(1 != more || !block.IsOk()) {
+				break;
+			}
+		}
+	}
+
+private:
+	IcuSqlite3AsyncWorker	m_worker;
+};
+
+#endif	//	defined(ICUSQLITE_HAVE_COROUTINES)
+
+#endif	//	!__ICU_SQLITE3_ASYNC_H__
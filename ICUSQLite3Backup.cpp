@@ -0,0 +1,354 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Backup.h"
+#include "ICUSQLite3Internal.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <chrono>
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3BackupOptions
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3BackupOptions::IcuSqlite3BackupOptions()
+	: pagesPerStep(128)
+	, sleepMs(0)
+	, maxBytesPerSec(0)
+	, busyTimeoutMs(60000)
+	, progress(nullptr)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3BackupJob - public
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3BackupJob::IcuSqlite3BackupJob(
+	IcuSqlite3Database& db)
+	: m_db(db)
+	, m_registered(false)
+	, m_fileDb(nullptr)
+	, m_backup(nullptr)
+	, m_pageSize(0)
+	, m_busySinceMs(-1)
+	, m_state(ICUSQLITE_BACKUP_STATE_IDLE)
+	, m_cancel(false)
+	, m_remaining(0)
+	, m_pageCount(0)
+{
+}
+
+IcuSqlite3BackupJob::~IcuSqlite3BackupJob()
+{
+	if(m_registered) {
+		//	not if |m_db| was closed (and maybe destroyed) first
+		IcuSqlite3DbLock lock(m_db.GetDatabaseHandle());
+		m_db.m_backupJobs.erase(this);
+		m_registered = false;
+	}
+	Abandon();
+}
+
+bool IcuSqlite3BackupJob::BeginBackup(
+	const UnicodeString& targetFilename,
+	const IcuSqlite3BackupOptions& options /*= IcuSqlite3BackupOptions()*/,
+	const unsigned char* targetKey /*= nullptr*/, const int keyLen /*= 0*/,
+	const UnicodeString& sourceDatabase /*= "main"*/)
+{
+	return Begin(targetFilename, false, options, targetKey, keyLen, sourceDatabase);
+}
+
+bool IcuSqlite3BackupJob::BeginRestore(
+	const UnicodeString& sourceFilename,
+	const IcuSqlite3BackupOptions& options /*= IcuSqlite3BackupOptions()*/,
+	const unsigned char* sourceKey /*= nullptr*/, const int keyLen /*= 0*/,
+	const UnicodeString& targetDatabase /*= "main"*/)
+{
+	return Begin(sourceFilename, true, options, sourceKey, keyLen, targetDatabase);
+}
+
+bool IcuSqlite3BackupJob::Step()
+{
+	if(m_thread.joinable() || nullptr == m_backup) {
+		return false;	//	running asynchronously, or nothing to do
+	}
+	return StepOnce(m_options.pagesPerStep);
+}
+
+bool IcuSqlite3BackupJob::RunAsync()
+{
+	if(m_thread.joinable() || nullptr == m_backup) {
+		return false;
+	}
+	if(ICUSQLITE_THREADING_SINGLE_OWNER == m_db.GetThreadingMode()) {
+		return false;	//	no connection mutex to share it with another thread
+	}
+	m_thread = std::thread(&IcuSqlite3BackupJob::Run, this);
+	return true;
+}
+
+EIcuSqlite3BackupState IcuSqlite3BackupJob::Wait()
+{
+	if(m_thread.joinable()) {
+		m_thread.join();
+	}
+	return GetState();
+}
+
+double IcuSqlite3BackupJob::GetProgress() const
+{
+	const int pageCount = m_pageCount;
+	if(ICUSQLITE_BACKUP_STATE_DONE == GetState()) {
+		return 1.0;
+	}
+	return (pageCount > 0) ?
+		static_cast<double>(pageCount - m_remaining) / pageCount : 0.0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3BackupJob - private
+///////////////////////////////////////////////////////////////////////////////
+bool IcuSqlite3BackupJob::Begin(
+	const UnicodeString& filename, const bool restore,
+	const IcuSqlite3BackupOptions& options,
+	const unsigned char* key, const int keyLen, const UnicodeString& dbName)
+{
+#if SQLITE_VERSION_NUMBER >= 3006011
+	if(!m_db.IsOpen() || ICUSQLITE_BACKUP_STATE_IDLE != GetState()) {
+		return false;
+	}
+
+	std::string utf8Filename;
+	IcuSqlite3ToUtf8(filename, utf8Filename);
+
+	sqlite3* fileDb;
+	int rc = sqlite3_open_v2(utf8Filename.c_str(), &fileDb,
+		restore ? SQLITE_OPEN_READONLY : (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE),
+		nullptr);
+	if(SQLITE_OK != rc) {
+		sqlite3_close(fileDb);
+		return false;
+	}
+
+#if ICUSQLITE_HAVE_CODEC
+	if(nullptr != key && keyLen > 0) {
+		rc = sqlite3_key(fileDb, key, keyLen);
+		if(SQLITE_OK != rc) {
+			sqlite3_close(fileDb);
+			return false;
+		}
+	}
+#else	//	ICUSQLITE_HAVE_CODEC
+	(void)key;
+	(void)keyLen;
+#endif	//	!ICUSQLITE_HAVE_CODEC
+
+	std::string utf8DbName;
+	IcuSqlite3ToUtf8(dbName, utf8DbName);
+
+	sqlite3* db = (sqlite3*)m_db.GetDatabaseHandle();
+	sqlite3_backup* backup = restore ?
+		sqlite3_backup_init(db, utf8DbName.c_str(), fileDb, "main") :
+		sqlite3_backup_init(fileDb, "main", db, utf8DbName.c_str());
+	if(nullptr == backup) {
+		sqlite3_close(fileDb);
+		return false;
+	}
+
+	//
+	//	Page size of the source, for the bandwidth cap
+	//
+	IcuSqlite3StatementBuffer sql;
+	sqlite3_stmt* stmt = nullptr;
+	m_pageSize = 4096;
+	if(SQLITE_OK == sqlite3_prepare_v2(restore ? fileDb : db,
+		sql.Format("PRAGMA %Q.page_size;", restore ? "main" : utf8DbName.c_str()),
+		-1, &stmt, nullptr) && SQLITE_ROW == sqlite3_step(stmt))
+	{
+		m_pageSize = sqlite3_column_int64(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	m_options	= options;
+	if(m_options.pagesPerStep <= 0) {
+		m_options.pagesPerStep = -1;	//	all at once
+	}
+	m_fileDb	= fileDb;
+	m_backup	= backup;
+	m_cancel	= false;
+	m_remaining	= 0;
+	m_pageCount	= 0;
+	m_state		= ICUSQLITE_BACKUP_STATE_READY;
+
+	{
+		IcuSqlite3DbLock lock(db);
+		m_db.m_backupJobs.insert(this);
+		m_registered = true;
+	}
+	return true;
+#else	//	SQLITE_VERSION_NUMBER >= 3006011
+	return false;
+#endif	//	SQLITE_VERSION_NUMBER < 3006011
+}
+
+bool IcuSqlite3BackupJob::StepOnce(
+	const int pages)
+{
+	if(m_cancel) {
+		Finish(ICUSQLITE_BACKUP_STATE_CANCELLED);
+		return false;
+	}
+
+	m_state = ICUSQLITE_BACKUP_STATE_RUNNING;
+	const int rc = sqlite3_backup_step((sqlite3_backup*)m_backup, pages);
+
+	m_remaining = sqlite3_backup_remaining((sqlite3_backup*)m_backup);
+	m_pageCount = sqlite3_backup_pagecount((sqlite3_backup*)m_backup);
+
+	switch(rc & 0xff) {
+		case SQLITE_DONE :
+			Finish(ICUSQLITE_BACKUP_STATE_DONE);
+			return false;
+
+		case SQLITE_OK :
+			m_busySinceMs = -1;
+			break;
+
+		case SQLITE_BUSY :
+		case SQLITE_LOCKED :
+			{
+				//
+				//	Someone else holds a lock we need. Nothing was copied;
+				//	try again next step unless we've waited long enough.
+				//
+				const int64_t now = IcuSqlite3NowMs();
+				if(m_busySinceMs < 0) {
+					m_busySinceMs = now;
+				} else if(m_options.busyTimeoutMs >= 0 &&
+					now - m_busySinceMs >= m_options.busyTimeoutMs)
+				{
+					Finish(ICUSQLITE_BACKUP_STATE_BUSY);
+					return false;
+				}
+			}
+			break;
+
+		default :
+			Finish(ICUSQLITE_BACKUP_STATE_FAILED);
+			return false;
+	}
+
+	if(nullptr != m_options.progress &&
+		!m_options.progress->OnProgress(m_remaining, m_pageCount))
+	{
+		Finish(ICUSQLITE_BACKUP_STATE_CANCELLED);
+		return false;
+	}
+
+	return true;
+}
+
+void IcuSqlite3BackupJob::Finish(
+	const EIcuSqlite3BackupState state)
+{
+	//
+	//	sqlite3_backup_finish() rolls back the destination if we didn't get
+	//	to SQLITE_DONE, so a cancelled restore leaves the database as it was
+	//
+	if(nullptr != m_backup) {
+		sqlite3_backup_finish((sqlite3_backup*)m_backup);
+		m_backup = nullptr;
+	}
+	if(nullptr != m_fileDb) {
+		sqlite3_close((sqlite3*)m_fileDb);
+		m_fileDb = nullptr;
+	}
+	m_state = state;
+}
+
+void IcuSqlite3BackupJob::Abandon()
+{
+	//
+	//	From the destructor, or from m_db.Close() which has already taken
+	//	it off the list
+	//
+	m_registered = false;
+	Cancel();
+	Wait();
+	if(!IsFinished() && ICUSQLITE_BACKUP_STATE_IDLE != GetState()) {
+		Finish(ICUSQLITE_BACKUP_STATE_CANCELLED);	//	begun but never run
+	}
+}
+
+void IcuSqlite3BackupJob::Run()
+{
+	const int64_t startMs = IcuSqlite3NowMs();
+	int64_t pagesCopied = 0;
+	int lastRemaining = -1;
+
+	while(StepOnce(m_options.pagesPerStep)) {
+		const int remaining = m_remaining;
+		if(lastRemaining >= 0 && remaining < lastRemaining) {
+			pagesCopied += lastRemaining - remaining;
+		} else if(lastRemaining < 0) {
+			pagesCopied += m_pageCount - remaining;
+		}
+		lastRemaining = remaining;
+
+		int64_t sleepMs = (m_busySinceMs >= 0) ?
+			((m_options.sleepMs > 0) ? m_options.sleepMs : 10) : m_options.sleepMs;
+
+		if(m_options.maxBytesPerSec > 0) {
+			//
+			//	Sleep off whatever we're ahead of the cap
+			//
+			const int64_t dueMs = (pagesCopied * m_pageSize * 1000) / m_options.maxBytesPerSec;
+			const int64_t aheadMs = dueMs - (IcuSqlite3NowMs() - startMs);
+			if(aheadMs > sleepMs) {
+				sleepMs = aheadMs;
+			}
+		}
+
+		if(sleepMs > 0) {
+			//
+			//	Wake up periodically so Cancel() isn't held up by a long nap
+			//
+			const int64_t wakeMs = IcuSqlite3NowMs() + sleepMs;
+			for(int64_t now = IcuSqlite3NowMs(); now < wakeMs && !m_cancel; now = IcuSqlite3NowMs()) {
+				const int64_t napMs = (wakeMs - now < 50) ? wakeMs - now : 50;
+				std::this_thread::sleep_for(std::chrono::milliseconds(napMs));
+			}
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
@@ -0,0 +1,146 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_BACKUP_H__
+#define __ICU_SQLITE3_BACKUP_H__
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <atomic>
+#include <thread>
+
+enum EIcuSqlite3BackupState {
+	ICUSQLITE_BACKUP_STATE_IDLE,		//	nothing begun
+	ICUSQLITE_BACKUP_STATE_READY,		//	begun, no pages copied yet
+	ICUSQLITE_BACKUP_STATE_RUNNING,
+	ICUSQLITE_BACKUP_STATE_DONE,
+	ICUSQLITE_BACKUP_STATE_CANCELLED,
+	ICUSQLITE_BACKUP_STATE_BUSY,		//	gave up waiting on locks (see busyTimeoutMs)
+	ICUSQLITE_BACKUP_STATE_FAILED,
+};
+
+//
+//	Progress notification for IcuSqlite3BackupJob. Called after each step,
+//	on whichever thread is stepping the job.
+//
+class IcuSqlite3BackupProgress
+{
+public:
+	virtual ~IcuSqlite3BackupProgress() {}
+
+	//
+	//	Return false to cancel the job
+	//
+	virtual bool OnProgress(const int remainingPages, const int totalPages) = 0;
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3BackupOptions
+{
+	IcuSqlite3BackupOptions();
+
+	int							pagesPerStep;	//	pages copied while holding the source read lock
+	int							sleepMs;		//	pause between steps; 0 just yields
+	int64_t						maxBytesPerSec;	//	bandwidth cap, 0 for none
+	int							busyTimeoutMs;	//	keep retrying BUSY/LOCKED this long, < 0 forever
+	IcuSqlite3BackupProgress*	progress;		//	optional, not owned
+};
+
+//
+//	Online backup (database -> file) or restore (file -> database) that
+//	copies a few pages at a time, releasing locks in between, so foreground
+//	traffic keeps running. Either drive it with Step() from your own loop,
+//	or RunAsync() it on a background thread and poll / Wait().
+//
+//	When run asynchronously the job steps |db| from its own thread, so |db|
+//	must be open in serialized mode (the default; not ICUSQLITE_OPEN_NOMUTEX).
+//	Closing |db| cancels a begun job (waiting for its thread) first.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3BackupJob
+{
+public:
+	explicit IcuSqlite3BackupJob(IcuSqlite3Database& db);
+	~IcuSqlite3BackupJob();	//	cancels and waits for a running job
+
+	bool BeginBackup(const UnicodeString& targetFilename,
+		const IcuSqlite3BackupOptions& options = IcuSqlite3BackupOptions(),
+		const unsigned char* targetKey = nullptr, const int keyLen = 0,
+		const UnicodeString& sourceDatabase = "main");
+
+	bool BeginRestore(const UnicodeString& sourceFilename,
+		const IcuSqlite3BackupOptions& options = IcuSqlite3BackupOptions(),
+		const unsigned char* sourceKey = nullptr, const int keyLen = 0,
+		const UnicodeString& targetDatabase = "main");
+
+	//
+	//	Copy one batch of pages on the calling thread. Returns true while
+	//	there is more to do. Does not sleep or throttle.
+	//
+	bool Step();
+
+	//
+	//	Step to completion on a background thread, honoring sleepMs and
+	//	maxBytesPerSec. Refused for single owner connections.
+	//
+	bool RunAsync();
+
+	void Cancel() { m_cancel = true; }
+	EIcuSqlite3BackupState Wait();
+
+	EIcuSqlite3BackupState GetState() const { return static_cast<EIcuSqlite3BackupState>(m_state.load()); }
+	bool IsFinished() const { return GetState() >= ICUSQLITE_BACKUP_STATE_DONE; }
+
+	int GetRemainingPages() const { return m_remaining; }
+	int GetPageCount() const { return m_pageCount; }
+	double GetProgress() const;	//	0.0 - 1.0
+
+private:
+	friend class IcuSqlite3Database;
+
+	IcuSqlite3Database&			m_db;
+	bool						m_registered;	//	in m_db's backup jobs
+	IcuSqlite3BackupOptions		m_options;
+	void*						m_fileDb;		//	the file side of the copy
+	void*						m_backup;
+	int64_t						m_pageSize;
+	int64_t						m_busySinceMs;	//	-1 when not waiting on locks
+
+	std::thread					m_thread;
+	std::atomic<int>			m_state;
+	std::atomic<bool>			m_cancel;
+	std::atomic<int>			m_remaining;
+	std::atomic<int>			m_pageCount;
+
+	bool Begin(const UnicodeString& filename, const bool restore,
+		const IcuSqlite3BackupOptions& options,
+		const unsigned char* key, const int keyLen, const UnicodeString& dbName);
+	bool StepOnce(const int pages);
+	void Finish(const EIcuSqlite3BackupState state);
+	void Run();
+	void Abandon();
+
+	IcuSqlite3BackupJob(const IcuSqlite3BackupJob&);	//	prevent copy
+	IcuSqlite3BackupJob& operator=(const IcuSqlite3BackupJob&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_BACKUP_H__
@@ -0,0 +1,238 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Busy.h"
+#include "ICUSQLite3Internal.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3BusyPolicy / IcuSqlite3BusyMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3BusyPolicy::IcuSqlite3BusyPolicy()
+	: timeoutMs(60000)	//	60 sec
+	, maxRetries(0)
+	, initialDelayMs(1)
+	, maxDelayMs(100)
+	, multiplier(2.0)
+	, jitter(0.5)
+{
+}
+
+IcuSqlite3BusyMetrics::IcuSqlite3BusyMetrics()
+	: busyEvents(0)
+	, retries(0)
+	, waitUs(0)
+	, maxWaitUs(0)
+	, timeouts(0)
+	, budgetCutoffs(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	Backoff
+///////////////////////////////////////////////////////////////////////////////
+int64_t IcuSqlite3BackoffDelayUs(
+	const int initialDelayMs, const int maxDelayMs, const double multiplier,
+	const double jitter, const int attempt, uint64_t& rng)
+{
+	double delayUs = std::max(initialDelayMs, 0) * 1000.0;
+	const double maxUs = std::max(maxDelayMs, initialDelayMs) * 1000.0;
+	for(int i = 0; i < attempt && delayUs < maxUs; ++i) {
+		delayUs *= std::max(multiplier, 1.0);
+	}
+	delayUs = std::min(delayUs, maxUs);
+
+	const double j = std::min(std::max(jitter, 0.0), 1.0);
+	if(j > 0.0) {
+		//
+		//	xorshift64; cheap and good enough to decorrelate retries
+		//
+		if(0 == rng) {
+			rng = 0x9e3779b97f4a7c15ULL;
+		}
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		const double r = static_cast<double>(rng >> 11) / static_cast<double>(1ULL << 53);
+		delayUs -= delayUs * j * r;
+	}
+	return std::max(static_cast<int64_t>(delayUs), static_cast<int64_t>(1));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3BusyHandler
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3BusyHandler::IcuSqlite3BusyHandler(
+	void* db, const IcuSqlite3BusyPolicy& policy)
+	: m_db(db)
+	, m_policy(policy)
+	, m_installed(false)
+	, m_waitStartUs(0)
+	, m_waitDeadlineUs(0)
+	, m_budgetDeadlineUs(0)
+	, m_rng(static_cast<uint64_t>(NowUs()) ^ reinterpret_cast<uintptr_t>(this))
+	, m_busyEvents(0)
+	, m_retries(0)
+	, m_waitUs(0)
+	, m_maxWaitUs(0)
+	, m_timeouts(0)
+	, m_budgetCutoffs(0)
+{
+}
+
+IcuSqlite3BusyHandler::~IcuSqlite3BusyHandler()
+{
+	if(m_installed) {
+		sqlite3_busy_handler((sqlite3*)m_db, nullptr, nullptr);
+	}
+}
+
+/*static*/
+int64_t IcuSqlite3BusyHandler::NowUs()
+{
+	return IcuSqlite3NowUs();
+}
+
+bool IcuSqlite3BusyHandler::Install()
+{
+	m_installed = (SQLITE_OK == sqlite3_busy_handler((sqlite3*)m_db, BusyCallback, this));
+	return m_installed;
+}
+
+int64_t IcuSqlite3BusyHandler::SetBudgetDeadline(
+	const int64_t deadlineUs)
+{
+	const int64_t previous = m_budgetDeadlineUs;
+	m_budgetDeadlineUs = deadlineUs;
+	return previous;
+}
+
+void IcuSqlite3BusyHandler::GetMetrics(
+	IcuSqlite3BusyMetrics& metrics) const
+{
+	metrics.busyEvents		= m_busyEvents;
+	metrics.retries			= m_retries;
+	metrics.waitUs			= m_waitUs;
+	metrics.maxWaitUs		= m_maxWaitUs;
+	metrics.timeouts		= m_timeouts;
+	metrics.budgetCutoffs	= m_budgetCutoffs;
+}
+
+void IcuSqlite3BusyHandler::ResetMetrics()
+{
+	m_busyEvents	= 0;
+	m_retries		= 0;
+	m_waitUs		= 0;
+	m_maxWaitUs		= 0;
+	m_timeouts		= 0;
+	m_budgetCutoffs	= 0;
+}
+
+/*static*/
+int IcuSqlite3BusyHandler::BusyCallback(
+	void* ctxt, int count)
+{
+	return static_cast<IcuSqlite3BusyHandler*>(ctxt)->OnBusy(count);
+}
+
+void IcuSqlite3BusyHandler::GiveUp(
+	const bool budget, const int64_t nowUs)
+{
+	if(budget) {
+		m_budgetCutoffs.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		m_timeouts.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	NoteWait(nowUs);
+}
+
+void IcuSqlite3BusyHandler::NoteWait(
+	const int64_t nowUs)
+{
+	const int64_t waitedUs = nowUs - m_waitStartUs;
+	int64_t maxWaitUs = m_maxWaitUs.load(std::memory_order_relaxed);
+	while(waitedUs > maxWaitUs && 
+		!m_maxWaitUs.compare_exchange_weak(maxWaitUs, waitedUs, std::memory_order_relaxed))
+	{
+	}
+}
+
+int IcuSqlite3BusyHandler::OnBusy(
+	const int count)
+{
+	const int64_t nowUs = NowUs();
+
+	if(0 == count) {
+		m_busyEvents.fetch_add(1, std::memory_order_relaxed);
+		m_waitStartUs		= nowUs;
+		m_waitDeadlineUs	= (m_policy.timeoutMs < 0) ? 0 :
+			nowUs + static_cast<int64_t>(m_policy.timeoutMs) * 1000;
+	}
+
+	if(m_policy.maxRetries > 0 && count >= m_policy.maxRetries) {
+		GiveUp(false, nowUs);
+		return 0;
+	}
+
+	//
+	//	Earliest of the policy's deadline and the caller's budget
+	//
+	const bool budgeted = (0 != m_budgetDeadlineUs && 
+		(0 == m_waitDeadlineUs || m_budgetDeadlineUs < m_waitDeadlineUs));
+	const int64_t deadlineUs = budgeted ? m_budgetDeadlineUs : m_waitDeadlineUs;
+	if(0 != deadlineUs && nowUs >= deadlineUs) {
+		GiveUp(budgeted, nowUs);
+		return 0;
+	}
+
+	int64_t delayUs = IcuSqlite3BackoffDelayUs(m_policy.initialDelayMs, m_policy.maxDelayMs,
+		m_policy.multiplier, m_policy.jitter, count, m_rng);
+	if(0 != deadlineUs) {
+		delayUs = std::min(delayUs, deadlineUs - nowUs);
+	}
+
+	//
+	//	A wait that ends in success is never reported back, so the
+	//	longest wait is tracked as it grows, up to the coming retry
+	//
+	NoteWait(nowUs + delayUs);
+
+	m_retries.fetch_add(1, std::memory_order_relaxed);
+	m_waitUs.fetch_add(delayUs, std::memory_order_relaxed);
+	std::this_thread::sleep_for(std::chrono::microseconds(delayUs));
+	return 1;
+}
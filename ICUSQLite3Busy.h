@@ -0,0 +1,104 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_BUSY_H__
+#define __ICU_SQLITE3_BUSY_H__
+
+//
+//	Internal: used by IcuSqlite3Database, not part of the public API
+//
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <atomic>
+
+//
+//	Sleep before retry |attempt| (0 based):
+//
+//		min(maxDelayMs, initialDelayMs * multiplier^attempt)
+//
+//	of which up to |jitter| (0.0 - 1.0) is randomized from |rng| (any
+//	seed), so contending connections don't retry in lock step.
+//
+int64_t IcuSqlite3BackoffDelayUs(const int initialDelayMs, const int maxDelayMs,
+	const double multiplier, const double jitter, const int attempt, uint64_t& rng);
+
+//
+//	The connection's sqlite3_busy_handler(). SQLite calls it with count 0
+//	when a lock wait begins and count + 1 for each retry after; returning
+//	0 gives up (SQLITE_BUSY to the caller). Sleeps follow
+//	IcuSqlite3BackoffDelayUs(), but never past the wait's deadline.
+//
+class IcuSqlite3BusyHandler
+{
+public:
+	IcuSqlite3BusyHandler(void* db, const IcuSqlite3BusyPolicy& policy);
+	~IcuSqlite3BusyHandler();
+
+	bool Install();
+	void SetPolicy(const IcuSqlite3BusyPolicy& policy) { m_policy = policy; }
+
+	//
+	//	Absolute budget deadline (NowUs() clock), 0 for none.
+	//	Returns the previous one.
+	//
+	int64_t SetBudgetDeadline(const int64_t deadlineUs);
+	int64_t GetBudgetDeadline() const { return m_budgetDeadlineUs; }
+
+	void GetMetrics(IcuSqlite3BusyMetrics& metrics) const;
+	void ResetMetrics();
+
+	static int64_t NowUs();
+
+private:
+	void*						m_db;
+	IcuSqlite3BusyPolicy		m_policy;
+	bool						m_installed;
+
+	//
+	//	Connection thread only
+	//
+	int64_t						m_waitStartUs;
+	int64_t						m_waitDeadlineUs;	//	0 = none
+	int64_t						m_budgetDeadlineUs;	//	0 = none
+	uint64_t					m_rng;
+
+	std::atomic<int64_t>		m_busyEvents;
+	std::atomic<int64_t>		m_retries;
+	std::atomic<int64_t>		m_waitUs;
+	std::atomic<int64_t>		m_maxWaitUs;
+	std::atomic<int64_t>		m_timeouts;
+	std::atomic<int64_t>		m_budgetCutoffs;
+
+	static int BusyCallback(void* ctxt, int count);
+
+	int OnBusy(const int count);
+	void GiveUp(const bool budget, const int64_t nowUs);
+	void NoteWait(const int64_t nowUs);
+
+	IcuSqlite3BusyHandler(const IcuSqlite3BusyHandler&);	//	prevent copy
+	IcuSqlite3BusyHandler& operator=(const IcuSqlite3BusyHandler&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_BUSY_H__
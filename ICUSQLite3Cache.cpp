@@ -0,0 +1,1010 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Cache.h"
+#include "ICUSQLite3Chunk.h"
+#include "ICUSQLite3Internal.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+//
+//	Distinct statements kept prepared; the cache is simply emptied when
+//	it fills up
+//
+#define ICUSQLITE_CACHE_MAX_STATEMENTS	64
+
+//
+//	Functions whose result can differ between two runs over the same data
+//
+static const char* const IcuSqlite3VolatileFunctions[] = {
+	"random", "randomblob", "changes", "total_changes", "last_insert_rowid",
+	"date", "time", "datetime", "julianday", "unixepoch", "strftime", "timediff",
+	"current_date", "current_time", "current_timestamp",
+	nullptr
+};
+
+//
+//	Eponymous virtual tables reporting connection or file state; names
+//	starting "pragma_" are matched separately
+//
+static const char* const IcuSqlite3VolatileTables[] = {
+	"dbstat", "sqlite_dbpage", "sqlite_stmt", "sqlite_memstat", "bytecode", "tables_used",
+	nullptr
+};
+
+static bool IcuSqlite3IsListed(
+	const char* const* list, const char* name)
+{
+	for(; nullptr != *list; ++list) {
+		if(0 == sqlite3_stricmp(*list, name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int64_t IcuSqlite3TotalChanges(
+	sqlite3* db)
+{
+#if SQLITE_VERSION_NUMBER >= 3037000
+	return sqlite3_total_changes64(db);
+#else	//	SQLITE_VERSION_NUMBER >= 3037000
+	return sqlite3_total_changes(db);
+#endif	//	SQLITE_VERSION_NUMBER >= 3037000
+}
+
+//
+//	Cache key text: comments dropped, whitespace runs outside literals and
+//	quoted names collapsed to one space, trailing ';' removed. Case is
+//	kept - it matters inside literals.
+//
+static void IcuSqlite3NormalizeSql(
+	const char* sql, std::string& out)
+{
+	out.clear();
+	bool space = false;
+	const char* p = sql;
+	while('\0' != *p) {
+		const char c = *p;
+		if(' ' == c || '\t' == c || '\n' == c || '\r' == c || '\f' == c) {
+			space = true;
+			++p;
+			continue;
+		}
+		if('-' == c && '-' == p[1]) {
+			while('\0' != *p && '\n' != *p) {
+				++p;
+			}
+			space = true;
+			continue;
+		}
+		if('/' == c && '*' == p[1]) {
+			p += 2;
+			while('\0' != *p && !('*' == p[0] && '/' == p[1])) {
+				++p;
+			}
+			p += ('\0' != *p) ? 2 : 0;
+			space = true;
+			continue;
+		}
+
+		if(space && !out.empty()) {
+			out += ' ';
+		}
+		space = false;
+
+		if('\'' == c || '"' == c || '`' == c || '[' == c) {
+			//	copied verbatim; '' / "" / `` escape the quote
+			const char close = ('[' == c) ? ']' : c;
+			out += *p++;
+			while('\0' != *p) {
+				out += *p;
+				if(close == *p++) {
+					if(']' == close || close != *p) {
+						break;
+					}
+					out += *p++;
+				}
+			}
+			continue;
+		}
+
+		out += *p++;
+	}
+
+	while(!out.empty() && (';' == out.back() || ' ' == out.back())) {
+		out.erase(out.size() - 1);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ResultCacheOptions / IcuSqlite3ResultCacheMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ResultCacheOptions::IcuSqlite3ResultCacheOptions()
+	: maxBytes(64 * 1024 * 1024)
+	, maxEntryBytes(4 * 1024 * 1024)
+{
+}
+
+IcuSqlite3ResultCacheMetrics::IcuSqlite3ResultCacheMetrics()
+	: hits(0)
+	, misses(0)
+	, uncacheable(0)
+	, evictions(0)
+	, invalidations(0)
+	, flushes(0)
+	, entries(0)
+	, bytes(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3CachedRows
+///////////////////////////////////////////////////////////////////////////////
+struct IcuSqlite3CachedRows
+{
+	IcuSqlite3CachedRows() : rc(SQLITE_OK) {}
+
+	IcuSqlite3Chunk				rows;
+	std::vector<std::string>	columnNames;	//	UTF-8
+	int							rc;
+	std::string					error;
+
+	size_t GetMemoryBytes() const
+	{
+		size_t bytes = sizeof(*this) + rows.GetMemoryBytes();
+		for(size_t n = 0; n < columnNames.size(); ++n) {
+			bytes += sizeof(std::string) + columnNames[n].capacity();
+		}
+		return bytes;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3CachedResult
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3CachedResult::IcuSqlite3CachedResult()
+	: m_row(-1)
+	, m_fromCache(false)
+{
+}
+
+IcuSqlite3CachedResult::IcuSqlite3CachedResult(
+	const std::shared_ptr<const IcuSqlite3CachedRows>& rows, const bool fromCache)
+	: m_rows(rows)
+	, m_row(-1)
+	, m_fromCache(fromCache)
+{
+}
+
+bool IcuSqlite3CachedResult::NextRow()
+{
+	if(nullptr == m_rows.get() || m_row >= m_rows->rows.GetRowCount()) {
+		return false;
+	}
+	return ++m_row < m_rows->rows.GetRowCount();
+}
+
+bool IcuSqlite3CachedResult::Eof() const
+{
+	return nullptr == m_rows.get() || m_row >= m_rows->rows.GetRowCount();
+}
+
+bool IcuSqlite3CachedResult::IsOk() const
+{
+	return nullptr != m_rows.get() && SQLITE_OK == m_rows->rc;
+}
+
+int IcuSqlite3CachedResult::GetErrorCode() const
+{
+	return (nullptr != m_rows.get()) ? m_rows->rc : SQLITE_MISUSE;
+}
+
+std::string IcuSqlite3CachedResult::GetErrorMessage() const
+{
+	return (nullptr != m_rows.get()) ? m_rows->error : std::string();
+}
+
+int IcuSqlite3CachedResult::GetRowCount() const
+{
+	return (nullptr != m_rows.get()) ? m_rows->rows.GetRowCount() : 0;
+}
+
+int IcuSqlite3CachedResult::GetColumnCount() const
+{
+	return (nullptr != m_rows.get()) ? static_cast<int>(m_rows->columnNames.size()) : 0;
+}
+
+UnicodeString IcuSqlite3CachedResult::GetColumnName(
+	const int colIdx) const
+{
+	if(colIdx < 0 || colIdx >= GetColumnCount()) {
+		return UnicodeString();
+	}
+	const std::string& name = m_rows->columnNames[colIdx];
+	return IcuSqlite3FromUtf8(name.data(), static_cast<int32_t>(name.size()));
+}
+
+EIcuSqlite3ColumnTypes IcuSqlite3CachedResult::GetColumnType(
+	const int colIdx) const
+{
+	if(nullptr == m_rows.get() || m_row < 0 || m_row >= m_rows->rows.GetRowCount()) {
+		return ICUSQLITE_COLUMN_TYPE_INVALID;
+	}
+	return m_rows->rows.GetType(m_row, colIdx);
+}
+
+int32_t IcuSqlite3CachedResult::GetInt(
+	const int colIdx, const int32_t defVal /*= 0*/) const
+{
+	return static_cast<int32_t>(GetInt64(colIdx, defVal));
+}
+
+int64_t IcuSqlite3CachedResult::GetInt64(
+	const int colIdx, const int64_t defVal /*= 0*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	return m_rows->rows.GetInt64(m_row, colIdx);
+}
+
+double IcuSqlite3CachedResult::GetDouble(
+	const int colIdx, const double defVal /*= 0.0*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	return m_rows->rows.GetDouble(m_row, colIdx);
+}
+
+UnicodeString IcuSqlite3CachedResult::GetString(
+	const int colIdx, const UnicodeString& defVal /*= ""*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	const std::string utf8 = GetStringUTF8(colIdx);
+	return IcuSqlite3FromUtf8(utf8.data(), static_cast<int32_t>(utf8.size()));
+}
+
+std::string IcuSqlite3CachedResult::GetStringUTF8(
+	const int colIdx, const std::string& defVal /*= ""*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	return m_rows->rows.GetString(m_row, colIdx);
+}
+
+bool IcuSqlite3CachedResult::GetBool(
+	const int colIdx, const bool defVal /*= false*/) const
+{
+	return 0 != GetInt(colIdx, (defVal) ? 1 : 0);
+}
+
+const unsigned char* IcuSqlite3CachedResult::GetBlob(
+	const int colIdx, int& len) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		len = 0;
+		return nullptr;
+	}
+	return m_rows->rows.GetBlob(m_row, colIdx, len);
+}
+
+bool IcuSqlite3CachedResult::IsNull(
+	const int colIdx) const
+{
+	return ICUSQLITE_COLUMN_TYPE_NULL == GetColumnType(colIdx);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ResultCacheState
+///////////////////////////////////////////////////////////////////////////////
+
+//
+//	Everything here is guarded by the connection mutex (IcuSqlite3DbLock,
+//	or SQLite holding it around the update hook)
+//
+struct IcuSqlite3ResultCacheState
+{
+	//
+	//	A table some cached statement reads; generation moves on every
+	//	write to it
+	//
+	struct Table
+	{
+		uint64_t	generation;
+	};
+
+	//
+	//	A schema (main, temp, ATTACHed) some cached statement reads
+	//
+	struct Schema
+	{
+		Schema() : dataVersion(nullptr), schemaVersion(nullptr), 
+			lastDataVersion(0), lastSchemaVersion(0), epoch(0) {}
+
+		std::string		name;
+		std::string		filename;
+		sqlite3_stmt*	dataVersion;		//	PRAGMA "name".data_version
+		sqlite3_stmt*	schemaVersion;		//	PRAGMA "name".schema_version
+		int64_t			lastDataVersion;
+		int64_t			lastSchemaVersion;
+		uint64_t		epoch;				//	moves when another connection commits
+	};
+
+	struct Query
+	{
+		Query() : stmt(nullptr), cacheable(false) {}
+
+		sqlite3_stmt*			stmt;
+		bool					cacheable;
+		std::vector<Table*>		tables;
+		std::vector<Schema*>	schemas;
+	};
+
+	struct Entry
+	{
+		const Query*								query;
+		uint64_t									hash;
+		IcuSqlite3QueryParams						params;
+		std::shared_ptr<const IcuSqlite3CachedRows>	rows;
+		std::vector<uint64_t>						generations;	//	per query->tables
+		std::vector<uint64_t>						epochs;			//	per query->schemas
+		size_t										bytes;
+	};
+
+	struct EntryKey
+	{
+		const Query*	query;
+		uint64_t		hash;
+
+		bool operator==(const EntryKey& key) const { return query == key.query && hash == key.hash; }
+	};
+
+	struct EntryKeyHash
+	{
+		size_t operator()(const EntryKey& key) const
+		{
+			return static_cast<size_t>(key.hash ^ (reinterpret_cast<uintptr_t>(key.query) * 0x9e3779b97f4a7c15ULL));
+		}
+	};
+
+	typedef std::list<Entry>	EntryList;	//	most recently used first
+
+	explicit IcuSqlite3ResultCacheState(const IcuSqlite3ResultCacheOptions& opts)
+		: options(opts)
+		, db(nullptr)
+		, bytes(0)
+		, hookedChanges(0)
+		, lastHookedChanges(0)
+		, lastTotalChanges(0)
+		, lastHookTable(nullptr)
+		, lastHookValid(false)
+		, hits(0)
+		, misses(0)
+		, uncacheable(0)
+		, evictions(0)
+		, invalidations(0)
+		, flushes(0)
+	{
+	}
+
+	~IcuSqlite3ResultCacheState()
+	{
+		Reset();
+	}
+
+	IcuSqlite3ResultCacheOptions							options;
+	sqlite3*												db;		//	non-null while attached
+
+	std::map<std::pair<std::string, std::string>, std::unique_ptr<Table> >	tables;
+	std::map<std::string, std::unique_ptr<Schema> >			schemas;
+	std::unordered_map<std::string, std::unique_ptr<Query> >	queries;	//	by normalized SQL
+
+	EntryList												entries;
+	std::unordered_map<EntryKey, EntryList::iterator, EntryKeyHash>	index;
+	size_t													bytes;
+
+	//
+	//	Update hook bookkeeping. total_changes moving further than the hook
+	//	saw means a write it doesn't report.
+	//
+	int64_t							hookedChanges;
+	int64_t							lastHookedChanges;
+	int64_t							lastTotalChanges;
+	std::string						lastHookSchema;		//	last table the hook resolved
+	std::string						lastHookName;
+	Table*							lastHookTable;		//	nullptr: not read by anything cached
+	bool							lastHookValid;
+
+	std::atomic<int64_t>			hits;
+	std::atomic<int64_t>			misses;
+	std::atomic<int64_t>			uncacheable;
+	std::atomic<int64_t>			evictions;
+	std::atomic<int64_t>			invalidations;
+	std::atomic<int64_t>			flushes;
+
+	static void UpdateCallback(void* ctxt, int /*op*/, const char* dbName, 
+		const char* table, sqlite3_int64 /*rowid*/)
+	{
+		static_cast<IcuSqlite3ResultCacheState*>(ctxt)->OnWrite(dbName, table);
+	}
+
+	void OnWrite(const char* dbName, const char* table)
+	{
+		++hookedChanges;
+
+		//	bulk writes hit the same table row after row
+		if(!lastHookValid || lastHookName != table || lastHookSchema != dbName) {
+			lastHookSchema	= dbName;
+			lastHookName	= table;
+			std::map<std::pair<std::string, std::string>, std::unique_ptr<Table> >::iterator it = 
+				tables.find(std::make_pair(lastHookSchema, lastHookName));
+			lastHookTable	= (it != tables.end()) ? it->second.get() : nullptr;
+			lastHookValid	= true;
+		}
+
+		if(nullptr != lastHookTable) {
+			++lastHookTable->generation;
+		}
+	}
+
+	void Attach(sqlite3* handle)
+	{
+		db = handle;
+		sqlite3_update_hook(db, UpdateCallback, this);
+		lastHookedChanges	= hookedChanges;
+		lastTotalChanges	= IcuSqlite3TotalChanges(db);
+	}
+
+	void Detach()
+	{
+		if(nullptr != db) {
+			sqlite3_update_hook(db, nullptr, nullptr);
+			Reset();
+			db = nullptr;
+		}
+	}
+
+	//
+	//	Drops every entry; statements stay prepared
+	//
+	void Flush()
+	{
+		if(!entries.empty()) {
+			++flushes;
+		}
+		index.clear();
+		entries.clear();
+		bytes = 0;
+	}
+
+	//
+	//	Drops everything, statements included
+	//
+	void Reset()
+	{
+		index.clear();
+		entries.clear();
+		bytes = 0;
+
+		for(std::unordered_map<std::string, std::unique_ptr<Query> >::iterator it = queries.begin();
+			it != queries.end(); ++it)
+		{
+			sqlite3_finalize(it->second->stmt);
+		}
+		queries.clear();
+
+		for(std::map<std::string, std::unique_ptr<Schema> >::iterator it = schemas.begin();
+			it != schemas.end(); ++it)
+		{
+			sqlite3_finalize(it->second->dataVersion);
+			sqlite3_finalize(it->second->schemaVersion);
+		}
+		schemas.clear();
+
+		tables.clear();
+		lastHookValid = false;
+	}
+
+	void SyncLocalWrites()
+	{
+		const int64_t total = IcuSqlite3TotalChanges(db);
+		if(total - lastTotalChanges != hookedChanges - lastHookedChanges) {
+			Flush();
+		}
+		lastTotalChanges	= total;
+		lastHookedChanges	= hookedChanges;
+	}
+
+	static bool ReadPragma(sqlite3_stmt* stmt, int64_t& value)
+	{
+		const bool ok = (SQLITE_ROW == sqlite3_step(stmt));
+		if(ok) {
+			value = sqlite3_column_int64(stmt, 0);
+		}
+		sqlite3_reset(stmt);
+		return ok;
+	}
+
+	Schema* GetSchema(const std::string& name)
+	{
+		std::map<std::string, std::unique_ptr<Schema> >::iterator it = schemas.find(name);
+		if(it != schemas.end()) {
+			return it->second.get();
+		}
+
+		const char* filename = sqlite3_db_filename(db, name.c_str());
+		if(nullptr == filename) {
+			return nullptr;
+		}
+
+		std::unique_ptr<Schema> schema(new Schema());
+		schema->name		= name;
+		schema->filename	= filename;
+
+		const std::string quoted = IcuSqlite3QuoteName(name);
+		const std::string dataSql = "PRAGMA " + quoted + ".data_version;";
+		const std::string schemaSql = "PRAGMA " + quoted + ".schema_version;";
+		if(SQLITE_OK != sqlite3_prepare_v2(db, dataSql.c_str(), -1, &schema->dataVersion, nullptr) ||
+			SQLITE_OK != sqlite3_prepare_v2(db, schemaSql.c_str(), -1, &schema->schemaVersion, nullptr) ||
+			!ReadPragma(schema->dataVersion, schema->lastDataVersion) ||
+			!ReadPragma(schema->schemaVersion, schema->lastSchemaVersion))
+		{
+			sqlite3_finalize(schema->dataVersion);
+			sqlite3_finalize(schema->schemaVersion);
+			return nullptr;
+		}
+
+		Schema* raw = schema.get();
+		schemas[name] = std::move(schema);
+		return raw;
+	}
+
+	//
+	//	false if a schema the query reads was changed, DETACHed or swapped
+	//	for another file; everything has been Reset() and |query| is gone
+	//
+	bool CheckSchemas(const Query* query)
+	{
+		for(size_t n = 0; n < query->schemas.size(); ++n) {
+			Schema* schema = query->schemas[n];
+			const char* filename = sqlite3_db_filename(db, schema->name.c_str());
+
+			int64_t dataVersion;
+			int64_t schemaVersion;
+			if(nullptr == filename || schema->filename != filename ||
+				!ReadPragma(schema->schemaVersion, schemaVersion) ||
+				schemaVersion != schema->lastSchemaVersion ||
+				!ReadPragma(schema->dataVersion, dataVersion))
+			{
+				Flush();
+				Reset();
+				return false;
+			}
+
+			if(dataVersion != schema->lastDataVersion) {
+				schema->lastDataVersion = dataVersion;
+				++schema->epoch;
+			}
+		}
+		return true;
+	}
+
+	Query* GetQuery(IcuSqlite3Database& database, const char* sql, const std::string& key, int& rc, std::string& error)
+	{
+		std::unordered_map<std::string, std::unique_ptr<Query> >::iterator it = queries.find(key);
+		if(it != queries.end()) {
+			return it->second.get();
+		}
+
+		if(queries.size() >= ICUSQLITE_CACHE_MAX_STATEMENTS) {
+			Flush();
+			Reset();
+		}
+
+		std::vector<std::pair<std::string, std::string> > read;
+		std::vector<std::string> functions;
+		sqlite3_stmt* stmt = (sqlite3_stmt*)database.PrepareWithReadSet(sql, -1, read, functions);
+		if(nullptr == stmt) {
+			rc		= sqlite3_extended_errcode(db);
+			error	= sqlite3_errmsg(db);
+			if(SQLITE_OK == rc) {
+				rc		= SQLITE_MISUSE;
+				error	= "empty statement";
+			}
+			return nullptr;
+		}
+
+		std::unique_ptr<Query> query(new Query());
+		query->stmt			= stmt;
+		query->cacheable	= (0 != sqlite3_stmt_readonly(stmt));
+
+		for(size_t n = 0; n < functions.size() && query->cacheable; ++n) {
+			query->cacheable = !IcuSqlite3IsListed(IcuSqlite3VolatileFunctions, functions[n].c_str());
+		}
+
+		for(size_t n = 0; n < read.size() && query->cacheable; ++n) {
+			const std::string& name = read[n].second;
+			if(0 == sqlite3_strnicmp(name.c_str(), "pragma_", 7) || 
+				IcuSqlite3IsListed(IcuSqlite3VolatileTables, name.c_str()))
+			{
+				query->cacheable = false;
+				break;
+			}
+
+			Schema* schema = GetSchema(read[n].first);
+			if(nullptr == schema) {
+				query->cacheable = false;
+				break;
+			}
+			if(std::find(query->schemas.begin(), query->schemas.end(), schema) == query->schemas.end()) {
+				query->schemas.push_back(schema);
+			}
+
+			std::unique_ptr<Table>& table = tables[read[n]];
+			if(nullptr == table.get()) {
+				table.reset(new Table());
+				table->generation = 0;
+				lastHookValid = false;
+			}
+			query->tables.push_back(table.get());
+		}
+
+		if(!query->cacheable) {
+			query->tables.clear();
+			query->schemas.clear();
+		}
+
+		Query* raw = query.get();
+		queries[key] = std::move(query);
+		return raw;
+	}
+
+	bool IsCurrent(const Entry& entry) const
+	{
+		const Query* query = entry.query;
+		for(size_t n = 0; n < query->tables.size(); ++n) {
+			if(query->tables[n]->generation != entry.generations[n]) {
+				return false;
+			}
+		}
+		for(size_t n = 0; n < query->schemas.size(); ++n) {
+			if(query->schemas[n]->epoch != entry.epochs[n]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Erase(EntryList::iterator it)
+	{
+		const EntryKey key = { it->query, it->hash };
+		index.erase(key);
+		bytes -= it->bytes;
+		entries.erase(it);
+	}
+
+	std::shared_ptr<const IcuSqlite3CachedRows> Lookup(const Query* query, 
+		const IcuSqlite3QueryParams& params, const uint64_t hash)
+	{
+		const EntryKey key = { query, hash };
+		std::unordered_map<EntryKey, EntryList::iterator, EntryKeyHash>::iterator it = index.find(key);
+		if(it == index.end()) {
+			return std::shared_ptr<const IcuSqlite3CachedRows>();
+		}
+
+		EntryList::iterator entry = it->second;
+		if(!IsCurrent(*entry)) {
+			++invalidations;
+			Erase(entry);
+			return std::shared_ptr<const IcuSqlite3CachedRows>();
+		}
+		if(entry->params != params) {
+			return std::shared_ptr<const IcuSqlite3CachedRows>();	//	hash collision
+		}
+
+		entries.splice(entries.begin(), entries, entry);
+		return entry->rows;
+	}
+
+	void Store(const Query* query, const IcuSqlite3QueryParams& params, const uint64_t hash,
+		const std::shared_ptr<const IcuSqlite3CachedRows>& rows, const size_t size)
+	{
+		const EntryKey key = { query, hash };
+		std::unordered_map<EntryKey, EntryList::iterator, EntryKeyHash>::iterator it = index.find(key);
+		if(it != index.end()) {
+			Erase(it->second);
+		}
+
+		entries.push_front(Entry());
+		Entry& entry	= entries.front();
+		entry.query		= query;
+		entry.hash		= hash;
+		entry.params	= params;
+		entry.rows		= rows;
+		entry.bytes		= size;
+		for(size_t n = 0; n < query->tables.size(); ++n) {
+			entry.generations.push_back(query->tables[n]->generation);
+		}
+		for(size_t n = 0; n < query->schemas.size(); ++n) {
+			entry.epochs.push_back(query->schemas[n]->epoch);
+		}
+		index[key]	= entries.begin();
+		bytes		+= size;
+
+		while(bytes > static_cast<size_t>(options.maxBytes) && !entries.empty()) {
+			++evictions;
+			Erase(--entries.end());
+		}
+	}
+
+	static std::shared_ptr<IcuSqlite3CachedRows> Run(sqlite3* handle, sqlite3_stmt* stmt, 
+		const IcuSqlite3QueryParams& params)
+	{
+		std::shared_ptr<IcuSqlite3CachedRows> result(new IcuSqlite3CachedRows());
+
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+		if(!params.Apply(stmt)) {
+			result->rc		= sqlite3_extended_errcode(handle);
+			result->error	= sqlite3_errmsg(handle);
+			return result;
+		}
+
+		const int cols = sqlite3_column_count(stmt);
+		result->columnNames.resize(cols);
+		for(int col = 0; col < cols; ++col) {
+			const char* name = sqlite3_column_name(stmt, col);
+			result->columnNames[col] = (nullptr != name) ? name : "";
+		}
+
+		result->rows.Reset(cols);
+		int r;
+		while(SQLITE_ROW == (r = sqlite3_step(stmt))) {
+			result->rows.AppendRow(stmt);
+		}
+		if(SQLITE_DONE != r) {
+			result->rc		= sqlite3_extended_errcode(handle);
+			result->error	= sqlite3_errmsg(handle);
+		}
+
+		//	ends the read transaction; values were SQLITE_STATIC
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+
+		result->rows.ShrinkToFit();
+		return result;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ResultCache
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ResultCache::IcuSqlite3ResultCache(
+	IcuSqlite3Database& db,
+	const IcuSqlite3ResultCacheOptions& options /*= IcuSqlite3ResultCacheOptions()*/)
+	: m_db(db)
+	, m_state(new IcuSqlite3ResultCacheState(options))
+{
+}
+
+IcuSqlite3ResultCache::~IcuSqlite3ResultCache()
+{
+	Detach();
+}
+
+bool IcuSqlite3ResultCache::Attach()
+{
+	sqlite3* db = (sqlite3*)m_db.GetDatabaseHandle();
+	if(nullptr == db) {
+		return false;
+	}
+
+	IcuSqlite3DbLock lock(db);
+	if(m_db.m_resultCache == this) {
+		return true;
+	}
+	if(nullptr != m_db.m_resultCache || m_db.IsChangeStreamRunning()) {
+		return false;	//	the update hook is taken
+	}
+
+	m_state->Attach(db);
+	m_db.m_resultCache = this;
+	return true;
+}
+
+void IcuSqlite3ResultCache::Detach()
+{
+	sqlite3* db = m_state->db;
+	if(nullptr == db) {
+		return;
+	}
+
+	IcuSqlite3DbLock lock(db);
+	m_state->Detach();
+	m_db.m_resultCache = nullptr;
+}
+
+bool IcuSqlite3ResultCache::IsAttached() const
+{
+	return nullptr != m_state->db;
+}
+
+IcuSqlite3CachedResult IcuSqlite3ResultCache::ExecuteQuery(
+	const char* sql,
+	const IcuSqlite3QueryParams& params /*= IcuSqlite3QueryParams()*/)
+{
+	std::shared_ptr<IcuSqlite3CachedRows> failed(new IcuSqlite3CachedRows());
+	sqlite3* db = (sqlite3*)m_db.GetDatabaseHandle();
+	if(nullptr == db || nullptr == sql) {
+		failed->rc		= SQLITE_MISUSE;
+		failed->error	= (nullptr == db) ? "database is not open" : "no SQL";
+		return IcuSqlite3CachedResult(failed, false);
+	}
+
+	IcuSqlite3DbLock lock(db);
+	IcuSqlite3ResultCacheState* state = m_state.get();
+	if(nullptr == state->db) {
+		//
+		//	Detached: plain execution
+		//
+		sqlite3_stmt* stmt = nullptr;
+		if(SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) || nullptr == stmt) {
+			failed->rc		= (nullptr == stmt && SQLITE_OK == sqlite3_errcode(db)) ? 
+				SQLITE_MISUSE : sqlite3_extended_errcode(db);
+			failed->error	= (SQLITE_MISUSE == failed->rc) ? "empty statement" : sqlite3_errmsg(db);
+			sqlite3_finalize(stmt);
+			return IcuSqlite3CachedResult(failed, false);
+		}
+		std::shared_ptr<const IcuSqlite3CachedRows> rows = IcuSqlite3ResultCacheState::Run(db, stmt, params);
+		sqlite3_finalize(stmt);
+		++state->uncacheable;
+		return IcuSqlite3CachedResult(rows, false);
+	}
+
+	state->SyncLocalWrites();
+
+	std::string key;
+	IcuSqlite3NormalizeSql(sql, key);
+
+	IcuSqlite3ResultCacheState::Query* query = nullptr;
+	for(int attempt = 0; attempt < 2; ++attempt) {
+		query = state->GetQuery(m_db, sql, key, failed->rc, failed->error);
+		if(nullptr == query) {
+			return IcuSqlite3CachedResult(failed, false);
+		}
+		if(state->CheckSchemas(query)) {
+			break;
+		}
+		query = nullptr;	//	schema changed; prepare again
+	}
+	if(nullptr == query) {
+		failed->rc		= SQLITE_SCHEMA;
+		failed->error	= "database schema is changing";
+		return IcuSqlite3CachedResult(failed, false);
+	}
+
+	const uint64_t hash = params.GetHash();
+	if(query->cacheable) {
+		std::shared_ptr<const IcuSqlite3CachedRows> rows = state->Lookup(query, params, hash);
+		if(nullptr != rows.get()) {
+			++state->hits;
+			return IcuSqlite3CachedResult(rows, true);
+		}
+	}
+
+	std::shared_ptr<const IcuSqlite3CachedRows> rows = IcuSqlite3ResultCacheState::Run(db, query->stmt, params);
+
+	//
+	//	Uncommitted rows would outlive a ROLLBACK, which the hook doesn't see
+	//
+	const size_t size = rows->GetMemoryBytes();
+	if(query->cacheable && SQLITE_OK == rows->rc && 0 != sqlite3_get_autocommit(db) &&
+		size <= static_cast<size_t>(state->options.maxEntryBytes) &&
+		size <= static_cast<size_t>(state->options.maxBytes))
+	{
+		state->Store(query, params, hash, rows, size);
+		++state->misses;
+	} else {
+		++state->uncacheable;
+	}
+	return IcuSqlite3CachedResult(rows, false);
+}
+
+IcuSqlite3CachedResult IcuSqlite3ResultCache::ExecuteQuery(
+	const UnicodeString& sql,
+	const IcuSqlite3QueryParams& params /*= IcuSqlite3QueryParams()*/)
+{
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteQuery(utf8Sql.c_str(), params);
+}
+
+void IcuSqlite3ResultCache::InvalidateTable(
+	const UnicodeString& tableName,
+	const UnicodeString& schema /*= "main"*/)
+{
+	sqlite3* db = m_state->db;
+	if(nullptr == db) {
+		return;
+	}
+
+	IcuSqlite3Utf8 utf8Table(tableName);
+	IcuSqlite3Utf8 utf8Schema(schema);
+
+	IcuSqlite3DbLock lock(db);
+	for(std::map<std::pair<std::string, std::string>, std::unique_ptr<IcuSqlite3ResultCacheState::Table> >::iterator 
+		it = m_state->tables.begin(); it != m_state->tables.end(); ++it)
+	{
+		if(0 == sqlite3_stricmp(it->first.first.c_str(), utf8Schema) &&
+			0 == sqlite3_stricmp(it->first.second.c_str(), utf8Table))
+		{
+			++it->second->generation;
+		}
+	}
+}
+
+void IcuSqlite3ResultCache::Clear()
+{
+	sqlite3* db = m_state->db;
+	if(nullptr == db) {
+		return;
+	}
+
+	IcuSqlite3DbLock lock(db);
+	m_state->Flush();
+}
+
+void IcuSqlite3ResultCache::GetMetrics(
+	IcuSqlite3ResultCacheMetrics& metrics) const
+{
+	metrics.hits			= m_state->hits;
+	metrics.misses			= m_state->misses;
+	metrics.uncacheable		= m_state->uncacheable;
+	metrics.evictions		= m_state->evictions;
+	metrics.invalidations	= m_state->invalidations;
+	metrics.flushes			= m_state->flushes;
+
+	IcuSqlite3DbLock lock(m_state->db);
+	metrics.entries			= static_cast<int64_t>(m_state->entries.size());
+	metrics.bytes			= static_cast<int64_t>(m_state->bytes);
+}
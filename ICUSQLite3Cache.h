@@ -0,0 +1,177 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_CACHE_H__
+#define __ICU_SQLITE3_CACHE_H__
+
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Params.h"
+
+//	STL
+#include <memory>
+#include <string>
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ResultCacheOptions
+{
+	IcuSqlite3ResultCacheOptions();
+
+	int64_t		maxBytes;			//	budget for cached rows; least recently used go first
+	int64_t		maxEntryBytes;		//	larger results are returned but not kept
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ResultCacheMetrics
+{
+	IcuSqlite3ResultCacheMetrics();
+
+	int64_t		hits;
+	int64_t		misses;				//	executed and kept
+	int64_t		uncacheable;		//	executed, not kept (see IcuSqlite3ResultCache)
+	int64_t		evictions;			//	dropped for the memory budget
+	int64_t		invalidations;		//	dropped because a table they read changed
+	int64_t		flushes;			//	everything dropped at once
+	int64_t		entries;
+	int64_t		bytes;
+};
+
+struct IcuSqlite3CachedRows;
+
+//
+//	Rows of one IcuSqlite3ResultCache::ExecuteQuery(), fully materialized.
+//	Reads like IcuSqlite3ResultSet: call NextRow() before the first row.
+//	Copies share the rows; each has its own position. The rows stay valid
+//	after the entry is evicted or the cache is destroyed.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3CachedResult
+{
+public:
+	IcuSqlite3CachedResult();
+
+	bool NextRow();
+	bool Eof() const;
+	bool IsOk() const;
+
+	int GetErrorCode() const;
+	std::string GetErrorMessage() const;
+
+	//
+	//	Served from the cache rather than executed
+	//
+	bool IsFromCache() const { return m_fromCache; }
+
+	int GetRowCount() const;
+	int GetColumnCount() const;
+	UnicodeString GetColumnName(const int colIdx) const;
+	EIcuSqlite3ColumnTypes GetColumnType(const int colIdx) const;
+
+	int32_t GetInt(const int colIdx, const int32_t defVal = 0) const;
+	int64_t GetInt64(const int colIdx, const int64_t defVal = 0) const;
+	double GetDouble(const int colIdx, const double defVal = 0.0) const;
+	UnicodeString GetString(const int colIdx, const UnicodeString& defVal = "") const;
+	std::string GetStringUTF8(const int colIdx, const std::string& defVal = "") const;
+	bool GetBool(const int colIdx, const bool defVal = false) const;
+	const unsigned char* GetBlob(const int colIdx, int& len) const;
+	bool IsNull(const int colIdx) const;
+
+private:
+	std::shared_ptr<const IcuSqlite3CachedRows>	m_rows;
+	int											m_row;
+	bool										m_fromCache;
+
+	IcuSqlite3CachedResult(const std::shared_ptr<const IcuSqlite3CachedRows>& rows, const bool fromCache);
+
+	friend class IcuSqlite3ResultCache;
+};
+
+struct IcuSqlite3ResultCacheState;
+
+//
+//	Keeps the rows of repeated read queries so that running one again,
+//	with the same bindings and unchanged data, is a hash lookup.
+//
+//	Entries are keyed on the SQL with comments and insignificant
+//	whitespace removed, plus a hash of the bound values (compared in full
+//	on a hit). The tables a statement reads are recorded when it is
+//	prepared, views expanded. While attached the cache holds the
+//	connection's update hook, so a write on this connection drops just
+//	the entries that read the written table. Writes the hook doesn't
+//	report (WITHOUT ROWID tables, DELETE of every row) empty the whole
+//	cache, as do schema changes. Commits from other connections are seen
+//	through PRAGMA data_version and drop the entries reading that schema.
+//
+//	Executed but never kept:
+//	 - statements that write, or call random(), date / time functions and
+//	   the like, or read pragma_* / dbstat style virtual tables. Other
+//	   application defined functions are assumed deterministic.
+//	 - queries run inside a transaction; hits are still served
+//	 - results over maxEntryBytes
+//
+//	Attach() fails while a change stream is running, and
+//	StartChangeStream() fails while a cache is attached. Detached, queries
+//	simply execute. Closing the database detaches the cache.
+//
+//		IcuSqlite3ResultCache cache(db);
+//		cache.Attach();
+//
+//		IcuSqlite3QueryParams params;
+//		params.Bind(1, regionId);
+//		IcuSqlite3CachedResult rows = cache.ExecuteQuery(
+//			"SELECT day, SUM(amount) FROM sales WHERE region = ? GROUP BY day;", params);
+//		while(rows.NextRow()) { ... }
+//
+//	Calls are serialized on the connection's mutex and may come from any
+//	thread the connection's threading mode allows.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3ResultCache
+{
+public:
+	explicit IcuSqlite3ResultCache(IcuSqlite3Database& db,
+		const IcuSqlite3ResultCacheOptions& options = IcuSqlite3ResultCacheOptions());
+	~IcuSqlite3ResultCache();	//	Detach()
+
+	bool Attach();
+	void Detach();
+	bool IsAttached() const;
+
+	IcuSqlite3CachedResult ExecuteQuery(const char* sql,
+		const IcuSqlite3QueryParams& params = IcuSqlite3QueryParams());
+	IcuSqlite3CachedResult ExecuteQuery(const UnicodeString& sql,
+		const IcuSqlite3QueryParams& params = IcuSqlite3QueryParams());
+
+	//
+	//	For changes the cache can't see: virtual tables, or application
+	//	defined functions with side effects
+	//
+	void InvalidateTable(const UnicodeString& tableName, const UnicodeString& schema = "main");
+	void Clear();
+
+	void GetMetrics(IcuSqlite3ResultCacheMetrics& metrics) const;
+
+private:
+	IcuSqlite3Database&							m_db;
+	std::unique_ptr<IcuSqlite3ResultCacheState>	m_state;
+
+	IcuSqlite3ResultCache(const IcuSqlite3ResultCache&);	//	prevent copy
+	IcuSqlite3ResultCache& operator=(const IcuSqlite3ResultCache&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_CACHE_H__
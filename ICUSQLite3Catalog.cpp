@@ -0,0 +1,423 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Catalog.h"
+#include "ICUSQLite3Internal.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <utility>
+
+//
+//	SQLite folds identifiers for ASCII only
+//
+static std::string IcuSqlite3FoldName(
+	const std::string& name)
+{
+	std::string folded(name);
+	for(size_t n = 0; n < folded.size(); ++n) {
+		if(folded[n] >= 'A' && folded[n] <= 'Z') {
+			folded[n] = static_cast<char>(folded[n] - 'A' + 'a');
+		}
+	}
+	return folded;
+}
+
+static sqlite3_stmt* IcuSqlite3PrepareCatalog(
+	void* db, const std::string& sql, const bool persistent)
+{
+	sqlite3_stmt* stmt = nullptr;
+#if SQLITE_VERSION_NUMBER >= 3020000
+	sqlite3_prepare_v3((sqlite3*)db, sql.c_str(), -1, 
+		persistent ? SQLITE_PREPARE_PERSISTENT : 0, &stmt, nullptr);
+#else
+	(void)persistent;
+	sqlite3_prepare_v2((sqlite3*)db, sql.c_str(), -1, &stmt, nullptr);
+#endif	//	SQLITE_VERSION_NUMBER >= 3020000
+	return stmt;
+}
+
+IcuSqlite3SchemaCatalog::IcuSqlite3SchemaCatalog(
+	void* db)
+	: m_db(db)
+	, m_listStmt(nullptr)
+{
+}
+
+IcuSqlite3SchemaCatalog::~IcuSqlite3SchemaCatalog()
+{
+	for(size_t n = 0; n < m_schemas.size(); ++n) {
+		FinalizeSchema(*m_schemas[n]);
+	}
+	sqlite3_finalize((sqlite3_stmt*)m_listStmt);
+}
+
+void IcuSqlite3SchemaCatalog::FinalizeSchema(
+	Schema& schema)
+{
+	if(nullptr != schema.versionStmt) {
+		sqlite3_finalize((sqlite3_stmt*)schema.versionStmt);
+		schema.versionStmt = nullptr;
+	}
+}
+
+void IcuSqlite3SchemaCatalog::Invalidate()
+{
+	for(size_t n = 0; n < m_schemas.size(); ++n) {
+		m_schemas[n]->version = -1;
+		m_schemas[n]->tables.clear();
+		m_schemas[n]->indexes.clear();
+	}
+}
+
+//
+//	Every (name, file) currently attached, in database_list order
+//
+bool IcuSqlite3SchemaCatalog::ListDatabases(
+	std::vector<std::pair<std::string, std::string> >& current)
+{
+	current.clear();
+
+#if SQLITE_VERSION_NUMBER >= 3039000
+	//
+	//	Like PRAGMA database_list, skip slots with nothing open (an unused
+	//	temp schema); those have no filename
+	//
+	for(int n = 0; ; ++n) {
+		const char* name = sqlite3_db_name((sqlite3*)m_db, n);
+		if(nullptr == name) {
+			break;
+		}
+		const char* file = sqlite3_db_filename((sqlite3*)m_db, name);
+		if(nullptr != file) {
+			current.push_back(std::make_pair(std::string(name), std::string(file)));
+		}
+	}
+#else
+	if(nullptr == m_listStmt) {
+		m_listStmt = IcuSqlite3PrepareCatalog(m_db, "PRAGMA database_list;", true);
+		if(nullptr == m_listStmt) {
+			return false;
+		}
+	}
+	sqlite3_stmt* stmt = (sqlite3_stmt*)m_listStmt;
+	while(SQLITE_ROW == sqlite3_step(stmt)) {
+		const char* name = (const char*)sqlite3_column_text(stmt, 1);
+		const char* file = (const char*)sqlite3_column_text(stmt, 2);
+		current.push_back(std::make_pair(std::string(name ? name : ""), std::string(file ? file : "")));
+	}
+	sqlite3_reset(stmt);
+#endif	//	SQLITE_VERSION_NUMBER >= 3039000
+	return true;
+}
+
+bool IcuSqlite3SchemaCatalog::RefreshDatabases()
+{
+	//
+	//	Runs on every lookup and the list hardly ever changes: compare it
+	//	in place, without copying any names
+	//
+	size_t count = 0;
+	bool same = true;
+
+#if SQLITE_VERSION_NUMBER >= 3039000
+	for(int n = 0; same; ++n) {
+		const char* name = sqlite3_db_name((sqlite3*)m_db, n);
+		if(nullptr == name) {
+			break;
+		}
+		const char* file = sqlite3_db_filename((sqlite3*)m_db, name);
+		if(nullptr == file) {
+			continue;	//	skipped by ListDatabases() too
+		}
+		same = (count < m_schemas.size() && 
+			m_schemas[count]->name == name && m_schemas[count]->file == file);
+		++count;
+	}
+#else
+	if(nullptr == m_listStmt) {
+		m_listStmt = IcuSqlite3PrepareCatalog(m_db, "PRAGMA database_list;", true);
+		if(nullptr == m_listStmt) {
+			return false;
+		}
+	}
+	sqlite3_stmt* stmt = (sqlite3_stmt*)m_listStmt;
+	while(same && SQLITE_ROW == sqlite3_step(stmt)) {
+		const char* name = (const char*)sqlite3_column_text(stmt, 1);
+		const char* file = (const char*)sqlite3_column_text(stmt, 2);
+		same = (count < m_schemas.size() && 
+			m_schemas[count]->name == (name ? name : "") && m_schemas[count]->file == (file ? file : ""));
+		++count;
+	}
+	sqlite3_reset(stmt);
+#endif	//	SQLITE_VERSION_NUMBER >= 3039000
+
+	if(same && count == m_schemas.size()) {
+		return true;
+	}
+
+	std::vector<std::pair<std::string, std::string> > current;
+	if(!ListDatabases(current)) {
+		return false;
+	}
+
+	//
+	//	Keep what's still attached under the same name and file
+	//
+	std::vector<std::unique_ptr<Schema> > schemas;
+	for(size_t n = 0; n < current.size(); ++n) {
+		std::unique_ptr<Schema> schema;
+		for(size_t old = 0; old < m_schemas.size(); ++old) {
+			if(nullptr != m_schemas[old].get() &&
+				current[n].first == m_schemas[old]->name && current[n].second == m_schemas[old]->file)
+			{
+				schema = std::move(m_schemas[old]);
+				break;
+			}
+		}
+		if(nullptr == schema.get()) {
+			schema.reset(new Schema());
+			schema->name = current[n].first;
+			schema->file = current[n].second;
+		}
+		schemas.push_back(std::move(schema));
+	}
+
+	for(size_t old = 0; old < m_schemas.size(); ++old) {
+		if(nullptr != m_schemas[old].get()) {
+			FinalizeSchema(*m_schemas[old]);
+		}
+	}
+	m_schemas.swap(schemas);
+	return true;
+}
+
+IcuSqlite3SchemaCatalog::Schema* IcuSqlite3SchemaCatalog::FindSchema(
+	const std::string& dbName)
+{
+	//	sqlite3_stricmp() folds ASCII only, like IcuSqlite3FoldName()
+	const char* name = dbName.empty() ? "main" : dbName.c_str();
+	for(size_t n = 0; n < m_schemas.size(); ++n) {
+		if(0 == sqlite3_stricmp(name, m_schemas[n]->name.c_str())) {
+			return m_schemas[n].get();
+		}
+	}
+	return nullptr;
+}
+
+IcuSqlite3SchemaCatalog::Schema* IcuSqlite3SchemaCatalog::GetSchema(
+	const std::string& dbName)
+{
+	if(!RefreshDatabases()) {
+		return nullptr;
+	}
+
+	Schema* schema = FindSchema(dbName);
+	if(nullptr == schema) {
+		return nullptr;
+	}
+
+	if(nullptr == schema->versionStmt) {
+		schema->versionStmt = IcuSqlite3PrepareCatalog(m_db, 
+			"PRAGMA " + IcuSqlite3QuoteName(schema->name) + ".schema_version;", true);
+		if(nullptr == schema->versionStmt) {
+			return nullptr;
+		}
+	}
+
+	sqlite3_stmt* stmt = (sqlite3_stmt*)schema->versionStmt;
+	const bool ok = (SQLITE_ROW == sqlite3_step(stmt));
+	const int version = ok ? sqlite3_column_int(stmt, 0) : -1;
+	sqlite3_reset(stmt);
+	if(!ok) {
+		return nullptr;
+	}
+
+	if(version != schema->version && !LoadSchema(*schema, version)) {
+		return nullptr;
+	}
+	return schema;
+}
+
+bool IcuSqlite3SchemaCatalog::LoadSchema(
+	Schema& schema, const int version)
+{
+	schema.version = -1;
+	schema.tables.clear();
+	schema.indexes.clear();
+
+	sqlite3_stmt* stmt = IcuSqlite3PrepareCatalog(m_db,
+		"SELECT type, name FROM " + IcuSqlite3QuoteName(schema.name) + 
+		".sqlite_master WHERE type IN ('table', 'index');", false);
+	if(nullptr == stmt) {
+		return false;
+	}
+
+	int rc;
+	while(SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+		const char* type = (const char*)sqlite3_column_text(stmt, 0);
+		const char* name = (const char*)sqlite3_column_text(stmt, 1);
+		if(nullptr == type || nullptr == name) {
+			continue;
+		}
+		if('t' == type[0]) {
+			schema.tables[IcuSqlite3FoldName(name)];
+		} else {
+			schema.indexes.insert(IcuSqlite3FoldName(name));
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	if(SQLITE_DONE != rc) {
+		schema.tables.clear();
+		schema.indexes.clear();
+		return false;
+	}
+
+	//
+	//	version was read before loading; a change in between just reloads
+	//	again. Inside a transaction a rollback can bring this version back
+	//	with other contents, so don't keep it.
+	//
+	schema.version = sqlite3_get_autocommit((sqlite3*)m_db) ? version : -1;
+	return true;
+}
+
+bool IcuSqlite3SchemaCatalog::LoadColumns(
+	const Schema& schema, const std::string& table, Table& entry)
+{
+	sqlite3_stmt* stmt = IcuSqlite3PrepareCatalog(m_db,
+		"PRAGMA " + IcuSqlite3QuoteName(schema.name) + 
+		".table_info(" + IcuSqlite3QuoteName(table) + ");", false);
+	if(nullptr == stmt) {
+		return false;
+	}
+
+	entry.columns.clear();
+	entry.columnKeys.clear();
+
+	int rc;
+	while(SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+		const char* name = (const char*)sqlite3_column_text(stmt, 1);
+		if(nullptr != name) {
+			entry.columns.push_back(name);
+			entry.columnKeys.insert(IcuSqlite3FoldName(name));
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	entry.columnsLoaded = (SQLITE_DONE == rc);
+	return entry.columnsLoaded;
+}
+
+IcuSqlite3SchemaCatalog::Table* IcuSqlite3SchemaCatalog::GetTable(
+	const std::string& dbName, const std::string& table, const bool withColumns)
+{
+	Schema* schema = GetSchema(dbName);
+	if(nullptr == schema) {
+		return nullptr;
+	}
+
+	std::unordered_map<std::string, Table>::iterator it = schema->tables.find(IcuSqlite3FoldName(table));
+	if(schema->tables.end() == it) {
+		return nullptr;
+	}
+	if(withColumns && !it->second.columnsLoaded && !LoadColumns(*schema, table, it->second)) {
+		return nullptr;
+	}
+	return &it->second;
+}
+
+bool IcuSqlite3SchemaCatalog::HasTable(
+	const std::string& dbName, const std::string& table)
+{
+	return nullptr != GetTable(dbName, table, false);
+}
+
+bool IcuSqlite3SchemaCatalog::HasIndex(
+	const std::string& dbName, const std::string& index)
+{
+	Schema* schema = GetSchema(dbName);
+	return nullptr != schema && schema->indexes.end() != schema->indexes.find(IcuSqlite3FoldName(index));
+}
+
+bool IcuSqlite3SchemaCatalog::HasColumn(
+	const std::string& dbName, const std::string& table, const std::string& column)
+{
+	Table* entry = GetTable(dbName, table, true);
+	return nullptr != entry && entry->columnKeys.end() != entry->columnKeys.find(IcuSqlite3FoldName(column));
+}
+
+bool IcuSqlite3SchemaCatalog::GetColumns(
+	const std::string& dbName, const std::string& table, std::vector<std::string>& columns)
+{
+	Table* entry = GetTable(dbName, table, true);
+	if(nullptr == entry) {
+		columns.clear();
+		return false;
+	}
+	columns = entry->columns;
+	return true;
+}
+
+bool IcuSqlite3SchemaCatalog::HasDatabase(
+	const std::string& dbName)
+{
+	//	exact name, as PRAGMA database_list reports it
+	if(!RefreshDatabases()) {
+		return false;
+	}
+	for(size_t n = 0; n < m_schemas.size(); ++n) {
+		if(dbName == m_schemas[n]->name) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int IcuSqlite3SchemaCatalog::GetDatabaseCount()
+{
+	return RefreshDatabases() ? static_cast<int>(m_schemas.size()) : 0;
+}
+
+void IcuSqlite3SchemaCatalog::GetDatabases(
+	std::set<std::string>& dbNames, std::set<std::string>& dbFiles)
+{
+	dbNames.clear();
+	dbFiles.clear();
+	if(!RefreshDatabases()) {
+		return;
+	}
+	for(size_t n = 0; n < m_schemas.size(); ++n) {
+		dbNames.insert(m_schemas[n]->name);
+		dbFiles.insert(m_schemas[n]->file);
+	}
+}
@@ -0,0 +1,119 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_CATALOG_H__
+#define __ICU_SQLITE3_CATALOG_H__
+
+//
+//	Internal: used by IcuSqlite3Database, not part of the public API
+//
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//
+//	Per connection cache of the attached databases and, per database, its
+//	tables, indexes and (loaded on first use) table columns. Names are
+//	matched case-insensitively (ASCII), as SQLite does.
+//
+//	The database list is checked on every lookup by walking the
+//	connection's schema slots, which costs no statement (before SQLite
+//	3.39: stepping a kept prepared PRAGMA database_list), comparing in
+//	place; only a changed list allocates anything. A database's
+//	objects are reloaded when its PRAGMA schema_version no longer matches
+//	the one they were loaded at; that check is one step of a statement
+//	kept prepared per database.
+//
+//	schema_version goes back down on ROLLBACK (TO), so a schema change
+//	rolled back and redone as a different change can repeat a version.
+//	Objects loaded inside a transaction therefore only serve the lookup
+//	that loaded them; whatever was loaded outside one matches the
+//	committed schema, which a rollback returns to.
+//
+class IcuSqlite3SchemaCatalog
+{
+public:
+	explicit IcuSqlite3SchemaCatalog(void* db);
+	~IcuSqlite3SchemaCatalog();
+
+	void Invalidate();
+
+	//
+	//	An empty dbName means "main"
+	//
+	bool HasTable(const std::string& dbName, const std::string& table);
+	bool HasIndex(const std::string& dbName, const std::string& index);
+	bool HasColumn(const std::string& dbName, const std::string& table, const std::string& column);
+	bool GetColumns(const std::string& dbName, const std::string& table, std::vector<std::string>& columns);
+
+	bool HasDatabase(const std::string& dbName);
+	int GetDatabaseCount();
+	void GetDatabases(std::set<std::string>& dbNames, std::set<std::string>& dbFiles);
+
+private:
+	struct Table
+	{
+		Table() : columnsLoaded(false) {}
+
+		bool							columnsLoaded;
+		std::vector<std::string>		columns;		//	declared order, as named
+		std::unordered_set<std::string>	columnKeys;		//	folded
+	};
+
+	struct Schema
+	{
+		Schema() : versionStmt(nullptr), version(-1) {}
+
+		std::string								name;
+		std::string								file;
+		void*									versionStmt;	//	PRAGMA "name".schema_version
+		int										version;		//	-1 until loaded
+		std::unordered_map<std::string, Table>	tables;			//	folded name
+		std::unordered_set<std::string>			indexes;		//	folded name
+	};
+
+	void*									m_db;
+	void*									m_listStmt;	//	PRAGMA database_list, SQLite < 3.39
+	std::vector<std::unique_ptr<Schema> >	m_schemas;	//	in database_list order
+
+	bool RefreshDatabases();
+	bool ListDatabases(std::vector<std::pair<std::string, std::string> >& current);
+	Schema* FindSchema(const std::string& dbName);
+	Schema* GetSchema(const std::string& dbName);
+	Table* GetTable(const std::string& dbName, const std::string& table, const bool withColumns);
+	bool LoadSchema(Schema& schema, const int version);
+	bool LoadColumns(const Schema& schema, const std::string& table, Table& entry);
+	void FinalizeSchema(Schema& schema);
+
+	IcuSqlite3SchemaCatalog(const IcuSqlite3SchemaCatalog&);	//	prevent copy
+	IcuSqlite3SchemaCatalog& operator=(const IcuSqlite3SchemaCatalog&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_CATALOG_H__
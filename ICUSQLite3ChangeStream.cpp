@@ -0,0 +1,534 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3ChangeStream.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <cctype>
+#include <cstring>
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ChangeBatch / IcuSqlite3ChangeStreamOptions /
+//	IcuSqlite3ChangeStreamMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ChangeBatch::IcuSqlite3ChangeBatch()
+	: sequence(0)
+	, truncated(false)
+	, lostBefore(false)
+{
+}
+
+void IcuSqlite3ChangeBatch::Clear()
+{
+	//	keeps capacity; batches are recycled through the queue
+	sequence	= 0;
+	truncated	= false;
+	lostBefore	= false;
+	changes.clear();
+	tables.clear();
+}
+
+IcuSqlite3ChangeStreamOptions::IcuSqlite3ChangeStreamOptions()
+	: queueBatches(64)
+	, maxChangesPerBatch(1024)
+{
+}
+
+IcuSqlite3ChangeStreamMetrics::IcuSqlite3ChangeStreamMetrics()
+	: batches(0)
+	, changes(0)
+	, truncatedBatches(0)
+	, droppedBatches(0)
+	, queuedBatches(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ChangeStream
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ChangeStream::IcuSqlite3ChangeStream(
+	void* db, IcuSqlite3ChangeListener* listener,
+	const IcuSqlite3ChangeStreamOptions& options)
+	: m_db(db)
+	, m_listener(listener)
+	, m_options(options)
+	, m_hooked(false)
+	, m_tracer(nullptr)
+	, m_traceMask(0)
+	, m_sequence(0)
+	, m_lost(false)
+	, m_committing(false)
+	, m_queue(options.queueBatches > 0 ? options.queueBatches : 64)
+	, m_stop(false)
+	, m_batches(0)
+	, m_changes(0)
+	, m_truncatedBatches(0)
+	, m_droppedBatches(0)
+{
+	if(m_options.maxChangesPerBatch < 0) {
+		m_options.maxChangesPerBatch = 0;
+	}
+	m_pending.changes.reserve(m_options.maxChangesPerBatch);
+	m_lastNameIn[0] = m_lastNameIn[1] = nullptr;
+	m_lastNameOut[0] = m_lastNameOut[1] = nullptr;
+}
+
+IcuSqlite3ChangeStream::~IcuSqlite3ChangeStream()
+{
+	Stop();
+}
+
+bool IcuSqlite3ChangeStream::Start()
+{
+	if(nullptr == m_listener) {
+		return false;
+	}
+
+	m_thread = std::thread(&IcuSqlite3ChangeStream::Run, this);
+
+	sqlite3* db = (sqlite3*)m_db;
+#if defined(SQLITE_ENABLE_PREUPDATE_HOOK) && !ICUSQLITE_HAVE_SESSION
+	//
+	//	Also sees WITHOUT ROWID tables and rowid changing UPDATEs. Left
+	//	to the session extension when it is in use; there is only one
+	//	preupdate hook per connection.
+	//
+	typedef void (*XPREUPDATE)(void*, sqlite3*, int, const char*, const char*,
+		sqlite3_int64, sqlite3_int64);
+	sqlite3_preupdate_hook(db, (XPREUPDATE)PreUpdateCallback, this);
+#else
+	typedef void (*XUPDATE)(void*, int, const char*, const char*, sqlite3_int64);
+	sqlite3_update_hook(db, (XUPDATE)UpdateCallback, this);
+#endif	//	defined(SQLITE_ENABLE_PREUPDATE_HOOK) && !ICUSQLITE_HAVE_SESSION
+	sqlite3_commit_hook(db, CommitCallback, this);
+	sqlite3_rollback_hook(db, RollbackCallback, this);
+	m_hooked = true;
+	return true;
+}
+
+void IcuSqlite3ChangeStream::Stop()
+{
+	if(m_hooked) {
+		Settle();
+	}
+	Unhook();
+
+	if(m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_wakeLock);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+	}
+}
+
+void IcuSqlite3ChangeStream::Unhook()
+{
+	if(!m_hooked) {
+		return;
+	}
+
+	sqlite3* db = (sqlite3*)m_db;
+#if defined(SQLITE_ENABLE_PREUPDATE_HOOK) && !ICUSQLITE_HAVE_SESSION
+	sqlite3_preupdate_hook(db, nullptr, nullptr);
+#else
+	sqlite3_update_hook(db, nullptr, nullptr);
+#endif	//	defined(SQLITE_ENABLE_PREUPDATE_HOOK) && !ICUSQLITE_HAVE_SESSION
+	sqlite3_commit_hook(db, nullptr, nullptr);
+	sqlite3_rollback_hook(db, nullptr, nullptr);
+	m_hooked = false;
+}
+
+void IcuSqlite3ChangeStream::SetTracer(
+	IcuSqlite3Tracer* tracer, const unsigned traceMask)
+{
+	m_tracer	= tracer;
+	m_traceMask	= traceMask;
+}
+
+unsigned IcuSqlite3ChangeStream::GetTraceMask() const
+{
+#if SQLITE_VERSION_NUMBER >= 3014000
+	return ICUSQLITE_TRACE_STMT | ICUSQLITE_TRACE_PROFILE | 
+		((nullptr != m_tracer) ? m_traceMask : 0);
+#else
+	return 0;	//	no statement trace; published from the commit hook
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+}
+
+void IcuSqlite3ChangeStream::Trace(
+	const EIcuSqlite3TraceEvent event, void* p, void* x)
+{
+	if(ICUSQLITE_TRACE_STMT == event) {
+		//
+		//	Whatever COMMIT ran before has finished by now, even one that
+		//	only completed in sqlite3_reset() (after its PROFILE event)
+		//
+		Settle();
+#if SQLITE_VERSION_NUMBER >= 3014000
+		//	x is "-- " prefixed for triggers and nested statements
+		OnStatement(sqlite3_sql((sqlite3_stmt*)p));
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+	} else if(ICUSQLITE_TRACE_PROFILE == event) {
+		Settle();
+	}
+
+	if(nullptr != m_tracer && 0 != (event & m_traceMask)) {
+		m_tracer->Trace(event, p, x);
+	}
+}
+
+void IcuSqlite3ChangeStream::GetMetrics(
+	IcuSqlite3ChangeStreamMetrics& metrics) const
+{
+	metrics.batches				= m_batches;
+	metrics.changes				= m_changes;
+	metrics.truncatedBatches	= m_truncatedBatches;
+	metrics.droppedBatches		= m_droppedBatches;
+	metrics.queuedBatches		= static_cast<int64_t>(m_queue.GetSize());
+}
+
+/*static*/
+void IcuSqlite3ChangeStream::UpdateCallback(
+	void* ctxt, int op, const char* dbName, const char* table, int64_t rowid)
+{
+	static_cast<IcuSqlite3ChangeStream*>(ctxt)->Record(op, dbName, table, rowid, rowid);
+}
+
+/*static*/
+void IcuSqlite3ChangeStream::PreUpdateCallback(
+	void* ctxt, void* /*db*/, int op, const char* dbName, const char* table,
+	int64_t oldRowid, int64_t newRowid)
+{
+	//	INSERT reports the new rowid as newRowid
+	if(SQLITE_INSERT == op) {
+		oldRowid = newRowid;
+	}
+	static_cast<IcuSqlite3ChangeStream*>(ctxt)->Record(op, dbName, table, oldRowid, newRowid);
+}
+
+/*static*/
+int IcuSqlite3ChangeStream::CommitCallback(
+	void* ctxt)
+{
+	IcuSqlite3ChangeStream* stream = static_cast<IcuSqlite3ChangeStream*>(ctxt);
+#if SQLITE_VERSION_NUMBER >= 3014000
+	stream->m_committing = true;	//	may still fail; see Settle()
+#else
+	stream->Publish();
+#endif	//	SQLITE_VERSION_NUMBER >= 3014000
+	return 0;	//	let the commit proceed
+}
+
+/*static*/
+void IcuSqlite3ChangeStream::RollbackCallback(
+	void* ctxt)
+{
+	IcuSqlite3ChangeStream* stream = static_cast<IcuSqlite3ChangeStream*>(ctxt);
+	stream->m_pending.Clear();
+	stream->m_committing = false;
+	stream->m_savepoints.clear();
+}
+
+void IcuSqlite3ChangeStream::Settle()
+{
+	if(!m_committing) {
+		return;
+	}
+	m_committing = false;
+
+	//
+	//	A COMMIT that failed (SQLITE_BUSY) leaves the transaction open:
+	//	keep collecting, a retry publishes the whole batch. Anything
+	//	worse rolls back and the rollback hook has cleared it already.
+	//
+	if(0 != sqlite3_get_autocommit((sqlite3*)m_db)) {
+		m_savepoints.clear();
+		Publish();
+	}
+}
+
+//
+//	Next token of |sql| into |token|, identifiers unquoted; false at the
+//	end. Enough to follow the savepoint statements, nothing more.
+//
+static bool IcuSqlite3NextToken(
+	const char*& sql, std::string& token)
+{
+	token.clear();
+	for(;;) {
+		while(isspace(static_cast<unsigned char>(*sql))) {
+			++sql;
+		}
+		if('-' == sql[0] && '-' == sql[1]) {
+			while('\0' != *sql && '\n' != *sql) {
+				++sql;
+			}
+		} else if('/' == sql[0] && '*' == sql[1]) {
+			const char* end = strstr(sql + 2, "*/");
+			sql = (nullptr != end) ? end + 2 : sql + strlen(sql);
+		} else {
+			break;
+		}
+	}
+
+	const char c = *sql;
+	if('\0' == c) {
+		return false;
+	}
+
+	if('"' == c || '\'' == c || '`' == c || '[' == c) {
+		const char close = ('[' == c) ? ']' : c;
+		for(++sql; '\0' != *sql; ++sql) {
+			if(close == *sql) {
+				if(']' == close || close != sql[1]) {
+					++sql;
+					break;
+				}
+				++sql;	//	doubled quote
+			}
+			token += *sql;
+		}
+		return true;
+	}
+
+	while('_' == *sql || '$' == *sql || isalnum(static_cast<unsigned char>(*sql)) || 
+		0 != (*sql & 0x80))
+	{
+		token += *sql++;
+	}
+	if(token.empty()) {
+		token += *sql++;	//	punctuation
+	}
+	return true;
+}
+
+void IcuSqlite3ChangeStream::OnStatement(
+	const char* sql)
+{
+	if(nullptr == sql) {
+		return;
+	}
+
+	//	cheap reject: everything but SAVEPOINT / RELEASE / ROLLBACK
+	const char* s = sql;
+	if(!IcuSqlite3NextToken(s, m_token) || 
+		('S' != toupper(static_cast<unsigned char>(m_token[0])) && 
+		'R' != toupper(static_cast<unsigned char>(m_token[0]))))
+	{
+		return;
+	}
+
+	enum { OPEN, RELEASE, ROLLBACK_TO } what;
+	if(0 == sqlite3_stricmp(m_token.c_str(), "SAVEPOINT")) {
+		what = OPEN;
+	} else if(0 == sqlite3_stricmp(m_token.c_str(), "RELEASE")) {
+		what = RELEASE;
+	} else if(0 == sqlite3_stricmp(m_token.c_str(), "ROLLBACK")) {
+		//	ROLLBACK [TRANSACTION] TO [SAVEPOINT] name; plain ROLLBACK is the hook's
+		if(!IcuSqlite3NextToken(s, m_token)) {
+			return;
+		}
+		if(0 == sqlite3_stricmp(m_token.c_str(), "TRANSACTION") && 
+			!IcuSqlite3NextToken(s, m_token))
+		{
+			return;
+		}
+		if(0 != sqlite3_stricmp(m_token.c_str(), "TO")) {
+			return;
+		}
+		what = ROLLBACK_TO;
+	} else {
+		return;
+	}
+
+	if(!IcuSqlite3NextToken(s, m_token)) {
+		return;
+	}
+	if(OPEN != what && 0 == sqlite3_stricmp(m_token.c_str(), "SAVEPOINT") && 
+		!IcuSqlite3NextToken(s, m_token))
+	{
+		return;
+	}
+
+	if(OPEN == what) {
+		SavepointMark mark;
+		mark.name		= m_token;
+		mark.changes	= m_pending.changes.size();
+		mark.tables		= m_pending.tables.size();
+		mark.truncated	= m_pending.truncated;
+		m_savepoints.push_back(mark);
+		return;
+	}
+
+	//	the most recent savepoint of that name, as SQLite resolves it
+	size_t i = m_savepoints.size();
+	while(i > 0 && 0 != sqlite3_stricmp(m_savepoints[i - 1].name.c_str(), m_token.c_str())) {
+		--i;
+	}
+	if(0 == i) {
+		return;	//	not ours to follow (fails in SQLite too)
+	}
+	--i;
+
+	if(RELEASE == what) {
+		//	its rows now belong to the enclosing savepoint / transaction
+		m_savepoints.erase(m_savepoints.begin() + i, m_savepoints.end());
+	} else {
+		//	undone without firing the rollback hook; the savepoint stays open
+		const SavepointMark& mark = m_savepoints[i];
+		m_pending.changes.erase(m_pending.changes.begin() + mark.changes, m_pending.changes.end());
+		m_pending.tables.erase(m_pending.tables.begin() + mark.tables, m_pending.tables.end());
+		m_pending.truncated = mark.truncated;
+		m_savepoints.erase(m_savepoints.begin() + i + 1, m_savepoints.end());
+	}
+}
+
+const char* IcuSqlite3ChangeStream::Intern(
+	const int slot, const char* name)
+{
+	//
+	//	SQLite hands us the same pointer for every row of a table, so
+	//	the common case is one compare against the previous name
+	//
+	if(name == m_lastNameIn[slot] && 0 == strcmp(name, m_lastNameOut[slot])) {
+		return m_lastNameOut[slot];
+	}
+
+	const char* interned = m_names.insert(name).first->c_str();
+	m_lastNameIn[slot]	= name;
+	m_lastNameOut[slot]	= interned;
+	return interned;
+}
+
+void IcuSqlite3ChangeStream::Record(
+	const int op, const char* dbName, const char* table,
+	const int64_t rowid, const int64_t newRowid)
+{
+	IcuSqlite3Change change;
+	change.op		= static_cast<EIcuSqlite3ChangeOp>(op);
+	change.dbName	= Intern(0, dbName);
+	change.table	= Intern(1, table);
+	change.rowid	= rowid;
+	change.newRowid	= newRowid;
+
+	bool seen = false;
+	for(size_t i = 0; i < m_pending.tables.size(); ++i) {
+		if(m_pending.tables[i].table == change.table && 
+			m_pending.tables[i].dbName == change.dbName)
+		{
+			seen = true;
+			break;
+		}
+	}
+	if(!seen) {
+		IcuSqlite3ChangedTable changedTable;
+		changedTable.dbName	= change.dbName;
+		changedTable.table	= change.table;
+		m_pending.tables.push_back(changedTable);
+	}
+
+	if(m_pending.changes.size() < static_cast<size_t>(m_options.maxChangesPerBatch)) {
+		m_pending.changes.push_back(change);
+	} else {
+		m_pending.truncated = true;
+	}
+}
+
+void IcuSqlite3ChangeStream::Publish()
+{
+	if(m_pending.tables.empty()) {
+		return;	//	read only / no row changes
+	}
+
+	IcuSqlite3ChangeBatch* slot = m_queue.BeginPush();
+	if(nullptr == slot) {
+		//
+		//	Consumer is behind; never make the commit wait for it
+		//
+		m_droppedBatches.fetch_add(1, std::memory_order_relaxed);
+		m_lost = true;
+		m_pending.Clear();
+		return;
+	}
+
+	//
+	//	Swap buffers with the recycled slot: no copy, and the slot's
+	//	(already grown) vectors become the next pending batch
+	//
+	m_pending.sequence		= ++m_sequence;
+	m_pending.lostBefore	= m_lost;
+	m_lost = false;
+
+	if(m_pending.truncated) {
+		m_truncatedBatches.fetch_add(1, std::memory_order_relaxed);
+	}
+	m_batches.fetch_add(1, std::memory_order_relaxed);
+	m_changes.fetch_add(static_cast<int64_t>(m_pending.changes.size()), std::memory_order_relaxed);
+
+	slot->sequence		= m_pending.sequence;
+	slot->truncated		= m_pending.truncated;
+	slot->lostBefore	= m_pending.lostBefore;
+	slot->changes.swap(m_pending.changes);
+	slot->tables.swap(m_pending.tables);
+	m_queue.EndPush();
+
+	m_pending.Clear();
+	if(m_pending.changes.capacity() < static_cast<size_t>(m_options.maxChangesPerBatch)) {
+		m_pending.changes.reserve(m_options.maxChangesPerBatch);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_wakeLock);
+	}
+	m_wake.notify_one();
+}
+
+void IcuSqlite3ChangeStream::Run()
+{
+	for(;;) {
+		IcuSqlite3ChangeBatch* batch = m_queue.BeginPop();
+		if(nullptr != batch) {
+			m_listener->OnChanges(*batch);
+			batch->Clear();
+			m_queue.EndPop();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_wakeLock);
+		if(m_stop) {
+			break;	//	drained
+		}
+		m_wake.wait(lock, [this] { return m_stop || 0 != m_queue.GetSize(); });
+	}
+}
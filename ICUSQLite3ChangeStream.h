@@ -0,0 +1,130 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_CHANGE_STREAM_H__
+#define __ICU_SQLITE3_CHANGE_STREAM_H__
+
+//
+//	Internal: used by IcuSqlite3Database, not part of the public API
+//
+
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Queue.h"
+
+//	STL
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+//	Rows are collected per transaction by the update (or preupdate) hook.
+//	The commit hook runs before the commit is attempted, so it only marks
+//	the batch; it is published once the statement trace (installed by the
+//	owner, chaining the connection's own IcuSqlite3Tracer) sees the
+//	connection back in autocommit mode. A COMMIT that failed leaves the
+//	transaction open and the batch pending. SAVEPOINT / RELEASE /
+//	ROLLBACK TO are followed from the statement trace as well, since
+//	ROLLBACK TO doesn't fire the rollback hook.
+//
+class IcuSqlite3ChangeStream : public IcuSqlite3Tracer
+{
+public:
+	IcuSqlite3ChangeStream(void* db, IcuSqlite3ChangeListener* listener,
+		const IcuSqlite3ChangeStreamOptions& options);
+	~IcuSqlite3ChangeStream();
+
+	bool Start();
+	void Stop();
+
+	void SetTracer(IcuSqlite3Tracer* tracer, const unsigned traceMask);
+	unsigned GetTraceMask() const;
+	virtual void Trace(const EIcuSqlite3TraceEvent event, void* p, void* x);
+
+	void GetMetrics(IcuSqlite3ChangeStreamMetrics& metrics) const;
+
+private:
+	struct SavepointMark
+	{
+		std::string		name;
+		size_t			changes;	//	m_pending sizes when it was opened
+		size_t			tables;
+		bool			truncated;
+	};
+
+	void*								m_db;
+	IcuSqlite3ChangeListener*			m_listener;
+	IcuSqlite3ChangeStreamOptions		m_options;
+	bool								m_hooked;
+	IcuSqlite3Tracer*					m_tracer;		//	chained, not owned
+	unsigned							m_traceMask;
+
+	//
+	//	Connection thread: the transaction being collected
+	//
+	IcuSqlite3ChangeBatch				m_pending;
+	int64_t								m_sequence;
+	bool								m_lost;
+	std::set<std::string>				m_names;		//	interned db / table names
+	const char*							m_lastNameIn[2];
+	const char*							m_lastNameOut[2];
+	bool								m_committing;	//	commit hook fired, outcome unknown
+	std::vector<SavepointMark>			m_savepoints;
+	std::string							m_token;
+
+	IcuSqlite3SpscRing<IcuSqlite3ChangeBatch>	m_queue;
+
+	std::thread							m_thread;
+	std::mutex							m_wakeLock;
+	std::condition_variable				m_wake;
+	bool								m_stop;
+
+	std::atomic<int64_t>				m_batches;
+	std::atomic<int64_t>				m_changes;
+	std::atomic<int64_t>				m_truncatedBatches;
+	std::atomic<int64_t>				m_droppedBatches;
+
+	static void UpdateCallback(void* ctxt, int op, const char* dbName,
+		const char* table, int64_t rowid);
+	static void PreUpdateCallback(void* ctxt, void* db, int op, const char* dbName,
+		const char* table, int64_t oldRowid, int64_t newRowid);
+	static int CommitCallback(void* ctxt);
+	static void RollbackCallback(void* ctxt);
+
+	void Record(const int op, const char* dbName, const char* table,
+		const int64_t rowid, const int64_t newRowid);
+	void Publish();
+	void Settle();
+	void OnStatement(const char* sql);
+	const char* Intern(const int slot, const char* name);
+	void Run();
+	void Unhook();
+
+	IcuSqlite3ChangeStream(const IcuSqlite3ChangeStream&);	//	prevent copy
+	IcuSqlite3ChangeStream& operator=(const IcuSqlite3ChangeStream&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_CHANGE_STREAM_H__
@@ -0,0 +1,324 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Checkpoint.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+///////////////////////////////////////////////////////////////////////////////
+//	Utility functions
+///////////////////////////////////////////////////////////////////////////////
+static int IcuSqlite3PragmaInt(
+	sqlite3* db, const char* sql, const int defVal)
+{
+	int result = defVal;
+	sqlite3_stmt* stmt = nullptr;
+	if(SQLITE_OK == sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr)) {
+		if(SQLITE_ROW == sqlite3_step(stmt)) {
+			result = sqlite3_column_int(stmt, 0);
+		}
+	}
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3CheckpointPolicy / IcuSqlite3CheckpointMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3CheckpointPolicy::IcuSqlite3CheckpointPolicy()
+	: frameThreshold(1000)		//	SQLite's own wal_autocheckpoint default
+	, maxIntervalMs(5000)
+	, idleMs(2000)
+	, idleMode(ICUSQLITE_WAL_CHECKPOINT_TRUNCATE)
+	, busyTimeoutMs(100)
+	, pollMs(100)
+{
+}
+
+IcuSqlite3CheckpointMetrics::IcuSqlite3CheckpointMetrics()
+	: walFrames(0)
+	, checkpointedFrames(0)
+	, checkpointLag(0)
+	, walBytes(0)
+	, checkpoints(0)
+	, idleCheckpoints(0)
+	, busyCheckpoints(0)
+	, lastCheckpointUs(0)
+	, maxCheckpointUs(0)
+	, msSinceCheckpoint(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3CheckpointScheduler
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3CheckpointScheduler::IcuSqlite3CheckpointScheduler(
+	void* db, const IcuSqlite3CheckpointPolicy& policy)
+	: m_db(db)
+	, m_checkpointDb(nullptr)
+	, m_policy(policy)
+	, m_savedAutoCheckpoint(1000)
+	, m_frameBytes(0)
+	, m_stop(false)
+	, m_walFrames(0)
+	, m_commitSeq(0)
+	, m_lastCommit(Clock::now().time_since_epoch().count())
+	, m_checkpointedFrames(0)
+	, m_idleSeq(-1)		//	allow one idle checkpoint of whatever is already in the WAL
+	, m_lastCheckpoint(Clock::now())
+{
+	if(m_policy.pollMs <= 0) {
+		m_policy.pollMs = 1;
+	}
+}
+
+IcuSqlite3CheckpointScheduler::~IcuSqlite3CheckpointScheduler()
+{
+	Stop();
+}
+
+bool IcuSqlite3CheckpointScheduler::Start(
+	const std::string& utf8Filename)
+{
+	//
+	//	The checkpointer only ever runs on our thread, so its connection
+	//	needs no mutex of its own
+	//
+	sqlite3* checkpointDb = nullptr;
+	if(SQLITE_OK != sqlite3_open_v2(utf8Filename.c_str(), &checkpointDb,
+		SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, nullptr))
+	{
+		sqlite3_close(checkpointDb);
+		return false;
+	}
+
+	sqlite3_busy_timeout(checkpointDb, m_policy.busyTimeoutMs);
+
+	//
+	//	A connection only discovers the WAL on its first read; until then
+	//	checkpoints are silent no-ops
+	//
+	if(SQLITE_OK != sqlite3_exec(checkpointDb, "SELECT COUNT(*) FROM sqlite_master;",
+		nullptr, nullptr, nullptr))
+	{
+		sqlite3_close(checkpointDb);
+		return false;
+	}
+
+	//	WAL frame = 24 byte frame header + page
+	m_frameBytes = 24 + IcuSqlite3PragmaInt(checkpointDb, "PRAGMA page_size;", 4096);
+
+	m_checkpointDb = checkpointDb;
+
+	//
+	//	The WAL hook is what wal_autocheckpoint uses too; installing ours
+	//	replaces it. Remember the setting so Stop() can put it back.
+	//
+	m_savedAutoCheckpoint = IcuSqlite3PragmaInt((sqlite3*)m_db,
+		"PRAGMA wal_autocheckpoint;", 1000);
+
+	typedef int (*XWALHOOK)(void*, sqlite3*, const char*, int);
+	sqlite3_wal_hook((sqlite3*)m_db, (XWALHOOK)xWalHook, this);
+
+	m_thread = std::thread(&IcuSqlite3CheckpointScheduler::Run, this);
+	return true;
+}
+
+void IcuSqlite3CheckpointScheduler::Stop()
+{
+	if(m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_wakeLock);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+
+		sqlite3_wal_hook((sqlite3*)m_db, nullptr, nullptr);
+		sqlite3_wal_autocheckpoint((sqlite3*)m_db, m_savedAutoCheckpoint);
+	}
+
+	if(nullptr != m_checkpointDb) {
+		sqlite3_close((sqlite3*)m_checkpointDb);
+		m_checkpointDb = nullptr;
+	}
+}
+
+void IcuSqlite3CheckpointScheduler::GetMetrics(
+	IcuSqlite3CheckpointMetrics& metrics) const
+{
+	std::lock_guard<std::mutex> lock(m_metricsLock);
+	metrics = m_metrics;
+
+	const int walFrames = m_walFrames.load(std::memory_order_relaxed);
+	metrics.walFrames		= walFrames;
+	metrics.checkpointLag	= (walFrames > metrics.checkpointedFrames) ?
+		walFrames - metrics.checkpointedFrames : 0;
+	metrics.walBytes		= (walFrames > 0) ? 32 + walFrames * m_frameBytes : 0;
+	metrics.msSinceCheckpoint = std::chrono::duration_cast<std::chrono::milliseconds>(
+		Clock::now() - m_lastCheckpoint).count();
+}
+
+/*static*/
+int IcuSqlite3CheckpointScheduler::xWalHook(
+	void* userData, void* db, const char* dbName, int frames)
+{
+	//
+	//	Runs on the committing thread after every WAL commit: keep it to a
+	//	few atomic stores and only wake the scheduler when it has work
+	//
+	IcuSqlite3CheckpointScheduler* self =
+		static_cast<IcuSqlite3CheckpointScheduler*>(userData);
+
+	//
+	//	The hook fires for every WAL database on the connection but the
+	//	scheduler only looks after "main"; ATTACHed ones get what
+	//	wal_autocheckpoint would have done for them
+	//
+	if(nullptr == dbName || 0 != sqlite3_stricmp(dbName, "main")) {
+		if(self->m_savedAutoCheckpoint > 0 && frames >= self->m_savedAutoCheckpoint) {
+			sqlite3_wal_checkpoint((sqlite3*)db, dbName);
+		}
+		return SQLITE_OK;
+	}
+
+	self->m_walFrames.store(frames, std::memory_order_relaxed);
+	self->m_lastCommit.store(Clock::now().time_since_epoch().count(),
+		std::memory_order_relaxed);
+	self->m_commitSeq.fetch_add(1, std::memory_order_release);
+
+	if(frames >= self->m_policy.frameThreshold) {
+		self->m_wake.notify_one();
+	}
+
+	return SQLITE_OK;
+}
+
+void IcuSqlite3CheckpointScheduler::Run()
+{
+	const Clock::duration maxInterval = std::chrono::milliseconds(m_policy.maxIntervalMs);
+	const Clock::duration idle = std::chrono::milliseconds(m_policy.idleMs);
+
+	std::unique_lock<std::mutex> lock(m_wakeLock);
+	while(!m_stop) {
+		m_wake.wait_for(lock, std::chrono::milliseconds(m_policy.pollMs));
+		if(m_stop) {
+			break;
+		}
+		lock.unlock();
+
+		const Clock::time_point now = Clock::now();
+		const int64_t commitSeq = m_commitSeq.load(std::memory_order_acquire);
+		const int walFrames = m_walFrames.load(std::memory_order_relaxed);
+		const Clock::time_point lastCommit(
+			Clock::duration(m_lastCommit.load(std::memory_order_relaxed)));
+
+		if(walFrames < m_checkpointedFrames) {
+			m_checkpointedFrames = 0;	//	a writer has restarted the WAL
+		}
+		const int pending = walFrames - m_checkpointedFrames;
+
+		if(pending >= m_policy.frameThreshold ||
+			(pending > 0 && now - m_lastCheckpoint >= maxInterval))
+		{
+			Checkpoint(ICUSQLITE_WAL_CHECKPOINT_PASSIVE, false);
+		} else if(commitSeq != m_idleSeq && now - lastCommit >= idle) {
+			//
+			//	Nobody is writing: escalate so the WAL is reset (and with
+			//	TRUNCATE, shrunk) instead of growing across bursts
+			//
+			if(Checkpoint(m_policy.idleMode, true)) {
+				m_idleSeq = commitSeq;
+			}
+		}
+
+		lock.lock();
+	}
+}
+
+bool IcuSqlite3CheckpointScheduler::Checkpoint(
+	const EIcuSqlite3WALCheckpoint mode, const bool idle)
+{
+	int sqliteMode;
+	switch(mode) {
+		case ICUSQLITE_WAL_CHECKPOINT_FULL		: sqliteMode = SQLITE_CHECKPOINT_FULL; break;
+		case ICUSQLITE_WAL_CHECKPOINT_RESTART	: sqliteMode = SQLITE_CHECKPOINT_RESTART; break;
+		case ICUSQLITE_WAL_CHECKPOINT_TRUNCATE	: sqliteMode = SQLITE_CHECKPOINT_TRUNCATE; break;
+		default									: sqliteMode = SQLITE_CHECKPOINT_PASSIVE; break;
+	}
+
+	const int walFramesBefore = m_walFrames.load(std::memory_order_relaxed);
+
+	int logFrames = -1;
+	int checkpointedFrames = -1;
+	const Clock::time_point start = Clock::now();
+	const int rc = sqlite3_wal_checkpoint_v2((sqlite3*)m_checkpointDb, "main",
+		sqliteMode, &logFrames, &checkpointedFrames);
+	const Clock::time_point end = Clock::now();
+	const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+	const bool reset = (SQLITE_OK == rc && SQLITE_CHECKPOINT_RESTART <= sqliteMode);
+	if(reset) {
+		//
+		//	The WAL starts over with the next write. Only clear the frame
+		//	count if no commit has raced in since we sampled it.
+		//
+		int expected = walFramesBefore;
+		m_walFrames.compare_exchange_strong(expected, 0);
+		checkpointedFrames = 0;
+	}
+
+	if(checkpointedFrames >= 0) {
+		m_checkpointedFrames = checkpointedFrames;
+	}
+
+	std::lock_guard<std::mutex> lock(m_metricsLock);
+	if(checkpointedFrames >= 0) {
+		m_metrics.checkpointedFrames = checkpointedFrames;
+	}
+
+	if(SQLITE_OK != rc) {
+		if(SQLITE_BUSY == (rc & 0xff)) {
+			++m_metrics.busyCheckpoints;
+		}
+		return false;
+	}
+
+	m_lastCheckpoint = end;
+	++m_metrics.checkpoints;
+	if(idle) {
+		++m_metrics.idleCheckpoints;
+	}
+	m_metrics.lastCheckpointUs = us;
+	if(us > m_metrics.maxCheckpointUs) {
+		m_metrics.maxCheckpointUs = us;
+	}
+	return true;
+}
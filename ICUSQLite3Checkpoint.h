@@ -0,0 +1,92 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_CHECKPOINT_H__
+#define __ICU_SQLITE3_CHECKPOINT_H__
+
+//
+//	Internal: used by IcuSqlite3Database, not part of the public API
+//
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class IcuSqlite3CheckpointScheduler
+{
+public:
+	IcuSqlite3CheckpointScheduler(void* db, const IcuSqlite3CheckpointPolicy& policy);
+	~IcuSqlite3CheckpointScheduler();
+
+	bool Start(const std::string& utf8Filename);
+	void Stop();
+
+	void GetMetrics(IcuSqlite3CheckpointMetrics& metrics) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void*							m_db;				//	foreground connection (WAL hook)
+	void*							m_checkpointDb;		//	our own connection
+	IcuSqlite3CheckpointPolicy		m_policy;
+	int								m_savedAutoCheckpoint;
+	int64_t							m_frameBytes;		//	page size + frame header
+
+	std::thread						m_thread;
+	std::mutex						m_wakeLock;
+	std::condition_variable			m_wake;
+	bool							m_stop;
+
+	//
+	//	Written by the WAL hook on the committing thread
+	//
+	std::atomic<int>				m_walFrames;
+	std::atomic<int64_t>			m_commitSeq;
+	std::atomic<Clock::rep>			m_lastCommit;
+
+	//
+	//	Scheduler thread state
+	//
+	int								m_checkpointedFrames;	//	frames known to be backfilled
+	int64_t							m_idleSeq;				//	m_commitSeq at the last idle checkpoint
+	Clock::time_point				m_lastCheckpoint;
+
+	mutable std::mutex				m_metricsLock;
+	IcuSqlite3CheckpointMetrics		m_metrics;
+
+	static int xWalHook(void* userData, void* db, const char* dbName, int frames);
+
+	void Run();
+	bool Checkpoint(const EIcuSqlite3WALCheckpoint mode, const bool idle);
+
+	IcuSqlite3CheckpointScheduler(const IcuSqlite3CheckpointScheduler&);
+	IcuSqlite3CheckpointScheduler& operator=(const IcuSqlite3CheckpointScheduler&);
+};
+
+#endif	//	!__ICU_SQLITE3_CHECKPOINT_H__
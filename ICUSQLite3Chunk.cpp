@@ -0,0 +1,342 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Chunk.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+IcuSqlite3Chunk::IcuSqlite3Chunk(
+	const int cols /*= 0*/)
+	: m_cols(cols)
+{
+}
+
+void IcuSqlite3Chunk::Reset(
+	const int cols)
+{
+	m_cols = cols;
+	m_cells.clear();
+	m_bytes.clear();
+}
+
+void IcuSqlite3Chunk::Reserve(
+	const size_t rows)
+{
+	m_cells.reserve(rows * m_cols);
+}
+
+void IcuSqlite3Chunk::ShrinkToFit()
+{
+	m_cells.shrink_to_fit();
+	m_bytes.shrink_to_fit();
+}
+
+size_t IcuSqlite3Chunk::GetMemoryBytes() const
+{
+	return m_cells.capacity() * sizeof(Cell) + m_bytes.capacity();
+}
+
+void IcuSqlite3Chunk::AppendRow(
+	void* stmt)
+{
+	sqlite3_stmt* s = (sqlite3_stmt*)stmt;
+	for(int col = 0; col < m_cols; ++col) {
+		switch(sqlite3_column_type(s, col)) {
+			case SQLITE_INTEGER :
+				AppendInt64(sqlite3_column_int64(s, col));
+				break;
+
+			case SQLITE_FLOAT :
+				AppendDouble(sqlite3_column_double(s, col));
+				break;
+
+			case SQLITE_TEXT :
+				{
+					const char* text = (const char*)sqlite3_column_text(s, col);
+					AppendText(text, sqlite3_column_bytes(s, col));
+				}
+				break;
+
+			case SQLITE_BLOB :
+				{
+					const void* blob = sqlite3_column_blob(s, col);
+					AppendBlob(blob, sqlite3_column_bytes(s, col));
+				}
+				break;
+
+			default :
+				AppendNull();
+				break;
+		}
+	}
+}
+
+void IcuSqlite3Chunk::AppendRow(
+	const IcuSqlite3Chunk& src, const int row)
+{
+	for(int col = 0; col < m_cols; ++col) {
+		AppendValue(src, row, col);
+	}
+}
+
+void IcuSqlite3Chunk::AppendNull()
+{
+	Cell cell;
+	cell.type	= ICUSQLITE_COLUMN_TYPE_NULL;
+	cell.len	= 0;
+	cell.i		= 0;
+	m_cells.push_back(cell);
+}
+
+void IcuSqlite3Chunk::AppendInt64(
+	const int64_t value)
+{
+	Cell cell;
+	cell.type	= ICUSQLITE_COLUMN_TYPE_INTEGER;
+	cell.len	= 0;
+	cell.i		= value;
+	m_cells.push_back(cell);
+}
+
+void IcuSqlite3Chunk::AppendDouble(
+	const double value)
+{
+	Cell cell;
+	cell.type	= ICUSQLITE_COLUMN_TYPE_FLOAT;
+	cell.len	= 0;
+	cell.d		= value;
+	m_cells.push_back(cell);
+}
+
+void IcuSqlite3Chunk::AppendText(
+	const char* text, const int len)
+{
+	AppendBytes(ICUSQLITE_COLUMN_TYPE_TEXT, text, len);
+}
+
+void IcuSqlite3Chunk::AppendBlob(
+	const void* blob, const int len)
+{
+	AppendBytes(ICUSQLITE_COLUMN_TYPE_BLOB, blob, len);
+}
+
+void IcuSqlite3Chunk::AppendBytes(
+	const int type, const void* data, const int len)
+{
+	Cell cell;
+	cell.type	= type;
+	cell.len	= (len > 0) ? len : 0;
+	cell.offset	= m_bytes.size();
+
+	//	TEXT is kept NUL terminated so it can be handed out as a C string
+	m_bytes.resize(cell.offset + cell.len + 1);
+	if(cell.len > 0) {
+		memcpy(&m_bytes[cell.offset], data, cell.len);
+	}
+	m_bytes[cell.offset + cell.len] = '\0';
+	m_cells.push_back(cell);
+}
+
+void IcuSqlite3Chunk::AppendValue(
+	const IcuSqlite3Chunk& src, const int row, const int col)
+{
+	const Cell* cell = src.GetCell(row, col);
+	if(nullptr == cell) {
+		AppendNull();
+		return;
+	}
+
+	switch(cell->type) {
+		case ICUSQLITE_COLUMN_TYPE_TEXT :
+		case ICUSQLITE_COLUMN_TYPE_BLOB :
+			AppendBytes(cell->type, &src.m_bytes[cell->offset], cell->len);
+			break;
+
+		default :
+			m_cells.push_back(*cell);
+			break;
+	}
+}
+
+const IcuSqlite3Chunk::Cell* IcuSqlite3Chunk::GetCell(
+	const int row, const int col) const
+{
+	if(row < 0 || col < 0 || col >= m_cols) {
+		return nullptr;
+	}
+
+	const size_t idx = static_cast<size_t>(row) * m_cols + col;
+	return (idx < m_cells.size()) ? &m_cells[idx] : nullptr;
+}
+
+EIcuSqlite3ColumnTypes IcuSqlite3Chunk::GetType(
+	const int row, const int col) const
+{
+	const Cell* cell = GetCell(row, col);
+	return (nullptr != cell) ? 
+		static_cast<EIcuSqlite3ColumnTypes>(cell->type) : ICUSQLITE_COLUMN_TYPE_INVALID;
+}
+
+bool IcuSqlite3Chunk::IsNull(
+	const int row, const int col) const
+{
+	const Cell* cell = GetCell(row, col);
+	return nullptr == cell || ICUSQLITE_COLUMN_TYPE_NULL == cell->type;
+}
+
+int64_t IcuSqlite3Chunk::GetInt64(
+	const int row, const int col) const
+{
+	const Cell* cell = GetCell(row, col);
+	if(nullptr == cell) {
+		return 0;
+	}
+
+	switch(cell->type) {
+		case ICUSQLITE_COLUMN_TYPE_INTEGER :	return cell->i;
+		case ICUSQLITE_COLUMN_TYPE_FLOAT :		return static_cast<int64_t>(cell->d);
+		case ICUSQLITE_COLUMN_TYPE_TEXT :		return strtoll(&m_bytes[cell->offset], nullptr, 10);
+		default :								return 0;
+	}
+}
+
+double IcuSqlite3Chunk::GetDouble(
+	const int row, const int col) const
+{
+	const Cell* cell = GetCell(row, col);
+	if(nullptr == cell) {
+		return 0.0;
+	}
+
+	switch(cell->type) {
+		case ICUSQLITE_COLUMN_TYPE_INTEGER :	return static_cast<double>(cell->i);
+		case ICUSQLITE_COLUMN_TYPE_FLOAT :		return cell->d;
+		case ICUSQLITE_COLUMN_TYPE_TEXT :		return strtod(&m_bytes[cell->offset], nullptr);
+		default :								return 0.0;
+	}
+}
+
+const char* IcuSqlite3Chunk::GetText(
+	const int row, const int col, int& len) const
+{
+	const Cell* cell = GetCell(row, col);
+	if(nullptr == cell || 
+		(ICUSQLITE_COLUMN_TYPE_TEXT != cell->type && ICUSQLITE_COLUMN_TYPE_BLOB != cell->type))
+	{
+		len = 0;
+		return nullptr;
+	}
+
+	len = cell->len;
+	return &m_bytes[cell->offset];
+}
+
+const unsigned char* IcuSqlite3Chunk::GetBlob(
+	const int row, const int col, int& len) const
+{
+	return reinterpret_cast<const unsigned char*>(GetText(row, col, len));
+}
+
+std::string IcuSqlite3Chunk::GetString(
+	const int row, const int col) const
+{
+	const Cell* cell = GetCell(row, col);
+	if(nullptr == cell) {
+		return std::string();
+	}
+
+	char buf[32];
+	switch(cell->type) {
+		case ICUSQLITE_COLUMN_TYPE_INTEGER :
+			snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(cell->i));
+			return buf;
+
+		case ICUSQLITE_COLUMN_TYPE_FLOAT :
+			//	15 significant digits, always with a '.' or exponent
+			snprintf(buf, sizeof(buf), "%.15g", cell->d);
+			if(nullptr == strpbrk(buf, ".eEin")) {
+				strcat(buf, ".0");
+			}
+			return buf;
+
+		case ICUSQLITE_COLUMN_TYPE_TEXT :
+		case ICUSQLITE_COLUMN_TYPE_BLOB :
+			return std::string(&m_bytes[cell->offset], cell->len);
+
+		default :
+			return std::string();
+	}
+}
+
+/*static*/
+int IcuSqlite3Chunk::Compare(
+	const IcuSqlite3Chunk& a, const int rowA, const int colA,
+	const IcuSqlite3Chunk& b, const int rowB, const int colB)
+{
+	const Cell* x = a.GetCell(rowA, colA);
+	const Cell* y = b.GetCell(rowB, colB);
+
+	//	rank: NULL / missing, numeric, TEXT, BLOB
+	static const int rank[] = { 0, 1, 1, 2, 3, 0 };
+	const int rankX = (nullptr != x) ? rank[x->type] : 0;
+	const int rankY = (nullptr != y) ? rank[y->type] : 0;
+	if(rankX != rankY) {
+		return (rankX < rankY) ? -1 : 1;
+	}
+
+	switch(rankX) {
+		case 0 :
+			return 0;
+
+		case 1 :
+			if(ICUSQLITE_COLUMN_TYPE_INTEGER == x->type && ICUSQLITE_COLUMN_TYPE_INTEGER == y->type) {
+				return (x->i < y->i) ? -1 : ((x->i > y->i) ? 1 : 0);
+			} else {
+				const double dx = (ICUSQLITE_COLUMN_TYPE_INTEGER == x->type) ? static_cast<double>(x->i) : x->d;
+				const double dy = (ICUSQLITE_COLUMN_TYPE_INTEGER == y->type) ? static_cast<double>(y->i) : y->d;
+				return (dx < dy) ? -1 : ((dx > dy) ? 1 : 0);
+			}
+
+		default :
+			{
+				const int n = (x->len < y->len) ? x->len : y->len;
+				const int r = (n > 0) ? memcmp(&a.m_bytes[x->offset], &b.m_bytes[y->offset], n) : 0;
+				if(0 != r) {
+					return r;
+				}
+				return (x->len < y->len) ? -1 : ((x->len > y->len) ? 1 : 0);
+			}
+	}
+}
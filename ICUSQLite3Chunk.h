@@ -0,0 +1,107 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_CHUNK_H__
+#define __ICU_SQLITE3_CHUNK_H__
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <string>
+#include <vector>
+
+//
+//	A block of result rows copied out of a statement, so they outlive it
+//	and can be read from another thread. Cells are fixed size and stored
+//	row by row; TEXT / BLOB bytes go to one shared arena (TEXT is NUL
+//	terminated there). Values are typed as SQLite returned them; the
+//	getters convert the way sqlite3_column_xxx() would.
+//
+//	Not synchronized: fill it on one thread, then hand it off.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3Chunk
+{
+public:
+	explicit IcuSqlite3Chunk(const int cols = 0);
+
+	void Reset(const int cols);
+	void Reserve(const size_t rows);
+	void ShrinkToFit();		//	drop spare capacity before keeping a chunk around
+
+	int GetColumnCount() const { return m_cols; }
+	int GetRowCount() const { return (m_cols > 0) ? static_cast<int>(m_cells.size() / m_cols) : 0; }
+	size_t GetMemoryBytes() const;
+
+	//
+	//	Copy the current row of a stepped sqlite3_stmt
+	//
+	void AppendRow(void* stmt);
+	void AppendRow(const IcuSqlite3Chunk& src, const int row);
+
+	//
+	//	Build a row a cell at a time; a row is complete after GetColumnCount()
+	//	appends
+	//
+	void AppendNull();
+	void AppendInt64(const int64_t value);
+	void AppendDouble(const double value);
+	void AppendText(const char* text, const int len);
+	void AppendBlob(const void* blob, const int len);
+	void AppendValue(const IcuSqlite3Chunk& src, const int row, const int col);
+
+	EIcuSqlite3ColumnTypes GetType(const int row, const int col) const;
+	bool IsNull(const int row, const int col) const;
+	int64_t GetInt64(const int row, const int col) const;
+	double GetDouble(const int row, const int col) const;
+	const char* GetText(const int row, const int col, int& len) const;	//	TEXT / BLOB only, else nullptr
+	const unsigned char* GetBlob(const int row, const int col, int& len) const;
+	std::string GetString(const int row, const int col) const;	//	numbers formatted as SQLite would
+
+	//
+	//	SQLite's ORDER BY ordering with BINARY collation: NULL < INTEGER /
+	//	REAL (compared numerically) < TEXT < BLOB. Returns < 0, 0 or > 0.
+	//
+	static int Compare(const IcuSqlite3Chunk& a, const int rowA, const int colA,
+		const IcuSqlite3Chunk& b, const int rowB, const int colB);
+
+private:
+	struct Cell
+	{
+		int		type;		//	EIcuSqlite3ColumnTypes
+		int		len;		//	TEXT / BLOB bytes
+		union {
+			int64_t		i;
+			double		d;
+			size_t		offset;	//	into m_bytes
+		};
+	};
+
+	int					m_cols;
+	std::vector<Cell>	m_cells;
+	std::vector<char>	m_bytes;
+
+	const Cell* GetCell(const int row, const int col) const;
+	void AppendBytes(const int type, const void* data, const int len);
+};
+
+#endif	//	!__ICU_SQLITE3_CHUNK_H__
@@ -0,0 +1,310 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Collation.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+///////////////////////////////////////////////////////////////////////////////
+//	SQLite callbacks
+///////////////////////////////////////////////////////////////////////////////
+static int IcuSqlite3CompareUtf8(
+	void* arg, int len1, const void* s1, int len2, const void* s2)
+{
+	//
+	//	Straight off the stored bytes; no UnicodeString per comparison
+	//
+	UErrorCode status = U_ZERO_ERROR;
+	const UCollationResult r = static_cast<const Collator*>(arg)->compareUTF8(
+		StringPiece(static_cast<const char*>(s1), len1),
+		StringPiece(static_cast<const char*>(s2), len2), status);
+	return static_cast<int>(r);
+}
+
+static int IcuSqlite3CompareUtf16(
+	void* arg, int len1, const void* s1, int len2, const void* s2)
+{
+	UErrorCode status = U_ZERO_ERROR;
+	const UCollationResult r = static_cast<const Collator*>(arg)->compare(
+		static_cast<const UChar*>(s1), len1 / static_cast<int>(sizeof(UChar)),
+		static_cast<const UChar*>(s2), len2 / static_cast<int>(sizeof(UChar)), status);
+	return static_cast<int>(r);
+}
+
+static bool IcuSqlite3ParseStrength(
+	const char* name, Collator::ECollationStrength& strength)
+{
+	static const struct {
+		const char*						name;
+		Collator::ECollationStrength	strength;
+	} strengths[] = {
+		{ "primary",	Collator::PRIMARY },
+		{ "secondary",	Collator::SECONDARY },
+		{ "tertiary",	Collator::TERTIARY },
+		{ "quaternary",	Collator::QUATERNARY },
+		{ "identical",	Collator::IDENTICAL },
+	};
+
+	if(nullptr == name) {
+		return false;
+	}
+	for(size_t i = 0; i < sizeof(strengths) / sizeof(strengths[0]); ++i) {
+		if(0 == sqlite3_stricmp(name, strengths[i].name)) {
+			strength = strengths[i].strength;
+			return true;
+		}
+	}
+	return false;
+}
+
+//
+//	SORTKEY(text, locale[, strength]): the locale's binary sort key as a
+//	BLOB. Keys compare with memcmp() (SQLite's BLOB order) exactly as a
+//	collation on that locale / strength (default tertiary) compares the
+//	text, so an index on SORTKEY(x, 'de') orders like ORDER BY x COLLATE
+//	de without calling the collator per compare. The key depends on the
+//	arguments alone, never on the collation names of the connection,
+//	which is what lets it be deterministic.
+//
+static void IcuSqlite3SortKey(
+	sqlite3_context* ctxt, int argCount, sqlite3_value** args)
+{
+	IcuSqlite3CollatorPool* pool = static_cast<IcuSqlite3CollatorPool*>(
+		sqlite3_user_data(ctxt));
+
+	if(SQLITE_NULL == sqlite3_value_type(args[0])) {
+		sqlite3_result_null(ctxt);
+		return;
+	}
+
+	Collator::ECollationStrength strength = Collator::TERTIARY;
+	if(argCount > 2 && !IcuSqlite3ParseStrength(
+		reinterpret_cast<const char*>(sqlite3_value_text(args[2])), strength))
+	{
+		sqlite3_result_error(ctxt, "SORTKEY: unknown collation strength", -1);
+		return;
+	}
+
+	const char* error = nullptr;
+	const Collator* collator = pool->AcquireForLocale(
+		reinterpret_cast<const char*>(sqlite3_value_text(args[1])), strength, error);
+	if(nullptr == collator) {
+		sqlite3_result_error(ctxt, error, -1);
+		return;
+	}
+
+	//
+	//	UTF-16 text is used in place; UTF-8 is widened into a buffer the
+	//	pool keeps, so steady state calls don't allocate
+	//
+	const UChar* text;
+	int32_t textLen;
+	if(pool->IsUtf16()) {
+		text = static_cast<const UChar*>(sqlite3_value_text16(args[0]));
+		textLen = sqlite3_value_bytes16(args[0]) / static_cast<int32_t>(sizeof(UChar));
+	} else {
+		const char* utf8 = reinterpret_cast<const char*>(sqlite3_value_text(args[0]));
+		const int32_t utf8Len = sqlite3_value_bytes(args[0]);
+		UnicodeString& scratch = pool->GetScratch();
+		UChar* buffer = scratch.getBuffer(ICUSQLITE_UTF16_CAPACITY(utf8Len) + 1);
+		if(nullptr == buffer) {
+			sqlite3_result_error_nomem(ctxt);
+			return;
+		}
+		scratch.releaseBuffer(IcuSqlite3Utf8ToUtf16(utf8, utf8Len, buffer));
+		text = scratch.getBuffer();
+		textLen = scratch.length();
+	}
+
+	int32_t capacity = textLen * 2 + 16;
+	uint8_t* key = static_cast<uint8_t*>(sqlite3_malloc64(capacity));
+	if(nullptr == key) {
+		sqlite3_result_error_nomem(ctxt);
+		return;
+	}
+
+	int32_t keyLen = collator->getSortKey(text, textLen, key, capacity);
+	if(keyLen > capacity) {
+		uint8_t* larger = static_cast<uint8_t*>(sqlite3_realloc64(key, keyLen));
+		if(nullptr == larger) {
+			sqlite3_free(key);
+			sqlite3_result_error_nomem(ctxt);
+			return;
+		}
+		key = larger;
+		keyLen = collator->getSortKey(text, textLen, key, keyLen);
+	}
+
+	sqlite3_result_blob64(ctxt, key, keyLen, sqlite3_free);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3CollatorPool
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3CollatorPool::IcuSqlite3CollatorPool(
+	void* db, const bool utf16)
+	: m_db(db)
+	, m_utf16(utf16)
+	, m_sortKeyCollators(0)
+{
+	m_lastSortKey.strength	= Collator::TERTIARY;
+	m_lastSortKey.collator	= nullptr;
+}
+
+IcuSqlite3CollatorPool::~IcuSqlite3CollatorPool()
+{
+	for(size_t i = 0; i < m_collators.size(); ++i) {
+		delete m_collators[i].collator;
+	}
+}
+
+bool IcuSqlite3CollatorPool::RegisterSortKey()
+{
+	int flags = 0;
+#if SQLITE_VERSION_NUMBER >= 3008003
+	flags |= SQLITE_DETERMINISTIC;
+#endif	//	SQLITE_VERSION_NUMBER >= 3008003
+	for(int argCount = 2; argCount <= 3; ++argCount) {
+		if(SQLITE_OK != sqlite3_create_function_v2(
+			(sqlite3*)m_db,
+			"SORTKEY",
+			argCount,
+			(m_utf16 ? SQLITE_UTF16 : SQLITE_UTF8) | flags,
+			this,
+			IcuSqlite3SortKey,
+			nullptr,
+			nullptr,
+			nullptr))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool IcuSqlite3CollatorPool::Register(
+	const char* name, const Locale& locale, 
+	const Collator::ECollationStrength strength)
+{
+	Collator* collator = Find(locale.getName(), strength);
+	if(nullptr == collator) {
+		collator = Create(locale, strength);
+		if(nullptr == collator) {
+			return false;
+		}
+	}
+
+	if(SQLITE_OK != sqlite3_create_collation_v2(
+		(sqlite3*)m_db,
+		name,
+		m_utf16 ? SQLITE_UTF16 : SQLITE_UTF8,
+		collator,
+		m_utf16 ? IcuSqlite3CompareUtf16 : IcuSqlite3CompareUtf8,
+		nullptr))	//	collators belong to the pool
+	{
+		return false;
+	}
+	return true;
+}
+
+const Collator* IcuSqlite3CollatorPool::AcquireForLocale(
+	const char* localeId, const Collator::ECollationStrength strength,
+	const char*& error)
+{
+	error = "SORTKEY: no ICU collator for this locale";
+	if(nullptr == localeId) {
+		return nullptr;
+	}
+
+	//
+	//	A statement nearly always asks for the same collator on every row
+	//
+	if(nullptr != m_lastSortKey.collator && 
+		strength == m_lastSortKey.strength && m_lastSortKey.localeName == localeId)
+	{
+		return m_lastSortKey.collator;
+	}
+
+	const Locale locale(localeId);
+	if(locale.isBogus()) {
+		return nullptr;
+	}
+
+	Collator* collator = Find(locale.getName(), strength);
+	if(nullptr == collator) {
+		if(m_sortKeyCollators >= ICUSQLITE_SORTKEY_COLLATORS) {
+			error = "SORTKEY: too many distinct locales on this connection";
+			return nullptr;
+		}
+		collator = Create(locale, strength);
+		if(nullptr == collator) {
+			return nullptr;
+		}
+		++m_sortKeyCollators;
+	}
+
+	m_lastSortKey.localeName	= localeId;
+	m_lastSortKey.strength		= strength;
+	m_lastSortKey.collator		= collator;
+	return collator;
+}
+
+Collator* IcuSqlite3CollatorPool::Find(
+	const std::string& localeName, const int strength) const
+{
+	for(size_t i = 0; i < m_collators.size(); ++i) {
+		if(m_collators[i].localeName == localeName && 
+			m_collators[i].strength == strength)
+		{
+			return m_collators[i].collator;
+		}
+	}
+	return nullptr;
+}
+
+Collator* IcuSqlite3CollatorPool::Create(
+	const Locale& locale, const Collator::ECollationStrength strength)
+{
+	UErrorCode status = U_ZERO_ERROR;
+	Collator* collator = Collator::createInstance(locale, status);
+	if(U_FAILURE(status)) {
+		delete collator;
+		return nullptr;
+	}
+	collator->setStrength(strength);
+
+	CollatorEntry entry;
+	entry.localeName	= locale.getName();
+	entry.strength		= strength;
+	entry.collator		= collator;
+	m_collators.push_back(entry);
+	return collator;
+}
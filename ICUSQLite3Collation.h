@@ -0,0 +1,90 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_COLLATION_H__
+#define __ICU_SQLITE3_COLLATION_H__
+
+//
+//	Internal: used by IcuSqlite3Database, not part of the public API
+//
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <string>
+#include <vector>
+
+//
+//	ICU collations registered on one connection. Collators are shared
+//	between collation names with the same locale and strength, and by
+//	SORTKEY(text, locale[, strength]), which the pool registers when the
+//	connection opens. Owned by the IcuSqlite3Database and destroyed after
+//	the connection is closed, so SQLite never holds a dangling collator.
+//
+class IcuSqlite3CollatorPool
+{
+public:
+	IcuSqlite3CollatorPool(void* db, const bool utf16);
+	~IcuSqlite3CollatorPool();
+
+	bool RegisterSortKey();
+	bool Register(const char* name, const Locale& locale,
+		const Collator::ECollationStrength strength);
+
+	//
+	//	SORTKEY() callback state; calls on a connection are serialized.
+	//	Locales come from SQL data, so SORTKEY() creates at most
+	//	ICUSQLITE_SORTKEY_COLLATORS collators of its own; past that only
+	//	those already in the pool are served. On nullptr, error is the
+	//	SQL error message.
+	//
+	const Collator* AcquireForLocale(const char* localeId, 
+		const Collator::ECollationStrength strength, const char*& error);
+	UnicodeString& GetScratch() { return m_scratch; }
+	bool IsUtf16() const { return m_utf16; }
+
+private:
+	enum { ICUSQLITE_SORTKEY_COLLATORS = 16 };
+
+	struct CollatorEntry
+	{
+		std::string		localeName;
+		int				strength;
+		Collator*		collator;
+	};
+
+	void*								m_db;
+	bool								m_utf16;
+	size_t								m_sortKeyCollators;	//	created by SORTKEY()
+	std::vector<CollatorEntry>			m_collators;
+	CollatorEntry						m_lastSortKey;	//	localeName is SORTKEY()'s argument
+	UnicodeString						m_scratch;
+
+	Collator* Find(const std::string& localeName, const int strength) const;
+	Collator* Create(const Locale& locale, const Collator::ECollationStrength strength);
+
+	IcuSqlite3CollatorPool(const IcuSqlite3CollatorPool&);	//	prevent copy
+	IcuSqlite3CollatorPool& operator=(const IcuSqlite3CollatorPool&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_COLLATION_H__
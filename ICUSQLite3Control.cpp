@@ -0,0 +1,156 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Control.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <cstdio>
+
+IcuSqlite3ControlStatements::IcuSqlite3ControlStatements(
+	void* db)
+	: m_db(db)
+{
+	for(int i = 0; i < ICUSQLITE_CONTROL_FIXED; ++i) {
+		m_fixed[i] = nullptr;
+	}
+}
+
+IcuSqlite3ControlStatements::~IcuSqlite3ControlStatements()
+{
+	for(int i = 0; i < ICUSQLITE_CONTROL_FIXED; ++i) {
+		sqlite3_finalize((sqlite3_stmt*)m_fixed[i]);
+	}
+	for(size_t i = 0; i < m_savepoints.size(); ++i) {
+		sqlite3_finalize((sqlite3_stmt*)m_savepoints[i]);
+	}
+}
+
+int IcuSqlite3ControlStatements::Begin(
+	const EIcuSqlite3TransTypes type)
+{
+	switch(type) {
+		case ICUSQLITE_TRANSACTION_DEFERRED :	return StepFixed(ICUSQLITE_CONTROL_BEGIN_DEFERRED);
+		case ICUSQLITE_TRANSACTION_IMMEDIATE :	return StepFixed(ICUSQLITE_CONTROL_BEGIN_IMMEDIATE);
+		case ICUSQLITE_TRANSACTION_EXCLUSIVE :	return StepFixed(ICUSQLITE_CONTROL_BEGIN_EXCLUSIVE);
+		default :								return StepFixed(ICUSQLITE_CONTROL_BEGIN);
+	}
+}
+
+int IcuSqlite3ControlStatements::Commit()
+{
+	return StepFixed(ICUSQLITE_CONTROL_COMMIT);
+}
+
+int IcuSqlite3ControlStatements::Rollback()
+{
+	return StepFixed(ICUSQLITE_CONTROL_ROLLBACK);
+}
+
+int IcuSqlite3ControlStatements::Savepoint(
+	const int level)
+{
+	return StepLevel(level, ICUSQLITE_CONTROL_SAVEPOINT);
+}
+
+int IcuSqlite3ControlStatements::Release(
+	const int level)
+{
+	return StepLevel(level, ICUSQLITE_CONTROL_RELEASE);
+}
+
+int IcuSqlite3ControlStatements::RollbackTo(
+	const int level)
+{
+	return StepLevel(level, ICUSQLITE_CONTROL_ROLLBACK_TO);
+}
+
+int IcuSqlite3ControlStatements::StepFixed(
+	const int which)
+{
+	static const char* const sql[ICUSQLITE_CONTROL_FIXED] = {
+		"BEGIN TRANSACTION;",
+		"BEGIN DEFERRED TRANSACTION;",
+		"BEGIN IMMEDIATE TRANSACTION;",
+		"BEGIN EXCLUSIVE TRANSACTION;",
+		"COMMIT TRANSACTION;",
+		"ROLLBACK TRANSACTION;",
+	};
+	return Step(m_fixed[which], sql[which]);
+}
+
+int IcuSqlite3ControlStatements::StepLevel(
+	const int level, const int which)
+{
+	if(level < 1) {
+		return SQLITE_MISUSE;
+	}
+
+	const size_t index = static_cast<size_t>(level - 1) * ICUSQLITE_CONTROL_PER_LEVEL + which;
+	if(index >= m_savepoints.size()) {
+		m_savepoints.resize(static_cast<size_t>(level) * ICUSQLITE_CONTROL_PER_LEVEL, nullptr);
+	}
+
+	static const char* const formats[ICUSQLITE_CONTROL_PER_LEVEL] = {
+		"SAVEPOINT icusqlite_sp%d;",
+		"RELEASE SAVEPOINT icusqlite_sp%d;",
+		"ROLLBACK TRANSACTION TO SAVEPOINT icusqlite_sp%d;",
+	};
+
+	char sql[64];
+	sql[0] = '\0';
+	if(nullptr == m_savepoints[index]) {
+		snprintf(sql, sizeof(sql), formats[which], level);
+	}
+	return Step(m_savepoints[index], sql);
+}
+
+int IcuSqlite3ControlStatements::Step(
+	void*& stmt, const char* sql)
+{
+	if(nullptr == stmt) {
+		sqlite3_stmt* prepared = nullptr;
+#if SQLITE_VERSION_NUMBER >= 3020000
+		int rc = sqlite3_prepare_v3((sqlite3*)m_db, sql, -1, 
+			SQLITE_PREPARE_PERSISTENT, &prepared, nullptr);
+#else	//	SQLITE_VERSION_NUMBER >= 3020000
+		int rc = sqlite3_prepare_v2((sqlite3*)m_db, sql, -1, &prepared, nullptr);
+#endif	//	SQLITE_VERSION_NUMBER < 3020000
+		if(SQLITE_OK != rc) {
+			return rc;
+		}
+		stmt = prepared;
+	}
+
+	int rc = sqlite3_step((sqlite3_stmt*)stmt);
+	sqlite3_reset((sqlite3_stmt*)stmt);	//	must not hold the statement open across COMMIT
+	return (SQLITE_DONE == rc) ? SQLITE_OK : rc;
+}
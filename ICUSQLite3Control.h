@@ -0,0 +1,89 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_CONTROL_H__
+#define __ICU_SQLITE3_CONTROL_H__
+
+//
+//	Internal: used by IcuSqlite3Database, not part of the public API
+//
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <vector>
+
+//
+//	Transaction control statements, prepared on first use and kept for the
+//	life of the connection so each BEGIN / COMMIT / scope costs a step +
+//	reset instead of a parse. Savepoints are named by nesting level ("icusqlite_sp1", ...),
+//	so one set of statements serves every scope at that depth.
+//
+class IcuSqlite3ControlStatements
+{
+public:
+	explicit IcuSqlite3ControlStatements(void* db);
+	~IcuSqlite3ControlStatements();	//	finalizes everything
+
+	//
+	//	SQLite result codes; SQLITE_DONE is reported as SQLITE_OK
+	//
+	int Begin(const EIcuSqlite3TransTypes type);
+	int Commit();
+	int Rollback();
+
+	int Savepoint(const int level);
+	int Release(const int level);
+	int RollbackTo(const int level);
+
+private:
+	enum {
+		ICUSQLITE_CONTROL_BEGIN,
+		ICUSQLITE_CONTROL_BEGIN_DEFERRED,
+		ICUSQLITE_CONTROL_BEGIN_IMMEDIATE,
+		ICUSQLITE_CONTROL_BEGIN_EXCLUSIVE,
+		ICUSQLITE_CONTROL_COMMIT,
+		ICUSQLITE_CONTROL_ROLLBACK,
+		ICUSQLITE_CONTROL_FIXED,
+	};
+
+	enum {
+		ICUSQLITE_CONTROL_SAVEPOINT,
+		ICUSQLITE_CONTROL_RELEASE,
+		ICUSQLITE_CONTROL_ROLLBACK_TO,
+		ICUSQLITE_CONTROL_PER_LEVEL,
+	};
+
+	void*				m_db;
+	void*				m_fixed[ICUSQLITE_CONTROL_FIXED];
+	std::vector<void*>	m_savepoints;	//	ICUSQLITE_CONTROL_PER_LEVEL per level
+
+	int StepFixed(const int which);
+	int StepLevel(const int level, const int which);
+	int Step(void*& stmt, const char* sql);
+
+	IcuSqlite3ControlStatements(const IcuSqlite3ControlStatements&);	//	prevent copy
+	IcuSqlite3ControlStatements& operator=(const IcuSqlite3ControlStatements&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_CONTROL_H__
@@ -0,0 +1,891 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Export.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <condition_variable>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+//
+//	sqlite3_snapshot_*() need a library built with SQLITE_ENABLE_SNAPSHOT;
+//	without them WAL databases are exported by a single reader
+//
+#if !defined(ICUSQLITE_HAVE_SNAPSHOT)
+	#if defined(SQLITE_ENABLE_SNAPSHOT) && SQLITE_VERSION_NUMBER >= 3010000
+		#define ICUSQLITE_HAVE_SNAPSHOT		1
+	#else
+		#define ICUSQLITE_HAVE_SNAPSHOT		0
+	#endif
+#endif	//	!defined(ICUSQLITE_HAVE_SNAPSHOT)
+
+///////////////////////////////////////////////////////////////////////////////
+//	Formatting - all append to a caller owned buffer that keeps its capacity
+///////////////////////////////////////////////////////////////////////////////
+static const char s_hexDigits[] = "0123456789abcdef";
+static const char s_base64Chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void IcuSqlite3AppendInt64(
+	std::string& out, const int64_t value)
+{
+	char buf[24];
+	char* end = buf + sizeof(buf);
+	char* p = end;
+
+	//	negate as unsigned so INT64_MIN works
+	uint64_t v = (value < 0) ? (0 - static_cast<uint64_t>(value)) : static_cast<uint64_t>(value);
+	do {
+		*--p = static_cast<char>('0' + (v % 10));
+		v /= 10;
+	} while(0 != v);
+	if(value < 0) {
+		*--p = '-';
+	}
+	out.append(p, end - p);
+}
+
+static void IcuSqlite3AppendDouble(
+	std::string& out, const double value)
+{
+	//
+	//	Shortest of %.15g / %.17g that reads back as the same value
+	//
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%.15g", value);
+	if(strtod(buf, nullptr) != value) {
+		len = snprintf(buf, sizeof(buf), "%.17g", value);
+	}
+	out.append(buf, len);
+}
+
+static void IcuSqlite3AppendVarint(
+	std::string& out, uint64_t value)
+{
+	char buf[10];
+	int len = 0;
+	do {
+		const unsigned char b = static_cast<unsigned char>(value & 0x7f);
+		value >>= 7;
+		buf[len++] = static_cast<char>(b | ((0 != value) ? 0x80 : 0));
+	} while(0 != value);
+	out.append(buf, len);
+}
+
+static void IcuSqlite3AppendCsvField(
+	std::string& out, const char* text, const int len, const char delimiter)
+{
+	bool quote = false;
+	for(int i = 0; i < len; ++i) {
+		const char c = text[i];
+		if(c == delimiter || '"' == c || '\n' == c || '\r' == c) {
+			quote = true;
+			break;
+		}
+	}
+
+	if(!quote) {
+		out.append(text, len);
+		return;
+	}
+
+	out.push_back('"');
+	const char* run = text;
+	const char* end = text + len;
+	for(const char* p = text; p < end; ++p) {
+		if('"' == *p) {
+			out.append(run, p - run + 1);	//	include the quote...
+			out.push_back('"');				//	...and double it
+			run = p + 1;
+		}
+	}
+	out.append(run, end - run);
+	out.push_back('"');
+}
+
+static void IcuSqlite3AppendJsonString(
+	std::string& out, const char* text, const int len)
+{
+	out.push_back('"');
+	const char* run = text;
+	const char* end = text + len;
+	for(const char* p = text; p < end; ++p) {
+		const unsigned char c = static_cast<unsigned char>(*p);
+		if(c >= 0x20 && '"' != c && '\\' != c) {
+			continue;
+		}
+
+		out.append(run, p - run);
+		run = p + 1;
+		switch(c) {
+			case '"'	: out.append("\\\"", 2); break;
+			case '\\'	: out.append("\\\\", 2); break;
+			case '\n'	: out.append("\\n", 2); break;
+			case '\r'	: out.append("\\r", 2); break;
+			case '\t'	: out.append("\\t", 2); break;
+			default		:
+				{
+					const char esc[6] = { '\\', 'u', '0', '0', s_hexDigits[c >> 4], s_hexDigits[c & 0xf] };
+					out.append(esc, sizeof(esc));
+				}
+				break;
+		}
+	}
+	out.append(run, end - run);
+	out.push_back('"');
+}
+
+static void IcuSqlite3AppendHex(
+	std::string& out, const unsigned char* data, const int len)
+{
+	const size_t start = out.size();
+	out.resize(start + len * 2);
+	char* p = &out[start];
+	for(int i = 0; i < len; ++i) {
+		*p++ = s_hexDigits[data[i] >> 4];
+		*p++ = s_hexDigits[data[i] & 0xf];
+	}
+}
+
+static void IcuSqlite3AppendBase64(
+	std::string& out, const unsigned char* data, const int len)
+{
+	const size_t start = out.size();
+	out.resize(start + ((len + 2) / 3) * 4);
+	char* p = &out[start];
+
+	int i = 0;
+	for(; i + 2 < len; i += 3) {
+		const uint32_t n = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		*p++ = s_base64Chars[(n >> 18) & 0x3f];
+		*p++ = s_base64Chars[(n >> 12) & 0x3f];
+		*p++ = s_base64Chars[(n >> 6) & 0x3f];
+		*p++ = s_base64Chars[n & 0x3f];
+	}
+	if(i < len) {
+		const uint32_t n = (data[i] << 16) | ((i + 1 < len) ? (data[i + 1] << 8) : 0);
+		*p++ = s_base64Chars[(n >> 18) & 0x3f];
+		*p++ = s_base64Chars[(n >> 12) & 0x3f];
+		*p++ = (i + 1 < len) ? s_base64Chars[(n >> 6) & 0x3f] : '=';
+		*p++ = '=';
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	Table export job - shared by the workers and the ordered writer
+///////////////////////////////////////////////////////////////////////////////
+namespace {
+
+struct IcuSqlite3ExportJob
+{
+	const IcuSqlite3ExportOptions*	options;
+	std::string						selectSql;		//	bound with a rowid range unless singleUnit
+	std::vector<std::string>		jsonKeys;		//	'{"name":' / ',"name":' per column
+	int								columns;
+	bool							singleUnit;
+	int64_t							minRowId;
+	uint64_t						rangeSize;
+	int64_t							units;
+
+	std::mutex						lock;
+	std::condition_variable			workerWake;
+	std::condition_variable			writerWake;
+	int64_t							nextUnit;		//	next range to hand out
+	int64_t							nextWrite;		//	next range the sink wants
+	std::vector<std::string>		slots;			//	rendered ranges, indexed unit % slots.size()
+	std::vector<char>				ready;
+	bool							failed;
+
+	std::atomic<int64_t>			rows;
+
+	IcuSqlite3ExportJob()
+		: options(nullptr), columns(0), singleUnit(false), minRowId(0), rangeSize(0)
+		, units(0), nextUnit(0), nextWrite(0), failed(false), rows(0)
+	{
+	}
+
+	void Fail()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		failed = true;
+		workerWake.notify_all();
+		writerWake.notify_all();
+	}
+
+	bool RenderUnit(sqlite3_stmt* stmt, const int64_t unit, std::string& out);
+	void RenderRow(sqlite3_stmt* stmt, std::string& out) const;
+	void Work(sqlite3* reader);
+	bool Drain(IcuSqlite3ExportSink& sink);
+};
+
+bool IcuSqlite3ExportJob::RenderUnit(
+	sqlite3_stmt* stmt, const int64_t unit, std::string& out)
+{
+	if(!singleUnit) {
+		//
+		//	Ranges are computed unsigned so a table spanning the whole
+		//	int64 rowid space doesn't overflow
+		//
+		const uint64_t first = static_cast<uint64_t>(minRowId) + static_cast<uint64_t>(unit) * rangeSize;
+		uint64_t last = first + rangeSize - 1;
+		if(unit == units - 1 || last < first) {
+			last = static_cast<uint64_t>(INT64_MAX);
+		}
+		sqlite3_reset(stmt);
+		sqlite3_bind_int64(stmt, 1, static_cast<int64_t>(first));
+		sqlite3_bind_int64(stmt, 2, static_cast<int64_t>(last));
+	}
+
+	int64_t count = 0;
+	int rc;
+	while(SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+		RenderRow(stmt, out);
+		++count;
+	}
+	sqlite3_reset(stmt);
+
+	rows.fetch_add(count, std::memory_order_relaxed);
+	return SQLITE_DONE == rc;
+}
+
+void IcuSqlite3ExportJob::RenderRow(
+	sqlite3_stmt* stmt, std::string& out) const
+{
+	const EIcuSqlite3ExportFormat format = options->format;
+	const char delimiter = options->delimiter;
+
+	if(ICUSQLITE_EXPORT_BINARY == format) {
+		out.push_back('\x01');
+	}
+
+	for(int col = 0; col < columns; ++col) {
+		const int type = sqlite3_column_type(stmt, col);
+
+		switch(format) {
+			case ICUSQLITE_EXPORT_CSV :
+				if(col > 0) {
+					out.push_back(delimiter);
+				}
+				switch(type) {
+					case SQLITE_INTEGER	: IcuSqlite3AppendInt64(out, sqlite3_column_int64(stmt, col)); break;
+					case SQLITE_FLOAT	: IcuSqlite3AppendDouble(out, sqlite3_column_double(stmt, col)); break;
+					case SQLITE_TEXT	:
+						{
+							const char* text = (const char*)sqlite3_column_text(stmt, col);
+							IcuSqlite3AppendCsvField(out, text, sqlite3_column_bytes(stmt, col), delimiter);
+						}
+						break;
+					case SQLITE_BLOB	:
+						{
+							const unsigned char* blob = (const unsigned char*)sqlite3_column_blob(stmt, col);
+							IcuSqlite3AppendHex(out, blob, sqlite3_column_bytes(stmt, col));
+						}
+						break;
+					default				: break;	//	NULL is an empty field
+				}
+				break;
+
+			case ICUSQLITE_EXPORT_NDJSON :
+				out.append(jsonKeys[col]);
+				switch(type) {
+					case SQLITE_INTEGER	: IcuSqlite3AppendInt64(out, sqlite3_column_int64(stmt, col)); break;
+					case SQLITE_FLOAT	:
+						{
+							const double value = sqlite3_column_double(stmt, col);
+							if(std::isfinite(value)) {
+								IcuSqlite3AppendDouble(out, value);
+							} else {
+								out.append("null", 4);
+							}
+						}
+						break;
+					case SQLITE_TEXT	:
+						{
+							const char* text = (const char*)sqlite3_column_text(stmt, col);
+							IcuSqlite3AppendJsonString(out, text, sqlite3_column_bytes(stmt, col));
+						}
+						break;
+					case SQLITE_BLOB	:
+						{
+							const unsigned char* blob = (const unsigned char*)sqlite3_column_blob(stmt, col);
+							out.push_back('"');
+							IcuSqlite3AppendBase64(out, blob, sqlite3_column_bytes(stmt, col));
+							out.push_back('"');
+						}
+						break;
+					default				: out.append("null", 4); break;
+				}
+				break;
+
+			case ICUSQLITE_EXPORT_BINARY :
+				switch(type) {
+					case SQLITE_INTEGER	:
+						{
+							const int64_t value = sqlite3_column_int64(stmt, col);
+							out.push_back('\x01');
+							IcuSqlite3AppendVarint(out,
+								(static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+						}
+						break;
+					case SQLITE_FLOAT	:
+						{
+							const double value = sqlite3_column_double(stmt, col);
+							uint64_t bits;
+							memcpy(&bits, &value, sizeof(bits));
+							char buf[9] = { '\x02' };
+							for(int i = 0; i < 8; ++i) {
+								buf[1 + i] = static_cast<char>((bits >> (i * 8)) & 0xff);
+							}
+							out.append(buf, sizeof(buf));
+						}
+						break;
+					case SQLITE_TEXT	:
+					case SQLITE_BLOB	:
+						{
+							//
+							//	TEXT is tagged UTF-8, so it must be read as such:
+							//	sqlite3_column_blob() would hand back a UTF-16
+							//	database's stored bytes unconverted
+							//
+							const char* data = (SQLITE_TEXT == type) ?
+								(const char*)sqlite3_column_text(stmt, col) :
+								(const char*)sqlite3_column_blob(stmt, col);
+							const int len = sqlite3_column_bytes(stmt, col);
+							out.push_back((SQLITE_TEXT == type) ? '\x03' : '\x04');
+							IcuSqlite3AppendVarint(out, static_cast<uint64_t>(len));
+							out.append(data, len);
+						}
+						break;
+					default				: out.push_back('\x00'); break;
+				}
+				break;
+		}
+	}
+
+	switch(format) {
+		case ICUSQLITE_EXPORT_CSV		: out.append("\r\n", 2); break;
+		case ICUSQLITE_EXPORT_NDJSON	: out.append((0 == columns) ? "{}\n" : "}\n"); break;
+		default							: break;
+	}
+}
+
+void IcuSqlite3ExportJob::Work(
+	sqlite3* reader)
+{
+	sqlite3_stmt* stmt = nullptr;
+	if(SQLITE_OK != sqlite3_prepare_v2(reader, selectSql.c_str(), -1, &stmt, nullptr)) {
+		Fail();
+		return;
+	}
+
+	std::string buffer;
+	std::unique_lock<std::mutex> guard(lock);
+	for(;;) {
+		//
+		//	Stay at most slots.size() ranges ahead of the sink
+		//
+		workerWake.wait(guard, [this] {
+			return failed || nextUnit >= units ||
+				nextUnit < nextWrite + static_cast<int64_t>(slots.size());
+		});
+		if(failed || nextUnit >= units) {
+			break;
+		}
+		const int64_t unit = nextUnit++;
+		guard.unlock();
+
+		buffer.clear();
+		const bool ok = RenderUnit(stmt, unit, buffer);
+
+		guard.lock();
+		if(!ok) {
+			failed = true;
+			workerWake.notify_all();
+			writerWake.notify_all();
+			break;
+		}
+
+		//
+		//	Trade our buffer for the slot's drained one, keeping both
+		//	capacities in circulation
+		//
+		const size_t slot = static_cast<size_t>(unit % slots.size());
+		slots[slot].swap(buffer);
+		ready[slot] = 1;
+		writerWake.notify_one();
+	}
+	guard.unlock();
+
+	sqlite3_finalize(stmt);
+}
+
+bool IcuSqlite3ExportJob::Drain(
+	IcuSqlite3ExportSink& sink)
+{
+	std::string buffer;
+	std::unique_lock<std::mutex> guard(lock);
+	while(nextWrite < units) {
+		const size_t slot = static_cast<size_t>(nextWrite % slots.size());
+		writerWake.wait(guard, [this, slot] { return failed || 0 != ready[slot]; });
+		if(failed) {
+			return false;
+		}
+
+		buffer.clear();
+		slots[slot].swap(buffer);
+		ready[slot] = 0;
+		++nextWrite;
+		workerWake.notify_all();
+		guard.unlock();
+
+		if(!buffer.empty() && !sink.Write(buffer.data(), buffer.size())) {
+			Fail();
+			return false;
+		}
+
+		guard.lock();
+	}
+	return !failed;
+}
+
+}	//	namespace
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3FileExportSink
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3FileExportSink::IcuSqlite3FileExportSink()
+	: m_file(nullptr)
+{
+}
+
+IcuSqlite3FileExportSink::~IcuSqlite3FileExportSink()
+{
+	Close();
+}
+
+bool IcuSqlite3FileExportSink::Open(
+	const UnicodeString& filename)
+{
+	Close();
+
+#if defined(WIN32)
+	std::wstring wideFilename(filename.getBuffer(), filename.getBuffer() + filename.length());
+	m_file = _wfopen(wideFilename.c_str(), L"wb");
+#else	//	defined(WIN32)
+	std::string utf8Filename;
+	IcuSqlite3ToUtf8(filename, utf8Filename);
+	m_file = fopen(utf8Filename.c_str(), "wb");
+#endif	//	!defined(WIN32)
+
+	if(nullptr != m_file) {
+		setvbuf((FILE*)m_file, nullptr, _IOFBF, 1024 * 1024);
+	}
+	return nullptr != m_file;
+}
+
+bool IcuSqlite3FileExportSink::Close()
+{
+	if(nullptr == m_file) {
+		return true;
+	}
+	const bool ok = (0 == fclose((FILE*)m_file));
+	m_file = nullptr;
+	return ok;
+}
+
+bool IcuSqlite3FileExportSink::Write(
+	const char* data, const size_t len)
+{
+	return nullptr != m_file && len == fwrite(data, 1, len, (FILE*)m_file);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ExportOptions
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ExportOptions::IcuSqlite3ExportOptions()
+	: format(ICUSQLITE_EXPORT_CSV)
+	, threads(0)
+	, rowidsPerRange(0)
+	, maxPendingRanges(0)
+	, delimiter(',')
+	, header(true)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Exporter - public
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3Exporter::IcuSqlite3Exporter(
+	IcuSqlite3Database& db)
+	: m_db(db)
+	, m_rows(0)
+{
+}
+
+IcuSqlite3Exporter::~IcuSqlite3Exporter()
+{
+	End();
+}
+
+bool IcuSqlite3Exporter::Begin(
+	const IcuSqlite3ExportOptions& options /*= IcuSqlite3ExportOptions()*/,
+	const UnicodeString& dbName /*= "main"*/)
+{
+	End();
+
+	//
+	//	Readers are separate connections we hold no key for
+	//
+	if(!m_db.IsOpen() || m_db.IsEncrypted()) {
+		return false;
+	}
+
+	std::string utf8DbName;
+	IcuSqlite3ToUtf8(dbName, utf8DbName);
+
+	sqlite3* db = (sqlite3*)m_db.GetDatabaseHandle();
+	const char* filename = sqlite3_db_filename(db, utf8DbName.c_str());
+	if(nullptr == filename || '\0' == filename[0]) {
+		return false;	//	temp / in-memory
+	}
+	const std::string utf8Filename(filename);
+
+	bool wal = false;
+	{
+		IcuSqlite3StatementBuffer sql;
+		sqlite3_stmt* stmt = nullptr;
+		if(SQLITE_OK == sqlite3_prepare_v2(db, sql.Format("PRAGMA %Q.journal_mode;", utf8DbName.c_str()),
+			-1, &stmt, nullptr) && SQLITE_ROW == sqlite3_step(stmt))
+		{
+			const char* mode = (const char*)sqlite3_column_text(stmt, 0);
+			wal = (nullptr != mode && 0 == sqlite3_stricmp(mode, "wal"));
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	m_options = options;
+	int threads = m_options.threads;
+	if(threads <= 0) {
+		threads = static_cast<int>(std::thread::hardware_concurrency());
+		if(threads <= 0) {
+			threads = 1;
+		}
+	}
+#if !ICUSQLITE_HAVE_SNAPSHOT
+	if(wal) {
+		threads = 1;	//	no way to put a second reader on the same snapshot
+	}
+#endif	//	!ICUSQLITE_HAVE_SNAPSHOT
+
+	//
+	//	The first reader starts a read transaction and keeps it open until
+	//	End(): that fixes the snapshot (WAL) or holds the SHARED lock that
+	//	keeps writers from committing (rollback journal)
+	//
+	void* first = nullptr;
+	if(!OpenReader(utf8Filename, &first)) {
+		return false;
+	}
+	if(SQLITE_OK != sqlite3_exec((sqlite3*)first, "BEGIN; SELECT COUNT(*) FROM sqlite_master;",
+		nullptr, nullptr, nullptr))
+	{
+		sqlite3_close((sqlite3*)first);
+		return false;
+	}
+	m_readers.push_back(first);
+
+#if ICUSQLITE_HAVE_SNAPSHOT
+	sqlite3_snapshot* snapshot = nullptr;
+	if(wal && threads > 1 &&
+		SQLITE_OK != sqlite3_snapshot_get((sqlite3*)first, "main", &snapshot))
+	{
+		threads = 1;
+	}
+#endif	//	ICUSQLITE_HAVE_SNAPSHOT
+
+	//
+	//	Additional readers are a bonus: if one can't join the snapshot we
+	//	just export with fewer
+	//
+	while(static_cast<int>(m_readers.size()) < threads) {
+		void* reader = nullptr;
+		if(!OpenReader(utf8Filename, &reader)) {
+			break;
+		}
+
+		int rc = sqlite3_exec((sqlite3*)reader, "BEGIN;", nullptr, nullptr, nullptr);
+#if ICUSQLITE_HAVE_SNAPSHOT
+		if(SQLITE_OK == rc && wal) {
+			rc = sqlite3_snapshot_open((sqlite3*)reader, "main", snapshot);
+		}
+#endif	//	ICUSQLITE_HAVE_SNAPSHOT
+		if(SQLITE_OK == rc) {
+			rc = sqlite3_exec((sqlite3*)reader, "SELECT COUNT(*) FROM sqlite_master;",
+				nullptr, nullptr, nullptr);
+		}
+		if(SQLITE_OK != rc) {
+			sqlite3_close((sqlite3*)reader);
+			break;
+		}
+		m_readers.push_back(reader);
+	}
+
+#if ICUSQLITE_HAVE_SNAPSHOT
+	if(nullptr != snapshot) {
+		sqlite3_snapshot_free(snapshot);
+	}
+#endif	//	ICUSQLITE_HAVE_SNAPSHOT
+
+	m_rows = 0;
+	return true;
+}
+
+bool IcuSqlite3Exporter::ExportTable(
+	const UnicodeString& tableName, IcuSqlite3ExportSink& sink)
+{
+	if(m_readers.empty()) {
+		return false;
+	}
+
+	std::string utf8Table;
+	IcuSqlite3ToUtf8(tableName, utf8Table);
+
+	sqlite3* first = (sqlite3*)m_readers[0];
+	IcuSqlite3ExportJob job;
+	job.options = &m_options;
+
+	//
+	//	Column names, and a rowid alias the table doesn't shadow
+	//
+	const char* rowidName = nullptr;
+	std::vector<std::string> columnNames;
+	{
+		IcuSqlite3StatementBuffer sql;
+		sqlite3_stmt* stmt = nullptr;
+		if(SQLITE_OK != sqlite3_prepare_v2(first, sql.Format("SELECT * FROM main.\"%w\";", utf8Table.c_str()),
+			-1, &stmt, nullptr))
+		{
+			return false;
+		}
+
+		job.columns = sqlite3_column_count(stmt);
+		for(int col = 0; col < job.columns; ++col) {
+			const char* name = sqlite3_column_name(stmt, col);
+			columnNames.push_back((nullptr != name) ? name : "");
+		}
+		sqlite3_finalize(stmt);
+
+		static const char* const aliases[] = { "rowid", "_rowid_", "oid" };
+		for(size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]) && nullptr == rowidName; ++i) {
+			rowidName = aliases[i];
+			for(size_t col = 0; col < columnNames.size(); ++col) {
+				if(0 == sqlite3_stricmp(columnNames[col].c_str(), aliases[i])) {
+					rowidName = nullptr;
+					break;
+				}
+			}
+		}
+	}
+
+	//
+	//	Rowid bounds; this fails for WITHOUT ROWID tables (and views), which
+	//	are exported as a single range
+	//
+	bool haveRange = false;
+	int64_t maxRowId = 0;
+	if(nullptr != rowidName) {
+		IcuSqlite3StatementBuffer sql;
+		sqlite3_stmt* stmt = nullptr;
+		if(SQLITE_OK == sqlite3_prepare_v2(first,
+			sql.Format("SELECT MIN(%s), MAX(%s) FROM main.\"%w\";", rowidName, rowidName, utf8Table.c_str()),
+			-1, &stmt, nullptr))
+		{
+			if(SQLITE_ROW == sqlite3_step(stmt)) {
+				haveRange = true;
+				if(SQLITE_NULL == sqlite3_column_type(stmt, 0)) {
+					job.units = 0;	//	empty
+				} else {
+					job.minRowId	= sqlite3_column_int64(stmt, 0);
+					maxRowId		= sqlite3_column_int64(stmt, 1);
+					job.units		= 1;
+				}
+			}
+		}
+		sqlite3_finalize(stmt);
+	}
+
+	IcuSqlite3StatementBuffer selectSql;
+	if(haveRange) {
+		selectSql.Format("SELECT * FROM main.\"%w\" WHERE %s BETWEEN ?1 AND ?2 ORDER BY %s;",
+			utf8Table.c_str(), rowidName, rowidName);
+
+		if(job.units > 0) {
+			//
+			//	Small ranges balance better, but each costs a seek and a
+			//	hand-off; aim for a few hundred per reader at most
+			//
+			const uint64_t span = static_cast<uint64_t>(maxRowId) - static_cast<uint64_t>(job.minRowId);
+			const uint64_t maxUnits = static_cast<uint64_t>(m_readers.size()) * 256;
+			uint64_t rangeSize = (m_options.rowidsPerRange > 0) ?
+				static_cast<uint64_t>(m_options.rowidsPerRange) : 4096;
+			if(span / rangeSize + 1 > maxUnits) {
+				rangeSize = span / maxUnits + 1;
+			}
+			job.rangeSize	= rangeSize;
+			job.units		= static_cast<int64_t>(span / rangeSize + 1);
+		}
+	} else {
+		selectSql.Format("SELECT * FROM main.\"%w\";", utf8Table.c_str());
+		job.singleUnit	= true;
+		job.units		= 1;
+	}
+	job.selectSql = (const char*)selectSql;
+
+	//
+	//	Header, written up front on this thread
+	//
+	std::string header;
+	switch(m_options.format) {
+		case ICUSQLITE_EXPORT_CSV :
+			if(m_options.header) {
+				for(size_t col = 0; col < columnNames.size(); ++col) {
+					if(col > 0) {
+						header.push_back(m_options.delimiter);
+					}
+					IcuSqlite3AppendCsvField(header, columnNames[col].data(),
+						static_cast<int>(columnNames[col].size()), m_options.delimiter);
+				}
+				header.append("\r\n", 2);
+			}
+			break;
+
+		case ICUSQLITE_EXPORT_NDJSON :
+			for(size_t col = 0; col < columnNames.size(); ++col) {
+				std::string key(1, (0 == col) ? '{' : ',');
+				IcuSqlite3AppendJsonString(key, columnNames[col].data(),
+					static_cast<int>(columnNames[col].size()));
+				key.push_back(':');
+				job.jsonKeys.push_back(key);
+			}
+			break;
+
+		case ICUSQLITE_EXPORT_BINARY :
+			header.append("ISQ3B1\0\0", 8);
+			IcuSqlite3AppendVarint(header, columnNames.size());
+			for(size_t col = 0; col < columnNames.size(); ++col) {
+				IcuSqlite3AppendVarint(header, columnNames[col].size());
+				header.append(columnNames[col]);
+			}
+			break;
+	}
+	if(!header.empty() && !sink.Write(header.data(), header.size())) {
+		return false;
+	}
+
+	bool ok = true;
+	if(job.units > 0) {
+		const int workers = (job.units < static_cast<int64_t>(m_readers.size())) ?
+			static_cast<int>(job.units) : static_cast<int>(m_readers.size());
+
+		size_t slots = (m_options.maxPendingRanges > 0) ? m_options.maxPendingRanges : 4;
+		if(slots < static_cast<size_t>(workers) * 2) {
+			slots = static_cast<size_t>(workers) * 2;	//	or workers starve behind the sink
+		}
+		job.slots.resize(slots);
+		job.ready.resize(slots, 0);
+
+		std::vector<std::thread> threads;
+		for(int i = 0; i < workers; ++i) {
+			threads.push_back(std::thread(&IcuSqlite3ExportJob::Work, &job, (sqlite3*)m_readers[i]));
+		}
+
+		ok = job.Drain(sink);
+		if(!ok) {
+			job.Fail();
+		}
+
+		for(size_t i = 0; i < threads.size(); ++i) {
+			threads[i].join();
+		}
+	}
+
+	if(ok && ICUSQLITE_EXPORT_BINARY == m_options.format) {
+		ok = sink.Write("\0", 1);
+	}
+
+	m_rows += job.rows;
+	return ok;
+}
+
+void IcuSqlite3Exporter::End()
+{
+	for(size_t i = 0; i < m_readers.size(); ++i) {
+		sqlite3_exec((sqlite3*)m_readers[i], "COMMIT;", nullptr, nullptr, nullptr);
+		sqlite3_close((sqlite3*)m_readers[i]);
+	}
+	m_readers.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Exporter - private
+///////////////////////////////////////////////////////////////////////////////
+bool IcuSqlite3Exporter::OpenReader(
+	const std::string& utf8Filename, void** reader)
+{
+	//
+	//	Each reader is only ever used by one worker at a time
+	//
+	sqlite3* db = nullptr;
+	if(SQLITE_OK != sqlite3_open_v2(utf8Filename.c_str(), &db,
+		SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr))
+	{
+		sqlite3_close(db);
+		return false;
+	}
+
+	//
+	//	Joining behind a writer that is waiting to commit (rollback journal).
+	//	A negative timeout waits forever in IcuSqlite3BusyPolicy, but means
+	//	"don't wait" to sqlite3_busy_timeout().
+	//
+	const int busyTimeoutMs = m_db.GetBusyTimeout();
+	sqlite3_busy_timeout(db, (busyTimeoutMs < 0) ? 0x7fffffff : busyTimeoutMs);
+
+	*reader = db;
+	return true;
+}
@@ -0,0 +1,153 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_EXPORT_H__
+#define __ICU_SQLITE3_EXPORT_H__
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <atomic>
+#include <string>
+#include <vector>
+
+enum EIcuSqlite3ExportFormat {
+	//
+	//	RFC 4180: header row of column names, fields quoted when needed,
+	//	NULL as an empty field, BLOBs as lower case hex
+	//
+	ICUSQLITE_EXPORT_CSV,
+
+	//
+	//	One JSON object per row keyed by column name. BLOBs are base64
+	//	strings; non-finite REALs are null.
+	//
+	ICUSQLITE_EXPORT_NDJSON,
+
+	//
+	//	Compact binary rows. Each table starts with:
+	//		"ISQ3B1\0\0", varint column count, per column: varint length + UTF-8 name
+	//	followed by rows, each a 0x01 byte and then one cell per column:
+	//		0 NULL		(no payload)
+	//		1 INTEGER	zig-zag varint
+	//		2 REAL		8 bytes IEEE 754, little endian
+	//		3 TEXT		varint byte length + UTF-8
+	//		4 BLOB		varint byte length + bytes
+	//	and a 0x00 byte after the last row.
+	//	Varints are LEB128 (7 bits per byte, low bits first).
+	//
+	ICUSQLITE_EXPORT_BINARY,
+};
+
+//
+//	Destination for exported bytes; always called from one thread at a time
+//	and in table / row order
+//
+class IcuSqlite3ExportSink
+{
+public:
+	virtual ~IcuSqlite3ExportSink() {}
+
+	virtual bool Write(const char* data, const size_t len) = 0;
+};
+
+//
+//	Sink writing to a file (created / truncated)
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3FileExportSink : public IcuSqlite3ExportSink
+{
+public:
+	IcuSqlite3FileExportSink();
+	virtual ~IcuSqlite3FileExportSink();
+
+	bool Open(const UnicodeString& filename);
+	bool Close();
+
+	virtual bool Write(const char* data, const size_t len);
+private:
+	void*	m_file;
+
+	IcuSqlite3FileExportSink(const IcuSqlite3FileExportSink&);
+	IcuSqlite3FileExportSink& operator=(const IcuSqlite3FileExportSink&);
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ExportOptions
+{
+	IcuSqlite3ExportOptions();
+
+	EIcuSqlite3ExportFormat	format;
+	int						threads;			//	reader connections; 0 = hardware concurrency
+	int64_t					rowidsPerRange;		//	rowid span handed to a worker at a time, 0 = auto
+	int						maxPendingRanges;	//	rendered ranges allowed to queue up ahead of the sink
+	char					delimiter;			//	CSV field delimiter
+	bool					header;				//	CSV header row
+};
+
+//
+//	Exports tables from the database behind |db| using several read
+//	connections that all see the same snapshot, each table split into rowid
+//	ranges rendered in parallel and written to the sink in rowid order.
+//
+//	Each worker renders straight from sqlite3_column_*() into a buffer it
+//	reuses from range to range, so the steady state makes no allocations.
+//	Memory is bounded by maxPendingRanges rendered ranges.
+//
+//		IcuSqlite3Exporter exporter(db);
+//		exporter.Begin(options);
+//		exporter.ExportTable("a", sink);
+//		exporter.ExportTable("b", sink);	//	same snapshot as "a"
+//		exporter.End();
+//
+//	Readers share a snapshot via sqlite3_snapshot_open() in WAL mode (needs
+//	ICUSQLITE_HAVE_SNAPSHOT) and via the shared lock held by the first
+//	reader in rollback journal mode. In WAL mode without snapshot support
+//	the export falls back to a single reader, as it does for WITHOUT ROWID
+//	tables. Encrypted and in-memory databases can't be exported this way.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3Exporter
+{
+public:
+	explicit IcuSqlite3Exporter(IcuSqlite3Database& db);
+	~IcuSqlite3Exporter();
+
+	bool Begin(const IcuSqlite3ExportOptions& options = IcuSqlite3ExportOptions(),
+		const UnicodeString& dbName = "main");
+	bool ExportTable(const UnicodeString& tableName, IcuSqlite3ExportSink& sink);
+	void End();
+
+	int GetReaderCount() const { return static_cast<int>(m_readers.size()); }
+	int64_t GetRowsExported() const { return m_rows; }
+
+private:
+	IcuSqlite3Database&			m_db;
+	IcuSqlite3ExportOptions		m_options;
+	std::vector<void*>			m_readers;		//	sqlite3*, m_readers[0] pins the snapshot
+	std::atomic<int64_t>		m_rows;
+
+	bool OpenReader(const std::string& utf8Filename, void** reader);
+
+	IcuSqlite3Exporter(const IcuSqlite3Exporter&);	//	prevent copy
+	IcuSqlite3Exporter& operator=(const IcuSqlite3Exporter&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_EXPORT_H__
@@ -0,0 +1,1389 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Import.h"
+#include "ICUSQLite3Internal.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(WIN32)
+	#include <windows.h>
+#else	//	defined(WIN32)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif	//	!defined(WIN32)
+
+//
+//	Vector scanning; x86 only, everything else takes the scalar path
+//
+#if defined(__AVX2__)
+	#define ICUSQLITE_HAVE_AVX2		1
+	#include <immintrin.h>
+#endif	//	defined(__AVX2__)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ICUSQLITE_HAVE_SSE2		1
+	#include <emmintrin.h>
+#endif	//	SSE2
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif	//	defined(_MSC_VER)
+
+///////////////////////////////////////////////////////////////////////////////
+//	Scanning
+///////////////////////////////////////////////////////////////////////////////
+static inline unsigned IcuSqlite3Ctz(
+	const unsigned v)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, v);
+	return index;
+#else	//	defined(_MSC_VER)
+	return __builtin_ctz(v);
+#endif	//	!defined(_MSC_VER)
+}
+
+static inline unsigned IcuSqlite3PopCount(
+	const unsigned v)
+{
+#if defined(_MSC_VER)
+	return __popcnt(v);
+#else	//	defined(_MSC_VER)
+	return __builtin_popcount(v);
+#endif	//	!defined(_MSC_VER)
+}
+
+//
+//	First of |a|, |b| or |c| in [p, end), or |end|
+//
+static const char* IcuSqlite3FindAny(
+	const char* p, const char* end, const char a, const char b, const char c)
+{
+#if ICUSQLITE_HAVE_AVX2
+	{
+		const __m256i va = _mm256_set1_epi8(a);
+		const __m256i vb = _mm256_set1_epi8(b);
+		const __m256i vc = _mm256_set1_epi8(c);
+		for(; end - p >= 32; p += 32) {
+			const __m256i x = _mm256_loadu_si256((const __m256i*)p);
+			const __m256i m = _mm256_or_si256(_mm256_or_si256(
+				_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)), _mm256_cmpeq_epi8(x, vc));
+			const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(m));
+			if(0 != mask) {
+				return p + IcuSqlite3Ctz(mask);
+			}
+		}
+	}
+#endif	//	ICUSQLITE_HAVE_AVX2
+#if ICUSQLITE_HAVE_SSE2
+	{
+		const __m128i va = _mm_set1_epi8(a);
+		const __m128i vb = _mm_set1_epi8(b);
+		const __m128i vc = _mm_set1_epi8(c);
+		for(; end - p >= 16; p += 16) {
+			const __m128i x = _mm_loadu_si128((const __m128i*)p);
+			const __m128i m = _mm_or_si128(_mm_or_si128(
+				_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)), _mm_cmpeq_epi8(x, vc));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+			if(0 != mask) {
+				return p + IcuSqlite3Ctz(mask);
+			}
+		}
+	}
+#endif	//	ICUSQLITE_HAVE_SSE2
+	for(; p < end; ++p) {
+		if(a == *p || b == *p || c == *p) {
+			break;
+		}
+	}
+	return p;
+}
+
+static size_t IcuSqlite3CountByte(
+	const char* p, const char* end, const char c)
+{
+	size_t count = 0;
+#if ICUSQLITE_HAVE_AVX2
+	{
+		const __m256i vc = _mm256_set1_epi8(c);
+		for(; end - p >= 32; p += 32) {
+			const __m256i x = _mm256_loadu_si256((const __m256i*)p);
+			count += IcuSqlite3PopCount(static_cast<unsigned>(
+				_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, vc))));
+		}
+	}
+#endif	//	ICUSQLITE_HAVE_AVX2
+#if ICUSQLITE_HAVE_SSE2
+	{
+		const __m128i vc = _mm_set1_epi8(c);
+		for(; end - p >= 16; p += 16) {
+			const __m128i x = _mm_loadu_si128((const __m128i*)p);
+			count += IcuSqlite3PopCount(static_cast<unsigned>(
+				_mm_movemask_epi8(_mm_cmpeq_epi8(x, vc))));
+		}
+	}
+#endif	//	ICUSQLITE_HAVE_SSE2
+	for(; p < end; ++p) {
+		if(c == *p) {
+			++count;
+		}
+	}
+	return count;
+}
+
+static const char* IcuSqlite3SkipAscii(
+	const char* p, const char* end)
+{
+#if ICUSQLITE_HAVE_AVX2
+	for(; end - p >= 32; p += 32) {
+		if(0 != _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)p))) {
+			break;
+		}
+	}
+#endif	//	ICUSQLITE_HAVE_AVX2
+#if ICUSQLITE_HAVE_SSE2
+	for(; end - p >= 16; p += 16) {
+		if(0 != _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p))) {
+			break;
+		}
+	}
+#endif	//	ICUSQLITE_HAVE_SSE2
+	while(p < end && 0 == (*p & 0x80)) {
+		++p;
+	}
+	return p;
+}
+
+//
+//	Well formed UTF-8: no overlongs, surrogates or code points past U+10FFFF
+//
+static bool IcuSqlite3IsValidUtf8(
+	const char* p, const char* end)
+{
+	for(;;) {
+		p = IcuSqlite3SkipAscii(p, end);
+		if(p >= end) {
+			return true;
+		}
+
+		const unsigned char c = static_cast<unsigned char>(*p);
+		int trail;
+		unsigned char lo = 0x80;
+		unsigned char hi = 0xbf;
+		if(c >= 0xc2 && c <= 0xdf) {
+			trail = 1;
+		} else if(c >= 0xe0 && c <= 0xef) {
+			trail = 2;
+			if(0xe0 == c) {
+				lo = 0xa0;	//	overlong
+			} else if(0xed == c) {
+				hi = 0x9f;	//	surrogates
+			}
+		} else if(c >= 0xf0 && c <= 0xf4) {
+			trail = 3;
+			if(0xf0 == c) {
+				lo = 0x90;	//	overlong
+			} else if(0xf4 == c) {
+				hi = 0x8f;	//	> U+10FFFF
+			}
+		} else {
+			return false;
+		}
+
+		if(end - p <= trail) {
+			return false;
+		}
+		const unsigned char c1 = static_cast<unsigned char>(p[1]);
+		if(c1 < lo || c1 > hi) {
+			return false;
+		}
+		for(int i = 2; i <= trail; ++i) {
+			if(0x80 != (static_cast<unsigned char>(p[i]) & 0xc0)) {
+				return false;
+			}
+		}
+		p += trail + 1;
+	}
+}
+
+//
+//	End of the CSV record containing |target| (just past its newline),
+//	tracking quotes from |p|, which must be at a record boundary
+//
+static const char* IcuSqlite3CsvRecordEnd(
+	const char* p, const char* end, const char* target)
+{
+	bool quoted = (0 != (IcuSqlite3CountByte(p, target, '"') & 1));
+	p = target;
+	for(;;) {
+		p = IcuSqlite3FindAny(p, end, '"', '\n', '\n');
+		if(p >= end) {
+			return end;
+		}
+		if('"' == *p) {
+			quoted = !quoted;
+		} else if(!quoted) {
+			return p + 1;
+		}
+		++p;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	Memory mapped input
+///////////////////////////////////////////////////////////////////////////////
+class IcuSqlite3MappedFile
+{
+public:
+	IcuSqlite3MappedFile() : m_data(nullptr), m_len(0)
+#if defined(WIN32)
+		, m_mapping(nullptr)
+#endif	//	defined(WIN32)
+	{
+	}
+	~IcuSqlite3MappedFile() { Close(); }
+
+	bool Open(const UnicodeString& filename);
+	void Close();
+
+	const char* GetData() const { return m_data; }
+	size_t GetLength() const { return m_len; }
+
+private:
+	const char*		m_data;
+	size_t			m_len;
+#if defined(WIN32)
+	HANDLE			m_mapping;
+#endif	//	defined(WIN32)
+
+	IcuSqlite3MappedFile(const IcuSqlite3MappedFile&);
+	IcuSqlite3MappedFile& operator=(const IcuSqlite3MappedFile&);
+};
+
+bool IcuSqlite3MappedFile::Open(
+	const UnicodeString& filename)
+{
+	Close();
+
+#if defined(WIN32)
+	std::wstring wideFilename(filename.getBuffer(), filename.getBuffer() + filename.length());
+	HANDLE file = CreateFileW(wideFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(INVALID_HANDLE_VALUE == file) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	m_len = static_cast<size_t>(size.QuadPart);
+
+	if(m_len > 0) {
+		m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if(nullptr != m_mapping) {
+			m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+	}
+	CloseHandle(file);	//	the mapping keeps the file open
+
+	if(m_len > 0 && nullptr == m_data) {
+		Close();
+		return false;
+	}
+#else	//	defined(WIN32)
+	std::string utf8Filename;
+	IcuSqlite3ToUtf8(filename, utf8Filename);
+
+	const int fd = open(utf8Filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if(0 != fstat(fd, &st)) {
+		close(fd);
+		return false;
+	}
+	m_len = static_cast<size_t>(st.st_size);
+
+	if(m_len > 0) {
+		void* data = mmap(nullptr, m_len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(MAP_FAILED == data) {
+			close(fd);
+			m_len = 0;
+			return false;
+		}
+		madvise(data, m_len, MADV_SEQUENTIAL);
+		m_data = (const char*)data;
+	}
+	close(fd);	//	the mapping keeps the file open
+#endif	//	!defined(WIN32)
+
+	return true;
+}
+
+void IcuSqlite3MappedFile::Close()
+{
+#if defined(WIN32)
+	if(nullptr != m_data) {
+		UnmapViewOfFile(m_data);
+	}
+	if(nullptr != m_mapping) {
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+#else	//	defined(WIN32)
+	if(nullptr != m_data) {
+		munmap((void*)m_data, m_len);
+	}
+#endif	//	!defined(WIN32)
+	m_data	= nullptr;
+	m_len	= 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	Parsing
+///////////////////////////////////////////////////////////////////////////////
+enum EIcuSqlite3ImportCellType {
+	ICUSQLITE_IMPORT_CELL_NULL,
+	ICUSQLITE_IMPORT_CELL_TEXT,
+	ICUSQLITE_IMPORT_CELL_INTEGER,
+	ICUSQLITE_IMPORT_CELL_REAL,
+};
+
+//
+//	TEXT points into the input or the batch arena, both of which outlive
+//	the batch's trip through the writer
+//
+struct IcuSqlite3ImportCell
+{
+	int				type;
+	int				len;
+	const char*		text;
+	union {
+		int64_t		i;
+		double		d;
+	};
+};
+
+//
+//	Scratch space for unescaped fields. Unescaping only ever shrinks a
+//	field, so an arena as large as the input it serves never needs to grow
+//	and the pointers handed out stay valid.
+//
+class IcuSqlite3ImportArena
+{
+public:
+	IcuSqlite3ImportArena() : m_capacity(0), m_used(0) {}
+
+	void Reset(const size_t capacity)
+	{
+		if(capacity > m_capacity) {
+			m_buffer.reset(new char[capacity]);
+			m_capacity = capacity;
+		}
+		m_used = 0;
+	}
+
+	char* GetTail() { return m_buffer.get() + m_used; }
+	void Commit(const size_t len) { m_used += len; }
+
+private:
+	std::unique_ptr<char[]>		m_buffer;
+	size_t						m_capacity;
+	size_t						m_used;
+};
+
+//
+//	One parsed chunk, stored a column at a time
+//
+struct IcuSqlite3ImportBatch
+{
+	std::vector<std::vector<IcuSqlite3ImportCell>>	columns;
+	std::vector<IcuSqlite3ImportCell>				row;		//	record being parsed
+	IcuSqlite3ImportArena							arena;
+	int64_t											rows;
+
+	void Reset(const int columnCount, const size_t inputLen)
+	{
+		columns.resize(columnCount);
+		for(size_t col = 0; col < columns.size(); ++col) {
+			columns[col].clear();
+		}
+		arena.Reset(inputLen);
+		rows = 0;
+	}
+};
+
+static inline void IcuSqlite3SetText(
+	IcuSqlite3ImportCell& cell, const char* text, const size_t len)
+{
+	cell.type	= ICUSQLITE_IMPORT_CELL_TEXT;
+	cell.text	= text;
+	cell.len	= static_cast<int>(len);
+}
+
+//
+//	Parses one CSV record starting at |p| into |row|, advancing |p| past
+//	its line break. Returns false for an unterminated quote or stray text
+//	after a closing quote; |p| still ends up at the next record.
+//
+static bool IcuSqlite3ParseCsvRecord(
+	const char*& p, const char* end, const char delimiter, const bool emptyIsNull,
+	IcuSqlite3ImportArena& arena, std::vector<IcuSqlite3ImportCell>& row)
+{
+	bool ok = true;
+	row.clear();
+
+	for(;;) {
+		IcuSqlite3ImportCell cell;
+		if(p < end && '"' == *p) {
+			const char* start = ++p;
+			const char* close = nullptr;
+			bool escaped = false;
+			for(;;) {
+				const char* q = (const char*)memchr(p, '"', end - p);
+				if(nullptr == q) {
+					p = end;
+					return false;	//	unterminated; ran to the end of the chunk
+				}
+				if(q + 1 < end && '"' == q[1]) {
+					escaped = true;
+					p = q + 2;
+					continue;
+				}
+				close = q;
+				p = q + 1;
+				break;
+			}
+
+			if(escaped) {
+				char* out = arena.GetTail();
+				char* dst = out;
+				for(const char* s = start; s < close; ++s) {
+					*dst++ = *s;
+					if('"' == *s) {
+						++s;	//	"" -> "
+					}
+				}
+				arena.Commit(dst - out);
+				IcuSqlite3SetText(cell, out, dst - out);
+			} else {
+				IcuSqlite3SetText(cell, start, close - start);
+			}
+
+			if(p < end && delimiter != *p && '\n' != *p && '\r' != *p) {
+				ok = false;
+				p = IcuSqlite3FindAny(p, end, delimiter, '\n', '\r');
+			}
+		} else {
+			const char* q = IcuSqlite3FindAny(p, end, delimiter, '\n', '\r');
+			if(q == p && emptyIsNull) {
+				cell.type	= ICUSQLITE_IMPORT_CELL_NULL;
+				cell.text	= nullptr;
+				cell.len	= 0;
+			} else {
+				IcuSqlite3SetText(cell, p, q - p);
+			}
+			p = q;
+		}
+		row.push_back(cell);
+
+		if(p < end && delimiter == *p) {
+			++p;
+			continue;
+		}
+
+		if(p < end && '\r' == *p) {
+			++p;
+		}
+		if(p < end && '\n' == *p) {
+			++p;
+		}
+		return ok;
+	}
+}
+
+static inline const char* IcuSqlite3SkipJsonSpace(
+	const char* p, const char* end)
+{
+	while(p < end && (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p)) {
+		++p;
+	}
+	return p;
+}
+
+static int IcuSqlite3HexValue(
+	const char c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static bool IcuSqlite3ParseHex4(
+	const char* p, const char* end, unsigned& value)
+{
+	if(end - p < 4) {
+		return false;
+	}
+	value = 0;
+	for(int i = 0; i < 4; ++i) {
+		const int h = IcuSqlite3HexValue(p[i]);
+		if(h < 0) {
+			return false;
+		}
+		value = (value << 4) | h;
+	}
+	return true;
+}
+
+static char* IcuSqlite3EncodeUtf8(
+	char* out, const unsigned cp)
+{
+	if(cp < 0x80) {
+		*out++ = static_cast<char>(cp);
+	} else if(cp < 0x800) {
+		*out++ = static_cast<char>(0xc0 | (cp >> 6));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3f));
+	} else if(cp < 0x10000) {
+		*out++ = static_cast<char>(0xe0 | (cp >> 12));
+		*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3f));
+	} else {
+		*out++ = static_cast<char>(0xf0 | (cp >> 18));
+		*out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+		*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3f));
+	}
+	return out;
+}
+
+//
+//	|p| is at the opening quote. Strings without escapes are returned in
+//	place; the rest are unescaped into |arena|.
+//
+static bool IcuSqlite3ParseJsonString(
+	const char*& p, const char* end, IcuSqlite3ImportArena& arena,
+	const char*& text, size_t& len)
+{
+	const char* start = ++p;
+	const char* q = IcuSqlite3FindAny(p, end, '"', '\\', '\\');
+	if(q >= end) {
+		return false;
+	}
+	if('"' == *q) {
+		text	= start;
+		len		= q - start;
+		p		= q + 1;
+		return true;
+	}
+
+	char* out = arena.GetTail();
+	memcpy(out, start, q - start);
+	char* dst = out + (q - start);
+	p = q;
+
+	while(p < end) {
+		if('"' == *p) {
+			++p;
+			text	= out;
+			len		= dst - out;
+			arena.Commit(len);
+			return true;
+		}
+		if('\\' != *p) {
+			q = IcuSqlite3FindAny(p, end, '"', '\\', '\\');
+			memcpy(dst, p, q - p);
+			dst += q - p;
+			p = q;
+			continue;
+		}
+
+		if(end - p < 2) {
+			return false;
+		}
+		const char esc = p[1];
+		p += 2;
+		switch(esc) {
+			case '"'	: *dst++ = '"'; break;
+			case '\\'	: *dst++ = '\\'; break;
+			case '/'	: *dst++ = '/'; break;
+			case 'b'	: *dst++ = '\b'; break;
+			case 'f'	: *dst++ = '\f'; break;
+			case 'n'	: *dst++ = '\n'; break;
+			case 'r'	: *dst++ = '\r'; break;
+			case 't'	: *dst++ = '\t'; break;
+			case 'u'	:
+				{
+					unsigned cp;
+					if(!IcuSqlite3ParseHex4(p, end, cp)) {
+						return false;
+					}
+					p += 4;
+					if(cp >= 0xd800 && cp <= 0xdbff) {
+						unsigned lo;
+						if(end - p >= 6 && '\\' == p[0] && 'u' == p[1] &&
+							IcuSqlite3ParseHex4(p + 2, end, lo) && lo >= 0xdc00 && lo <= 0xdfff)
+						{
+							cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+							p += 6;
+						} else {
+							cp = 0xfffd;	//	unpaired
+						}
+					} else if(cp >= 0xdc00 && cp <= 0xdfff) {
+						cp = 0xfffd;
+					}
+					dst = IcuSqlite3EncodeUtf8(dst, cp);
+				}
+				break;
+			default :
+				return false;
+		}
+	}
+	return false;
+}
+
+//
+//	Skips a nested object / array, |p| at its opening bracket
+//
+static bool IcuSqlite3SkipJsonNested(
+	const char*& p, const char* end)
+{
+	int depth = 0;
+	while(p < end) {
+		const char c = *p++;
+		if('"' == c) {
+			for(;;) {
+				const char* q = IcuSqlite3FindAny(p, end, '"', '\\', '\\');
+				if(q >= end) {
+					return false;
+				}
+				p = q + (('\\' == *q) ? 2 : 1);
+				if('"' == *q) {
+					break;
+				}
+			}
+		} else if('{' == c || '[' == c) {
+			++depth;
+		} else if('}' == c || ']' == c) {
+			if(0 == --depth) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool IcuSqlite3ParseJsonNumber(
+	const char*& p, const char* end, IcuSqlite3ImportCell& cell)
+{
+	const char* start = p;
+	bool integral = true;
+	while(p < end) {
+		const char c = *p;
+		if(c >= '0' && c <= '9') {
+		} else if('.' == c || 'e' == c || 'E' == c || '+' == c) {
+			integral = false;
+		} else if('-' != c) {
+			break;
+		}
+		++p;
+	}
+
+	const size_t len = p - start;
+	if(0 == len || len > 63) {
+		return false;
+	}
+
+	if(integral) {
+		const char* s = start;
+		const bool negative = ('-' == *s);
+		if(negative) {
+			++s;
+		}
+		uint64_t value = 0;
+		bool overflow = (s == p);
+		for(; s < p && !overflow; ++s) {
+			if('-' == *s) {
+				return false;
+			}
+			const unsigned digit = *s - '0';
+			if(value > (UINT64_MAX - digit) / 10) {
+				overflow = true;
+			}
+			value = value * 10 + digit;
+		}
+		if(!overflow && value <= static_cast<uint64_t>(INT64_MAX) + (negative ? 1 : 0)) {
+			cell.type	= ICUSQLITE_IMPORT_CELL_INTEGER;
+			cell.i		= negative ? static_cast<int64_t>(0 - value) : static_cast<int64_t>(value);
+			return true;
+		}
+	}
+
+	//
+	//	strtod() wants a terminator, which the mapping may not have
+	//
+	char buf[64];
+	memcpy(buf, start, len);
+	buf[len] = '\0';
+	char* numEnd = nullptr;
+	cell.type	= ICUSQLITE_IMPORT_CELL_REAL;
+	cell.d		= strtod(buf, &numEnd);
+	return numEnd == buf + len;
+}
+
+static bool IcuSqlite3ParseJsonValue(
+	const char*& p, const char* end, IcuSqlite3ImportArena& arena, IcuSqlite3ImportCell& cell)
+{
+	if(p >= end) {
+		return false;
+	}
+
+	switch(*p) {
+		case '"' :
+			{
+				const char* text;
+				size_t len;
+				if(!IcuSqlite3ParseJsonString(p, end, arena, text, len)) {
+					return false;
+				}
+				IcuSqlite3SetText(cell, text, len);
+			}
+			return true;
+
+		case '{' :
+		case '[' :
+			{
+				const char* start = p;
+				if(!IcuSqlite3SkipJsonNested(p, end)) {
+					return false;
+				}
+				IcuSqlite3SetText(cell, start, p - start);
+			}
+			return true;
+
+		case 't' :
+			if(end - p >= 4 && 0 == memcmp(p, "true", 4)) {
+				cell.type	= ICUSQLITE_IMPORT_CELL_INTEGER;
+				cell.i		= 1;
+				p += 4;
+				return true;
+			}
+			return false;
+
+		case 'f' :
+			if(end - p >= 5 && 0 == memcmp(p, "false", 5)) {
+				cell.type	= ICUSQLITE_IMPORT_CELL_INTEGER;
+				cell.i		= 0;
+				p += 5;
+				return true;
+			}
+			return false;
+
+		case 'n' :
+			if(end - p >= 4 && 0 == memcmp(p, "null", 4)) {
+				cell.type	= ICUSQLITE_IMPORT_CELL_NULL;
+				p += 4;
+				return true;
+			}
+			return false;
+
+		default :
+			return IcuSqlite3ParseJsonNumber(p, end, cell);
+	}
+}
+
+//
+//	Parses one object spanning [p, end) into |row|, which arrives sized to
+//	the column count and all NULL
+//
+static bool IcuSqlite3ParseJsonRecord(
+	const char* p, const char* end, const std::vector<std::string>& columnNames,
+	IcuSqlite3ImportArena& arena, std::vector<IcuSqlite3ImportCell>& row)
+{
+	p = IcuSqlite3SkipJsonSpace(p, end);
+	if(p >= end || '{' != *p) {
+		return false;
+	}
+	p = IcuSqlite3SkipJsonSpace(p + 1, end);
+
+	if(p < end && '}' == *p) {
+		++p;
+	} else {
+		for(;;) {
+			if(p >= end || '"' != *p) {
+				return false;
+			}
+			const char* key;
+			size_t keyLen;
+			if(!IcuSqlite3ParseJsonString(p, end, arena, key, keyLen)) {
+				return false;
+			}
+
+			p = IcuSqlite3SkipJsonSpace(p, end);
+			if(p >= end || ':' != *p) {
+				return false;
+			}
+			p = IcuSqlite3SkipJsonSpace(p + 1, end);
+
+			IcuSqlite3ImportCell cell;
+			if(!IcuSqlite3ParseJsonValue(p, end, arena, cell)) {
+				return false;
+			}
+
+			for(size_t col = 0; col < columnNames.size(); ++col) {
+				if(columnNames[col].size() == keyLen &&
+					0 == memcmp(columnNames[col].data(), key, keyLen))
+				{
+					row[col] = cell;
+					break;
+				}
+			}
+
+			p = IcuSqlite3SkipJsonSpace(p, end);
+			if(p < end && ',' == *p) {
+				p = IcuSqlite3SkipJsonSpace(p + 1, end);
+				continue;
+			}
+			if(p < end && '}' == *p) {
+				++p;
+				break;
+			}
+			return false;
+		}
+	}
+
+	return IcuSqlite3SkipJsonSpace(p, end) == end;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ImportJob - the pipeline for one Import() call
+///////////////////////////////////////////////////////////////////////////////
+struct IcuSqlite3ImportJob
+{
+	IcuSqlite3Importer&					importer;
+	const IcuSqlite3ImportOptions&		options;
+	const char*							data;			//	start of input, for offsets
+	const char*							end;
+	std::vector<std::string>			columnNames;
+
+	std::mutex							lock;
+	std::condition_variable				workerWake;
+	std::condition_variable				writerWake;
+	const char*							splitPos;		//	stage 1: next chunk starts here
+	int64_t								nextChunk;
+	int64_t								nextWrite;
+	std::vector<std::unique_ptr<IcuSqlite3ImportBatch>>	batches;
+	std::vector<IcuSqlite3ImportBatch*>	freeBatches;
+	std::vector<IcuSqlite3ImportBatch*>	parsed;			//	indexed chunk % batches.size()
+	bool								failed;
+	int64_t								uncommittedRows;	//	writer: inserted since the last commit
+
+	IcuSqlite3ImportJob(IcuSqlite3Importer& imp, const IcuSqlite3ImportOptions& opts,
+		const char* begin, const char* dataEnd)
+		: importer(imp), options(opts), data(begin), end(dataEnd), splitPos(begin)
+		, nextChunk(0), nextWrite(0), failed(false), uncommittedRows(0)
+	{
+	}
+
+	void Fail()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		failed = true;
+		workerWake.notify_all();
+		writerWake.notify_all();
+	}
+
+	void BadRow(const char* record);
+	void Parse(IcuSqlite3ImportBatch& batch, const char* begin, const char* chunkEnd);
+	void Work();
+	bool Write(sqlite3* db, sqlite3_stmt* insert, const bool ownTransaction);
+};
+
+void IcuSqlite3ImportJob::BadRow(
+	const char* record)
+{
+	const int64_t offset = record - data;
+	int64_t first = importer.m_firstBadOffset.load();
+	while((first < 0 || offset < first) &&
+		!importer.m_firstBadOffset.compare_exchange_weak(first, offset))
+	{
+	}
+
+	if(importer.m_badRows.fetch_add(1) + 1 > options.maxBadRows) {
+		Fail();
+	}
+}
+
+void IcuSqlite3ImportJob::Parse(
+	IcuSqlite3ImportBatch& batch, const char* begin, const char* chunkEnd)
+{
+	const int columns = static_cast<int>(columnNames.size());
+	batch.Reset(columns, chunkEnd - begin);
+
+	//
+	//	Validate the whole chunk in one pass; only if that fails do we
+	//	narrow it down record by record
+	//
+	const bool checkRecords = !IcuSqlite3IsValidUtf8(begin, chunkEnd);
+
+	const char* p = begin;
+	while(p < chunkEnd) {
+		const char* record = p;
+		bool ok;
+
+		if(ICUSQLITE_IMPORT_NDJSON == options.format) {
+			const char* q = (const char*)memchr(p, '\n', chunkEnd - p);
+			const char* lineEnd = (nullptr != q) ? q : chunkEnd;
+			p = (nullptr != q) ? q + 1 : chunkEnd;
+			if(IcuSqlite3SkipJsonSpace(record, lineEnd) == lineEnd) {
+				continue;	//	blank line
+			}
+
+			IcuSqlite3ImportCell nullCell;
+			nullCell.type	= ICUSQLITE_IMPORT_CELL_NULL;
+			nullCell.text	= nullptr;
+			nullCell.len	= 0;
+			batch.row.assign(columns, nullCell);
+			ok = IcuSqlite3ParseJsonRecord(record, lineEnd, columnNames, batch.arena, batch.row);
+		} else {
+			if('\n' == *p || '\r' == *p) {
+				++p;
+				continue;	//	blank line
+			}
+			ok = IcuSqlite3ParseCsvRecord(p, chunkEnd, options.delimiter, options.emptyIsNull,
+				batch.arena, batch.row) && columns == static_cast<int>(batch.row.size());
+		}
+
+		if(ok && checkRecords) {
+			ok = IcuSqlite3IsValidUtf8(record, p);
+		}
+
+		if(!ok) {
+			BadRow(record);
+			continue;
+		}
+
+		for(int col = 0; col < columns; ++col) {
+			batch.columns[col].push_back(batch.row[col]);
+		}
+		++batch.rows;
+	}
+}
+
+void IcuSqlite3ImportJob::Work()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	for(;;) {
+		//
+		//	Backpressure: every batch is either being parsed or waiting on
+		//	the writer
+		//
+		if(freeBatches.empty() && !failed && splitPos < end) {
+			const int64_t waitStart = IcuSqlite3NowUs();
+			workerWake.wait(guard, [this] { return failed || splitPos >= end || !freeBatches.empty(); });
+			importer.m_parserWaitUs += IcuSqlite3NowUs() - waitStart;
+		}
+		if(importer.m_cancel) {
+			failed = true;
+			writerWake.notify_all();
+		}
+		if(failed || splitPos >= end) {
+			break;
+		}
+
+		IcuSqlite3ImportBatch* batch = freeBatches.back();
+		freeBatches.pop_back();
+
+		//
+		//	Stage 1: cut the next chunk on a record boundary
+		//
+		const int64_t chunk = nextChunk++;
+		const char* begin = splitPos;
+		const char* target = (static_cast<size_t>(end - begin) > options.chunkBytes) ?
+			begin + options.chunkBytes : end;
+		if(target >= end) {
+			splitPos = end;
+		} else if(ICUSQLITE_IMPORT_NDJSON == options.format) {
+			const char* q = (const char*)memchr(target, '\n', end - target);
+			splitPos = (nullptr != q) ? q + 1 : end;
+		} else {
+			splitPos = IcuSqlite3CsvRecordEnd(begin, end, target);
+		}
+		const char* chunkEnd = splitPos;
+		if(splitPos >= end) {
+			writerWake.notify_all();	//	chunk count is now final
+		}
+		guard.unlock();
+
+		//
+		//	Stage 2
+		//
+		const int64_t parseStart = IcuSqlite3NowUs();
+		Parse(*batch, begin, chunkEnd);
+		importer.m_parseUs += IcuSqlite3NowUs() - parseStart;
+
+		guard.lock();
+		parsed[static_cast<size_t>(chunk % parsed.size())] = batch;
+		importer.m_bytes += chunkEnd - begin;
+		writerWake.notify_all();
+	}
+}
+
+bool IcuSqlite3ImportJob::Write(
+	sqlite3* db, sqlite3_stmt* insert, const bool ownTransaction)
+{
+	const int columns = static_cast<int>(columnNames.size());
+
+	std::unique_lock<std::mutex> guard(lock);
+	for(;;) {
+		const size_t slot = static_cast<size_t>(nextWrite % parsed.size());
+		if(nullptr == parsed[slot] && !failed && !(splitPos >= end && nextWrite >= nextChunk)) {
+			const int64_t waitStart = IcuSqlite3NowUs();
+			writerWake.wait(guard, [this, slot] {
+				return failed || nullptr != parsed[slot] || (splitPos >= end && nextWrite >= nextChunk);
+			});
+			importer.m_writerWaitUs += IcuSqlite3NowUs() - waitStart;
+		}
+		if(failed) {
+			return false;
+		}
+		if(nullptr == parsed[slot]) {
+			return true;	//	all chunks written
+		}
+
+		IcuSqlite3ImportBatch* batch = parsed[slot];
+		parsed[slot] = nullptr;
+		guard.unlock();
+
+		//
+		//	Stage 3
+		//
+		const int64_t insertStart = IcuSqlite3NowUs();
+		bool ok = true;
+		for(int64_t row = 0; row < batch->rows && ok; ++row) {
+			for(int col = 0; col < columns; ++col) {
+				const IcuSqlite3ImportCell& cell = batch->columns[col][static_cast<size_t>(row)];
+				switch(cell.type) {
+					case ICUSQLITE_IMPORT_CELL_TEXT		:
+						sqlite3_bind_text(insert, col + 1, cell.text, cell.len, SQLITE_STATIC);
+						break;
+					case ICUSQLITE_IMPORT_CELL_INTEGER	: sqlite3_bind_int64(insert, col + 1, cell.i); break;
+					case ICUSQLITE_IMPORT_CELL_REAL		: sqlite3_bind_double(insert, col + 1, cell.d); break;
+					default								: sqlite3_bind_null(insert, col + 1); break;
+				}
+			}
+			ok = (SQLITE_DONE == sqlite3_step(insert));
+			sqlite3_reset(insert);
+			if(!ok) {
+				break;
+			}
+
+			//
+			//	Rows only count once their transaction has committed
+			//
+			++uncommittedRows;
+			if(ownTransaction && options.rowsPerTransaction > 0 &&
+				uncommittedRows >= options.rowsPerTransaction)
+			{
+				ok = (SQLITE_OK == sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr));
+				if(ok) {
+					++importer.m_transactions;
+					importer.m_rows += uncommittedRows;
+					uncommittedRows = 0;
+					ok = (SQLITE_OK == sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr));
+				}
+			}
+		}
+		++importer.m_chunks;
+		importer.m_insertUs += IcuSqlite3NowUs() - insertStart;
+
+		guard.lock();
+		++nextWrite;
+		freeBatches.push_back(batch);
+		workerWake.notify_one();
+
+		if(!ok || importer.m_cancel) {
+			failed = true;
+			workerWake.notify_all();
+			return false;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ImportOptions / IcuSqlite3ImportMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ImportOptions::IcuSqlite3ImportOptions()
+	: format(ICUSQLITE_IMPORT_CSV)
+	, threads(0)
+	, chunkBytes(4 * 1024 * 1024)
+	, maxQueuedChunks(0)		//	2 per worker
+	, rowsPerTransaction(0)
+	, maxBadRows(0)
+	, delimiter(',')
+	, header(true)
+	, emptyIsNull(false)
+{
+}
+
+IcuSqlite3ImportMetrics::IcuSqlite3ImportMetrics()
+	: bytes(0)
+	, rows(0)
+	, badRows(0)
+	, firstBadOffset(-1)
+	, chunks(0)
+	, transactions(0)
+	, parseUs(0)
+	, insertUs(0)
+	, writerWaitUs(0)
+	, parserWaitUs(0)
+	, elapsedUs(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Importer
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3Importer::IcuSqlite3Importer(
+	IcuSqlite3Database& db)
+	: m_db(db)
+	, m_cancel(false)
+	, m_bytes(0)
+	, m_rows(0)
+	, m_badRows(0)
+	, m_firstBadOffset(-1)
+	, m_chunks(0)
+	, m_transactions(0)
+	, m_parseUs(0)
+	, m_insertUs(0)
+	, m_writerWaitUs(0)
+	, m_parserWaitUs(0)
+	, m_elapsedUs(0)
+{
+}
+
+IcuSqlite3Importer::~IcuSqlite3Importer()
+{
+}
+
+bool IcuSqlite3Importer::ImportFile(
+	const UnicodeString& filename, const UnicodeString& tableName,
+	const IcuSqlite3ImportOptions& options /*= IcuSqlite3ImportOptions()*/)
+{
+	IcuSqlite3MappedFile file;
+	if(!file.Open(filename)) {
+		return false;
+	}
+	return Import(file.GetData(), file.GetLength(), tableName, options);
+}
+
+bool IcuSqlite3Importer::Import(
+	const char* data, const size_t len, const UnicodeString& tableName,
+	const IcuSqlite3ImportOptions& options /*= IcuSqlite3ImportOptions()*/)
+{
+	if(!m_db.IsOpen() || (nullptr == data && len > 0)) {
+		return false;
+	}
+
+	m_cancel			= false;
+	m_bytes				= 0;
+	m_rows				= 0;
+	m_badRows			= 0;
+	m_firstBadOffset	= -1;
+	m_chunks			= 0;
+	m_transactions		= 0;
+	m_parseUs			= 0;
+	m_insertUs			= 0;
+	m_writerWaitUs		= 0;
+	m_parserWaitUs		= 0;
+	m_elapsedUs			= 0;
+
+	const int64_t startUs = IcuSqlite3NowUs();
+	const char* end = data + len;
+	const char* begin = data;
+	if(len >= 3 && 0 == memcmp(data, "\xef\xbb\xbf", 3)) {
+		begin += 3;	//	BOM
+	}
+
+	IcuSqlite3ImportOptions opts = options;
+	if(0 == opts.chunkBytes) {
+		opts.chunkBytes = IcuSqlite3ImportOptions().chunkBytes;
+	}
+
+	IcuSqlite3ImportJob job(*this, opts, data, end);
+
+	std::string utf8Table;
+	IcuSqlite3ToUtf8(tableName, utf8Table);
+	sqlite3* db = (sqlite3*)m_db.GetDatabaseHandle();
+
+	//
+	//	Target columns: the CSV header, or the table's own
+	//
+	if(ICUSQLITE_IMPORT_CSV == opts.format && opts.header) {
+		const char* headerEnd = IcuSqlite3CsvRecordEnd(begin, end, begin);
+		IcuSqlite3ImportArena arena;
+		arena.Reset(headerEnd - begin);
+		std::vector<IcuSqlite3ImportCell> row;
+		const char* p = begin;
+		if(begin == end || !IcuSqlite3ParseCsvRecord(p, headerEnd, opts.delimiter, false, arena, row)) {
+			return false;
+		}
+		for(size_t col = 0; col < row.size(); ++col) {
+			job.columnNames.push_back(std::string(row[col].text, row[col].len));
+		}
+		job.splitPos = begin = headerEnd;
+	} else {
+		IcuSqlite3StatementBuffer sql;
+		sqlite3_stmt* stmt = nullptr;
+		if(SQLITE_OK != sqlite3_prepare_v2(db, sql.Format("SELECT * FROM \"%w\";", utf8Table.c_str()),
+			-1, &stmt, nullptr))
+		{
+			return false;
+		}
+		for(int col = 0; col < sqlite3_column_count(stmt); ++col) {
+			job.columnNames.push_back(sqlite3_column_name(stmt, col));
+		}
+		sqlite3_finalize(stmt);
+		job.splitPos = begin;
+	}
+
+	if(job.columnNames.empty()) {
+		return false;
+	}
+	m_bytes = begin - data;	//	BOM and header
+
+	std::string insertSql("INSERT INTO \"");
+	{
+		IcuSqlite3StatementBuffer sql;
+		insertSql += sql.Format("%w\"(", utf8Table.c_str());
+		for(size_t col = 0; col < job.columnNames.size(); ++col) {
+			insertSql += sql.Format((0 == col) ? "\"%w\"" : ",\"%w\"", job.columnNames[col].c_str());
+		}
+		insertSql += ") VALUES(";
+		for(size_t col = 0; col < job.columnNames.size(); ++col) {
+			insertSql += (0 == col) ? "?" : ",?";
+		}
+		insertSql += ");";
+	}
+
+	sqlite3_stmt* insert = nullptr;
+	if(SQLITE_OK != sqlite3_prepare_v2(db, insertSql.c_str(), -1, &insert, nullptr)) {
+		sqlite3_finalize(insert);
+		return false;
+	}
+
+	int threads = opts.threads;
+	if(threads <= 0) {
+		threads = static_cast<int>(std::thread::hardware_concurrency());
+		if(threads <= 0) {
+			threads = 1;
+		}
+	}
+	int batchCount = (opts.maxQueuedChunks > 0) ? opts.maxQueuedChunks : threads * 2;
+	if(batchCount < threads + 1) {
+		batchCount = threads + 1;	//	keep every worker busy while the writer drains one
+	}
+	for(int i = 0; i < batchCount; ++i) {
+		job.batches.push_back(std::unique_ptr<IcuSqlite3ImportBatch>(new IcuSqlite3ImportBatch()));
+		job.freeBatches.push_back(job.batches.back().get());
+	}
+	job.parsed.resize(batchCount, nullptr);
+
+	//
+	//	Join the caller's transaction if there is one
+	//
+	const bool ownTransaction = (0 != sqlite3_get_autocommit(db));
+	if(ownTransaction && SQLITE_OK != sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr)) {
+		sqlite3_finalize(insert);
+		return false;
+	}
+
+	std::vector<std::thread> workers;
+	for(int i = 0; i < threads; ++i) {
+		workers.push_back(std::thread(&IcuSqlite3ImportJob::Work, &job));
+	}
+
+	bool ok = job.Write(db, insert, ownTransaction);
+	if(!ok) {
+		job.Fail();
+	}
+	for(size_t i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+	sqlite3_finalize(insert);
+
+	if(ownTransaction) {
+		if(ok && SQLITE_OK == sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr)) {
+			++m_transactions;
+			m_rows += job.uncommittedRows;
+		} else {
+			ok = false;
+			sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		}
+	} else if(ok) {
+		m_rows += job.uncommittedRows;	//	left to the caller's transaction
+	}
+
+	m_elapsedUs = IcuSqlite3NowUs() - startUs;
+	return ok;
+}
+
+void IcuSqlite3Importer::GetMetrics(
+	IcuSqlite3ImportMetrics& metrics) const
+{
+	metrics.bytes			= m_bytes;
+	metrics.rows			= m_rows;
+	metrics.badRows			= m_badRows;
+	metrics.firstBadOffset	= m_firstBadOffset;
+	metrics.chunks			= m_chunks;
+	metrics.transactions	= m_transactions;
+	metrics.parseUs			= m_parseUs;
+	metrics.insertUs		= m_insertUs;
+	metrics.writerWaitUs	= m_writerWaitUs;
+	metrics.parserWaitUs	= m_parserWaitUs;
+	metrics.elapsedUs		= m_elapsedUs;
+}
@@ -0,0 +1,140 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_IMPORT_H__
+#define __ICU_SQLITE3_IMPORT_H__
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <atomic>
+#include <string>
+#include <vector>
+
+enum EIcuSqlite3ImportFormat {
+	//
+	//	RFC 4180. Fields are bound as TEXT and converted by column affinity;
+	//	an empty unquoted field is NULL if emptyIsNull is set.
+	//
+	ICUSQLITE_IMPORT_CSV,
+
+	//
+	//	One JSON object per line. Keys are matched to column names, unknown
+	//	keys are ignored and missing ones are NULL. Strings bind as TEXT,
+	//	numbers as INTEGER / REAL, true / false as 1 / 0, nested objects and
+	//	arrays as their JSON text.
+	//
+	ICUSQLITE_IMPORT_NDJSON,
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ImportOptions
+{
+	IcuSqlite3ImportOptions();
+
+	EIcuSqlite3ImportFormat	format;
+	int						threads;			//	parse workers; 0 = hardware concurrency
+	size_t					chunkBytes;			//	input handed to a worker at a time
+	int						maxQueuedChunks;	//	parsed chunks allowed to wait for the writer
+	int64_t					rowsPerTransaction;	//	commit every N rows, 0 = one transaction
+	int64_t					maxBadRows;			//	malformed / non UTF-8 rows skipped before giving up
+	char					delimiter;			//	CSV field delimiter
+	bool					header;				//	CSV: first record names the target columns
+	bool					emptyIsNull;		//	CSV: empty unquoted field binds NULL
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ImportMetrics
+{
+	IcuSqlite3ImportMetrics();
+
+	int64_t		bytes;				//	input consumed
+	int64_t		rows;				//	committed (inserted, in the caller's transaction)
+	int64_t		badRows;
+	int64_t		firstBadOffset;		//	byte offset of the first bad row, -1 if none
+	int64_t		chunks;
+	int64_t		transactions;		//	committed
+	int64_t		parseUs;			//	summed across workers
+	int64_t		insertUs;			//	writer time spent binding / stepping / committing
+	int64_t		writerWaitUs;		//	writer starved for parsed input
+	int64_t		parserWaitUs;		//	workers held back by a full queue (backpressure)
+	int64_t		elapsedUs;
+};
+
+//
+//	Loads CSV or NDJSON into a table through a three stage pipeline:
+//
+//		1. the input is memory mapped and cut into chunks on record
+//		   boundaries (quote aware for CSV)
+//		2. worker threads parse chunks into columnar batches, validating
+//		   UTF-8 and scanning for delimiters 16 / 32 bytes at a time
+//		3. the calling thread binds the batches, in input order, into one
+//		   prepared INSERT inside large transactions
+//
+//	Field data is bound straight out of the mapping (or the batch's own
+//	buffer when it had to be unescaped), so nothing is copied per field.
+//	At most maxQueuedChunks parsed batches exist at once; workers wait for
+//	the writer when it falls behind.
+//
+//	If |db| is already inside a transaction the rows are inserted into it
+//	and rowsPerTransaction is ignored. On failure the open transaction is
+//	rolled back; earlier rowsPerTransaction commits are kept.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3Importer
+{
+public:
+	explicit IcuSqlite3Importer(IcuSqlite3Database& db);
+	~IcuSqlite3Importer();
+
+	bool ImportFile(const UnicodeString& filename, const UnicodeString& tableName,
+		const IcuSqlite3ImportOptions& options = IcuSqlite3ImportOptions());
+	bool Import(const char* data, const size_t len, const UnicodeString& tableName,
+		const IcuSqlite3ImportOptions& options = IcuSqlite3ImportOptions());
+
+	//
+	//	Callable from any thread while an import runs
+	//
+	void Cancel() { m_cancel = true; }
+	void GetMetrics(IcuSqlite3ImportMetrics& metrics) const;
+
+private:
+	IcuSqlite3Database&			m_db;
+	std::atomic<bool>			m_cancel;
+
+	std::atomic<int64_t>		m_bytes;
+	std::atomic<int64_t>		m_rows;
+	std::atomic<int64_t>		m_badRows;
+	std::atomic<int64_t>		m_firstBadOffset;
+	std::atomic<int64_t>		m_chunks;
+	std::atomic<int64_t>		m_transactions;
+	std::atomic<int64_t>		m_parseUs;
+	std::atomic<int64_t>		m_insertUs;
+	std::atomic<int64_t>		m_writerWaitUs;
+	std::atomic<int64_t>		m_parserWaitUs;
+	std::atomic<int64_t>		m_elapsedUs;
+
+	IcuSqlite3Importer(const IcuSqlite3Importer&);	//	prevent copy
+	IcuSqlite3Importer& operator=(const IcuSqlite3Importer&);	//	prevent assign
+
+	friend struct IcuSqlite3ImportJob;
+};
+
+#endif	//	!__ICU_SQLITE3_IMPORT_H__
@@ -0,0 +1,104 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_INTERNAL_H__
+#define __ICU_SQLITE3_INTERNAL_H__
+
+//
+//	Internal: small helpers shared by the library's translation units, not
+//	part of the public API. Unlike the public headers this one pulls in
+//	sqlite3.h.
+//
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <chrono>
+#include <string>
+
+//
+//	Holds the connection's (recursive) mutex for the scope. Serialized
+//	connections guard wrapper state with it; single owner (NOMUTEX)
+//	connections have none, so this costs nothing there.
+//
+class IcuSqlite3DbLock
+{
+public:
+	explicit IcuSqlite3DbLock(void* db)
+		: m_mutex((nullptr != db) ? sqlite3_db_mutex((sqlite3*)db) : nullptr)
+	{
+		sqlite3_mutex_enter(m_mutex);	//	no-op if null
+	}
+	~IcuSqlite3DbLock()
+	{
+		sqlite3_mutex_leave(m_mutex);
+	}
+
+private:
+	sqlite3_mutex*	m_mutex;
+
+	IcuSqlite3DbLock(const IcuSqlite3DbLock&);	//	prevent copy
+	IcuSqlite3DbLock& operator=(const IcuSqlite3DbLock&);	//	prevent assign
+};
+
+//
+//	"name" with embedded quotes doubled, for schema / table names spliced
+//	into SQL (PRAGMA "aux".data_version, ...)
+//
+inline std::string IcuSqlite3QuoteName(
+	const std::string& name)
+{
+	std::string quoted(1, '"');
+	for(size_t n = 0; n < name.size(); ++n) {
+		if('"' == name[n]) {
+			quoted += '"';
+		}
+		quoted += name[n];
+	}
+	quoted += '"';
+	return quoted;
+}
+
+//
+//	Monotonic clock for timeouts, deadlines and metrics
+//
+inline int64_t IcuSqlite3NowUs()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline int64_t IcuSqlite3NowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif	//	!__ICU_SQLITE3_INTERNAL_H__
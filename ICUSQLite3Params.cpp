@@ -0,0 +1,207 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Params.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <cstring>
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3QueryParams
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::Bind(
+	const int paramIdx, const int value)
+{
+	return Bind(paramIdx, static_cast<int64_t>(value));
+}
+
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::Bind(
+	const int paramIdx, const int64_t value)
+{
+	Param param;
+	param.idx	= paramIdx;
+	param.type	= ICUSQLITE_COLUMN_TYPE_INTEGER;
+	param.i		= value;
+	param.d		= 0.0;
+	m_params.push_back(param);
+	return *this;
+}
+
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::Bind(
+	const int paramIdx, const double value)
+{
+	Param param;
+	param.idx	= paramIdx;
+	param.type	= ICUSQLITE_COLUMN_TYPE_FLOAT;
+	param.i		= 0;
+	param.d		= value;
+	m_params.push_back(param);
+	return *this;
+}
+
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::Bind(
+	const int paramIdx, const char* utf8)
+{
+	if(nullptr == utf8) {
+		return BindNull(paramIdx);
+	}
+	return Bind(paramIdx, std::string(utf8));
+}
+
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::Bind(
+	const int paramIdx, const std::string& utf8)
+{
+	Param param;
+	param.idx	= paramIdx;
+	param.type	= ICUSQLITE_COLUMN_TYPE_TEXT;
+	param.i		= 0;
+	param.d		= 0.0;
+	param.bytes	= utf8;
+	m_params.push_back(param);
+	return *this;
+}
+
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::Bind(
+	const int paramIdx, const UnicodeString& value)
+{
+	std::string utf8;
+	return Bind(paramIdx, IcuSqlite3ToUtf8(value, utf8));
+}
+
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::BindBlob(
+	const int paramIdx, const void* blob, const int len)
+{
+	Param param;
+	param.idx	= paramIdx;
+	param.type	= ICUSQLITE_COLUMN_TYPE_BLOB;
+	param.i		= 0;
+	param.d		= 0.0;
+	if(len > 0) {
+		param.bytes.assign(static_cast<const char*>(blob), len);
+	}
+	m_params.push_back(param);
+	return *this;
+}
+
+IcuSqlite3QueryParams& IcuSqlite3QueryParams::BindNull(
+	const int paramIdx)
+{
+	Param param;
+	param.idx	= paramIdx;
+	param.type	= ICUSQLITE_COLUMN_TYPE_NULL;
+	param.i		= 0;
+	param.d		= 0.0;
+	m_params.push_back(param);
+	return *this;
+}
+
+bool IcuSqlite3QueryParams::operator==(
+	const IcuSqlite3QueryParams& params) const
+{
+	if(m_params.size() != params.m_params.size()) {
+		return false;
+	}
+
+	for(size_t n = 0; n < m_params.size(); ++n) {
+		const Param& a = m_params[n];
+		const Param& b = params.m_params[n];
+		if(a.idx != b.idx || a.type != b.type || a.i != b.i || a.bytes != b.bytes ||
+			0 != memcmp(&a.d, &b.d, sizeof(a.d)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint64_t IcuSqlite3QueryParams::GetHash() const
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for(size_t n = 0; n < m_params.size(); ++n) {
+		const Param& param = m_params[n];
+		const int32_t head[2] = { param.idx, static_cast<int32_t>(param.type) };
+
+		const unsigned char* fields[3] = {
+			reinterpret_cast<const unsigned char*>(head), 
+			reinterpret_cast<const unsigned char*>(&param.i), 
+			reinterpret_cast<const unsigned char*>(&param.d) };
+		const size_t fieldLens[3] = { sizeof(head), sizeof(param.i), sizeof(param.d) };
+		for(int f = 0; f < 3; ++f) {
+			for(size_t b = 0; b < fieldLens[f]; ++b) {
+				hash = (hash ^ fields[f][b]) * prime;
+			}
+		}
+
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(param.bytes.data());
+		for(size_t b = 0; b < param.bytes.size(); ++b) {
+			hash = (hash ^ bytes[b]) * prime;
+		}
+		hash = (hash ^ 0xff) * prime;	//	"ab","c" != "a","bc"
+	}
+	return hash;
+}
+
+bool IcuSqlite3QueryParams::Apply(
+	void* stmt) const
+{
+	sqlite3_stmt* s = (sqlite3_stmt*)stmt;
+	for(size_t n = 0; n < m_params.size(); ++n) {
+		const Param& param = m_params[n];
+		int r;
+		switch(param.type) {
+			case ICUSQLITE_COLUMN_TYPE_INTEGER :
+				r = sqlite3_bind_int64(s, param.idx, param.i);
+				break;
+			case ICUSQLITE_COLUMN_TYPE_FLOAT :
+				r = sqlite3_bind_double(s, param.idx, param.d);
+				break;
+			case ICUSQLITE_COLUMN_TYPE_TEXT :
+				r = sqlite3_bind_text(s, param.idx, param.bytes.data(), 
+					static_cast<int>(param.bytes.size()), SQLITE_STATIC);
+				break;
+			case ICUSQLITE_COLUMN_TYPE_BLOB :
+				r = sqlite3_bind_blob(s, param.idx, param.bytes.data(), 
+					static_cast<int>(param.bytes.size()), SQLITE_STATIC);
+				break;
+			default :
+				r = sqlite3_bind_null(s, param.idx);
+				break;
+		}
+		if(SQLITE_OK != r) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,86 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_PARAMS_H__
+#define __ICU_SQLITE3_PARAMS_H__
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <string>
+#include <vector>
+
+//
+//	Parameter values captured for binding later, possibly to several
+//	statements (IcuSqlite3ShardExecutor) or compared against earlier
+//	bindings (IcuSqlite3ResultCache). Values are copied.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3QueryParams
+{
+public:
+	IcuSqlite3QueryParams& Bind(const int paramIdx, const int value);
+	IcuSqlite3QueryParams& Bind(const int paramIdx, const int64_t value);
+	IcuSqlite3QueryParams& Bind(const int paramIdx, const double value);
+	IcuSqlite3QueryParams& Bind(const int paramIdx, const char* utf8);
+	IcuSqlite3QueryParams& Bind(const int paramIdx, const std::string& utf8);
+	IcuSqlite3QueryParams& Bind(const int paramIdx, const UnicodeString& value);
+	IcuSqlite3QueryParams& BindBlob(const int paramIdx, const void* blob, const int len);
+	IcuSqlite3QueryParams& BindNull(const int paramIdx);
+
+	bool IsEmpty() const { return m_params.empty(); }
+	void Clear() { m_params.clear(); }
+
+	//
+	//	Same values bound in the same order. Values are compared by type
+	//	and bytes: 1 and 1.0 differ, as do text and blob "x".
+	//
+	bool operator==(const IcuSqlite3QueryParams& params) const;
+	bool operator!=(const IcuSqlite3QueryParams& params) const { return !(*this == params); }
+
+	//
+	//	64-bit FNV-1a over what operator== compares
+	//
+	uint64_t GetHash() const;
+
+private:
+	struct Param
+	{
+		int						idx;
+		EIcuSqlite3ColumnTypes	type;
+		int64_t					i;
+		double					d;
+		std::string				bytes;
+	};
+	std::vector<Param>	m_params;
+
+	//
+	//	Binds to a sqlite3_stmt* without copying; the values must outlive
+	//	the statement's use of them
+	//
+	bool Apply(void* stmt) const;
+
+	friend struct IcuSqlite3ShardJob;
+	friend struct IcuSqlite3ResultCacheState;
+};
+
+#endif	//	!__ICU_SQLITE3_PARAMS_H__
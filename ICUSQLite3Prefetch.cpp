@@ -0,0 +1,475 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Prefetch.h"
+#include "ICUSQLite3Chunk.h"
+#include "ICUSQLite3Internal.h"
+#include "ICUSQLite3Queue.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3PrefetchOptions / IcuSqlite3PrefetchMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3PrefetchOptions::IcuSqlite3PrefetchOptions()
+	: rowsPerChunk(1024)
+	, queuedChunks(4)
+{
+}
+
+IcuSqlite3PrefetchMetrics::IcuSqlite3PrefetchMetrics()
+	: rows(0)
+	, chunks(0)
+	, stepUs(0)
+	, producerWaitUs(0)
+	, consumerWaitUs(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3PrefetchState
+///////////////////////////////////////////////////////////////////////////////
+
+//
+//	Queue slot; its chunk keeps its buffers from one use to the next
+//
+struct IcuSqlite3PrefetchChunk
+{
+	IcuSqlite3PrefetchChunk() : last(false), rc(SQLITE_OK) {}
+
+	IcuSqlite3Chunk		rows;
+	bool				last;	//	statement finished (or failed) after these rows
+	int					rc;
+	std::string			error;
+};
+
+struct IcuSqlite3PrefetchState
+{
+	IcuSqlite3PrefetchState(const size_t queuedChunks)
+		: db(nullptr)
+		, stmt(nullptr)
+		, ownStmt(false)
+		, rowsPerChunk(0)
+		, queue(queuedChunks)
+		, stop(false)
+		, cur(nullptr)
+		, row(-1)
+		, eof(false)
+		, rc(SQLITE_OK)
+		, rows(0)
+		, chunks(0)
+		, stepUs(0)
+		, producerWaitUs(0)
+		, consumerWaitUs(0)
+	{
+	}
+
+	sqlite3*									db;
+	sqlite3_stmt*								stmt;
+	bool										ownStmt;
+	int											rowsPerChunk;
+	std::vector<std::string>					columnNames;
+
+	IcuSqlite3SpscRing<IcuSqlite3PrefetchChunk>	queue;
+	std::mutex									wakeLock;
+	std::condition_variable						wake;
+	std::atomic<bool>							stop;
+	std::thread									thread;
+
+	//	consumer side
+	IcuSqlite3PrefetchChunk*					cur;
+	int											row;
+	bool										eof;
+	int											rc;
+	std::string									error;
+
+	std::atomic<int64_t>						rows;
+	std::atomic<int64_t>						chunks;
+	std::atomic<int64_t>						stepUs;
+	std::atomic<int64_t>						producerWaitUs;
+	std::atomic<int64_t>						consumerWaitUs;
+
+	void Wake()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wakeLock);
+		}
+		wake.notify_one();
+	}
+
+	void Produce()
+	{
+		const int cols = static_cast<int>(columnNames.size());
+		for(;;) {
+			IcuSqlite3PrefetchChunk* chunk = queue.BeginPush();
+			if(nullptr == chunk) {
+				const int64_t waitStart = IcuSqlite3NowUs();
+				std::unique_lock<std::mutex> lock(wakeLock);
+				wake.wait(lock, [this] { return stop || queue.GetSize() < queue.GetCapacity(); });
+				producerWaitUs += IcuSqlite3NowUs() - waitStart;
+				if(stop) {
+					return;
+				}
+				continue;
+			}
+			if(stop) {
+				return;
+			}
+
+			const int64_t start = IcuSqlite3NowUs();
+			chunk->rows.Reset(cols);		//	keeps capacity
+			chunk->rows.Reserve(rowsPerChunk);
+
+			int n = 0;
+			int r = SQLITE_ROW;
+			while(n < rowsPerChunk && SQLITE_ROW == (r = sqlite3_step(stmt))) {
+				chunk->rows.AppendRow(stmt);
+				++n;
+			}
+
+			chunk->last	= (SQLITE_ROW != r);
+			chunk->rc	= SQLITE_OK;
+			chunk->error.clear();
+			if(chunk->last && SQLITE_DONE != r) {
+				chunk->rc		= sqlite3_extended_errcode(db);
+				chunk->error	= sqlite3_errmsg(db);
+			}
+
+			rows	+= n;
+			++chunks;
+			stepUs	+= IcuSqlite3NowUs() - start;
+
+			const bool last = chunk->last;
+			queue.EndPush();
+			Wake();
+			if(last) {
+				return;
+			}
+		}
+	}
+
+	bool NextRow()
+	{
+		for(;;) {
+			if(eof) {
+				return false;
+			}
+
+			if(nullptr != cur) {
+				if(++row < cur->rows.GetRowCount()) {
+					return true;
+				}
+
+				const bool last = cur->last;
+				if(last) {
+					rc		= cur->rc;
+					error	= cur->error;
+					eof		= true;
+				}
+				cur = nullptr;
+				queue.EndPop();
+				Wake();
+				if(last) {
+					return false;
+				}
+			}
+
+			cur = queue.BeginPop();
+			if(nullptr == cur) {
+				const int64_t waitStart = IcuSqlite3NowUs();
+				std::unique_lock<std::mutex> lock(wakeLock);
+				wake.wait(lock, [this] { return 0 != queue.GetSize(); });
+				consumerWaitUs += IcuSqlite3NowUs() - waitStart;
+				continue;
+			}
+			row = -1;
+		}
+	}
+
+	const IcuSqlite3Chunk* GetRow(const int colIdx) const
+	{
+		return (nullptr != cur && colIdx >= 0 && colIdx < cur->rows.GetColumnCount()) ? &cur->rows : nullptr;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3PrefetchResultSet
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3PrefetchResultSet::IcuSqlite3PrefetchResultSet(
+	IcuSqlite3Database& db)
+	: m_db(db)
+{
+}
+
+IcuSqlite3PrefetchResultSet::~IcuSqlite3PrefetchResultSet()
+{
+	Finalize();
+}
+
+bool IcuSqlite3PrefetchResultSet::Execute(
+	const UnicodeString& sql,
+	const IcuSqlite3PrefetchOptions& options /*= IcuSqlite3PrefetchOptions()*/)
+{
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return Execute(utf8Sql.c_str(), options);
+}
+
+bool IcuSqlite3PrefetchResultSet::Execute(
+	const char* sql,
+	const IcuSqlite3PrefetchOptions& options /*= IcuSqlite3PrefetchOptions()*/)
+{
+	Finalize();
+
+	sqlite3* db = (sqlite3*)m_db.GetDatabaseHandle();
+	if(nullptr == db || nullptr == sql) {
+		return false;
+	}
+
+	sqlite3_stmt* stmt = nullptr;
+	const int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+	if(SQLITE_OK != rc || nullptr == stmt) {
+		m_state.reset(new IcuSqlite3PrefetchState(1));
+		m_state->db		= db;
+		m_state->eof	= true;
+		m_state->rc		= (SQLITE_OK != rc) ? sqlite3_extended_errcode(db) : SQLITE_MISUSE;
+		m_state->error	= (SQLITE_OK != rc) ? sqlite3_errmsg(db) : "empty statement";
+		sqlite3_finalize(stmt);
+		return false;
+	}
+
+	return Start(stmt, true, options);
+}
+
+bool IcuSqlite3PrefetchResultSet::Execute(
+	IcuSqlite3Statement& stmt,
+	const IcuSqlite3PrefetchOptions& options /*= IcuSqlite3PrefetchOptions()*/)
+{
+	Finalize();
+
+	if(nullptr == m_db.GetDatabaseHandle() || !stmt.IsOk()) {
+		return false;
+	}
+	return Start(stmt.m_stmt, false, options);
+}
+
+bool IcuSqlite3PrefetchResultSet::Start(
+	void* stmt, const bool ownStmt, const IcuSqlite3PrefetchOptions& options)
+{
+	//
+	//	Without the connection mutex the producer and the rest of the
+	//	program can't share the connection
+	//
+	if(ICUSQLITE_THREADING_SINGLE_OWNER == m_db.GetThreadingMode()) {
+		if(ownStmt) {
+			sqlite3_finalize((sqlite3_stmt*)stmt);
+		}
+		return false;
+	}
+
+	std::unique_ptr<IcuSqlite3PrefetchState> state(new IcuSqlite3PrefetchState(
+		(options.queuedChunks > 0) ? options.queuedChunks : 1));
+	state->db			= (sqlite3*)m_db.GetDatabaseHandle();
+	state->stmt			= (sqlite3_stmt*)stmt;
+	state->ownStmt		= ownStmt;
+	state->rowsPerChunk	= (options.rowsPerChunk > 0) ? options.rowsPerChunk : 1;
+
+	const int cols = sqlite3_column_count(state->stmt);
+	state->columnNames.resize(cols);
+	for(int col = 0; col < cols; ++col) {
+		const char* name = sqlite3_column_name(state->stmt, col);
+		state->columnNames[col] = (nullptr != name) ? name : "";
+	}
+
+	{
+		IcuSqlite3DbLock lock(state->db);
+		m_db.m_prefetchers.insert(this);
+	}
+	state->thread = std::thread(&IcuSqlite3PrefetchState::Produce, state.get());
+	m_state = std::move(state);
+	return true;
+}
+
+void IcuSqlite3PrefetchResultSet::Finalize()
+{
+	if(nullptr == m_state.get()) {
+		return;
+	}
+
+	if(m_state->thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_state->wakeLock);
+			m_state->stop = true;
+		}
+		m_state->wake.notify_one();
+		m_state->thread.join();
+
+		IcuSqlite3DbLock lock(m_state->db);
+		m_db.m_prefetchers.erase(this);
+	}
+
+	if(nullptr != m_state->stmt) {
+		if(m_state->ownStmt) {
+			sqlite3_finalize(m_state->stmt);
+		} else {
+			sqlite3_reset(m_state->stmt);
+		}
+	}
+	m_state.reset();
+}
+
+bool IcuSqlite3PrefetchResultSet::NextRow()
+{
+	return (nullptr != m_state.get()) ? m_state->NextRow() : false;
+}
+
+bool IcuSqlite3PrefetchResultSet::Eof() const
+{
+	return nullptr == m_state.get() || m_state->eof;
+}
+
+bool IcuSqlite3PrefetchResultSet::IsOk() const
+{
+	return nullptr != m_state.get() && SQLITE_OK == m_state->rc;
+}
+
+int IcuSqlite3PrefetchResultSet::GetErrorCode() const
+{
+	return (nullptr != m_state.get()) ? m_state->rc : SQLITE_MISUSE;
+}
+
+std::string IcuSqlite3PrefetchResultSet::GetErrorMessage() const
+{
+	return (nullptr != m_state.get()) ? m_state->error : std::string();
+}
+
+int IcuSqlite3PrefetchResultSet::GetColumnCount() const
+{
+	return (nullptr != m_state.get()) ? static_cast<int>(m_state->columnNames.size()) : 0;
+}
+
+UnicodeString IcuSqlite3PrefetchResultSet::GetColumnName(
+	const int colIdx) const
+{
+	if(colIdx < 0 || colIdx >= GetColumnCount()) {
+		return UnicodeString();
+	}
+	const std::string& name = m_state->columnNames[colIdx];
+	return IcuSqlite3FromUtf8(name.data(), static_cast<int32_t>(name.size()));
+}
+
+EIcuSqlite3ColumnTypes IcuSqlite3PrefetchResultSet::GetColumnType(
+	const int colIdx) const
+{
+	const IcuSqlite3Chunk* rows = (nullptr != m_state.get()) ? m_state->GetRow(colIdx) : nullptr;
+	return (nullptr != rows) ? rows->GetType(m_state->row, colIdx) : ICUSQLITE_COLUMN_TYPE_INVALID;
+}
+
+int32_t IcuSqlite3PrefetchResultSet::GetInt(
+	const int colIdx, const int32_t defVal /*= 0*/) const
+{
+	return static_cast<int32_t>(GetInt64(colIdx, defVal));
+}
+
+int64_t IcuSqlite3PrefetchResultSet::GetInt64(
+	const int colIdx, const int64_t defVal /*= 0*/) const
+{
+	const IcuSqlite3Chunk* rows = (nullptr != m_state.get()) ? m_state->GetRow(colIdx) : nullptr;
+	return (nullptr != rows) ? rows->GetInt64(m_state->row, colIdx) : defVal;
+}
+
+double IcuSqlite3PrefetchResultSet::GetDouble(
+	const int colIdx, const double defVal /*= 0.0*/) const
+{
+	const IcuSqlite3Chunk* rows = (nullptr != m_state.get()) ? m_state->GetRow(colIdx) : nullptr;
+	return (nullptr != rows) ? rows->GetDouble(m_state->row, colIdx) : defVal;
+}
+
+UnicodeString IcuSqlite3PrefetchResultSet::GetString(
+	const int colIdx, const UnicodeString& defVal /*= ""*/) const
+{
+	const IcuSqlite3Chunk* rows = (nullptr != m_state.get()) ? m_state->GetRow(colIdx) : nullptr;
+	if(nullptr == rows) {
+		return defVal;
+	}
+	const std::string utf8 = rows->GetString(m_state->row, colIdx);
+	return IcuSqlite3FromUtf8(utf8.data(), static_cast<int32_t>(utf8.size()));
+}
+
+std::string IcuSqlite3PrefetchResultSet::GetStringUTF8(
+	const int colIdx, const std::string& defVal /*= ""*/) const
+{
+	const IcuSqlite3Chunk* rows = (nullptr != m_state.get()) ? m_state->GetRow(colIdx) : nullptr;
+	return (nullptr != rows) ? rows->GetString(m_state->row, colIdx) : defVal;
+}
+
+bool IcuSqlite3PrefetchResultSet::GetBool(
+	const int colIdx, const bool defVal /*= false*/) const
+{
+	return 0 != GetInt(colIdx, (defVal) ? 1 : 0);
+}
+
+const unsigned char* IcuSqlite3PrefetchResultSet::GetBlob(
+	const int colIdx, int& len) const
+{
+	const IcuSqlite3Chunk* rows = (nullptr != m_state.get()) ? m_state->GetRow(colIdx) : nullptr;
+	if(nullptr == rows) {
+		len = 0;
+		return nullptr;
+	}
+	return rows->GetBlob(m_state->row, colIdx, len);
+}
+
+bool IcuSqlite3PrefetchResultSet::IsNull(
+	const int colIdx) const
+{
+	return ICUSQLITE_COLUMN_TYPE_NULL == GetColumnType(colIdx);
+}
+
+void IcuSqlite3PrefetchResultSet::GetMetrics(
+	IcuSqlite3PrefetchMetrics& metrics) const
+{
+	metrics = IcuSqlite3PrefetchMetrics();
+	if(nullptr == m_state.get()) {
+		return;
+	}
+	metrics.rows			= m_state->rows;
+	metrics.chunks			= m_state->chunks;
+	metrics.stepUs			= m_state->stepUs;
+	metrics.producerWaitUs	= m_state->producerWaitUs;
+	metrics.consumerWaitUs	= m_state->consumerWaitUs;
+}
@@ -0,0 +1,127 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_PREFETCH_H__
+#define __ICU_SQLITE3_PREFETCH_H__
+
+#include "ICUSQLite3.h"
+
+//	STL
+#include <memory>
+#include <string>
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3PrefetchOptions
+{
+	IcuSqlite3PrefetchOptions();
+
+	int		rowsPerChunk;		//	rows decoded per hand off
+	int		queuedChunks;		//	decoded chunks allowed ahead of the consumer (rounded up to a power of 2)
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3PrefetchMetrics
+{
+	IcuSqlite3PrefetchMetrics();
+
+	int64_t		rows;
+	int64_t		chunks;
+	int64_t		stepUs;				//	producer time stepping / decoding
+	int64_t		producerWaitUs;		//	producer held back by a full queue
+	int64_t		consumerWaitUs;		//	consumer starved for rows
+};
+
+struct IcuSqlite3PrefetchState;
+
+//
+//	Result set whose statement is stepped on a background thread. Rows are
+//	decoded into chunks of rowsPerChunk rows and passed to the consumer
+//	through a bounded single producer / single consumer queue, so
+//	sqlite3_step() and the consumer's own work overlap. The queue's
+//	chunks are reused, so a long scan doesn't keep allocating.
+//
+//	Reads like IcuSqlite3ResultSet: call NextRow() before the first row.
+//	Values are copies; pointers from GetBlob() stay valid until the next
+//	NextRow().
+//
+//	The connection must be ICUSQLITE_THREADING_SERIALIZED; other calls on
+//	it wait for the step in progress. Finalize() (or destruction) stops
+//	the producer after its current step; so does closing the connection,
+//	which leaves the result set at Eof(). Don't close it while another
+//	thread is reading the result set.
+//
+//		IcuSqlite3PrefetchResultSet rows(db);
+//		if(rows.Execute("SELECT * FROM events;")) {
+//			while(rows.NextRow()) { ... }
+//		}
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3PrefetchResultSet
+{
+public:
+	explicit IcuSqlite3PrefetchResultSet(IcuSqlite3Database& db);
+	~IcuSqlite3PrefetchResultSet();
+
+	bool Execute(const char* sql,
+		const IcuSqlite3PrefetchOptions& options = IcuSqlite3PrefetchOptions());
+	bool Execute(const UnicodeString& sql,
+		const IcuSqlite3PrefetchOptions& options = IcuSqlite3PrefetchOptions());
+
+	//
+	//	Steps an already bound statement. It's reset, not finalized, when
+	//	done; leave it alone until then.
+	//
+	bool Execute(IcuSqlite3Statement& stmt,
+		const IcuSqlite3PrefetchOptions& options = IcuSqlite3PrefetchOptions());
+
+	bool NextRow();
+	bool Eof() const;
+	bool IsOk() const;
+	void Finalize();
+
+	int GetErrorCode() const;			//	SQLite (extended) result code
+	std::string GetErrorMessage() const;
+
+	int GetColumnCount() const;
+	UnicodeString GetColumnName(const int colIdx) const;
+	EIcuSqlite3ColumnTypes GetColumnType(const int colIdx) const;
+
+	int32_t GetInt(const int colIdx, const int32_t defVal = 0) const;
+	int64_t GetInt64(const int colIdx, const int64_t defVal = 0) const;
+	double GetDouble(const int colIdx, const double defVal = 0.0) const;
+	UnicodeString GetString(const int colIdx, const UnicodeString& defVal = "") const;
+	std::string GetStringUTF8(const int colIdx, const std::string& defVal = "") const;
+	bool GetBool(const int colIdx, const bool defVal = false) const;
+	const unsigned char* GetBlob(const int colIdx, int& len) const;
+	bool IsNull(const int colIdx) const;
+
+	void GetMetrics(IcuSqlite3PrefetchMetrics& metrics) const;
+
+private:
+	IcuSqlite3Database&							m_db;
+	std::unique_ptr<IcuSqlite3PrefetchState>	m_state;
+
+	bool Start(void* stmt, const bool ownStmt, const IcuSqlite3PrefetchOptions& options);
+
+	IcuSqlite3PrefetchResultSet(const IcuSqlite3PrefetchResultSet&);	//	prevent copy
+	IcuSqlite3PrefetchResultSet& operator=(const IcuSqlite3PrefetchResultSet&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_PREFETCH_H__
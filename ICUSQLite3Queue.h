@@ -0,0 +1,112 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_QUEUE_H__
+#define __ICU_SQLITE3_QUEUE_H__
+
+//
+//	Internal: not part of the public API
+//
+
+//	STL
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+//
+//	Bounded single producer / single consumer ring of preallocated slots.
+//	Slots are filled and drained in place (BeginPush() / EndPush(),
+//	BeginPop() / EndPop()), so a slot's buffers are reused rather than
+//	reallocated. Neither side locks or waits; a full or empty ring returns
+//	nullptr.
+//
+template<typename T>
+class IcuSqlite3SpscRing
+{
+public:
+	explicit IcuSqlite3SpscRing(size_t capacity)
+		: m_head(0)
+		, m_tail(0)
+	{
+		size_t size = 2;
+		while(size < capacity) {
+			size <<= 1;
+		}
+		m_slots.reset(new T[size]);
+		m_mask = size - 1;
+	}
+
+	size_t GetCapacity() const { return m_mask + 1; }
+
+	size_t GetSize() const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+
+	//
+	//	Producer
+	//
+	T* BeginPush()
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if(tail - m_head.load(std::memory_order_acquire) > m_mask) {
+			return nullptr;	//	full
+		}
+		return &m_slots[tail & m_mask];
+	}
+
+	void EndPush()
+	{
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	//
+	//	Consumer
+	//
+	T* BeginPop()
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if(head == m_tail.load(std::memory_order_acquire)) {
+			return nullptr;	//	empty
+		}
+		return &m_slots[head & m_mask];
+	}
+
+	void EndPop()
+	{
+		m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	std::unique_ptr<T[]>		m_slots;
+	size_t						m_mask;
+
+	//	kept on separate cache lines; each is written by one side only
+	alignas(64) std::atomic<size_t>	m_head;		//	next slot to pop
+	alignas(64) std::atomic<size_t>	m_tail;		//	next slot to push
+
+	IcuSqlite3SpscRing(const IcuSqlite3SpscRing&);	//	prevent copy
+	IcuSqlite3SpscRing& operator=(const IcuSqlite3SpscRing&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_QUEUE_H__
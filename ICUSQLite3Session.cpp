@@ -0,0 +1,483 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Session.h"
+
+#if ICUSQLITE_HAVE_SESSION
+
+#include "ICUSQLite3Transcode.h"
+
+//
+//	sqlite3.h only declares the session API with these set; the library
+//	itself must have been built with them as well
+//
+#if !defined(SQLITE_ENABLE_SESSION)
+	#define SQLITE_ENABLE_SESSION			1
+#endif	//	!defined(SQLITE_ENABLE_SESSION)
+#if !defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+	#define SQLITE_ENABLE_PREUPDATE_HOOK	1
+#endif	//	!defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <cstring>
+
+///////////////////////////////////////////////////////////////////////////////
+//	Apply callbacks
+///////////////////////////////////////////////////////////////////////////////
+static int IcuSqlite3ChangesetFilter(
+	void* ctxt, const char* table)
+{
+	IcuSqlite3ChangesetConflictHandler* handler = 
+		static_cast<IcuSqlite3ChangesetConflictHandler*>(ctxt);
+	return (nullptr == handler || handler->Filter(table)) ? 1 : 0;
+}
+
+static int IcuSqlite3ChangesetConflict(
+	void* ctxt, int conflict, sqlite3_changeset_iter* iter)
+{
+	IcuSqlite3ChangesetConflictHandler* handler = 
+		static_cast<IcuSqlite3ChangesetConflictHandler*>(ctxt);
+	if(nullptr == handler) {
+		return SQLITE_CHANGESET_ABORT;
+	}
+
+	//
+	//	A FOREIGN_KEY iterator only supports sqlite3changeset_fk_conflicts()
+	//
+	IcuSqlite3ChangesetChange change(
+		SQLITE_CHANGESET_FOREIGN_KEY == conflict ? nullptr : iter);
+	EIcuSqlite3ChangesetResolution resolution = handler->OnConflict(
+		static_cast<EIcuSqlite3ChangesetConflict>(conflict), change);
+
+	switch(resolution) {
+		case ICUSQLITE_CHANGESET_REPLACE :
+			//	anything else is SQLITE_MISUSE
+			if(SQLITE_CHANGESET_DATA == conflict || SQLITE_CHANGESET_CONFLICT == conflict) {
+				return SQLITE_CHANGESET_REPLACE;
+			}
+			return SQLITE_CHANGESET_OMIT;
+
+		case ICUSQLITE_CHANGESET_OMIT :
+			return SQLITE_CHANGESET_OMIT;
+
+		default :
+			return SQLITE_CHANGESET_ABORT;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ChangesetChange
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ChangesetChange::IcuSqlite3ChangesetChange(
+	void* iter)
+	: m_iter(iter)
+	, m_table("")
+	, m_op(0)
+	, m_columns(0)
+	, m_indirect(false)
+{
+	if(nullptr != m_iter) {
+		int indirect = 0;
+		if(SQLITE_OK == sqlite3changeset_op((sqlite3_changeset_iter*)m_iter, 
+			&m_table, &m_columns, &m_op, &indirect))
+		{
+			m_indirect = (0 != indirect);
+		}
+	}
+}
+
+bool IcuSqlite3ChangesetChange::GetValue(
+	const EIcuSqlite3ChangesetValue which, const int column,
+	IcuSqlite3ChangesetValueView& value) const
+{
+	value.type			= ICUSQLITE_COLUMN_TYPE_INVALID;
+	value.i				= 0;
+	value.d				= 0.0;
+	value.blob.data		= nullptr;
+	value.blob.length	= 0;
+	value.blob.null		= true;
+
+	if(nullptr == m_iter || column < 0 || column >= m_columns) {
+		return false;
+	}
+
+	sqlite3_changeset_iter* iter = (sqlite3_changeset_iter*)m_iter;
+	sqlite3_value* v = nullptr;
+	int rc;
+	switch(which) {
+		case ICUSQLITE_CHANGESET_OLD :		rc = sqlite3changeset_old(iter, column, &v); break;
+		case ICUSQLITE_CHANGESET_NEW :		rc = sqlite3changeset_new(iter, column, &v); break;
+		default :							rc = sqlite3changeset_conflict(iter, column, &v); break;
+	}
+	if(SQLITE_OK != rc || nullptr == v) {
+		return false;	//	not part of this change (e.g. an unchanged UPDATE column)
+	}
+
+	switch(sqlite3_value_type(v)) {
+		case SQLITE_INTEGER :
+			value.type	= ICUSQLITE_COLUMN_TYPE_INTEGER;
+			value.i		= sqlite3_value_int64(v);
+			break;
+
+		case SQLITE_FLOAT :
+			value.type	= ICUSQLITE_COLUMN_TYPE_FLOAT;
+			value.d		= sqlite3_value_double(v);
+			break;
+
+		case SQLITE_TEXT :
+			value.type			= ICUSQLITE_COLUMN_TYPE_TEXT;
+			value.blob.data		= sqlite3_value_text(v);
+			value.blob.length	= sqlite3_value_bytes(v);
+			value.blob.null		= false;
+			break;
+
+		case SQLITE_BLOB :
+			value.type			= ICUSQLITE_COLUMN_TYPE_BLOB;
+			value.blob.data		= static_cast<const unsigned char*>(sqlite3_value_blob(v));
+			value.blob.length	= sqlite3_value_bytes(v);
+			value.blob.null		= false;
+			break;
+
+		default :
+			value.type	= ICUSQLITE_COLUMN_TYPE_NULL;
+			break;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Changeset
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3Changeset::IcuSqlite3Changeset()
+	: m_data(nullptr)
+	, m_size(0)
+	, m_patchset(false)
+	, m_lastResult(SQLITE_OK)
+{
+}
+
+IcuSqlite3Changeset::~IcuSqlite3Changeset()
+{
+	Clear();
+}
+
+IcuSqlite3Changeset::IcuSqlite3Changeset(
+	IcuSqlite3Changeset&& other)
+	: m_data(other.m_data)
+	, m_size(other.m_size)
+	, m_patchset(other.m_patchset)
+	, m_lastResult(other.m_lastResult)
+{
+	other.m_data	= nullptr;
+	other.m_size	= 0;
+}
+
+IcuSqlite3Changeset& IcuSqlite3Changeset::operator=(
+	IcuSqlite3Changeset&& other)
+{
+	if(this != &other) {
+		Adopt(other.m_data, other.m_size, other.m_patchset);
+		m_lastResult	= other.m_lastResult;
+		other.m_data	= nullptr;
+		other.m_size	= 0;
+	}
+	return *this;
+}
+
+void IcuSqlite3Changeset::Adopt(
+	void* data, const int size, const bool patchset)
+{
+	sqlite3_free(m_data);
+	m_data		= data;
+	m_size		= (nullptr == data) ? 0 : size;
+	m_patchset	= patchset;
+}
+
+void IcuSqlite3Changeset::Clear()
+{
+	Adopt(nullptr, 0, false);
+}
+
+bool IcuSqlite3Changeset::Assign(
+	const void* data, const int size, const bool patchset /*= false*/)
+{
+	if(size < 0 || (size > 0 && nullptr == data)) {
+		m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	void* copy = nullptr;
+	if(size > 0) {
+		copy = sqlite3_malloc64(static_cast<sqlite3_uint64>(size));
+		if(nullptr == copy) {
+			m_lastResult = SQLITE_NOMEM;
+			return false;
+		}
+		memcpy(copy, data, size);
+	}
+
+	Adopt(copy, size, patchset);
+	m_lastResult = SQLITE_OK;
+	return true;
+}
+
+bool IcuSqlite3Changeset::Apply(
+	IcuSqlite3Database& db,
+	IcuSqlite3ChangesetConflictHandler* handler /*= nullptr*/) const
+{
+	sqlite3* handle = (sqlite3*)db.GetDatabaseHandle();
+	if(nullptr == handle) {
+		m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	m_lastResult = sqlite3changeset_apply(handle, m_size, m_data,
+		IcuSqlite3ChangesetFilter, IcuSqlite3ChangesetConflict, handler);
+	return SQLITE_OK == m_lastResult;
+}
+
+bool IcuSqlite3Changeset::Invert(
+	IcuSqlite3Changeset& inverted) const
+{
+	if(m_patchset) {
+		m_lastResult = SQLITE_MISUSE;	//	no old values to restore
+		return false;
+	}
+
+	int size = 0;
+	void* data = nullptr;
+	m_lastResult = sqlite3changeset_invert(m_size, m_data, &size, &data);
+	if(SQLITE_OK != m_lastResult) {
+		return false;
+	}
+
+	inverted.Adopt(data, size, false);
+	return true;
+}
+
+/*static*/
+bool IcuSqlite3Changeset::Concat(
+	const IcuSqlite3Changeset& first, const IcuSqlite3Changeset& second,
+	IcuSqlite3Changeset& result)
+{
+	if(first.m_patchset != second.m_patchset) {
+		result.m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	int size = 0;
+	void* data = nullptr;
+	result.m_lastResult = sqlite3changeset_concat(first.m_size, first.m_data,
+		second.m_size, second.m_data, &size, &data);
+	if(SQLITE_OK != result.m_lastResult) {
+		return false;
+	}
+
+	result.Adopt(data, size, first.m_patchset);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Session
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3Session::IcuSqlite3Session(
+	IcuSqlite3Database& db)
+	: m_db(db)
+	, m_session(nullptr)
+	, m_allTables(false)
+	, m_enabled(true)
+	, m_indirect(false)
+	, m_lastResult(SQLITE_OK)
+{
+}
+
+IcuSqlite3Session::~IcuSqlite3Session()
+{
+	Close();
+}
+
+bool IcuSqlite3Session::Open(
+	const UnicodeString& dbName /*= "main"*/)
+{
+	if(nullptr != m_session) {
+		m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	IcuSqlite3ToUtf8(dbName, m_dbName);
+	m_tables.clear();
+	m_allTables	= false;
+	m_enabled	= true;
+	m_indirect	= false;
+	return Create();
+}
+
+void IcuSqlite3Session::Close()
+{
+	if(nullptr != m_session) {
+		sqlite3session_delete((sqlite3_session*)m_session);
+		m_session = nullptr;
+	}
+}
+
+bool IcuSqlite3Session::Create()
+{
+	sqlite3* handle = (sqlite3*)m_db.GetDatabaseHandle();
+	if(nullptr == handle) {
+		m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	sqlite3_session* session = nullptr;
+	m_lastResult = sqlite3session_create(handle, m_dbName.c_str(), &session);
+	if(SQLITE_OK != m_lastResult) {
+		return false;
+	}
+
+	//
+	//	Restore attachments and flags (TakeChangeset() starts over with a
+	//	fresh session object; there is no way to reset one)
+	//
+	if(m_allTables) {
+		m_lastResult = sqlite3session_attach(session, nullptr);
+	}
+	for(size_t i = 0; SQLITE_OK == m_lastResult && i < m_tables.size(); ++i) {
+		m_lastResult = sqlite3session_attach(session, m_tables[i].c_str());
+	}
+	if(SQLITE_OK != m_lastResult) {
+		sqlite3session_delete(session);
+		return false;
+	}
+
+	sqlite3session_enable(session, m_enabled ? 1 : 0);
+	sqlite3session_indirect(session, m_indirect ? 1 : 0);
+	m_session = session;
+	return true;
+}
+
+bool IcuSqlite3Session::Attach(
+	const UnicodeString& tableName /*= UnicodeString()*/)
+{
+	if(nullptr == m_session) {
+		m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	if(tableName.isEmpty()) {
+		m_lastResult = sqlite3session_attach((sqlite3_session*)m_session, nullptr);
+		if(SQLITE_OK == m_lastResult) {
+			m_allTables = true;
+		}
+	} else {
+		std::string name;
+		IcuSqlite3ToUtf8(tableName, name);
+		m_lastResult = sqlite3session_attach((sqlite3_session*)m_session, name.c_str());
+		if(SQLITE_OK == m_lastResult) {
+			m_tables.push_back(name);
+		}
+	}
+	return SQLITE_OK == m_lastResult;
+}
+
+void IcuSqlite3Session::Enable(
+	const bool enable)
+{
+	m_enabled = enable;
+	if(nullptr != m_session) {
+		sqlite3session_enable((sqlite3_session*)m_session, enable ? 1 : 0);
+	}
+}
+
+void IcuSqlite3Session::SetIndirect(
+	const bool indirect)
+{
+	m_indirect = indirect;
+	if(nullptr != m_session) {
+		sqlite3session_indirect((sqlite3_session*)m_session, indirect ? 1 : 0);
+	}
+}
+
+bool IcuSqlite3Session::IsEmpty() const
+{
+	return nullptr == m_session || 0 != sqlite3session_isempty((sqlite3_session*)m_session);
+}
+
+bool IcuSqlite3Session::GetChangeset(
+	IcuSqlite3Changeset& changeset) const
+{
+	if(nullptr == m_session) {
+		m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	int size = 0;
+	void* data = nullptr;
+	m_lastResult = sqlite3session_changeset((sqlite3_session*)m_session, &size, &data);
+	if(SQLITE_OK != m_lastResult) {
+		return false;
+	}
+
+	changeset.Adopt(data, size, false);
+	return true;
+}
+
+bool IcuSqlite3Session::GetPatchset(
+	IcuSqlite3Changeset& patchset) const
+{
+	if(nullptr == m_session) {
+		m_lastResult = SQLITE_MISUSE;
+		return false;
+	}
+
+	int size = 0;
+	void* data = nullptr;
+	m_lastResult = sqlite3session_patchset((sqlite3_session*)m_session, &size, &data);
+	if(SQLITE_OK != m_lastResult) {
+		return false;
+	}
+
+	patchset.Adopt(data, size, true);
+	return true;
+}
+
+bool IcuSqlite3Session::TakeChangeset(
+	IcuSqlite3Changeset& changeset, const bool patchset /*= false*/)
+{
+	if(!(patchset ? GetPatchset(changeset) : GetChangeset(changeset))) {
+		return false;
+	}
+
+	Close();
+	return Create();
+}
+
+#endif	//	ICUSQLITE_HAVE_SESSION
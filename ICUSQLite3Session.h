@@ -0,0 +1,247 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_SESSION_H__
+#define __ICU_SQLITE3_SESSION_H__
+
+//
+//	Wrappers for the session extension (sqlite3session_*, sqlite3changeset_*)
+//	for incremental replication: record what a transaction changed, ship
+//	the changeset, apply it on a replica.
+//
+//	Requires SQLite built with SQLITE_ENABLE_SESSION and
+//	SQLITE_ENABLE_PREUPDATE_HOOK, and ICUSQLITE_HAVE_SESSION=1 here.
+//	The session extension owns the connection's preupdate hook, so a
+//	change stream started on the same connection falls back to the
+//	update hook.
+//
+
+#include "ICUSQLite3.h"
+
+#if ICUSQLITE_HAVE_SESSION
+
+//	STL
+#include <string>
+#include <vector>
+
+enum EIcuSqlite3ChangesetConflict {
+	ICUSQLITE_CHANGESET_DATA		= 1,	//	row found, but its current values differ
+	ICUSQLITE_CHANGESET_NOTFOUND	= 2,	//	UPDATE / DELETE row not found
+	ICUSQLITE_CHANGESET_CONFLICT	= 3,	//	INSERT hit an existing primary key
+	ICUSQLITE_CHANGESET_CONSTRAINT	= 4,	//	other constraint violation
+	ICUSQLITE_CHANGESET_FOREIGN_KEY	= 5,	//	foreign keys left violated (once, at the end)
+};
+
+enum EIcuSqlite3ChangesetResolution {
+	ICUSQLITE_CHANGESET_OMIT		= 0,	//	skip this change
+	ICUSQLITE_CHANGESET_REPLACE		= 1,	//	DATA / CONFLICT only: overwrite the replica's row
+	ICUSQLITE_CHANGESET_ABORT		= 2,	//	roll back the whole apply
+};
+
+enum EIcuSqlite3ChangesetValue {
+	ICUSQLITE_CHANGESET_OLD,		//	UPDATE / DELETE: value before the change
+	ICUSQLITE_CHANGESET_NEW,		//	UPDATE / INSERT: value after the change
+	ICUSQLITE_CHANGESET_CURRENT,	//	DATA / CONFLICT: the replica's value
+};
+
+//
+//	A value read out of a change. TEXT is UTF-8 in |blob|; |blob| points
+//	into SQLite's memory and is only valid during the callback.
+//
+struct IcuSqlite3ChangesetValueView
+{
+	EIcuSqlite3ColumnTypes	type;	//	INVALID if the change has no such value
+	int64_t					i;
+	double					d;
+	IcuSqlite3BlobView		blob;
+};
+
+//
+//	The change a conflict was raised for
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3ChangesetChange
+{
+public:
+	explicit IcuSqlite3ChangesetChange(void* iter);
+
+	const char* GetTable() const { return m_table; }
+	EIcuSqlite3ChangeOp GetOp() const { return static_cast<EIcuSqlite3ChangeOp>(m_op); }
+	int GetColumnCount() const { return m_columns; }
+	bool IsIndirect() const { return m_indirect; }
+
+	bool GetValue(const EIcuSqlite3ChangesetValue which, const int column,
+		IcuSqlite3ChangesetValueView& value) const;
+
+private:
+	void*			m_iter;
+	const char*		m_table;
+	int				m_op;
+	int				m_columns;
+	bool			m_indirect;
+};
+
+class IcuSqlite3ChangesetConflictHandler
+{
+public:
+	virtual ~IcuSqlite3ChangesetConflictHandler() {}
+
+	//
+	//	Return false to skip every change to |table|
+	//
+	virtual bool Filter(const char* /*table*/) { return true; }
+
+	virtual EIcuSqlite3ChangesetResolution OnConflict(
+		const EIcuSqlite3ChangesetConflict conflict,
+		const IcuSqlite3ChangesetChange& change) = 0;
+};
+
+//
+//	A serialized changeset (or patchset): SQLite's own compact binary
+//	format, ready to write to a file or socket as is. Memory comes from
+//	sqlite3_malloc().
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3Changeset
+{
+public:
+	IcuSqlite3Changeset();
+	~IcuSqlite3Changeset();
+
+	IcuSqlite3Changeset(IcuSqlite3Changeset&& other);
+	IcuSqlite3Changeset& operator=(IcuSqlite3Changeset&& other);
+
+	const void* GetData() const { return m_data; }
+	int GetSize() const { return m_size; }
+	bool IsEmpty() const { return 0 == m_size; }
+	bool IsPatchset() const { return m_patchset; }
+
+	//
+	//	Load a changeset received from elsewhere (copies |data|)
+	//
+	bool Assign(const void* data, const int size, const bool patchset = false);
+	void Clear();
+
+	//
+	//	Apply to |db| in a single savepoint. Conflicts go to |handler|; with
+	//	no handler any conflict aborts. On abort nothing is applied, false
+	//	is returned and GetLastResult() is SQLITE_ABORT.
+	//
+	bool Apply(IcuSqlite3Database& db,
+		IcuSqlite3ChangesetConflictHandler* handler = nullptr) const;
+
+	//
+	//	The changeset that undoes this one (not available for patchsets)
+	//
+	bool Invert(IcuSqlite3Changeset& inverted) const;
+
+	//
+	//	|first| followed by |second| as one changeset; rows changed by both
+	//	are merged. Both must be changesets or both patchsets.
+	//
+	static bool Concat(const IcuSqlite3Changeset& first,
+		const IcuSqlite3Changeset& second, IcuSqlite3Changeset& result);
+
+	int GetLastResult() const { return m_lastResult; }
+
+private:
+	void*			m_data;
+	int				m_size;
+	bool			m_patchset;
+	mutable int		m_lastResult;
+
+	void Adopt(void* data, const int size, const bool patchset);
+
+	IcuSqlite3Changeset(const IcuSqlite3Changeset&);	//	prevent copy
+	IcuSqlite3Changeset& operator=(const IcuSqlite3Changeset&);	//	prevent assign
+
+	friend class IcuSqlite3Session;
+};
+
+//
+//	Records changes to the attached tables of one database. Tables need a
+//	PRIMARY KEY; rows of tables without one are not recorded.
+//
+//	For per-transaction changesets call TakeChangeset() after each commit:
+//	it hands over what was recorded and starts recording afresh.
+//
+//	Close() (or destroy) the session before closing |db|.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3Session
+{
+public:
+	explicit IcuSqlite3Session(IcuSqlite3Database& db);
+	~IcuSqlite3Session();
+
+	bool Open(const UnicodeString& dbName = "main");
+	void Close();
+	bool IsOpen() const { return nullptr != m_session; }
+
+	//
+	//	Empty name = every table, including ones created later
+	//
+	bool Attach(const UnicodeString& tableName = UnicodeString());
+
+	void Enable(const bool enable);
+	bool IsEnabled() const { return m_enabled; }
+
+	//
+	//	Mark changes made from now on as indirect (e.g. done by triggers
+	//	or replication itself) until set back to false
+	//
+	void SetIndirect(const bool indirect);
+
+	bool IsEmpty() const;
+
+	//
+	//	Everything recorded since Open() / the last TakeChangeset()
+	//
+	bool GetChangeset(IcuSqlite3Changeset& changeset) const;
+
+	//
+	//	Smaller than a changeset (no old values for UPDATE / DELETE), but
+	//	cannot be inverted or checked for DATA conflicts
+	//
+	bool GetPatchset(IcuSqlite3Changeset& patchset) const;
+
+	bool TakeChangeset(IcuSqlite3Changeset& changeset, const bool patchset = false);
+
+	int GetLastResult() const { return m_lastResult; }
+
+private:
+	IcuSqlite3Database&			m_db;
+	void*						m_session;
+	std::string					m_dbName;
+	std::vector<std::string>	m_tables;
+	bool						m_allTables;
+	bool						m_enabled;
+	bool						m_indirect;
+	mutable int					m_lastResult;
+
+	bool Create();
+
+	IcuSqlite3Session(const IcuSqlite3Session&);	//	prevent copy
+	IcuSqlite3Session& operator=(const IcuSqlite3Session&);	//	prevent assign
+};
+
+#endif	//	ICUSQLITE_HAVE_SESSION
+
+#endif	//	!__ICU_SQLITE3_SESSION_H__
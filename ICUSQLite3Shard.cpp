@@ -0,0 +1,1138 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Shard.h"
+#include "ICUSQLite3Chunk.h"
+#include "ICUSQLite3Internal.h"
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <algorithm>
+#include <map>
+
+//
+//	Statements kept prepared per shard; the cache is simply emptied when
+//	it fills up
+//
+#define ICUSQLITE_SHARD_MAX_CACHED_STMTS	32
+
+//
+//	Rows per chunk handed from a shard to the merge, and chunks a shard
+//	may run ahead of the consumer before its task is parked
+//
+#define ICUSQLITE_SHARD_CHUNK_ROWS		256
+#define ICUSQLITE_SHARD_QUEUED_CHUNKS	4
+
+//
+//	true if a + b doesn't fit in an int64_t
+//
+static bool IcuSqlite3AddOverflows(
+	const int64_t a, const int64_t b)
+{
+	return (b > 0) ? (a > INT64_MAX - b) : (a < INT64_MIN - b);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ShardSortKey / IcuSqlite3ShardQuery / IcuSqlite3ShardMetrics
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ShardSortKey::IcuSqlite3ShardSortKey(
+	const int column /*= 0*/, const bool descending /*= false*/)
+	: column(column)
+	, descending(descending)
+{
+}
+
+IcuSqlite3ShardQuery::IcuSqlite3ShardQuery()
+	: merge(ICUSQLITE_SHARD_MERGE_CONCAT)
+	, groupColumns(0)
+{
+}
+
+IcuSqlite3ShardMetrics::IcuSqlite3ShardMetrics()
+	: queries(0)
+	, shardRuns(0)
+	, rows(0)
+	, failures(0)
+	, shardUs(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ShardJob
+///////////////////////////////////////////////////////////////////////////////
+
+//
+//	One ExecuteQuery(): per shard chunk queues filled by the workers
+//	(parts), and the merge state NextRow() advances on the consumer's
+//	thread
+//
+struct IcuSqlite3ShardJob
+{
+	typedef std::unique_ptr<IcuSqlite3Chunk>	ChunkPtr;
+
+	//
+	//	One shard's rows. The worker appends chunks to ready and parks the
+	//	task once ICUSQLITE_SHARD_QUEUED_CHUNKS are waiting; the consumer
+	//	takes them from the front, resumes a parked task and hands used
+	//	chunks back through spare.
+	//
+	struct Part
+	{
+		Part() : shard(-1), cols(-1), done(false), parked(false), rc(SQLITE_OK), headRow(-1) {}
+
+		int							shard;
+		int							cols;			//	-1 until the statement is prepared
+		std::vector<std::string>	columnNames;
+		std::deque<ChunkPtr>		ready;
+		std::vector<ChunkPtr>		spare;
+		bool						done;
+		bool						parked;			//	task waits in the executor for room in ready
+		int							rc;
+		std::string					error;
+
+		ChunkPtr					head;			//	consumer's current chunk
+		int							headRow;
+	};
+
+	//
+	//	Running total for one AGGREGATE column of one group
+	//
+	struct Accumulator
+	{
+		Accumulator() : type(ICUSQLITE_COLUMN_TYPE_NULL), i(0), d(0.0), chunk(nullptr), row(0) {}
+
+		int						type;	//	SUM: NULL, INTEGER or FLOAT so far
+		int64_t					i;
+		double					d;
+		const IcuSqlite3Chunk*	chunk;	//	MIN / MAX / ANY: the winning cell
+		int						row;
+	};
+
+	struct GroupKey
+	{
+		const IcuSqlite3Chunk*	chunk;
+		int						row;
+	};
+
+	struct GroupLess
+	{
+		explicit GroupLess(const int cols) : cols(cols) {}
+
+		bool operator()(const GroupKey& a, const GroupKey& b) const
+		{
+			for(int col = 0; col < cols; ++col) {
+				const int r = IcuSqlite3Chunk::Compare(*a.chunk, a.row, col, *b.chunk, b.row, col);
+				if(0 != r) {
+					return r < 0;
+				}
+			}
+			return false;
+		}
+
+		int	cols;
+	};
+
+	IcuSqlite3ShardJob() 
+		: executor(nullptr)
+		, cancel(false)
+		, started(false)
+		, eof(false)
+		, rc(SQLITE_OK)
+		, cur(nullptr)
+		, curRow(-1)
+		, curShard(-1)
+		, concatPart(0)
+		, lastPart(-1)
+	{
+	}
+
+	bool Fail(const int code, const std::string& message)
+	{
+		if(SQLITE_OK == rc) {
+			rc		= code;
+			error	= message;
+		}
+		eof	= true;
+		cur	= nullptr;
+		return false;
+	}
+
+	//
+	//	Worker side
+	//
+	std::string					sql;
+	IcuSqlite3ShardQuery		query;
+	IcuSqlite3ShardParams		params;
+	IcuSqlite3ShardExecutor*	executor;
+
+	std::mutex					lock;
+	std::condition_variable		partReady;
+	std::vector<Part>			parts;
+	std::atomic<bool>			cancel;
+
+	bool Bind(void* stmt) const
+	{
+		return params.Apply(stmt);
+	}
+
+	void Start(const int slot, sqlite3_stmt* stmt)
+	{
+		const int cols = sqlite3_column_count(stmt);
+		std::vector<std::string> names(cols);
+		for(int col = 0; col < cols; ++col) {
+			const char* name = sqlite3_column_name(stmt, col);
+			names[col] = (nullptr != name) ? name : "";
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		parts[slot].columnNames.swap(names);
+		parts[slot].cols = cols;
+		partReady.notify_all();
+	}
+
+	void Push(const int slot, ChunkPtr chunk)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		Part& part = parts[slot];
+		if(chunk->GetRowCount() > 0) {
+			part.ready.push_back(std::move(chunk));
+			partReady.notify_all();
+		} else {
+			part.spare.push_back(std::move(chunk));
+		}
+	}
+
+	void Finish(const int slot, const int code, const std::string& message)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		parts[slot].rc		= code;
+		parts[slot].error	= message;
+		parts[slot].done	= true;
+		parts[slot].parked	= false;
+		partReady.notify_all();
+	}
+
+	//
+	//	Called when the result goes away: parked tasks are resumed so they
+	//	see the flag, finish and give their statements back
+	//
+	void Cancel()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		cancel = true;
+		for(size_t slot = 0; slot < parts.size(); ++slot) {
+			parts[slot].ready.clear();
+			parts[slot].spare.clear();
+			if(parts[slot].parked) {
+				parts[slot].parked = false;
+				executor->Resume(this, static_cast<int>(slot));
+			}
+		}
+	}
+
+	//
+	//	Consumer side (the thread iterating the result)
+	//
+	bool						started;
+	bool						eof;
+	int							rc;
+	std::string					error;
+
+	const IcuSqlite3Chunk*		cur;
+	int							curRow;
+	int							curShard;
+
+	size_t						concatPart;
+	std::vector<int>			heap;		//	ORDERED: parts with rows left
+	int							lastPart;
+	std::vector<ChunkPtr>		kept;		//	AGGREGATE: every chunk, the groups point into them
+	IcuSqlite3Chunk				merged;		//	AGGREGATE output
+
+	//
+	//	Waits until the part's statement is prepared (or failed)
+	//
+	bool WaitColumns(const size_t slot)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		partReady.wait(guard, [&] { return parts[slot].cols >= 0 || parts[slot].done; });
+		const Part& part = parts[slot];
+		if(part.cols < 0) {
+			const int code = (SQLITE_OK != part.rc) ? part.rc : SQLITE_ERROR;
+			const std::string message = part.error;
+			guard.unlock();
+			return Fail(code, message);
+		}
+		guard.unlock();
+
+		if(part.cols != parts[0].cols) {	//	part 0 is always waited for first
+			return Fail(SQLITE_MISMATCH, "shards returned different column counts");
+		}
+		return true;
+	}
+
+	//
+	//	The part's next chunk; nullptr once it's exhausted or failed (the
+	//	job has then failed too)
+	//
+	ChunkPtr NextChunk(const size_t slot)
+	{
+		Part& part = parts[slot];
+		std::unique_lock<std::mutex> guard(lock);
+		partReady.wait(guard, [&] { return !part.ready.empty() || part.done; });
+		if(part.ready.empty()) {
+			const int code = part.rc;
+			const std::string message = part.error;
+			part.spare.clear();
+			guard.unlock();
+			if(SQLITE_OK != code) {
+				Fail(code, message);
+			}
+			return ChunkPtr();
+		}
+
+		ChunkPtr chunk = std::move(part.ready.front());
+		part.ready.pop_front();
+		if(part.parked) {
+			part.parked = false;
+			executor->Resume(this, static_cast<int>(slot));
+		}
+		return chunk;
+	}
+
+	//
+	//	Moves the part's head to its next row; false once the part is
+	//	exhausted or failed
+	//
+	bool NextPartRow(const size_t slot)
+	{
+		Part& part = parts[slot];
+		if(nullptr != part.head.get()) {
+			if(++part.headRow < part.head->GetRowCount()) {
+				return true;
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			part.spare.push_back(std::move(part.head));
+		}
+		part.head		= NextChunk(slot);
+		part.headRow	= 0;
+		return nullptr != part.head.get();
+	}
+
+	int GetColumnCount() const
+	{
+		return (!parts.empty() && parts[0].cols > 0) ? parts[0].cols : 0;
+	}
+
+	//
+	//	true if part a's head row sorts after part b's (std::*_heap builds
+	//	a max heap, so this yields the smallest first). Ties go to the
+	//	lower shard so equal keys keep shard order.
+	//
+	bool After(const int a, const int b) const
+	{
+		const std::vector<IcuSqlite3ShardSortKey>& orderBy = query.orderBy;
+		for(size_t n = 0; n < orderBy.size(); ++n) {
+			const int col = orderBy[n].column;
+			int r = IcuSqlite3Chunk::Compare(*parts[a].head, parts[a].headRow, col, 
+				*parts[b].head, parts[b].headRow, col);
+			if(0 != r) {
+				if(orderBy[n].descending) {
+					r = -r;
+				}
+				return r > 0;
+			}
+		}
+		return a > b;
+	}
+
+	bool StartOrdered()
+	{
+		for(size_t slot = 0; slot < parts.size(); ++slot) {
+			if(!WaitColumns(slot)) {
+				return false;
+			}
+		}
+
+		const int cols = GetColumnCount();
+		if(query.orderBy.empty()) {
+			return Fail(SQLITE_MISUSE, "ordered merge without orderBy");
+		}
+		for(size_t n = 0; n < query.orderBy.size(); ++n) {
+			if(query.orderBy[n].column < 0 || query.orderBy[n].column >= cols) {
+				return Fail(SQLITE_RANGE, "orderBy column out of range");
+			}
+		}
+
+		heap.clear();
+		for(size_t slot = 0; slot < parts.size(); ++slot) {
+			if(NextPartRow(slot)) {
+				heap.push_back(static_cast<int>(slot));
+			} else if(eof) {
+				return false;
+			}
+		}
+
+		auto after = [this](const int a, const int b) { return After(a, b); };
+		std::make_heap(heap.begin(), heap.end(), after);
+		lastPart = -1;
+		return true;
+	}
+
+	bool NextOrdered()
+	{
+		auto after = [this](const int a, const int b) { return After(a, b); };
+		if(lastPart >= 0) {
+			if(NextPartRow(lastPart)) {
+				heap.push_back(lastPart);
+				std::push_heap(heap.begin(), heap.end(), after);
+			} else if(eof) {
+				return false;
+			}
+		}
+		if(heap.empty()) {
+			eof = true;
+			cur = nullptr;
+			return false;
+		}
+
+		std::pop_heap(heap.begin(), heap.end(), after);
+		lastPart = heap.back();
+		heap.pop_back();
+
+		cur			= parts[lastPart].head.get();
+		curRow		= parts[lastPart].headRow;
+		curShard	= parts[lastPart].shard;
+		return true;
+	}
+
+	bool StartAggregate()
+	{
+		for(size_t slot = 0; slot < parts.size(); ++slot) {
+			if(!WaitColumns(slot)) {
+				return false;
+			}
+		}
+
+		const int cols = GetColumnCount();
+		const int keys = query.groupColumns;
+		if(keys < 0 || keys > cols) {
+			return Fail(SQLITE_RANGE, "groupColumns out of range");
+		}
+
+		typedef std::map<GroupKey, size_t, GroupLess> GroupMap;
+		GroupMap groups((GroupLess(keys)));
+		std::vector<GroupKey> keyRows;
+		std::vector<Accumulator> totals;	//	group * (cols - keys) + column
+
+		//
+		//	Partial aggregates are a row per group, so keeping every chunk
+		//	is bounded by the group count rather than the data
+		//
+		const int values = cols - keys;
+		for(size_t slot = 0; slot < parts.size(); ++slot) {
+			for(;;) {
+				ChunkPtr chunk = NextChunk(slot);
+				if(nullptr == chunk.get()) {
+					if(eof) {
+						return false;
+					}
+					break;
+				}
+
+				const IcuSqlite3Chunk& rows = *chunk;
+				kept.push_back(std::move(chunk));
+				for(int row = 0; row < rows.GetRowCount(); ++row) {
+					GroupKey key = { &rows, row };
+					std::pair<GroupMap::iterator, bool> ins = groups.insert(
+						std::make_pair(key, keyRows.size()));
+					if(ins.second) {
+						keyRows.push_back(key);
+						totals.resize(totals.size() + values);
+					}
+
+					Accumulator* acc = &totals[ins.first->second * values];
+					for(int col = keys; col < cols; ++col) {
+						Accumulate(acc[col - keys], col, rows, row);
+					}
+				}
+			}
+		}
+
+		merged.Reset(cols);
+		merged.Reserve(groups.size());
+		for(GroupMap::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+			const GroupKey& key = keyRows[it->second];
+			for(int col = 0; col < keys; ++col) {
+				merged.AppendValue(*key.chunk, key.row, col);
+			}
+
+			const Accumulator* acc = &totals[it->second * values];
+			for(int col = keys; col < cols; ++col) {
+				const Accumulator& a = acc[col - keys];
+				if(nullptr != a.chunk) {
+					merged.AppendValue(*a.chunk, a.row, col);
+				} else if(ICUSQLITE_COLUMN_TYPE_INTEGER == a.type) {
+					merged.AppendInt64(a.i);
+				} else if(ICUSQLITE_COLUMN_TYPE_FLOAT == a.type) {
+					merged.AppendDouble(a.d);
+				} else {
+					merged.AppendNull();
+				}
+			}
+		}
+		kept.clear();
+		return true;
+	}
+
+	void Accumulate(Accumulator& acc, const int col, const IcuSqlite3Chunk& rows, const int row) const
+	{
+		if(rows.IsNull(row, col)) {
+			return;	//	aggregates skip NULLs
+		}
+
+		const size_t idx = static_cast<size_t>(col - query.groupColumns);
+		const EIcuSqlite3ShardAggregate op = (idx < query.aggregates.size()) ? 
+			query.aggregates[idx] : ICUSQLITE_SHARD_AGGREGATE_SUM;
+
+		switch(op) {
+			case ICUSQLITE_SHARD_AGGREGATE_MIN :
+			case ICUSQLITE_SHARD_AGGREGATE_MAX :
+				if(nullptr == acc.chunk) {
+					acc.chunk	= &rows;
+					acc.row		= row;
+				} else {
+					const int r = IcuSqlite3Chunk::Compare(rows, row, col, *acc.chunk, acc.row, col);
+					if((ICUSQLITE_SHARD_AGGREGATE_MIN == op) ? (r < 0) : (r > 0)) {
+						acc.chunk	= &rows;
+						acc.row		= row;
+					}
+				}
+				break;
+
+			case ICUSQLITE_SHARD_AGGREGATE_ANY :
+				if(nullptr == acc.chunk) {
+					acc.chunk	= &rows;
+					acc.row		= row;
+				}
+				break;
+
+			default :
+				if(ICUSQLITE_COLUMN_TYPE_INTEGER == rows.GetType(row, col) && 
+					ICUSQLITE_COLUMN_TYPE_FLOAT != acc.type)
+				{
+					const int64_t value = rows.GetInt64(row, col);
+					if(!IcuSqlite3AddOverflows(acc.i, value)) {
+						acc.type	= ICUSQLITE_COLUMN_TYPE_INTEGER;
+						acc.i		+= value;
+						break;
+					}
+					//	past the int64 range: carry on in floating point
+				}
+				if(ICUSQLITE_COLUMN_TYPE_INTEGER == acc.type) {
+					acc.d = static_cast<double>(acc.i);	//	promote, as SUM() does
+				}
+				acc.type	= ICUSQLITE_COLUMN_TYPE_FLOAT;
+				acc.d		+= rows.GetDouble(row, col);
+				break;
+		}
+	}
+
+	bool NextRow()
+	{
+		if(eof) {
+			return false;
+		}
+
+		if(!started) {
+			started = true;
+			if(parts.empty()) {
+				eof = true;
+				return false;
+			}
+			if(!WaitColumns(0)) {
+				return false;
+			}
+			if(ICUSQLITE_SHARD_MERGE_ORDERED == query.merge && !StartOrdered()) {
+				return false;
+			}
+			if(ICUSQLITE_SHARD_MERGE_AGGREGATE == query.merge && !StartAggregate()) {
+				return false;
+			}
+		}
+
+		switch(query.merge) {
+			case ICUSQLITE_SHARD_MERGE_ORDERED :
+				return NextOrdered();
+
+			case ICUSQLITE_SHARD_MERGE_AGGREGATE :
+				if(++curRow < merged.GetRowCount()) {
+					cur = &merged;
+					return true;
+				}
+				break;
+
+			default :
+				while(concatPart < parts.size()) {
+					//	curRow < 0: this part hasn't handed out a row yet
+					if(curRow < 0 && !WaitColumns(concatPart)) {
+						return false;
+					}
+					if(NextPartRow(concatPart)) {
+						cur			= parts[concatPart].head.get();
+						curRow		= parts[concatPart].headRow;
+						curShard	= parts[concatPart].shard;
+						return true;
+					}
+					if(eof) {
+						return false;
+					}
+					++concatPart;
+					curRow = -1;
+				}
+				break;
+		}
+
+		eof = true;
+		cur = nullptr;
+		return false;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ShardResult
+///////////////////////////////////////////////////////////////////////////////
+IcuSqlite3ShardResult::IcuSqlite3ShardResult()
+{
+}
+
+IcuSqlite3ShardResult::IcuSqlite3ShardResult(
+	const std::shared_ptr<IcuSqlite3ShardJob>& job)
+	: m_job(job)
+{
+}
+
+IcuSqlite3ShardResult::IcuSqlite3ShardResult(
+	IcuSqlite3ShardResult&& result)
+	: m_job(std::move(result.m_job))
+{
+}
+
+IcuSqlite3ShardResult& IcuSqlite3ShardResult::operator=(
+	IcuSqlite3ShardResult&& result)
+{
+	if(&result != this) {
+		if(nullptr != m_job.get()) {
+			m_job->Cancel();
+		}
+		m_job = std::move(result.m_job);
+	}
+	return *this;
+}
+
+IcuSqlite3ShardResult::~IcuSqlite3ShardResult()
+{
+	if(nullptr != m_job.get()) {
+		m_job->Cancel();	//	workers skip / stop what's left
+	}
+}
+
+bool IcuSqlite3ShardResult::NextRow()
+{
+	return (nullptr != m_job.get()) ? m_job->NextRow() : false;
+}
+
+bool IcuSqlite3ShardResult::Eof() const
+{
+	return nullptr == m_job.get() || m_job->eof;
+}
+
+bool IcuSqlite3ShardResult::IsOk() const
+{
+	return nullptr != m_job.get() && SQLITE_OK == m_job->rc;
+}
+
+int IcuSqlite3ShardResult::GetErrorCode() const
+{
+	return (nullptr != m_job.get()) ? m_job->rc : SQLITE_MISUSE;
+}
+
+std::string IcuSqlite3ShardResult::GetErrorMessage() const
+{
+	return (nullptr != m_job.get()) ? m_job->error : std::string();
+}
+
+int IcuSqlite3ShardResult::GetColumnCount() const
+{
+	return (nullptr != m_job.get() && m_job->started) ? m_job->GetColumnCount() : 0;
+}
+
+UnicodeString IcuSqlite3ShardResult::GetColumnName(
+	const int colIdx) const
+{
+	if(colIdx < 0 || colIdx >= GetColumnCount()) {
+		return UnicodeString();
+	}
+	const std::string& name = m_job->parts[0].columnNames[colIdx];
+	return IcuSqlite3FromUtf8(name.data(), static_cast<int32_t>(name.size()));
+}
+
+EIcuSqlite3ColumnTypes IcuSqlite3ShardResult::GetColumnType(
+	const int colIdx) const
+{
+	if(nullptr == m_job.get() || nullptr == m_job->cur) {
+		return ICUSQLITE_COLUMN_TYPE_INVALID;
+	}
+	return m_job->cur->GetType(m_job->curRow, colIdx);
+}
+
+int IcuSqlite3ShardResult::GetShard() const
+{
+	if(nullptr == m_job.get() || nullptr == m_job->cur ||
+		ICUSQLITE_SHARD_MERGE_AGGREGATE == m_job->query.merge)
+	{
+		return -1;
+	}
+	return m_job->curShard;
+}
+
+int32_t IcuSqlite3ShardResult::GetInt(
+	const int colIdx, const int32_t defVal /*= 0*/) const
+{
+	return static_cast<int32_t>(GetInt64(colIdx, defVal));
+}
+
+int64_t IcuSqlite3ShardResult::GetInt64(
+	const int colIdx, const int64_t defVal /*= 0*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	return m_job->cur->GetInt64(m_job->curRow, colIdx);
+}
+
+double IcuSqlite3ShardResult::GetDouble(
+	const int colIdx, const double defVal /*= 0.0*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	return m_job->cur->GetDouble(m_job->curRow, colIdx);
+}
+
+UnicodeString IcuSqlite3ShardResult::GetString(
+	const int colIdx, const UnicodeString& defVal /*= ""*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	const std::string utf8 = GetStringUTF8(colIdx);
+	return IcuSqlite3FromUtf8(utf8.data(), static_cast<int32_t>(utf8.size()));
+}
+
+std::string IcuSqlite3ShardResult::GetStringUTF8(
+	const int colIdx, const std::string& defVal /*= ""*/) const
+{
+	if(ICUSQLITE_COLUMN_TYPE_INVALID == GetColumnType(colIdx)) {
+		return defVal;
+	}
+	return m_job->cur->GetString(m_job->curRow, colIdx);
+}
+
+bool IcuSqlite3ShardResult::GetBool(
+	const int colIdx, const bool defVal /*= false*/) const
+{
+	return 0 != GetInt(colIdx, (defVal) ? 1 : 0);
+}
+
+const unsigned char* IcuSqlite3ShardResult::GetBlob(
+	const int colIdx, int& len) const
+{
+	if(nullptr == m_job.get() || nullptr == m_job->cur) {
+		len = 0;
+		return nullptr;
+	}
+	return m_job->cur->GetBlob(m_job->curRow, colIdx, len);
+}
+
+bool IcuSqlite3ShardResult::IsNull(
+	const int colIdx) const
+{
+	return ICUSQLITE_COLUMN_TYPE_NULL == GetColumnType(colIdx);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3ShardExecutor
+///////////////////////////////////////////////////////////////////////////////
+struct IcuSqlite3ShardExecutor::Shard
+{
+	~Shard()
+	{
+		//	statements must go before the connection closes
+		for(std::map<std::string, void*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+			sqlite3_finalize((sqlite3_stmt*)it->second);
+		}
+	}
+
+	//
+	//	A statement for |sql|: the cached one if no other task is using
+	//	it, else a fresh one
+	//
+	sqlite3_stmt* Acquire(const std::string& sql, int& rc)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			std::map<std::string, void*>::iterator cached = stmts.find(sql);
+			if(stmts.end() != cached) {
+				sqlite3_stmt* stmt = (sqlite3_stmt*)cached->second;
+				stmts.erase(cached);
+				rc = SQLITE_OK;
+				return stmt;
+			}
+		}
+
+		sqlite3* handle = (sqlite3*)db.GetDatabaseHandle();
+		sqlite3_stmt* stmt = nullptr;
+#if SQLITE_VERSION_NUMBER >= 3020000
+		rc = sqlite3_prepare_v3(handle, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+#else
+		rc = sqlite3_prepare_v2(handle, sql.c_str(), -1, &stmt, nullptr);
+#endif	//	SQLITE_VERSION_NUMBER >= 3020000
+		return stmt;
+	}
+
+	//
+	//	Hands a statement from Acquire() back, reset
+	//
+	void Release(const std::string& sql, sqlite3_stmt* stmt)
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+
+		std::lock_guard<std::mutex> guard(lock);
+		if(stmts.end() != stmts.find(sql)) {
+			sqlite3_finalize(stmt);		//	another task's copy got back first
+			return;
+		}
+		if(stmts.size() >= ICUSQLITE_SHARD_MAX_CACHED_STMTS) {
+			for(std::map<std::string, void*>::iterator it = stmts.begin(); it != stmts.end(); ++it) {
+				sqlite3_finalize((sqlite3_stmt*)it->second);
+			}
+			stmts.clear();
+		}
+		stmts[sql] = stmt;
+	}
+
+	IcuSqlite3Database				db;
+	std::mutex						lock;	//	guards stmts
+	std::map<std::string, void*>	stmts;	//	sql -> idle prepared sqlite3_stmt
+};
+
+IcuSqlite3ShardExecutor::IcuSqlite3ShardExecutor(
+	const int threads /*= 0*/)
+	: m_maxThreads(threads)
+	, m_stop(false)
+	, m_queries(0)
+	, m_shardRuns(0)
+	, m_rows(0)
+	, m_failures(0)
+	, m_shardUs(0)
+{
+	if(m_maxThreads <= 0) {
+		m_maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+	}
+	if(m_maxThreads <= 0) {
+		m_maxThreads = 1;
+	}
+}
+
+IcuSqlite3ShardExecutor::~IcuSqlite3ShardExecutor()
+{
+	StopWorkers();
+}
+
+bool IcuSqlite3ShardExecutor::AddShard(
+	const UnicodeString& filename,
+	const unsigned char* key /*= nullptr*/, const int keyLen /*= 0*/,
+	const IcuSqlite3OpenProfile& profile /*= IcuSqlite3OpenProfile()*/)
+{
+	std::unique_ptr<Shard> shard(new Shard());
+	shard->db.SetOpenProfile(profile);
+	if(!shard->db.Open(filename, ICUSQLITE_OPEN_READONLY, ICUSQLITE_EXT_OPEN_DEFAULT, key, keyLen)) {
+		return false;
+	}
+
+	m_shards.push_back(std::move(shard));
+	return true;
+}
+
+void IcuSqlite3ShardExecutor::RemoveAllShards()
+{
+	StopWorkers();
+	m_shards.clear();
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_stop = false;		//	workers restart with the next query
+}
+
+IcuSqlite3ShardResult IcuSqlite3ShardExecutor::ExecuteQuery(
+	const UnicodeString& sql,
+	const IcuSqlite3ShardQuery& query /*= IcuSqlite3ShardQuery()*/,
+	const IcuSqlite3ShardParams& params /*= IcuSqlite3ShardParams()*/)
+{
+	IcuSqlite3Utf8 utf8Sql(sql);
+	return ExecuteQuery(utf8Sql.c_str(), query, params);
+}
+
+IcuSqlite3ShardResult IcuSqlite3ShardExecutor::ExecuteQuery(
+	const char* sql,
+	const IcuSqlite3ShardQuery& query /*= IcuSqlite3ShardQuery()*/,
+	const IcuSqlite3ShardParams& params /*= IcuSqlite3ShardParams()*/)
+{
+	std::shared_ptr<IcuSqlite3ShardJob> job(new IcuSqlite3ShardJob());
+	job->sql		= (nullptr != sql) ? sql : "";
+	job->query		= query;
+	job->params		= params;
+	job->executor	= this;
+	++m_queries;
+
+	std::vector<int> selected = query.shards;
+	if(selected.empty()) {
+		for(int n = 0; n < GetShardCount(); ++n) {
+			selected.push_back(n);
+		}
+	}
+	for(size_t n = 0; n < selected.size(); ++n) {
+		if(selected[n] < 0 || selected[n] >= GetShardCount()) {
+			job->Fail(SQLITE_RANGE, "no such shard");
+			return IcuSqlite3ShardResult(job);
+		}
+	}
+
+	job->parts.resize(selected.size());
+	for(size_t n = 0; n < selected.size(); ++n) {
+		job->parts[n].shard = selected[n];
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+
+		const size_t threads = std::min(static_cast<size_t>(m_maxThreads), m_shards.size());
+		while(m_workers.size() < threads) {
+			m_workers.push_back(std::thread(&IcuSqlite3ShardExecutor::Worker, this));
+		}
+
+		for(size_t n = 0; n < selected.size(); ++n) {
+			Task task;
+			task.job	= job;
+			task.slot	= static_cast<int>(n);
+			task.shard	= m_shards[selected[n]].get();
+			task.stmt	= nullptr;
+			m_tasks.push_back(task);
+		}
+	}
+	m_wake.notify_all();
+
+	return IcuSqlite3ShardResult(job);
+}
+
+void IcuSqlite3ShardExecutor::GetMetrics(
+	IcuSqlite3ShardMetrics& metrics) const
+{
+	metrics.queries		= m_queries;
+	metrics.shardRuns	= m_shardRuns;
+	metrics.rows		= m_rows;
+	metrics.failures	= m_failures;
+	metrics.shardUs		= m_shardUs;
+}
+
+void IcuSqlite3ShardExecutor::Worker()
+{
+	for(;;) {
+		Task task;
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			m_wake.wait(guard, [this] { return m_stop || !m_tasks.empty(); });
+			if(m_stop) {
+				return;
+			}
+			task = m_tasks.front();
+			m_tasks.pop_front();
+		}
+		RunTask(task);
+	}
+}
+
+void IcuSqlite3ShardExecutor::Resume(
+	IcuSqlite3ShardJob* job, const int slot)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		for(std::deque<Task>::iterator it = m_parked.begin(); it != m_parked.end(); ++it) {
+			if(it->job.get() == job && it->slot == slot) {
+				m_tasks.push_back(*it);
+				m_parked.erase(it);
+				break;
+			}
+		}
+	}
+	m_wake.notify_one();
+}
+
+void IcuSqlite3ShardExecutor::RunTask(
+	Task& task)
+{
+	IcuSqlite3ShardJob& job = *task.job;
+	IcuSqlite3ShardJob::Part& part = job.parts[task.slot];
+	sqlite3* db = (sqlite3*)task.shard->db.GetDatabaseHandle();
+	sqlite3_stmt* stmt = (sqlite3_stmt*)task.stmt;
+
+	int rc = SQLITE_ROW;
+	if(nullptr == stmt) {
+		if(job.cancel) {
+			job.Finish(task.slot, SQLITE_INTERRUPT, "cancelled");
+			return;
+		}
+
+		stmt = task.shard->Acquire(job.sql, rc);
+		if(SQLITE_OK != rc || nullptr == stmt) {
+			sqlite3_finalize(stmt);
+			++m_failures;
+			job.Finish(task.slot, (SQLITE_OK != rc) ? sqlite3_extended_errcode(db) : SQLITE_MISUSE, 
+				(SQLITE_OK != rc) ? sqlite3_errmsg(db) : "empty statement");
+			return;
+		}
+
+		task.stmt = stmt;
+		job.Start(task.slot, stmt);
+		rc = job.Bind(stmt) ? SQLITE_ROW : sqlite3_extended_errcode(db);
+		++m_shardRuns;
+	}
+
+	//
+	//	Step a chunk at a time until done, or until the consumer is far
+	//	enough behind that the task is better off parked
+	//
+	const int64_t start = IcuSqlite3NowUs();
+	const int cols = sqlite3_column_count(stmt);
+	int64_t rows = 0;
+	bool parked = false;
+	while(SQLITE_ROW == rc) {
+		IcuSqlite3ShardJob::ChunkPtr chunk;
+		{
+			std::lock_guard<std::mutex> guard(job.lock);
+			if(job.cancel) {
+				rc = SQLITE_INTERRUPT;
+				break;
+			}
+			if(part.ready.size() >= ICUSQLITE_SHARD_QUEUED_CHUNKS) {
+				//	the consumer resumes it when it takes a chunk
+				part.parked = true;
+				std::lock_guard<std::mutex> parkGuard(m_lock);
+				m_parked.push_back(task);
+				parked = true;
+				break;
+			}
+			if(!part.spare.empty()) {
+				chunk = std::move(part.spare.back());
+				part.spare.pop_back();
+			}
+		}
+
+		if(nullptr == chunk.get()) {
+			chunk.reset(new IcuSqlite3Chunk(cols));
+		}
+		chunk->Reset(cols);		//	keeps capacity
+		chunk->Reserve(ICUSQLITE_SHARD_CHUNK_ROWS);
+
+		int n = 0;
+		while(n < ICUSQLITE_SHARD_CHUNK_ROWS && SQLITE_ROW == (rc = sqlite3_step(stmt))) {
+			chunk->AppendRow(stmt);
+			++n;
+		}
+		rows += n;
+		job.Push(task.slot, std::move(chunk));
+	}
+
+	m_rows		+= rows;
+	m_shardUs	+= IcuSqlite3NowUs() - start;
+	if(parked) {
+		return;
+	}
+
+	if(SQLITE_DONE == rc) {
+		rc = SQLITE_OK;
+	} else if(SQLITE_INTERRUPT != rc) {
+		rc = sqlite3_extended_errcode(db);
+	}
+
+	const std::string error = (SQLITE_OK == rc) ? std::string() : 
+		((SQLITE_INTERRUPT == rc) ? std::string("cancelled") : std::string(sqlite3_errmsg(db)));
+	task.shard->Release(job.sql, stmt);
+	task.stmt = nullptr;
+
+	if(SQLITE_OK != rc) {
+		++m_failures;
+	}
+	job.Finish(task.slot, rc, error);
+}
+
+void IcuSqlite3ShardExecutor::StopWorkers()
+{
+	std::vector<std::thread> workers;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stop = true;
+		workers.swap(m_workers);
+	}
+	m_wake.notify_all();
+
+	//	a task that is running parks or finishes first
+	for(size_t n = 0; n < workers.size(); ++n) {
+		workers[n].join();
+	}
+
+	std::deque<Task> orphans;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		orphans.swap(m_tasks);
+		orphans.insert(orphans.end(), m_parked.begin(), m_parked.end());
+		m_parked.clear();
+	}
+
+	//	anyone still waiting on these gets an error rather than a hang
+	for(size_t n = 0; n < orphans.size(); ++n) {
+		if(nullptr != orphans[n].stmt) {
+			orphans[n].shard->Release(orphans[n].job->sql, (sqlite3_stmt*)orphans[n].stmt);
+		}
+		orphans[n].job->Finish(orphans[n].slot, SQLITE_ABORT, "shard executor stopped");
+	}
+}
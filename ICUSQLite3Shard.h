@@ -0,0 +1,248 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_SHARD_H__
+#define __ICU_SQLITE3_SHARD_H__
+
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Params.h"
+
+//	STL
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum EIcuSqlite3ShardMerge {
+	//
+	//	Shard 0's rows, then shard 1's, ... each in the order its query
+	//	returned them
+	//
+	ICUSQLITE_SHARD_MERGE_CONCAT,
+
+	//
+	//	Each shard's query must already be sorted on orderBy (ORDER BY in
+	//	the SQL); the per-shard results are k-way merged on the same keys
+	//
+	ICUSQLITE_SHARD_MERGE_ORDERED,
+
+	//
+	//	Each shard returns partial aggregates grouped on its leading
+	//	groupColumns columns (GROUP BY in the SQL). Rows with equal keys
+	//	are combined column by column per aggregates[]; the result is
+	//	sorted on the group key. AVG isn't combinable - select SUM and
+	//	COUNT instead.
+	//
+	ICUSQLITE_SHARD_MERGE_AGGREGATE,
+};
+
+enum EIcuSqlite3ShardAggregate {
+	ICUSQLITE_SHARD_AGGREGATE_SUM,		//	also for COUNT / TOTAL partials
+	ICUSQLITE_SHARD_AGGREGATE_MIN,
+	ICUSQLITE_SHARD_AGGREGATE_MAX,
+	ICUSQLITE_SHARD_AGGREGATE_ANY,		//	first non-NULL value seen
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ShardSortKey
+{
+	IcuSqlite3ShardSortKey(const int column = 0, const bool descending = false);
+
+	int		column;
+	bool	descending;
+};
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ShardQuery
+{
+	IcuSqlite3ShardQuery();
+
+	EIcuSqlite3ShardMerge					merge;
+	std::vector<IcuSqlite3ShardSortKey>		orderBy;		//	ORDERED
+	int										groupColumns;	//	AGGREGATE: leading key columns
+	std::vector<EIcuSqlite3ShardAggregate>	aggregates;		//	AGGREGATE: per remaining column, missing = SUM
+	std::vector<int>						shards;			//	shard indexes to run on, empty = all
+};
+
+//
+//	Parameter values bound to every shard's statement
+//
+typedef IcuSqlite3QueryParams	IcuSqlite3ShardParams;
+
+struct ICUSQLITE_DLLIMPEXP IcuSqlite3ShardMetrics
+{
+	IcuSqlite3ShardMetrics();
+
+	int64_t		queries;
+	int64_t		shardRuns;		//	per shard executions
+	int64_t		rows;			//	rows returned by shards, before merging
+	int64_t		failures;		//	shard runs that failed
+	int64_t		shardUs;		//	summed shard execution time
+};
+
+struct IcuSqlite3ShardJob;
+class IcuSqlite3ShardExecutor;
+
+//
+//	Merged rows of one IcuSqlite3ShardExecutor::ExecuteQuery(). Reads
+//	like IcuSqlite3ResultSet: call NextRow() before the first row.
+//	NextRow() waits for the shards it needs; CONCAT hands out shard 0's
+//	rows while later shards still run, ORDERED starts once every shard
+//	has its first rows and AGGREGATE waits for all of them. Destroying
+//	the result cancels shard work still outstanding.
+//
+//	If any shard fails NextRow() returns false and IsOk() is false.
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3ShardResult
+{
+public:
+	IcuSqlite3ShardResult();
+	IcuSqlite3ShardResult(IcuSqlite3ShardResult&& result);
+	IcuSqlite3ShardResult& operator=(IcuSqlite3ShardResult&& result);
+	~IcuSqlite3ShardResult();
+
+	bool NextRow();
+	bool Eof() const;
+	bool IsOk() const;
+
+	int GetErrorCode() const;			//	SQLite (extended) result code of the first failure
+	std::string GetErrorMessage() const;
+
+	int GetColumnCount() const;
+	UnicodeString GetColumnName(const int colIdx) const;
+	EIcuSqlite3ColumnTypes GetColumnType(const int colIdx) const;
+
+	//
+	//	Shard the current row came from; -1 for AGGREGATE
+	//
+	int GetShard() const;
+
+	int32_t GetInt(const int colIdx, const int32_t defVal = 0) const;
+	int64_t GetInt64(const int colIdx, const int64_t defVal = 0) const;
+	double GetDouble(const int colIdx, const double defVal = 0.0) const;
+	UnicodeString GetString(const int colIdx, const UnicodeString& defVal = "") const;
+	std::string GetStringUTF8(const int colIdx, const std::string& defVal = "") const;
+	bool GetBool(const int colIdx, const bool defVal = false) const;
+	const unsigned char* GetBlob(const int colIdx, int& len) const;
+	bool IsNull(const int colIdx) const;
+
+private:
+	std::shared_ptr<IcuSqlite3ShardJob>	m_job;
+
+	explicit IcuSqlite3ShardResult(const std::shared_ptr<IcuSqlite3ShardJob>& job);
+
+	IcuSqlite3ShardResult(const IcuSqlite3ShardResult&);	//	prevent copy
+	IcuSqlite3ShardResult& operator=(const IcuSqlite3ShardResult&);	//	prevent assign
+
+	friend class IcuSqlite3ShardExecutor;
+};
+
+//
+//	Runs one query against many database files at once - e.g. one file
+//	per month, each query covering a range of months.
+//
+//	Each shard gets its own read-only connection, so shards are read in
+//	parallel instead of serially through ATTACHed schemas on one
+//	connection. A shard's statements stay prepared between queries. A
+//	pool of worker threads (one per core by default, never more than
+//	there are shards) runs the per-shard work. Each shard's rows are
+//	copied out a chunk at a time and merged on the calling thread; a
+//	shard that gets a few chunks ahead of the merge is parked, freeing
+//	its thread, until the merge catches up. Memory use depends on the
+//	number of shards, not on the size of their results.
+//
+//	Add shards before querying; ExecuteQuery() itself may be called from
+//	several threads. A shard runs one query at a time.
+//
+//		IcuSqlite3ShardExecutor shards;
+//		shards.AddShard("2024-01.db");
+//		shards.AddShard("2024-02.db");
+//
+//		IcuSqlite3ShardQuery query;
+//		query.merge			= ICUSQLITE_SHARD_MERGE_AGGREGATE;
+//		query.groupColumns	= 1;
+//		IcuSqlite3ShardResult rows = shards.ExecuteQuery(
+//			"SELECT region, SUM(amount), COUNT(*) FROM sales GROUP BY region;", query);
+//		while(rows.NextRow()) { ... }
+//
+class ICUSQLITE_DLLIMPEXP IcuSqlite3ShardExecutor
+{
+public:
+	explicit IcuSqlite3ShardExecutor(const int threads = 0);	//	0 = hardware concurrency
+	~IcuSqlite3ShardExecutor();
+
+	bool AddShard(const UnicodeString& filename,
+		const unsigned char* key = nullptr, const int keyLen = 0,
+		const IcuSqlite3OpenProfile& profile = IcuSqlite3OpenProfile());
+	int GetShardCount() const { return static_cast<int>(m_shards.size()); }
+	void RemoveAllShards();
+
+	IcuSqlite3ShardResult ExecuteQuery(const char* sql,
+		const IcuSqlite3ShardQuery& query = IcuSqlite3ShardQuery(),
+		const IcuSqlite3ShardParams& params = IcuSqlite3ShardParams());
+	IcuSqlite3ShardResult ExecuteQuery(const UnicodeString& sql,
+		const IcuSqlite3ShardQuery& query = IcuSqlite3ShardQuery(),
+		const IcuSqlite3ShardParams& params = IcuSqlite3ShardParams());
+
+	void GetMetrics(IcuSqlite3ShardMetrics& metrics) const;
+
+private:
+	struct Shard;
+	struct Task
+	{
+		std::shared_ptr<IcuSqlite3ShardJob>	job;
+		int									slot;	//	index into the job's parts
+		Shard*								shard;
+		void*								stmt;	//	sqlite3_stmt part way through, once started
+	};
+
+	std::vector<std::unique_ptr<Shard> >	m_shards;
+	int										m_maxThreads;
+
+	std::mutex								m_lock;
+	std::condition_variable					m_wake;
+	std::deque<Task>						m_tasks;
+	std::deque<Task>						m_parked;	//	waiting for the consumer to take a chunk
+	std::vector<std::thread>				m_workers;
+	bool									m_stop;
+
+	std::atomic<int64_t>					m_queries;
+	std::atomic<int64_t>					m_shardRuns;
+	std::atomic<int64_t>					m_rows;
+	std::atomic<int64_t>					m_failures;
+	std::atomic<int64_t>					m_shardUs;
+
+	void Worker();
+	void RunTask(Task& task);
+	void Resume(IcuSqlite3ShardJob* job, const int slot);
+	void StopWorkers();
+
+	friend struct IcuSqlite3ShardJob;
+
+	IcuSqlite3ShardExecutor(const IcuSqlite3ShardExecutor&);	//	prevent copy
+	IcuSqlite3ShardExecutor& operator=(const IcuSqlite3ShardExecutor&);	//	prevent assign
+};
+
+#endif	//	!__ICU_SQLITE3_SHARD_H__
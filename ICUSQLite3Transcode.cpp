@@ -0,0 +1,450 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#include "ICUSQLite3Transcode.h"
+
+//	SQLite3 and/or SQLite3 + ICU extensions
+#if defined(ICUSQLITE_HAVE_ICU_EXTENSIONS) && \
+	(!defined(SQLITE_AMALGAMATION) || SQLITE_AMALGAMATION==0) && \
+	!defined(ICUSQLITE_USING_AMALGAMATION)
+	#include "sqliteicu.h"
+#else	//	defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+	#include "sqlite3.h"
+#endif	//	!defined(ICUSQLITE_HAVE_ICU_EXTENSIONS)
+
+//	STL
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if ICUSQLITE_TRANSCODE_STATS
+	#include <atomic>
+	#include <chrono>
+#endif	//	ICUSQLITE_TRANSCODE_STATS
+
+#if defined(__AVX2__)
+	#define ICUSQLITE_HAVE_AVX2		1
+	#include <immintrin.h>
+#endif	//	defined(__AVX2__)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ICUSQLITE_HAVE_SSE2		1
+	#include <emmintrin.h>
+#endif	//	SSE2
+
+///////////////////////////////////////////////////////////////////////////////
+//	Statistics (ICUSQLITE_TRANSCODE_STATS builds only)
+///////////////////////////////////////////////////////////////////////////////
+#if ICUSQLITE_TRANSCODE_STATS
+static std::atomic<int64_t> s_toUtf8Calls(0);
+static std::atomic<int64_t> s_toUtf8Units(0);
+static std::atomic<int64_t> s_toUtf16Calls(0);
+static std::atomic<int64_t> s_toUtf16Bytes(0);
+static std::atomic<int64_t> s_transcodeNs(0);
+
+class IcuSqlite3TranscodeTimer
+{
+public:
+	IcuSqlite3TranscodeTimer() : m_start(std::chrono::steady_clock::now()) {}
+	~IcuSqlite3TranscodeTimer()
+	{
+		s_transcodeNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - m_start).count(), std::memory_order_relaxed);
+	}
+private:
+	std::chrono::steady_clock::time_point	m_start;
+};
+
+	#define ICUSQLITE_TRANSCODE_COUNT(calls, amount, n) \
+		calls.fetch_add(1, std::memory_order_relaxed); \
+		amount.fetch_add(n, std::memory_order_relaxed); \
+		IcuSqlite3TranscodeTimer transcodeTimer
+#else	//	ICUSQLITE_TRANSCODE_STATS
+	#define ICUSQLITE_TRANSCODE_COUNT(calls, amount, n)
+#endif	//	!ICUSQLITE_TRANSCODE_STATS
+
+/*static*/
+bool IcuSqlite3Database::GetTranscodeStats(
+	IcuSqlite3TranscodeStats& stats)
+{
+#if ICUSQLITE_TRANSCODE_STATS
+	stats.toUtf8Calls	= s_toUtf8Calls;
+	stats.toUtf8Units	= s_toUtf8Units;
+	stats.toUtf16Calls	= s_toUtf16Calls;
+	stats.toUtf16Bytes	= s_toUtf16Bytes;
+	stats.nanoseconds	= s_transcodeNs;
+	return true;
+#else	//	ICUSQLITE_TRANSCODE_STATS
+	stats = IcuSqlite3TranscodeStats();
+	return false;
+#endif	//	!ICUSQLITE_TRANSCODE_STATS
+}
+
+/*static*/
+void IcuSqlite3Database::ResetTranscodeStats()
+{
+#if ICUSQLITE_TRANSCODE_STATS
+	s_toUtf8Calls	= 0;
+	s_toUtf8Units	= 0;
+	s_toUtf16Calls	= 0;
+	s_toUtf16Bytes	= 0;
+	s_transcodeNs	= 0;
+#endif	//	ICUSQLITE_TRANSCODE_STATS
+}
+
+IcuSqlite3TranscodeStats::IcuSqlite3TranscodeStats()
+	: toUtf8Calls(0)
+	, toUtf8Units(0)
+	, toUtf16Calls(0)
+	, toUtf16Bytes(0)
+	, nanoseconds(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	UTF-16 -> UTF-8
+///////////////////////////////////////////////////////////////////////////////
+static int32_t IcuSqlite3Utf16Length(
+	const UChar* src)
+{
+	const UChar* p = src;
+	while(0 != *p) {
+		++p;
+	}
+	return static_cast<int32_t>(p - src);
+}
+
+int32_t IcuSqlite3Utf16ToUtf8(
+	const UChar* src, int32_t len, char* dst)
+{
+	if(len < 0) {
+		len = IcuSqlite3Utf16Length(src);
+	}
+	ICUSQLITE_TRANSCODE_COUNT(s_toUtf8Calls, s_toUtf8Units, len);
+
+	const UChar* p = src;
+	const UChar* end = src + len;
+	char* out = dst;
+
+	while(p < end) {
+		//
+		//	ASCII runs: narrow 32 / 16 units at a time
+		//
+#if ICUSQLITE_HAVE_AVX2
+		{
+			const __m256i highMask = _mm256_set1_epi16(static_cast<short>(0xff80));
+			while(end - p >= 32) {
+				const __m256i a = _mm256_loadu_si256((const __m256i*)p);
+				const __m256i b = _mm256_loadu_si256((const __m256i*)(p + 16));
+				if(!_mm256_testz_si256(_mm256_or_si256(a, b), highMask)) {
+					break;
+				}
+				//	packus interleaves the 128 bit lanes; put them back in order
+				const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+				_mm256_storeu_si256((__m256i*)out, packed);
+				p += 32;
+				out += 32;
+			}
+		}
+#endif	//	ICUSQLITE_HAVE_AVX2
+#if ICUSQLITE_HAVE_SSE2
+		{
+			const __m128i highMask = _mm_set1_epi16(static_cast<short>(0xff80));
+			const __m128i zero = _mm_setzero_si128();
+			while(end - p >= 16) {
+				const __m128i a = _mm_loadu_si128((const __m128i*)p);
+				const __m128i b = _mm_loadu_si128((const __m128i*)(p + 8));
+				const __m128i high = _mm_and_si128(_mm_or_si128(a, b), highMask);
+				if(0xffff != _mm_movemask_epi8(_mm_cmpeq_epi8(high, zero))) {
+					break;
+				}
+				_mm_storeu_si128((__m128i*)out, _mm_packus_epi16(a, b));
+				p += 16;
+				out += 16;
+			}
+		}
+#endif	//	ICUSQLITE_HAVE_SSE2
+
+		//
+		//	Scalar until the next ASCII character (or a short tail)
+		//
+		while(p < end) {
+			unsigned c = *p++;
+			if(c < 0x80) {
+				*out++ = static_cast<char>(c);
+				if(end - p >= 16) {
+					break;	//	back to the vector loop
+				}
+				continue;
+			}
+
+			if(c < 0x800) {
+				*out++ = static_cast<char>(0xc0 | (c >> 6));
+				*out++ = static_cast<char>(0x80 | (c & 0x3f));
+				continue;
+			}
+
+			if(c >= 0xd800 && c <= 0xdfff) {
+				if(c <= 0xdbff && p < end && *p >= 0xdc00 && *p <= 0xdfff) {
+					c = 0x10000 + ((c - 0xd800) << 10) + (*p++ - 0xdc00);
+					*out++ = static_cast<char>(0xf0 | (c >> 18));
+					*out++ = static_cast<char>(0x80 | ((c >> 12) & 0x3f));
+					*out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+					*out++ = static_cast<char>(0x80 | (c & 0x3f));
+					continue;
+				}
+				c = 0xfffd;	//	unpaired
+			}
+
+			*out++ = static_cast<char>(0xe0 | (c >> 12));
+			*out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+			*out++ = static_cast<char>(0x80 | (c & 0x3f));
+		}
+	}
+
+	return static_cast<int32_t>(out - dst);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	UTF-8 -> UTF-16
+///////////////////////////////////////////////////////////////////////////////
+int32_t IcuSqlite3Utf8ToUtf16(
+	const char* src, int32_t len, UChar* dst)
+{
+	if(len < 0) {
+		len = static_cast<int32_t>(strlen(src));
+	}
+	ICUSQLITE_TRANSCODE_COUNT(s_toUtf16Calls, s_toUtf16Bytes, len);
+
+	const unsigned char* p = (const unsigned char*)src;
+	const unsigned char* end = p + len;
+	UChar* out = dst;
+
+	while(p < end) {
+		//
+		//	ASCII runs: widen 32 / 16 bytes at a time
+		//
+#if ICUSQLITE_HAVE_AVX2
+		while(end - p >= 32) {
+			const __m256i x = _mm256_loadu_si256((const __m256i*)p);
+			if(0 != _mm256_movemask_epi8(x)) {
+				break;
+			}
+			_mm256_storeu_si256((__m256i*)out, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(x)));
+			_mm256_storeu_si256((__m256i*)(out + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(x, 1)));
+			p += 32;
+			out += 32;
+		}
+#endif	//	ICUSQLITE_HAVE_AVX2
+#if ICUSQLITE_HAVE_SSE2
+		{
+			const __m128i zero = _mm_setzero_si128();
+			while(end - p >= 16) {
+				const __m128i x = _mm_loadu_si128((const __m128i*)p);
+				if(0 != _mm_movemask_epi8(x)) {
+					break;
+				}
+				_mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(x, zero));
+				_mm_storeu_si128((__m128i*)(out + 8), _mm_unpackhi_epi8(x, zero));
+				p += 16;
+				out += 16;
+			}
+		}
+#endif	//	ICUSQLITE_HAVE_SSE2
+
+		while(p < end) {
+			const unsigned c = *p;
+			if(c < 0x80) {
+				*out++ = static_cast<UChar>(c);
+				++p;
+				if(end - p >= 16) {
+					break;
+				}
+				continue;
+			}
+
+			//
+			//	Multi-byte sequence; anything ill-formed is one U+FFFD per
+			//	maximal bad prefix
+			//
+			int trail;
+			unsigned lo = 0x80;
+			unsigned hi = 0xbf;
+			unsigned cp;
+			if(c >= 0xc2 && c <= 0xdf) {
+				trail = 1;
+				cp = c & 0x1f;
+			} else if(c >= 0xe0 && c <= 0xef) {
+				trail = 2;
+				cp = c & 0x0f;
+				if(0xe0 == c) {
+					lo = 0xa0;
+				} else if(0xed == c) {
+					hi = 0x9f;
+				}
+			} else if(c >= 0xf0 && c <= 0xf4) {
+				trail = 3;
+				cp = c & 0x07;
+				if(0xf0 == c) {
+					lo = 0x90;
+				} else if(0xf4 == c) {
+					hi = 0x8f;
+				}
+			} else {
+				*out++ = 0xfffd;
+				++p;
+				continue;
+			}
+
+			const unsigned char* s = p + 1;
+			bool ok = true;
+			for(int i = 0; i < trail; ++i, ++s) {
+				const unsigned t = (s < end) ? *s : 0;
+				if((0 == i && (t < lo || t > hi)) || (0 != i && 0x80 != (t & 0xc0))) {
+					ok = false;
+					break;
+				}
+				cp = (cp << 6) | (t & 0x3f);
+			}
+			p = s;
+
+			if(!ok) {
+				*out++ = 0xfffd;
+			} else if(cp >= 0x10000) {
+				cp -= 0x10000;
+				*out++ = static_cast<UChar>(0xd800 + (cp >> 10));
+				*out++ = static_cast<UChar>(0xdc00 + (cp & 0x3ff));
+			} else {
+				*out++ = static_cast<UChar>(cp);
+			}
+		}
+	}
+
+	return static_cast<int32_t>(out - dst);
+}
+
+UnicodeString IcuSqlite3FromUtf8(
+	const char* src, const int32_t len /*= -1*/)
+{
+	UnicodeString result;
+	if(nullptr == src) {
+		return result;
+	}
+
+	const int32_t srcLen = (len < 0) ? static_cast<int32_t>(strlen(src)) : len;
+	UChar* buf = result.getBuffer(ICUSQLITE_UTF16_CAPACITY(srcLen));
+	if(nullptr == buf) {
+		return result;	//	out of memory
+	}
+	result.releaseBuffer(IcuSqlite3Utf8ToUtf16(src, srcLen, buf));
+	return result;
+}
+
+std::string& IcuSqlite3ToUtf8(
+	const UnicodeString& src, std::string& dst)
+{
+	//
+	//	Like toUTF8String(), appends
+	//
+	const size_t start = dst.size();
+	dst.resize(start + ICUSQLITE_UTF8_CAPACITY(src.length()));
+	const int32_t len = IcuSqlite3Utf16ToUtf8(src.getBuffer(), src.length(), &dst[0] + start);
+	dst.resize(start + len);
+	return dst;
+}
+
+char* IcuSqlite3ToUtf8Malloc(
+	const UnicodeString& src, int32_t& len)
+{
+	char* buf = (char*)sqlite3_malloc64(ICUSQLITE_UTF8_CAPACITY(src.length()) + 1);
+	if(nullptr == buf) {
+		len = 0;
+		return nullptr;
+	}
+	len = IcuSqlite3Utf16ToUtf8(src.getBuffer(), src.length(), buf);
+	buf[len] = '\0';
+	return buf;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//	IcuSqlite3Utf8
+///////////////////////////////////////////////////////////////////////////////
+namespace {
+
+struct IcuSqlite3ScratchBuffer
+{
+	std::unique_ptr<char[]>	data;
+	size_t					capacity;
+};
+
+//
+//	Large one-offs (a multi megabyte SQL script, say) aren't worth keeping
+//	around per thread
+//
+const size_t	ICUSQLITE_SCRATCH_MAX_KEEP	= 1024 * 1024;
+const size_t	ICUSQLITE_SCRATCH_MAX_POOL	= 8;
+
+thread_local std::vector<std::unique_ptr<IcuSqlite3ScratchBuffer>> t_scratchPool;
+
+}	//	namespace
+
+IcuSqlite3Utf8::IcuSqlite3Utf8(
+	const UnicodeString& src)
+	: m_data(m_inline)
+	, m_len(0)
+	, m_pooled(nullptr)
+{
+	const size_t needed = ICUSQLITE_UTF8_CAPACITY(static_cast<size_t>(src.length())) + 1;
+	if(needed > sizeof(m_inline)) {
+		IcuSqlite3ScratchBuffer* scratch;
+		if(!t_scratchPool.empty()) {
+			scratch = t_scratchPool.back().release();
+			t_scratchPool.pop_back();
+		} else {
+			scratch = new IcuSqlite3ScratchBuffer();
+			scratch->capacity = 0;
+		}
+		if(scratch->capacity < needed) {
+			scratch->data.reset(new char[needed]);
+			scratch->capacity = needed;
+		}
+		m_pooled	= scratch;
+		m_data		= scratch->data.get();
+	}
+
+	m_len = IcuSqlite3Utf16ToUtf8(src.getBuffer(), src.length(), m_data);
+	m_data[m_len] = '\0';
+}
+
+IcuSqlite3Utf8::~IcuSqlite3Utf8()
+{
+	if(nullptr != m_pooled) {
+		IcuSqlite3ScratchBuffer* scratch = static_cast<IcuSqlite3ScratchBuffer*>(m_pooled);
+		if(scratch->capacity <= ICUSQLITE_SCRATCH_MAX_KEEP &&
+			t_scratchPool.size() < ICUSQLITE_SCRATCH_MAX_POOL)
+		{
+			t_scratchPool.push_back(std::unique_ptr<IcuSqlite3ScratchBuffer>(scratch));
+		} else {
+			delete scratch;
+		}
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_TRANSCODE_H__
+#define __ICU_SQLITE3_TRANSCODE_H__
+
+//
+//	Internal: UTF-8 <-> UTF-16 conversion for every string crossing the
+//	API, not part of the public API.
+//
+//	Both directions copy runs of ASCII 16 / 32 characters at a time (SSE2 /
+//	AVX2, whichever the build targets) and drop to a scalar loop for
+//	anything else. Ill-formed input (unpaired surrogates, bad UTF-8) becomes
+//	U+FFFD, as with UnicodeString::toUTF8String() / fromUTF8().
+//
+
+#include "ICUSQLite3.h"
+
+//
+//	Worst case output sizes
+//
+#define ICUSQLITE_UTF8_CAPACITY(utf16Len)	((utf16Len) * 3)
+#define ICUSQLITE_UTF16_CAPACITY(utf8Len)	(utf8Len)
+
+//
+//	Convert |len| units / bytes (-1 = NUL terminated) into |dst|, which
+//	must have room for the worst case. Returns the output length; no NUL
+//	is written.
+//
+int32_t IcuSqlite3Utf16ToUtf8(const UChar* src, int32_t len, char* dst);
+int32_t IcuSqlite3Utf8ToUtf16(const char* src, int32_t len, UChar* dst);
+
+//
+//	Drop in replacements for UnicodeString::fromUTF8() / toUTF8String()
+//
+UnicodeString IcuSqlite3FromUtf8(const char* src, const int32_t len = -1);
+std::string& IcuSqlite3ToUtf8(const UnicodeString& src, std::string& dst);
+
+//
+//	sqlite3_malloc()ed UTF-8 copy, for handing to SQLite with sqlite3_free
+//	as the destructor. Returns nullptr if out of memory.
+//
+char* IcuSqlite3ToUtf8Malloc(const UnicodeString& src, int32_t& len);
+
+//
+//	Short lived UTF-8 view of a UnicodeString, NUL terminated. Short
+//	strings convert into inline storage; longer ones borrow a buffer from a
+//	per-thread pool, so steady state conversions don't allocate.
+//
+//		IcuSqlite3Utf8 utf8Name(name);
+//		sqlite3_bind_parameter_index(stmt, utf8Name);
+//
+class IcuSqlite3Utf8
+{
+public:
+	explicit IcuSqlite3Utf8(const UnicodeString& src);
+	~IcuSqlite3Utf8();
+
+	const char* c_str() const { return m_data; }
+	int32_t length() const { return m_len; }
+	operator const char*() const { return m_data; }
+
+private:
+	enum { ICUSQLITE_UTF8_INLINE = 256 };
+
+	char*		m_data;
+	int32_t		m_len;
+	void*		m_pooled;		//	buffer borrowed from the thread's pool, if any
+	char		m_inline[ICUSQLITE_UTF8_INLINE];
+
+	IcuSqlite3Utf8(const IcuSqlite3Utf8&);
+	IcuSqlite3Utf8& operator=(const IcuSqlite3Utf8&);
+};
+
+#endif	//	!__ICU_SQLITE3_TRANSCODE_H__
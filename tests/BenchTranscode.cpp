@@ -0,0 +1,173 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Transcoding microbenchmark. Not a pass / fail test.
+//
+//	Part one times IcuSqlite3Utf16ToUtf8() / IcuSqlite3Utf8ToUtf16()
+//	against UnicodeString::toUTF8String() / fromUTF8() on ASCII, Latin-1 and
+//	CJK text. Part two runs an insert / select workload; in a build with
+//	ICUSQLITE_TRANSCODE_STATS=1 it also reports how much of that time went
+//	into transcoding.
+//
+//		g++ -std=c++11 -O2 -DICUSQLITE_TRANSCODE_STATS=1 -I.. BenchTranscode.cpp
+//			../ICUSQLite3*.cpp -lsqlite3 -licui18n -licuuc -licudata -lpthread
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Transcode.h"
+
+//	STL
+#include <chrono>
+#include <string>
+#include <vector>
+
+static int64_t BenchNowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//
+//	Keeps the optimizer from dropping a result
+//
+static volatile int64_t g_sink = 0;
+
+static void BenchConvert(const char* label, const UnicodeString& text, const int iterations)
+{
+	std::string icuUtf8;
+	text.toUTF8String(icuUtf8);
+
+	std::vector<char> utf8(ICUSQLITE_UTF8_CAPACITY(text.length()));
+	std::vector<UChar> utf16(ICUSQLITE_UTF16_CAPACITY(icuUtf8.size()));
+
+	int64_t start = BenchNowNs();
+	for(int n = 0; n < iterations; ++n) {
+		std::string s;
+		text.toUTF8String(s);
+		g_sink = g_sink + (int64_t)s.size();
+	}
+	const int64_t icuTo8 = BenchNowNs() - start;
+
+	start = BenchNowNs();
+	for(int n = 0; n < iterations; ++n) {
+		g_sink = g_sink + IcuSqlite3Utf16ToUtf8(text.getBuffer(), text.length(), &utf8[0]);
+	}
+	const int64_t ownTo8 = BenchNowNs() - start;
+
+	start = BenchNowNs();
+	for(int n = 0; n < iterations; ++n) {
+		g_sink = g_sink + UnicodeString::fromUTF8(icuUtf8).length();
+	}
+	const int64_t icuTo16 = BenchNowNs() - start;
+
+	start = BenchNowNs();
+	for(int n = 0; n < iterations; ++n) {
+		g_sink = g_sink + IcuSqlite3Utf8ToUtf16(icuUtf8.data(), (int32_t)icuUtf8.size(), &utf16[0]);
+	}
+	const int64_t ownTo16 = BenchNowNs() - start;
+
+	const double units = (double)text.length() * iterations;
+	printf("%-8s to UTF-8: ICU %6.2f ns/unit, ICUSQLite3 %6.2f ns/unit   "
+		"to UTF-16: ICU %6.2f ns/unit, ICUSQLite3 %6.2f ns/unit\n",
+		label, icuTo8 / units, ownTo8 / units, icuTo16 / units, ownTo16 / units);
+}
+
+static UnicodeString BenchRepeat(const char* utf8, const int32_t length)
+{
+	const UnicodeString unit = UnicodeString::fromUTF8(utf8);
+	UnicodeString text;
+	while(text.length() < length) {
+		text += unit;
+	}
+	return text;
+}
+
+static void BenchWorkload(const int rows)
+{
+	static const char* const filename = "bench-transcode.db";
+	IcuSqlite3TestRemoveDb(filename);
+
+	IcuSqlite3Database db;
+	if(!db.Open(filename)) {
+		fprintf(stderr, "can't open %s\n", filename);
+		return;
+	}
+	db.ExecuteUpdate("CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT, note TEXT)");
+	IcuSqlite3Database::ResetTranscodeStats();
+
+	int64_t start = BenchNowNs();
+	db.Begin();
+	IcuSqlite3Statement insert = db.PrepareStatement(
+		UnicodeString("INSERT INTO t (name, note) VALUES (?, ?)"));
+	const UnicodeString note = BenchRepeat("Zürich \xE6\x9D\xB1\xE4\xBA\xAC ", 64);
+	for(int n = 0; n < rows; ++n) {
+		UnicodeString name("customer ");
+		name += UnicodeString::fromUTF8(std::to_string(n));
+		insert.Bind(1, name);
+		insert.Bind(2, note);
+		insert.ExecuteUpdate();
+		insert.Reset();
+	}
+	insert.Finalize();
+	db.Commit();
+	const int64_t insertNs = BenchNowNs() - start;
+
+	start = BenchNowNs();
+	IcuSqlite3ResultSet rs = db.ExecuteQuery(UnicodeString("SELECT name, note FROM t"));
+	while(rs.NextRow()) {
+		g_sink = g_sink + rs.GetString(0).length() + rs.GetString(1).length();
+	}
+	rs.Finalize();
+	const int64_t selectNs = BenchNowNs() - start;
+
+	printf("workload: %d rows, insert %.1f ms, select %.1f ms\n", 
+		rows, insertNs / 1e6, selectNs / 1e6);
+
+	IcuSqlite3TranscodeStats stats;
+	if(IcuSqlite3Database::GetTranscodeStats(stats)) {
+		printf("transcoding: %lld to UTF-8 (%lld units), %lld to UTF-16 (%lld bytes), "
+			"%.1f ms = %.1f%% of the workload\n",
+			(long long)stats.toUtf8Calls, (long long)stats.toUtf8Units,
+			(long long)stats.toUtf16Calls, (long long)stats.toUtf16Bytes,
+			stats.nanoseconds / 1e6, 100.0 * stats.nanoseconds / (insertNs + selectNs));
+	} else {
+		printf("transcoding: not collected, build with ICUSQLITE_TRANSCODE_STATS=1\n");
+	}
+
+	db.Close();
+	IcuSqlite3TestRemoveDb(filename);
+}
+
+int main(int argc, char** argv)
+{
+	const int iterations = (argc > 1) ? atoi(argv[1]) : 20000;
+
+	BenchConvert("ASCII", BenchRepeat("SELECT name FROM customers WHERE id = ?; ", 256), iterations);
+	BenchConvert("Latin-1", BenchRepeat("Gr\xC3\xBC\xC3\x9F" "e aus M\xC3\xBCnchen, ", 256), iterations);
+	BenchConvert("CJK", BenchRepeat("\xE6\x9D\xB1\xE4\xBA\xAC\xE9\x83\xBD", 256), iterations);
+
+	BenchWorkload(iterations);
+	return (int)(g_sink & 0);
+}
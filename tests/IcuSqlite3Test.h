@@ -0,0 +1,73 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+#ifndef __ICU_SQLITE3_TEST_H__
+#define __ICU_SQLITE3_TEST_H__
+
+//
+//	Minimal harness for the regression tests in this directory. Each
+//	Test*.cpp is a standalone program; build it against the library
+//	sources, e.g.
+//
+//		g++ -std=c++11 -I.. TestOpenClose.cpp ../ICUSQLite3*.cpp
+//			-lsqlite3 -licui18n -licuuc -licudata -lpthread
+//
+//	and run it from a writable directory. Exit status is the number of
+//	failed checks.
+//
+
+//	STL
+#include <cstdio>
+#include <cstdlib>
+
+static int g_icuSqlite3TestFailures = 0;
+
+#define ICUSQLITE_TEST_CHECK(cond) \
+	do { \
+		if(!(cond)) { \
+			++g_icuSqlite3TestFailures; \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while(0)
+
+//
+//	Removes a database file and its -wal / -shm / -journal siblings
+//
+static inline void IcuSqlite3TestRemoveDb(const char* filename)
+{
+	static const char* const suffixes[] = { "", "-wal", "-shm", "-journal" };
+	for(size_t n = 0; n < sizeof(suffixes) / sizeof(suffixes[0]); ++n) {
+		char path[1024];
+		snprintf(path, sizeof(path), "%s%s", filename, suffixes[n]);
+		remove(path);
+	}
+}
+
+static inline int IcuSqlite3TestResult(const char* name)
+{
+	fprintf(stderr, "%s: %s (%d failed)\n", name, 
+		(0 == g_icuSqlite3TestFailures) ? "ok" : "FAILED", g_icuSqlite3TestFailures);
+	return g_icuSqlite3TestFailures;
+}
+
+#endif	//	!__ICU_SQLITE3_TEST_H__
@@ -0,0 +1,136 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Admission control with nested statements and a user trace
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//	STL
+#include <string>
+
+static const char* const g_outerSql = 
+	"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 1000000) "
+	"SELECT sum(lookup(i)) FROM n;";
+
+//
+//	A statement run from a user function gets its own budget; it doesn't
+//	reset the budget of the statement calling it
+//
+static void TestNestedStatement()
+{
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:"));
+
+	IcuSqlite3Database* conn = &db;
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<int64_t(int64_t)>("lookup", [conn](int64_t i) -> int64_t {
+		if(0 != i % 50) {
+			return 1;
+		}
+		int64_t value = 0;
+		conn->ExecuteScalar("SELECT 1;", value);
+		return value;
+	}));
+
+	IcuSqlite3AdmissionPolicy policy;
+	policy.maxSteps			= 100000;
+	policy.checkInterval	= 100;
+	ICUSQLITE_TEST_CHECK(db.SetAdmissionPolicy(policy));
+
+	int64_t sum = 0;
+	ICUSQLITE_TEST_CHECK(!db.ExecuteScalar(g_outerSql, sum));
+
+	IcuSqlite3AdmissionMetrics metrics;
+	ICUSQLITE_TEST_CHECK(db.GetAdmissionMetrics(metrics));
+	ICUSQLITE_TEST_CHECK(1 == metrics.stepCutoffs);
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ADMISSION_CUTOFF_STEPS == metrics.lastCutoff);
+	ICUSQLITE_TEST_CHECK(std::string(g_outerSql) == metrics.lastCutoffSql);
+	ICUSQLITE_TEST_CHECK(metrics.statements > 1);
+
+	db.Close();
+}
+
+class CountingTracer : public IcuSqlite3Tracer
+{
+public:
+	explicit CountingTracer(int& statements) : m_statements(statements) {}
+
+	virtual void Trace(const EIcuSqlite3TraceEvent event, void*, void*)
+	{
+		if(ICUSQLITE_TRACE_STMT == event) {
+			++m_statements;
+		}
+	}
+
+private:
+	int&	m_statements;
+};
+
+//
+//	The tracer keeps getting its events while admission control shares
+//	the trace hook, and after it is removed again
+//
+static void TestTracerChained()
+{
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:"));
+
+	int statements = 0;
+	ICUSQLITE_TEST_CHECK(db.SetTracer(new CountingTracer(statements), ICUSQLITE_TRACE_STMT));
+
+	int64_t value = 0;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT 1;", value));
+	ICUSQLITE_TEST_CHECK(1 == statements);
+
+	IcuSqlite3AdmissionPolicy policy;
+	policy.maxSteps = 1000000;
+	ICUSQLITE_TEST_CHECK(db.SetAdmissionPolicy(policy));
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT 2;", value));
+	ICUSQLITE_TEST_CHECK(2 == statements);
+
+	//	replaced while admission control holds the hook
+	int replaced = 0;
+	ICUSQLITE_TEST_CHECK(db.SetTracer(new CountingTracer(replaced), ICUSQLITE_TRACE_STMT));
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT 3;", value));
+	ICUSQLITE_TEST_CHECK(2 == statements);
+	ICUSQLITE_TEST_CHECK(1 == replaced);
+
+	db.ClearAdmissionPolicy();
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT 4;", value));
+	ICUSQLITE_TEST_CHECK(2 == replaced);
+
+	ICUSQLITE_TEST_CHECK(db.SetTracer(nullptr, 0));
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT 5;", value));
+	ICUSQLITE_TEST_CHECK(2 == replaced);
+
+	db.Close();
+}
+
+int main()
+{
+	TestNestedStatement();
+	TestTracerChained();
+	return IcuSqlite3TestResult("TestAdmission");
+}
@@ -0,0 +1,136 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Per group aggregate state and window functions
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+struct IcuSqlite3TestSumState
+{
+	IcuSqlite3TestSumState() : sum(0), rows(0) {}
+
+	int64_t	sum;
+	int64_t	rows;
+};
+
+//
+//	sum(x) * 1000 + count(x), kept per group
+//
+class IcuSqlite3TestSum : public IcuSqlite3WindowFunction
+{
+public:
+	IcuSqlite3TestSum() : m_inverses(0) {}
+
+	virtual void Step(IcuSqlite3FunctionContext* pContext)
+	{
+		IcuSqlite3TestSumState* state = pContext->GetAggregateState<IcuSqlite3TestSumState>();
+		state->sum += pContext->GetArgAsInt64(0);
+		++state->rows;
+	}
+
+	virtual void Inverse(IcuSqlite3FunctionContext* pContext)
+	{
+		IcuSqlite3TestSumState* state = pContext->GetAggregateState<IcuSqlite3TestSumState>();
+		state->sum -= pContext->GetArgAsInt64(0);
+		--state->rows;
+		++m_inverses;
+	}
+
+	virtual void Value(IcuSqlite3FunctionContext* pContext)
+	{
+		IcuSqlite3TestSumState* state = pContext->GetAggregateState<IcuSqlite3TestSumState>();
+		pContext->SetResult(static_cast<int64_t>(state->sum * 1000 + state->rows));
+	}
+
+	virtual void Finalize(IcuSqlite3FunctionContext* pContext)
+	{
+		//	a group with no rows never allocated state
+		if(nullptr == pContext->GetAggregateContext(0)) {
+			pContext->SetResult(static_cast<int64_t>(0));
+			return;
+		}
+		Value(pContext);
+		pContext->ReleaseAggregateState<IcuSqlite3TestSumState>();
+	}
+
+	int64_t	m_inverses;
+};
+
+static void TestGroups(IcuSqlite3Database& db)
+{
+	ICUSQLITE_TEST_CHECK(db.CreateAggregateFunction("tsum", 1, new IcuSqlite3TestSum()));
+
+	//	interleaved groups each keep their own running state
+	IcuSqlite3ResultSet rs = db.ExecuteQuery(
+		"SELECT g, tsum(x) FROM t GROUP BY g ORDER BY g;");
+	ICUSQLITE_TEST_CHECK(rs.NextRow());
+	ICUSQLITE_TEST_CHECK(1 == rs.GetInt64(0));
+	ICUSQLITE_TEST_CHECK(9 * 1000 + 3 == rs.GetInt64(1));		//	1 + 3 + 5
+	ICUSQLITE_TEST_CHECK(rs.NextRow());
+	ICUSQLITE_TEST_CHECK(2 == rs.GetInt64(0));
+	ICUSQLITE_TEST_CHECK(6 * 1000 + 2 == rs.GetInt64(1));		//	2 + 4
+	ICUSQLITE_TEST_CHECK(!rs.NextRow());
+
+	int64_t value = -1;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT tsum(x) FROM t WHERE 0;", value));
+	ICUSQLITE_TEST_CHECK(0 == value);
+}
+
+static void TestWindow(IcuSqlite3Database& db)
+{
+	IcuSqlite3TestSum* func = new IcuSqlite3TestSum();
+	if(!db.CreateWindowFunction("wsum", 1, func)) {
+		return;	//	SQLite older than 3.25
+	}
+
+	//	a two row frame sliding over x = 1..5
+	IcuSqlite3ResultSet rs = db.ExecuteQuery(
+		"SELECT wsum(x) OVER (ORDER BY x ROWS BETWEEN 1 PRECEDING AND CURRENT ROW) FROM t ORDER BY x;");
+	const int64_t expected[] = { 1001, 3002, 5002, 7002, 9002 };
+	for(size_t row = 0; row < sizeof(expected) / sizeof(expected[0]); ++row) {
+		ICUSQLITE_TEST_CHECK(rs.NextRow());
+		ICUSQLITE_TEST_CHECK(expected[row] == rs.GetInt64(0));
+	}
+	ICUSQLITE_TEST_CHECK(!rs.NextRow());
+	rs.Finalize();
+
+	ICUSQLITE_TEST_CHECK(3 == func->m_inverses);
+}
+
+int main()
+{
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (g INTEGER, x INTEGER);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate(
+		"INSERT INTO t VALUES (1, 1), (2, 2), (1, 3), (2, 4), (1, 5);"));
+
+	TestGroups(db);
+	TestWindow(db);
+	db.Close();
+
+	return IcuSqlite3TestResult("TestAggregate");
+}
@@ -0,0 +1,187 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Async worker / generator lifetimes. The coroutine checks need a C++20
+//	build (-std=c++20).
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Async.h"
+
+//	STL
+#include <chrono>
+#include <deque>
+
+//
+//	Stop() from a task defers the join: the destructor (or a Start()) on
+//	another thread waits for the worker to wind down
+//
+static void TestStopFromWorker()
+{
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:"));
+
+	std::promise<void> stopped;
+	std::future<void> wait = stopped.get_future();
+	{
+		IcuSqlite3AsyncWorker worker(db);
+		ICUSQLITE_TEST_CHECK(worker.Start());
+		ICUSQLITE_TEST_CHECK(worker.Post([&worker, &stopped] {
+			worker.Stop();
+			stopped.set_value();
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}));
+		wait.get();
+	}	//	joins here
+
+	{
+		IcuSqlite3AsyncWorker worker(db);
+		ICUSQLITE_TEST_CHECK(worker.Start());
+		ICUSQLITE_TEST_CHECK(worker.Post([&worker] { worker.Stop(); }));
+		ICUSQLITE_TEST_CHECK(worker.Start());	//	joins, then restarts
+
+		std::promise<int> ran;
+		std::future<int> result = ran.get_future();
+		ICUSQLITE_TEST_CHECK(worker.Post([&ran] { ran.set_value(1); }));
+		ICUSQLITE_TEST_CHECK(1 == result.get());
+		worker.Stop();
+		ICUSQLITE_TEST_CHECK(!worker.IsRunning());
+	}
+
+	db.Close();
+}
+
+#if defined(ICUSQLITE_HAVE_COROUTINES)
+
+struct TestTask
+{
+	struct promise_type
+	{
+		TestTask get_return_object() { return TestTask { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+		std::suspend_never initial_suspend() const noexcept { return std::suspend_never(); }
+		std::suspend_always final_suspend() const noexcept { return std::suspend_always(); }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type>	handle;
+};
+
+static TestTask Consume(IcuSqlite3AsyncGenerator<IcuSqlite3AsyncRows>& rows, int& blocks)
+{
+	//	not while(co_await ...): g++ 12 can't destroy a coroutine suspended there
+	for(;;) {
+		const bool more = co_await rows.Next();
+		if(!more) {
+			break;
+		}
+		++blocks;
+	}
+}
+
+//
+//	Dropping a generator while its next step is queued, running or waiting
+//	to be resumed neither writes into nor resumes the destroyed coroutine
+//
+static void TestDropGeneratorMidCall()
+{
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:"));
+
+	std::mutex lock;
+	std::deque<std::function<void()>> completions;
+
+	IcuSqlite3AsyncDatabase async(db);
+	async.SetResumeDispatcher([&lock, &completions](std::function<void()> completion) {
+		std::lock_guard<std::mutex> guard(lock);
+		completions.push_back(std::move(completion));
+	});
+	ICUSQLITE_TEST_CHECK(async.Start());
+
+	//
+	//	Runs queued completions until |blocks| have been consumed
+	//
+	auto pump = [&lock, &completions](const int& blocks, const int until) {
+		while(blocks < until) {
+			std::function<void()> completion;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if(!completions.empty()) {
+					completion = std::move(completions.front());
+					completions.pop_front();
+				}
+			}
+			if(completion) {
+				completion();
+			} else {
+				std::this_thread::yield();
+			}
+		}
+	};
+
+	for(int dropAfter = 0; dropAfter < 4; ++dropAfter) {
+		int blocks = 0;
+		TestTask consumer;
+		{
+			IcuSqlite3AsyncGenerator<IcuSqlite3AsyncRows> rows = async.ExecuteQuery(
+				"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 100000) "
+				"SELECT i, 'row ' || i FROM n;", 64);
+			consumer = Consume(rows, blocks);
+			pump(blocks, dropAfter);
+			consumer.handle.destroy();
+		}	//	generator dropped with a call in flight
+
+		//	drain the worker, then the completions it left behind
+		async.Stop();
+		for(;;) {
+			std::function<void()> completion;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if(completions.empty()) {
+					break;
+				}
+				completion = std::move(completions.front());
+				completions.pop_front();
+			}
+			completion();
+		}
+		ICUSQLITE_TEST_CHECK(dropAfter == blocks);
+		ICUSQLITE_TEST_CHECK(async.Start());
+	}
+
+	async.Stop();
+	db.Close();
+}
+
+#endif	//	defined(ICUSQLITE_HAVE_COROUTINES)
+
+int main()
+{
+	TestStopFromWorker();
+#if defined(ICUSQLITE_HAVE_COROUTINES)
+	TestDropGeneratorMidCall();
+#endif	//	defined(ICUSQLITE_HAVE_COROUTINES)
+	return IcuSqlite3TestResult("TestAsync");
+}
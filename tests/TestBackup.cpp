@@ -0,0 +1,173 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	IcuSqlite3BackupJob: stepped and asynchronous copies, and closing the
+//	connection under a job that is still running
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Backup.h"
+
+//	STL
+#include <atomic>
+
+class TestProgress : public IcuSqlite3BackupProgress
+{
+public:
+	TestProgress() : m_calls(0) {}
+
+	virtual bool OnProgress(const int /*remainingPages*/, const int /*totalPages*/)
+	{
+		++m_calls;
+		return true;
+	}
+
+	int GetCalls() const { return m_calls; }
+
+private:
+	std::atomic<int>	m_calls;
+};
+
+static void Fill(IcuSqlite3Database& db)
+{
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate(
+		"CREATE TABLE t (a INTEGER PRIMARY KEY, b BLOB);"
+		"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 200) "
+		"INSERT INTO t SELECT i, zeroblob(2000) FROM n;"));
+}
+
+static int64_t Count(const char* filename)
+{
+	IcuSqlite3Database db;
+	int64_t count = -1;
+	ICUSQLITE_TEST_CHECK(db.Open(filename));
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT count(*) FROM t;", count));
+	return count;
+}
+
+//
+//	Driven by Step() on this thread, one page at a time
+//
+static void TestStepped(IcuSqlite3Database& db)
+{
+	IcuSqlite3TestRemoveDb("test-backup-copy.db");
+
+	IcuSqlite3BackupOptions options;
+	options.pagesPerStep = 1;
+
+	IcuSqlite3BackupJob job(db);
+	ICUSQLITE_TEST_CHECK(job.BeginBackup("test-backup-copy.db", options));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_BACKUP_STATE_READY == job.GetState());
+
+	int steps = 0;
+	while(job.Step()) {
+		++steps;
+	}
+	ICUSQLITE_TEST_CHECK(steps > 1);
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_BACKUP_STATE_DONE == job.GetState());
+	ICUSQLITE_TEST_CHECK(1.0 == job.GetProgress());
+	ICUSQLITE_TEST_CHECK(200 == Count("test-backup-copy.db"));
+}
+
+static void TestAsync(IcuSqlite3Database& db)
+{
+	IcuSqlite3TestRemoveDb("test-backup-copy.db");
+
+	TestProgress progress;
+	IcuSqlite3BackupOptions options;
+	options.pagesPerStep	= 16;
+	options.progress		= &progress;
+
+	IcuSqlite3BackupJob job(db);
+	ICUSQLITE_TEST_CHECK(job.BeginBackup("test-backup-copy.db", options));
+	ICUSQLITE_TEST_CHECK(job.RunAsync());
+	ICUSQLITE_TEST_CHECK(!job.Step());	//	the thread owns it now
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_BACKUP_STATE_DONE == job.Wait());
+	ICUSQLITE_TEST_CHECK(progress.GetCalls() > 0);
+	ICUSQLITE_TEST_CHECK(200 == Count("test-backup-copy.db"));
+}
+
+//
+//	Close() cancels jobs still holding the connection: a slow asynchronous
+//	one (its thread stops stepping) and a begun, never stepped one
+//
+static void TestCloseCancels()
+{
+	IcuSqlite3TestRemoveDb("test-backup-copy.db");
+	IcuSqlite3TestRemoveDb("test-backup-copy2.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-backup.db"));
+
+	TestProgress progress;
+	IcuSqlite3BackupOptions options;
+	options.pagesPerStep	= 1;
+	options.sleepMs			= 20;
+	options.progress		= &progress;
+
+	IcuSqlite3BackupJob running(db);
+	IcuSqlite3BackupJob idle(db);
+	ICUSQLITE_TEST_CHECK(running.BeginBackup("test-backup-copy.db", options));
+	ICUSQLITE_TEST_CHECK(idle.BeginBackup("test-backup-copy2.db"));
+	ICUSQLITE_TEST_CHECK(running.RunAsync());
+
+	db.Close();
+	ICUSQLITE_TEST_CHECK(!db.IsOpen());
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_BACKUP_STATE_CANCELLED == running.GetState());
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_BACKUP_STATE_CANCELLED == idle.GetState());
+	ICUSQLITE_TEST_CHECK(!idle.Step());
+
+	const int calls = progress.GetCalls();
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_BACKUP_STATE_CANCELLED == running.Wait());
+	ICUSQLITE_TEST_CHECK(calls == progress.GetCalls());
+
+	//	reopened fine, and the jobs outliving the close is harmless
+	ICUSQLITE_TEST_CHECK(db.Open("test-backup.db"));
+	int64_t count = -1;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT count(*) FROM t;", count));
+	ICUSQLITE_TEST_CHECK(200 == count);
+	db.Close();
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-backup.db");
+
+	{
+		IcuSqlite3Database db;
+		ICUSQLITE_TEST_CHECK(db.Open("test-backup.db"));
+		Fill(db);
+
+		TestStepped(db);
+		TestAsync(db);
+		db.Close();
+	}
+	TestCloseCancels();
+
+	IcuSqlite3TestRemoveDb("test-backup.db");
+	IcuSqlite3TestRemoveDb("test-backup-copy.db");
+	IcuSqlite3TestRemoveDb("test-backup-copy2.db");
+	return IcuSqlite3TestResult("TestBackup");
+}
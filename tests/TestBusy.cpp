@@ -0,0 +1,185 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Busy handling: SetBusyTimeout(), the backoff policy, IcuSqlite3BusyBudget
+//	and the lock-wait metrics
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//	STL
+#include <chrono>
+#include <thread>
+
+static IcuSqlite3BusyMetrics Metrics(IcuSqlite3Database& db)
+{
+	IcuSqlite3BusyMetrics metrics;
+	ICUSQLITE_TEST_CHECK(db.GetBusyMetrics(metrics));
+	return metrics;
+}
+
+static bool TryInsert(IcuSqlite3Database& db)
+{
+	return 1 == db.ExecuteUpdate("INSERT INTO t VALUES (1);");
+}
+
+//
+//	As with sqlite3_busy_timeout(), a negative timeout doesn't wait
+//
+static void TestTimeout(IcuSqlite3Database& db)
+{
+	ICUSQLITE_TEST_CHECK(db.SetBusyTimeout(-1));
+	ICUSQLITE_TEST_CHECK(0 == db.GetBusyTimeout());
+	ICUSQLITE_TEST_CHECK(db.SetBusyTimeout(0));
+	ICUSQLITE_TEST_CHECK(0 == db.GetBusyTimeout());
+
+	db.ResetBusyMetrics();
+	ICUSQLITE_TEST_CHECK(!TryInsert(db));
+	IcuSqlite3BusyMetrics metrics = Metrics(db);
+	ICUSQLITE_TEST_CHECK(1 == metrics.busyEvents);
+	ICUSQLITE_TEST_CHECK(0 == metrics.retries);
+	ICUSQLITE_TEST_CHECK(1 == metrics.timeouts);
+	ICUSQLITE_TEST_CHECK(0 == metrics.budgetCutoffs);
+
+	ICUSQLITE_TEST_CHECK(db.SetBusyTimeout(1500));
+	ICUSQLITE_TEST_CHECK(1500 == db.GetBusyTimeout());
+	ICUSQLITE_TEST_CHECK(1500 == db.GetBusyPolicy().timeoutMs);
+}
+
+//
+//	Backoff until the policy's timeout, or its retry cap
+//
+static void TestBackoff(IcuSqlite3Database& db)
+{
+	IcuSqlite3BusyPolicy policy;
+	policy.timeoutMs		= 60;
+	policy.initialDelayMs	= 1;
+	policy.maxDelayMs		= 8;
+	policy.jitter			= 0.0;
+	ICUSQLITE_TEST_CHECK(db.SetBusyPolicy(policy));
+
+	db.ResetBusyMetrics();
+	ICUSQLITE_TEST_CHECK(!TryInsert(db));
+	IcuSqlite3BusyMetrics metrics = Metrics(db);
+	ICUSQLITE_TEST_CHECK(1 == metrics.busyEvents);
+	ICUSQLITE_TEST_CHECK(1 == metrics.timeouts);
+	ICUSQLITE_TEST_CHECK(metrics.retries >= 4);			//	1 + 2 + 4 + 8 (+ 8 ...) ms
+	ICUSQLITE_TEST_CHECK(metrics.waitUs >= 15000);
+	ICUSQLITE_TEST_CHECK(metrics.waitUs <= 60000);		//	the last sleep is cut to the deadline
+	ICUSQLITE_TEST_CHECK(metrics.maxWaitUs >= metrics.waitUs);
+
+	policy.maxRetries = 3;
+	ICUSQLITE_TEST_CHECK(db.SetBusyPolicy(policy));
+	db.ResetBusyMetrics();
+	ICUSQLITE_TEST_CHECK(!TryInsert(db));
+	metrics = Metrics(db);
+	ICUSQLITE_TEST_CHECK(3 == metrics.retries);
+	ICUSQLITE_TEST_CHECK(1 == metrics.timeouts);
+	ICUSQLITE_TEST_CHECK(7000 == metrics.waitUs);		//	1 + 2 + 4 ms, no jitter
+
+	db.ResetBusyMetrics();
+	metrics = Metrics(db);
+	ICUSQLITE_TEST_CHECK(0 == metrics.busyEvents && 0 == metrics.retries && 
+		0 == metrics.waitUs && 0 == metrics.maxWaitUs && 0 == metrics.timeouts);
+}
+
+//
+//	A budget cuts a wait the policy would still allow short
+//
+static void TestBudget(IcuSqlite3Database& db)
+{
+	IcuSqlite3BusyPolicy policy;
+	policy.timeoutMs	= 10000;
+	policy.maxDelayMs	= 5;
+	ICUSQLITE_TEST_CHECK(db.SetBusyPolicy(policy));
+
+	db.ResetBusyMetrics();
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		IcuSqlite3BusyBudget budget(&db, 30);
+		{
+			IcuSqlite3BusyBudget longer(&db, 5000);		//	can't extend the outer one
+			ICUSQLITE_TEST_CHECK(!TryInsert(db));
+		}
+		ICUSQLITE_TEST_CHECK(budget.IsExhausted());
+	}
+	const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	ICUSQLITE_TEST_CHECK(ms < 1000);
+
+	IcuSqlite3BusyMetrics metrics = Metrics(db);
+	ICUSQLITE_TEST_CHECK(1 == metrics.budgetCutoffs);
+	ICUSQLITE_TEST_CHECK(0 == metrics.timeouts);
+}
+
+//
+//	The lock goes away while waiting: no give up, the wait is recorded
+//
+static void TestWaitSucceeds(IcuSqlite3Database& db, IcuSqlite3Database& other)
+{
+	IcuSqlite3BusyPolicy policy;
+	policy.timeoutMs	= 5000;
+	policy.maxDelayMs	= 5;
+	ICUSQLITE_TEST_CHECK(db.SetBusyPolicy(policy));
+
+	db.ResetBusyMetrics();
+	std::thread release([&other] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+		ICUSQLITE_TEST_CHECK(other.Rollback());
+	});
+	ICUSQLITE_TEST_CHECK(TryInsert(db));
+	release.join();
+
+	IcuSqlite3BusyMetrics metrics = Metrics(db);
+	ICUSQLITE_TEST_CHECK(1 == metrics.busyEvents);
+	ICUSQLITE_TEST_CHECK(metrics.retries > 0);
+	ICUSQLITE_TEST_CHECK(0 == metrics.timeouts && 0 == metrics.budgetCutoffs);
+	ICUSQLITE_TEST_CHECK(metrics.maxWaitUs > 0);
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-busy.db");
+
+	IcuSqlite3Database db;
+	IcuSqlite3Database other;
+	ICUSQLITE_TEST_CHECK(db.Open("test-busy.db"));
+	ICUSQLITE_TEST_CHECK(other.Open("test-busy.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a INTEGER);"));
+
+	//	|other| holds the write lock until TestWaitSucceeds() lets go
+	ICUSQLITE_TEST_CHECK(other.Begin(ICUSQLITE_TRANSACTION_EXCLUSIVE));
+
+	TestTimeout(db);
+	TestBackoff(db);
+	TestBudget(db);
+	TestWaitSucceeds(db, other);
+
+	other.Close();
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-busy.db");
+	return IcuSqlite3TestResult("TestBusy");
+}
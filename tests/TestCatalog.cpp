@@ -0,0 +1,149 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Schema catalog: TableExists() / ColumnExists() against transactions
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//
+//	ROLLBACK brings schema_version back, so a later change can reuse the
+//	version a rolled back change had; the catalog mustn't serve the rolled
+//	back schema for it
+//
+static void TestRollbackRepeatsVersion()
+{
+	IcuSqlite3TestRemoveDb("test-catalog.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-catalog.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a);"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("t"));
+
+	//	raw SQL, so the wrapper's own Rollback() bookkeeping doesn't run
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("BEGIN;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE x (a);"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("x"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ROLLBACK;"));
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("BEGIN;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE y (a);"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("y"));
+	ICUSQLITE_TEST_CHECK(!db.TableExists("x"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("COMMIT;"));
+
+	ICUSQLITE_TEST_CHECK(db.TableExists("t"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("y"));
+	ICUSQLITE_TEST_CHECK(!db.TableExists("x"));
+
+	db.Close();
+	IcuSqlite3TestRemoveDb("test-catalog.db");
+}
+
+//
+//	Same with a savepoint and a column: ROLLBACK TO fires no rollback hook
+//
+static void TestRollbackToSavepoint()
+{
+	IcuSqlite3TestRemoveDb("test-catalog.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-catalog.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a);"));
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("BEGIN;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("SAVEPOINT sp;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ALTER TABLE t ADD COLUMN b;"));
+	ICUSQLITE_TEST_CHECK(db.ColumnExists("t", "b"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ROLLBACK TO sp;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ALTER TABLE t ADD COLUMN c;"));
+	ICUSQLITE_TEST_CHECK(db.ColumnExists("t", "c"));
+	ICUSQLITE_TEST_CHECK(!db.ColumnExists("t", "b"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("RELEASE sp;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("COMMIT;"));
+
+	std::vector<std::string> columns;
+	ICUSQLITE_TEST_CHECK(db.GetColumnNames("t", columns));
+	ICUSQLITE_TEST_CHECK(2 == columns.size() && "a" == columns[0] && "c" == columns[1]);
+
+	db.Close();
+	IcuSqlite3TestRemoveDb("test-catalog.db");
+}
+
+static void CreateWithTable(const char* filename, const char* table)
+{
+	IcuSqlite3TestRemoveDb(filename);
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(filename));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate((std::string("CREATE TABLE ") + table + " (a);").c_str()));
+	db.Close();
+}
+
+//
+//	ATTACH / DETACH are noticed on the next lookup, and a name attached
+//	again to another file serves that file's tables
+//
+static void TestAttachDetach()
+{
+	IcuSqlite3TestRemoveDb("test-catalog.db");
+	CreateWithTable("test-catalog-a.db", "ta");
+	CreateWithTable("test-catalog-b.db", "tb");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-catalog.db"));
+	ICUSQLITE_TEST_CHECK(!db.TableExists("ta", "aux"));
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ATTACH 'test-catalog-a.db' AS aux;"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("ta", "aux"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("TA", "Aux"));		//	ASCII case folded, as SQLite does
+	ICUSQLITE_TEST_CHECK(!db.TableExists("ta"));
+	ICUSQLITE_TEST_CHECK(!db.TableExists("ta", "main"));
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("DETACH aux;"));
+	ICUSQLITE_TEST_CHECK(!db.TableExists("ta", "aux"));
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ATTACH 'test-catalog-b.db' AS aux;"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("tb", "aux"));
+	ICUSQLITE_TEST_CHECK(!db.TableExists("ta", "aux"));
+
+	//	the temp schema appears once something is created in it
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TEMP TABLE tt (a);"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("tt", "temp"));
+	ICUSQLITE_TEST_CHECK(db.TableExists("tb", "aux"));
+
+	db.Close();
+	IcuSqlite3TestRemoveDb("test-catalog.db");
+	IcuSqlite3TestRemoveDb("test-catalog-a.db");
+	IcuSqlite3TestRemoveDb("test-catalog-b.db");
+}
+
+int main()
+{
+	TestRollbackRepeatsVersion();
+	TestRollbackToSavepoint();
+	TestAttachDetach();
+	return IcuSqlite3TestResult("TestCatalog");
+}
@@ -0,0 +1,265 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	StartChangeStream(): batches are published only once the commit has
+//	gone through, and rolled back savepoints drop out of them
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//	STL
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+	#include <signal.h>
+	#include <sys/resource.h>
+#endif	//	!defined(_WIN32)
+
+//
+//	Each published batch as "table:rowid,table:rowid,..."
+//
+class TestChangeListener : public IcuSqlite3ChangeListener
+{
+public:
+	virtual void OnChanges(const IcuSqlite3ChangeBatch& batch)
+	{
+		std::string rows;
+		for(size_t i = 0; i < batch.changes.size(); ++i) {
+			if(!rows.empty()) {
+				rows += ",";
+			}
+			rows += batch.changes[i].table;
+			rows += ":" + std::to_string(batch.changes[i].rowid);
+		}
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_batches.push_back(rows);
+	}
+
+	//	only read once the stream is stopped (its thread joined)
+	const std::vector<std::string>& GetBatches() const { return m_batches; }
+
+private:
+	std::mutex					m_lock;
+	std::vector<std::string>	m_batches;
+};
+
+//
+//	Another connection's read transaction keeps COMMIT from getting its
+//	exclusive lock (rollback journal): the failed COMMIT publishes nothing,
+//	the ROLLBACK after it nothing either, and a COMMIT that is retried
+//	until it succeeds publishes everything exactly once
+//
+static void TestFailedCommit(IcuSqlite3Database& db, IcuSqlite3Database& other)
+{
+	TestChangeListener listener;
+	ICUSQLITE_TEST_CHECK(db.StartChangeStream(&listener));
+
+	int64_t count = 0;
+	ICUSQLITE_TEST_CHECK(other.Begin());
+	ICUSQLITE_TEST_CHECK(other.ExecuteScalar("SELECT count(*) FROM t;", count));
+
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (1, 'a');"));
+	ICUSQLITE_TEST_CHECK(!db.Commit());
+	ICUSQLITE_TEST_CHECK(!db.IsAutoCommitMode());
+	ICUSQLITE_TEST_CHECK(db.Rollback());
+
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (2, 'b');"));
+	ICUSQLITE_TEST_CHECK(!db.Commit());
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (3, 'c');"));
+	ICUSQLITE_TEST_CHECK(!db.Commit());
+	ICUSQLITE_TEST_CHECK(other.Commit());
+	ICUSQLITE_TEST_CHECK(db.Commit());
+
+	//	a single statement commit is published straight away as well
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (4, 'd');"));
+
+	db.StopChangeStream();
+	const std::vector<std::string>& batches = listener.GetBatches();
+	ICUSQLITE_TEST_CHECK(2 == batches.size());
+	ICUSQLITE_TEST_CHECK(batches.size() > 0 && "t:2,t:3" == batches[0]);
+	ICUSQLITE_TEST_CHECK(batches.size() > 1 && "t:4" == batches[1]);
+}
+
+#if !defined(_WIN32)
+//
+//	A commit that fails once the commit hook has run (here writing the
+//	database file past RLIMIT_FSIZE) rolls back: nothing is published
+//
+static void TestCommitRolledBack(IcuSqlite3Database& db)
+{
+	int64_t pages = 0;
+	int64_t pageSize = 0;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("PRAGMA page_count;", pages));
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("PRAGMA page_size;", pageSize));
+
+	TestChangeListener listener;
+	ICUSQLITE_TEST_CHECK(db.StartChangeStream(&listener));
+
+	struct rlimit saved;
+	ICUSQLITE_TEST_CHECK(0 == getrlimit(RLIMIT_FSIZE, &saved));
+	signal(SIGXFSZ, SIG_IGN);
+
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (5, zeroblob(65536));"));
+
+	struct rlimit limit = saved;
+	limit.rlim_cur = static_cast<rlim_t>(pages * pageSize);
+	ICUSQLITE_TEST_CHECK(0 == setrlimit(RLIMIT_FSIZE, &limit));
+	ICUSQLITE_TEST_CHECK(!db.Commit());
+	ICUSQLITE_TEST_CHECK(0 == setrlimit(RLIMIT_FSIZE, &saved));
+	if(!db.IsAutoCommitMode()) {
+		ICUSQLITE_TEST_CHECK(db.Rollback());
+	}
+
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (6, 'e');"));
+
+	db.StopChangeStream();
+	const std::vector<std::string>& batches = listener.GetBatches();
+	ICUSQLITE_TEST_CHECK(1 == batches.size());
+	ICUSQLITE_TEST_CHECK(batches.size() > 0 && "t:6" == batches[0]);
+
+	int64_t count = -1;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT count(*) FROM t WHERE a = 5;", count));
+	ICUSQLITE_TEST_CHECK(0 == count);
+}
+#endif	//	!defined(_WIN32)
+
+//
+//	ROLLBACK TO doesn't fire the rollback hook; the stream follows the
+//	savepoints itself
+//
+static void TestSavepointRollback(IcuSqlite3Database& db)
+{
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("DELETE FROM t; DELETE FROM u;"));
+
+	TestChangeListener listener;
+	ICUSQLITE_TEST_CHECK(db.StartChangeStream(&listener));
+
+	{
+		IcuSqlite3Savepoint outer(&db);
+		ICUSQLITE_TEST_CHECK(outer.Execute("INSERT INTO t VALUES (10, 'a');"));
+		{
+			IcuSqlite3Savepoint inner(&db);
+			ICUSQLITE_TEST_CHECK(inner.Execute("INSERT INTO t VALUES (11, 'b');"));
+			ICUSQLITE_TEST_CHECK(inner.Execute("INSERT INTO u VALUES (12);"));
+			ICUSQLITE_TEST_CHECK(inner.Rollback());
+		}
+		{
+			IcuSqlite3Savepoint inner(&db);
+			ICUSQLITE_TEST_CHECK(inner.Execute("INSERT INTO t VALUES (13, 'c');"));
+		}
+	}
+
+	//	the same by hand: quoted names, case, a released inner savepoint
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("SAVEPOINT \"Outer\";"));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (20, 'a');"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("savepoint a;"));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (21, 'b');"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("SAVEPOINT b;"));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO u VALUES (22);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("RELEASE b;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("/* undo a */ ROLLBACK TO SAVEPOINT [A];"));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (23, 'c');"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("RELEASE outer;"));
+	ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+
+	db.StopChangeStream();
+	const std::vector<std::string>& batches = listener.GetBatches();
+	ICUSQLITE_TEST_CHECK(2 == batches.size());
+	ICUSQLITE_TEST_CHECK(batches.size() > 0 && "t:10,t:13" == batches[0]);
+	ICUSQLITE_TEST_CHECK(batches.size() > 1 && "t:20,t:23" == batches[1]);
+
+	std::string rows;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT group_concat(a) FROM (SELECT a FROM t ORDER BY a);", rows));
+	ICUSQLITE_TEST_CHECK("10,13,20,23" == rows);
+}
+
+//
+//	A tracer set before or after the stream still gets its events
+//
+class TestCountingTracer : public IcuSqlite3Tracer
+{
+public:
+	explicit TestCountingTracer(int* statements) : m_statements(statements) {}
+
+	virtual void Trace(const EIcuSqlite3TraceEvent event, void* /*p*/, void* /*x*/)
+	{
+		if(ICUSQLITE_TRACE_STMT == event) {
+			++*m_statements;
+		}
+	}
+
+private:
+	int*	m_statements;
+};
+
+static void TestTracerChained(IcuSqlite3Database& db)
+{
+	int statements = 0;
+	ICUSQLITE_TEST_CHECK(db.SetTracer(new TestCountingTracer(&statements), ICUSQLITE_TRACE_STMT));
+
+	TestChangeListener listener;
+	ICUSQLITE_TEST_CHECK(db.StartChangeStream(&listener));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (30, 'a');"));
+	ICUSQLITE_TEST_CHECK(1 == statements);
+	db.StopChangeStream();
+
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (31, 'b');"));
+	ICUSQLITE_TEST_CHECK(2 == statements);
+	ICUSQLITE_TEST_CHECK(1 == listener.GetBatches().size());
+
+	ICUSQLITE_TEST_CHECK(db.SetTracer(nullptr, 0));
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-change-stream.db");
+
+	IcuSqlite3Database db;
+	IcuSqlite3Database other;
+	ICUSQLITE_TEST_CHECK(db.Open("test-change-stream.db"));
+	ICUSQLITE_TEST_CHECK(other.Open("test-change-stream.db"));
+	ICUSQLITE_TEST_CHECK(db.SetBusyTimeout(0));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate(
+		"CREATE TABLE t (a INTEGER PRIMARY KEY, b TEXT); CREATE TABLE u (a INTEGER PRIMARY KEY);"));
+
+	TestFailedCommit(db, other);
+#if !defined(_WIN32)
+	TestCommitRolledBack(db);
+#endif	//	!defined(_WIN32)
+	TestSavepointRollback(db);
+	TestTracerChained(db);
+
+	other.Close();
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-change-stream.db");
+	return IcuSqlite3TestResult("TestChangeStream");
+}
@@ -0,0 +1,96 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Checkpoint scheduler with more than one WAL database on the connection
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//	STL
+#include <fstream>
+
+static long FileSize(const char* filename)
+{
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	return file ? static_cast<long>(file.tellg()) : -1;
+}
+
+//
+//	Commits to an ATTACHed WAL database are neither counted against "main"
+//	nor left without checkpoints
+//
+static void TestAttachedWal()
+{
+	IcuSqlite3TestRemoveDb("test-checkpoint.db");
+	IcuSqlite3TestRemoveDb("test-checkpoint-aux.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-checkpoint.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("PRAGMA journal_mode = WAL;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a);"));
+	ICUSQLITE_TEST_CHECK(db.Attach("test-checkpoint-aux.db", "aux"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("PRAGMA aux.journal_mode = WAL;"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE aux.t (a);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("PRAGMA wal_autocheckpoint = 16;"));
+
+	//	nothing the scheduler would act on by itself during the test
+	IcuSqlite3CheckpointPolicy policy;
+	policy.frameThreshold	= 1000000;
+	policy.maxIntervalMs	= 60 * 60 * 1000;
+	policy.idleMs			= 60 * 60 * 1000;
+	ICUSQLITE_TEST_CHECK(db.StartCheckpointScheduler(policy));
+
+	IcuSqlite3CheckpointMetrics before;
+	ICUSQLITE_TEST_CHECK(db.GetCheckpointMetrics(before));
+
+	for(int n = 0; n < 200; ++n) {
+		ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("INSERT INTO aux.t VALUES (randomblob(4000));"));
+	}
+
+	IcuSqlite3CheckpointMetrics after;
+	ICUSQLITE_TEST_CHECK(db.GetCheckpointMetrics(after));
+	ICUSQLITE_TEST_CHECK(before.walFrames == after.walFrames);
+	ICUSQLITE_TEST_CHECK(0 == after.checkpoints);
+
+	//	200 pages uncheckpointed would be 800KB of WAL
+	const long auxWal = FileSize("test-checkpoint-aux.db-wal");
+	ICUSQLITE_TEST_CHECK(auxWal >= 0 && auxWal < 200 * 1024);
+
+	//	"main" is still the scheduler's
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("INSERT INTO t VALUES (1);"));
+	ICUSQLITE_TEST_CHECK(db.GetCheckpointMetrics(after));
+	ICUSQLITE_TEST_CHECK(after.walFrames > before.walFrames);
+
+	db.StopCheckpointScheduler();
+	db.Close();
+	IcuSqlite3TestRemoveDb("test-checkpoint.db");
+	IcuSqlite3TestRemoveDb("test-checkpoint-aux.db");
+}
+
+int main()
+{
+	TestAttachedWal();
+	return IcuSqlite3TestResult("TestCheckpoint");
+}
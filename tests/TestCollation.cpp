@@ -0,0 +1,172 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	CreateCollation() and SORTKEY(): locale ordering, sort keys ordering
+//	exactly like the collation, and the cap on SORTKEY()'s own collators
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//	STL
+#include <string>
+
+static int64_t Int(IcuSqlite3Database& db, const char* sql)
+{
+	int64_t value = -12345;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+static std::string Text(IcuSqlite3Database& db, const char* sql)
+{
+	std::string value;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+static void Open(IcuSqlite3Database& db, const bool utf16)
+{
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:", ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE,
+		ICUSQLITE_EXT_OPEN_DEFAULT | (utf16 ? ICUSQLITE_EXT_OPEN_UTF16 : 0)));
+	ICUSQLITE_TEST_CHECK((utf16 ? "UTF-16le" : "UTF-8") == Text(db, "PRAGMA encoding;"));
+}
+
+static void TestOrdering(const bool utf16)
+{
+	IcuSqlite3Database db;
+	Open(db, utf16);
+
+	ICUSQLITE_TEST_CHECK(db.CreateCollation("de", Locale("de")));
+	ICUSQLITE_TEST_CHECK(db.CreateCollation("sv", Locale("sv")));
+	ICUSQLITE_TEST_CHECK(db.CreateCollation("de1", Locale("de"), Collator::PRIMARY));
+	ICUSQLITE_TEST_CHECK(!db.CreateCollation(nullptr, Locale("de")));
+
+	ICUSQLITE_TEST_CHECK(0 == db.ExecuteUpdate("CREATE TABLE w(t TEXT);"));
+	ICUSQLITE_TEST_CHECK(4 == db.ExecuteUpdate(
+		"INSERT INTO w VALUES('z'), (char(228)), ('a'), ('b');"));
+
+	//	German sorts "ä" with "a", Swedish after "z"
+	ICUSQLITE_TEST_CHECK("a,\xC3\xA4,b,z" == Text(db,
+		"SELECT group_concat(t, ',') FROM (SELECT t FROM w ORDER BY t COLLATE de);"));
+	ICUSQLITE_TEST_CHECK("a,b,z,\xC3\xA4" == Text(db,
+		"SELECT group_concat(t, ',') FROM (SELECT t FROM w ORDER BY t COLLATE sv);"));
+	ICUSQLITE_TEST_CHECK("a,b,z,\xC3\xA4" == Text(db,
+		"SELECT group_concat(t, ',') FROM (SELECT t FROM w ORDER BY t COLLATE BINARY);"));
+
+	//	strength
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT 'Apfel' = 'apfel' COLLATE de1;"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT 'Apfel' = 'apfel' COLLATE de;"));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT SORTKEY('Apfel', 'de', 'primary') = SORTKEY('apfel', 'de', 'PRIMARY');"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT SORTKEY('Apfel', 'de') = SORTKEY('apfel', 'de');"));
+
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT SORTKEY(NULL, 'de') IS NULL;"));
+	ICUSQLITE_TEST_CHECK(-1 == db.ExecuteUpdate("SELECT SORTKEY('a', 'de', 'loudest');"));
+}
+
+static void TestSortKeyMatchesCollation(const bool utf16)
+{
+	IcuSqlite3Database db;
+	Open(db, utf16);
+
+	ICUSQLITE_TEST_CHECK(db.CreateCollation("de", Locale("de")));
+	ICUSQLITE_TEST_CHECK(db.CreateCollation("sv", Locale("sv")));
+	ICUSQLITE_TEST_CHECK(db.CreateCollation("fr2", Locale("fr"), Collator::SECONDARY));
+
+	ICUSQLITE_TEST_CHECK(0 == db.ExecuteUpdate("CREATE TABLE w(t TEXT);"));
+	ICUSQLITE_TEST_CHECK(15 == db.ExecuteUpdate(
+		"INSERT INTO w VALUES('Apfel'), ('apfel'), (char(196) || 'pfel'), ('zebra'), "
+		"('Z' || char(252) || 'rich'), (char(246) || 'l'), ('Ol'), ('oeuvre'), "
+		"(char(233) || 'clair'), ('eclair'), ('Eclair'), ('b'), (''), ('10'), ('9');"));
+
+	//	every pair compares the same way through the key as the collation
+	static const char* const pairs[] = {
+		"SELECT count(*) FROM w x, w y WHERE "
+			"(x.t < y.t COLLATE de) != (SORTKEY(x.t, 'de') < SORTKEY(y.t, 'de')) OR "
+			"(x.t = y.t COLLATE de) != (SORTKEY(x.t, 'de') = SORTKEY(y.t, 'de'));",
+		"SELECT count(*) FROM w x, w y WHERE "
+			"(x.t < y.t COLLATE sv) != (SORTKEY(x.t, 'sv') < SORTKEY(y.t, 'sv')) OR "
+			"(x.t = y.t COLLATE sv) != (SORTKEY(x.t, 'sv') = SORTKEY(y.t, 'sv'));",
+		"SELECT count(*) FROM w x, w y WHERE "
+			"(x.t < y.t COLLATE fr2) != (SORTKEY(x.t, 'fr', 'secondary') < SORTKEY(y.t, 'fr', 'secondary')) OR "
+			"(x.t = y.t COLLATE fr2) != (SORTKEY(x.t, 'fr', 'secondary') = SORTKEY(y.t, 'fr', 'secondary'));",
+	};
+	for(size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i) {
+		ICUSQLITE_TEST_CHECK(0 == Int(db, pairs[i]));
+	}
+
+	//	and an index on the key gives the collation's order
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE INDEX wKey ON w(SORTKEY(t, 'de'));"));
+	ICUSQLITE_TEST_CHECK(
+		Text(db, "SELECT group_concat(t, ',') FROM (SELECT t FROM w ORDER BY t COLLATE de, t);") == 
+		Text(db, "SELECT group_concat(t, ',') FROM (SELECT t FROM w ORDER BY SORTKEY(t, 'de'), t);"));
+}
+
+static void TestSortKeyLocaleCap(const bool utf16)
+{
+	IcuSqlite3Database db;
+	Open(db, utf16);
+
+	//	no CreateCollation() needed for SORTKEY()
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT SORTKEY('a', 'de') < SORTKEY('b', 'de');"));
+
+	static const char* const locales[] = {
+		"sv", "fr", "en", "es", "it", "nl", "pl", "cs",
+		"da", "fi", "nb", "tr", "ja", "zh", "ko",
+	};
+	std::string sql;
+	for(size_t i = 0; i < sizeof(locales) / sizeof(locales[0]); ++i) {
+		sql = std::string("SELECT length(SORTKEY('a', '") + locales[i] + "')) > 0;";
+		ICUSQLITE_TEST_CHECK(1 == Int(db, sql.c_str()));
+	}
+
+	//	16 in use: new locales / strengths are refused, known ones still served
+	ICUSQLITE_TEST_CHECK(-1 == db.ExecuteUpdate("SELECT SORTKEY('a', 'ru');"));
+	ICUSQLITE_TEST_CHECK(db.GetLastErrorMessage().indexOf("too many distinct locales") >= 0);
+	ICUSQLITE_TEST_CHECK(-1 == db.ExecuteUpdate("SELECT SORTKEY('a', 'de', 'primary');"));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT SORTKEY('a', 'de') < SORTKEY('b', 'de');"));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT length(SORTKEY('a', 'sv')) > 0;"));
+
+	//	a registered collation puts its collator in the pool for SORTKEY();
+	//	Russian sorts Cyrillic before Latin
+	ICUSQLITE_TEST_CHECK(db.CreateCollation("ru", Locale("ru")));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT SORTKEY(char(1073), 'ru') < SORTKEY('a', 'ru');"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT SORTKEY(char(1073), 'en') < SORTKEY('a', 'en');"));
+
+	//	a new connection starts over
+	db.Close();
+	Open(db, utf16);
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT length(SORTKEY('a', 'el')) > 0;"));
+}
+
+int main()
+{
+	for(int utf16 = 0; utf16 <= 1; ++utf16) {
+		TestOrdering(0 != utf16);
+		TestSortKeyMatchesCollation(0 != utf16);
+		TestSortKeyLocaleCap(0 != utf16);
+	}
+
+	return IcuSqlite3TestResult("TestCollation");
+}
@@ -0,0 +1,110 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Native text encoding: binds, column reads and functions on UTF-8 and
+//	UTF-16 databases
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//
+//	Appends '!' to its argument and reports the argument's length in the
+//	result, so a length taken from a NUL scan would show
+//
+class IcuSqlite3TestEcho : public IcuSqlite3ScalarFunction
+{
+public:
+	virtual void Scalar(IcuSqlite3FunctionContext* pContext)
+	{
+		UnicodeString arg = pContext->GetArgAsUnicodeString(0);
+		UnicodeString result(arg);
+		result += UnicodeString("!");
+		result += UnicodeString((UChar)(0x30 + arg.length()));
+		pContext->SetResult(result);
+	}
+};
+
+static UnicodeString Sample()
+{
+	//	"Grüße \U0001F600", with a NUL in the middle
+	UnicodeString text("Gr");
+	text += (UChar)0x00FC;
+	text += (UChar)0x00DF;
+	text += UnicodeString("e");
+	text += (UChar)0x0000;
+	text += (UChar32)0x1F600;
+	return text;
+}
+
+static void TestEncoding(const bool utf16)
+{
+	IcuSqlite3Database db;
+	const int extFlags = utf16 ?
+		(ICUSQLITE_EXT_OPEN_DEFAULT | ICUSQLITE_EXT_OPEN_UTF16) : ICUSQLITE_EXT_OPEN_DEFAULT;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:", ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE, extFlags));
+	ICUSQLITE_TEST_CHECK(utf16 == db.IsUtf16());
+
+	UnicodeString encoding;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("PRAGMA encoding;", encoding));
+	ICUSQLITE_TEST_CHECK(utf16 == encoding.startsWith("UTF-16"));
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (s TEXT);"));
+
+	const UnicodeString sample = Sample();
+	{
+		IcuSqlite3Statement insert = db.PrepareStatement("INSERT INTO t VALUES (?);");
+		ICUSQLITE_TEST_CHECK(insert.Bind(1, sample));
+		ICUSQLITE_TEST_CHECK(1 == insert.ExecuteUpdate());
+	}
+
+	int64_t bytes = 0;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT length(CAST(s AS BLOB)) FROM t;", bytes));
+	ICUSQLITE_TEST_CHECK((utf16 ? 16 : 12) == bytes);	//	stored as is, NUL included
+
+	{
+		IcuSqlite3ResultSet rs = db.ExecuteQuery("SELECT s FROM t;");
+		ICUSQLITE_TEST_CHECK(rs.NextRow());
+		ICUSQLITE_TEST_CHECK(sample == rs.GetString(0));
+	}
+
+	ICUSQLITE_TEST_CHECK(db.CreateScalarFunction("echo", 1, new IcuSqlite3TestEcho()));
+	{
+		IcuSqlite3ResultSet rs = db.ExecuteQuery("SELECT echo(s) FROM t;");
+		ICUSQLITE_TEST_CHECK(rs.NextRow());
+
+		UnicodeString expected(sample);
+		expected += UnicodeString("!8");
+		ICUSQLITE_TEST_CHECK(expected == rs.GetString(0));
+	}
+
+	db.Close();
+}
+
+int main()
+{
+	TestEncoding(false);
+	TestEncoding(true);
+	return IcuSqlite3TestResult("TestEncoding");
+}
@@ -0,0 +1,101 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Exporter output on a UTF-16 database: text is always written as UTF-8
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Export.h"
+
+#include <string>
+
+class IcuSqlite3TestStringSink : public IcuSqlite3ExportSink
+{
+public:
+	virtual bool Write(const char* data, const size_t len)
+	{
+		out.append(data, len);
+		return true;
+	}
+
+	std::string	out;
+};
+
+static bool Export(IcuSqlite3Database& db, const EIcuSqlite3ExportFormat format, std::string& out)
+{
+	IcuSqlite3ExportOptions options;
+	options.format	= format;
+	options.threads	= 2;
+
+	IcuSqlite3TestStringSink sink;
+	IcuSqlite3Exporter exporter(db);
+	const bool ok = exporter.Begin(options) && exporter.ExportTable("t", sink);
+	exporter.End();
+	out = sink.out;
+	return ok;
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-export.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-export.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("PRAGMA encoding = 'UTF-16le';"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (id INTEGER PRIMARY KEY, s TEXT, b BLOB);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("INSERT INTO t VALUES (1, char(233), x'00ff');"));
+
+	UnicodeString encoding;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("PRAGMA encoding;", encoding));
+	ICUSQLITE_TEST_CHECK(UnicodeString("UTF-16le") == encoding);
+
+	//
+	//	Binary: the TEXT cell (tag 3) carries the two UTF-8 bytes of U+00E9,
+	//	not the UTF-16 bytes the database stores; the BLOB cell is as is
+	//
+	std::string binary;
+	ICUSQLITE_TEST_CHECK(Export(db, ICUSQLITE_EXPORT_BINARY, binary));
+	const char expected[] =
+		"ISQ3B1\0\0"
+		"\x03" "\x02" "id" "\x01" "s" "\x01" "b"
+		"\x01"
+		"\x01" "\x02"
+		"\x03" "\x02" "\xC3\xA9"
+		"\x04" "\x02" "\x00\xFF"
+		"\x00";
+	ICUSQLITE_TEST_CHECK(std::string(expected, sizeof(expected) - 1) == binary);
+
+	std::string csv;
+	ICUSQLITE_TEST_CHECK(Export(db, ICUSQLITE_EXPORT_CSV, csv));
+	ICUSQLITE_TEST_CHECK("id,s,b\r\n1,\xC3\xA9,00ff\r\n" == csv);
+
+	std::string json;
+	ICUSQLITE_TEST_CHECK(Export(db, ICUSQLITE_EXPORT_NDJSON, json));
+	ICUSQLITE_TEST_CHECK("{\"id\":1,\"s\":\"\xC3\xA9\",\"b\":\"AP8=\"}\n" == json);
+
+	db.Close();
+	IcuSqlite3TestRemoveDb("test-export.db");
+	return IcuSqlite3TestResult("TestExport");
+}
@@ -0,0 +1,152 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Zero copy function arguments and owned / static results
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+#include <string.h>
+
+enum EIcuSqlite3TestView {
+	ICUSQLITE_TEST_UTF8_LENGTH,		//	bytes through GetArgAsUtf8()
+	ICUSQLITE_TEST_BLOB_SUM,		//	byte sum through GetArgAsBlobView()
+	ICUSQLITE_TEST_ALIAS_LENGTH,	//	UTF-16 units through GetArgAsUnicodeStringAlias()
+	ICUSQLITE_TEST_TWICE,			//	the argument repeated, as an owned result
+	ICUSQLITE_TEST_STATIC,			//	a static result
+};
+
+class IcuSqlite3TestViews : public IcuSqlite3ScalarFunction
+{
+public:
+	explicit IcuSqlite3TestViews(const EIcuSqlite3TestView view) : m_view(view) {}
+
+	virtual void Scalar(IcuSqlite3FunctionContext* pContext)
+	{
+		switch(m_view) {
+			case ICUSQLITE_TEST_UTF8_LENGTH :
+				{
+					const IcuSqlite3Utf8View text = pContext->GetArgAsUtf8(0);
+					if(text.IsNull()) {
+						pContext->SetNullResult();
+					} else {
+						pContext->SetResult(static_cast<int64_t>(text.length));
+					}
+				}
+				break;
+
+			case ICUSQLITE_TEST_BLOB_SUM :
+				{
+					const IcuSqlite3BlobView blob = pContext->GetArgAsBlobView(0);
+					int64_t sum = 0;
+					for(int i = 0; i < blob.length; ++i) {
+						sum += blob.data[i];
+					}
+					pContext->SetResult(sum);
+				}
+				break;
+
+			case ICUSQLITE_TEST_ALIAS_LENGTH :
+				{
+					UnicodeString alias;
+					if(pContext->GetArgAsUnicodeStringAlias(0, alias)) {
+						pContext->SetResult(static_cast<int64_t>(alias.length()));
+					} else {
+						pContext->SetResult(static_cast<int64_t>(-1));
+					}
+				}
+				break;
+
+			case ICUSQLITE_TEST_TWICE :
+				{
+					const IcuSqlite3Utf8View text = pContext->GetArgAsUtf8(0);
+					char* result = static_cast<char*>(pContext->AllocResult(text.length * 2));
+					if(nullptr == result) {
+						pContext->SetNullResult();
+						break;
+					}
+					memcpy(result, text.data, text.length);
+					memcpy(result + text.length, text.data, text.length);
+					pContext->SetOwnedResult(result, text.length * 2);
+				}
+				break;
+
+			case ICUSQLITE_TEST_STATIC :
+				pContext->SetStaticResult("constant");
+				break;
+		}
+	}
+
+private:
+	EIcuSqlite3TestView	m_view;
+};
+
+static int64_t Int(IcuSqlite3Database& db, const char* sql)
+{
+	int64_t value = -12345;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+static std::string Text(IcuSqlite3Database& db, const char* sql)
+{
+	std::string value;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+int main()
+{
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:"));
+
+	ICUSQLITE_TEST_CHECK(db.CreateScalarFunction("u8len", 1, new IcuSqlite3TestViews(ICUSQLITE_TEST_UTF8_LENGTH)));
+	ICUSQLITE_TEST_CHECK(db.CreateScalarFunction("blobsum", 1, new IcuSqlite3TestViews(ICUSQLITE_TEST_BLOB_SUM)));
+	ICUSQLITE_TEST_CHECK(db.CreateScalarFunction("u16len", 1, new IcuSqlite3TestViews(ICUSQLITE_TEST_ALIAS_LENGTH)));
+	ICUSQLITE_TEST_CHECK(db.CreateScalarFunction("twice", 1, new IcuSqlite3TestViews(ICUSQLITE_TEST_TWICE)));
+	ICUSQLITE_TEST_CHECK(db.CreateScalarFunction("konst", 0, new IcuSqlite3TestViews(ICUSQLITE_TEST_STATIC)));
+
+	//	"é\U0001F600" is 6 bytes of UTF-8 and 3 UTF-16 units
+	ICUSQLITE_TEST_CHECK(6 == Int(db, "SELECT u8len(char(233, 128512));"));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT u8len(NULL) IS NULL;"));
+	ICUSQLITE_TEST_CHECK(3 == Int(db, "SELECT u16len(char(233, 128512));"));
+	ICUSQLITE_TEST_CHECK(-1 == Int(db, "SELECT u16len(NULL);"));
+
+	ICUSQLITE_TEST_CHECK(0x01 + 0x02 + 0xFF == Int(db, "SELECT blobsum(x'0102FF');"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT blobsum(x'');"));
+
+	ICUSQLITE_TEST_CHECK("abcabc" == Text(db, "SELECT twice('abc');"));
+	ICUSQLITE_TEST_CHECK("constant|constant" == Text(db, "SELECT konst() || '|' || konst();"));
+
+	//	views and owned results across many rows of one statement
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (s TEXT);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate(
+		"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 1000) "
+		"INSERT INTO t SELECT printf('%.*c', i % 50, 'x') FROM n;"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT count(*) FROM t WHERE twice(s) != s || s OR u8len(s) != length(s);"));
+
+	db.Close();
+	return IcuSqlite3TestResult("TestFunctionViews");
+}
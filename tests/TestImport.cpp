@@ -0,0 +1,214 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	CSV / NDJSON import: chunking, quoting, bad rows and transactions
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Import.h"
+
+#include <string>
+
+static int64_t Count(IcuSqlite3Database& db, const char* sql)
+{
+	int64_t value = -1;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+static std::string Text(IcuSqlite3Database& db, const char* sql)
+{
+	std::string value;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+//
+//	Quoted delimiters, doubled quotes and embedded newlines survive tiny
+//	chunks, so every chunk boundary lands in or near a quoted field
+//
+static void TestCsvQuotingAcrossChunks(IcuSqlite3Database& db)
+{
+	db.ExecuteUpdate("DROP TABLE IF EXISTS t;");
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (id INTEGER, name TEXT, note TEXT);"));
+
+	std::string csv;
+	for(int i = 0; i < 2000; ++i) {
+		csv += std::to_string(i) + ",\"n,\"\"" + std::to_string(i) + "\"\"\",\"multi\r\nline\"\r\n";
+	}
+
+	IcuSqlite3ImportOptions options;
+	options.header		= false;
+	options.chunkBytes	= 37;
+	options.threads		= 3;
+
+	IcuSqlite3Importer importer(db);
+	ICUSQLITE_TEST_CHECK(importer.Import(csv.data(), csv.size(), "t", options));
+
+	IcuSqlite3ImportMetrics metrics;
+	importer.GetMetrics(metrics);
+	ICUSQLITE_TEST_CHECK(2000 == metrics.rows);
+	ICUSQLITE_TEST_CHECK(0 == metrics.badRows);
+	ICUSQLITE_TEST_CHECK(metrics.chunks > 1);
+	ICUSQLITE_TEST_CHECK(static_cast<int64_t>(csv.size()) == metrics.bytes);
+
+	ICUSQLITE_TEST_CHECK(2000 == Count(db, "SELECT count(*) FROM t;"));
+	ICUSQLITE_TEST_CHECK(0 == Count(db, "SELECT count(*) FROM t WHERE rowid != id + 1;"));
+	ICUSQLITE_TEST_CHECK("n,\"1234\"|multi\r\nline" == Text(db, "SELECT name || '|' || note FROM t WHERE id = 1234;"));
+}
+
+//
+//	A UTF-8 BOM is skipped and the header maps fields to columns by name
+//
+static void TestCsvBomAndHeader(IcuSqlite3Database& db)
+{
+	db.ExecuteUpdate("DROP TABLE IF EXISTS t;");
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (id INTEGER, name TEXT, note TEXT);"));
+
+	const std::string csv = "\xEF\xBB\xBFnote,id\n\"x\",1\n,2\n";
+
+	IcuSqlite3ImportOptions options;
+	options.header		= true;
+	options.emptyIsNull	= true;
+
+	IcuSqlite3Importer importer(db);
+	ICUSQLITE_TEST_CHECK(importer.Import(csv.data(), csv.size(), "t", options));
+	ICUSQLITE_TEST_CHECK(2 == Count(db, "SELECT count(*) FROM t;"));
+	ICUSQLITE_TEST_CHECK("x" == Text(db, "SELECT note FROM t WHERE id = 1;"));
+	ICUSQLITE_TEST_CHECK(1 == Count(db, "SELECT count(*) FROM t WHERE id = 2 AND note IS NULL AND name IS NULL;"));
+}
+
+//
+//	Malformed and non UTF-8 rows are skipped up to maxBadRows; one more
+//	fails the import and rolls its transaction back
+//
+static void TestBadRowLimit(IcuSqlite3Database& db)
+{
+	db.ExecuteUpdate("DROP TABLE IF EXISTS t;");
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (id INTEGER, name TEXT, note TEXT);"));
+
+	const std::string good		= "1,a,b\n";
+	const std::string tooShort	= "2,a\n";
+	const std::string notUtf8	= "3,\xFF\xFE,b\n";
+	const std::string csv		= good + tooShort + "4,c,d\n" + notUtf8 + "5,e,f\n";
+
+	IcuSqlite3ImportOptions options;
+	options.header		= false;
+	options.maxBadRows	= 2;
+
+	IcuSqlite3Importer importer(db);
+	ICUSQLITE_TEST_CHECK(importer.Import(csv.data(), csv.size(), "t", options));
+
+	IcuSqlite3ImportMetrics metrics;
+	importer.GetMetrics(metrics);
+	ICUSQLITE_TEST_CHECK(3 == metrics.rows);
+	ICUSQLITE_TEST_CHECK(2 == metrics.badRows);
+	ICUSQLITE_TEST_CHECK(static_cast<int64_t>(good.size()) == metrics.firstBadOffset);
+	ICUSQLITE_TEST_CHECK(3 == Count(db, "SELECT count(*) FROM t;"));
+
+	options.maxBadRows	= 1;
+	ICUSQLITE_TEST_CHECK(!importer.Import(csv.data(), csv.size(), "t", options));
+	importer.GetMetrics(metrics);
+	ICUSQLITE_TEST_CHECK(0 == metrics.rows);
+	ICUSQLITE_TEST_CHECK(3 == Count(db, "SELECT count(*) FROM t;"));
+}
+
+//
+//	Rows go into the caller's transaction when one is open
+//
+static void TestCallersTransaction(IcuSqlite3Database& db)
+{
+	db.ExecuteUpdate("DROP TABLE IF EXISTS t;");
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (id INTEGER, name TEXT, note TEXT);"));
+
+	const std::string csv = "1,a,b\n2,c,d\n";
+
+	IcuSqlite3ImportOptions options;
+	options.header				= false;
+	options.rowsPerTransaction	= 1;
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("BEGIN;"));
+	IcuSqlite3Importer importer(db);
+	ICUSQLITE_TEST_CHECK(importer.Import(csv.data(), csv.size(), "t", options));
+
+	IcuSqlite3ImportMetrics metrics;
+	importer.GetMetrics(metrics);
+	ICUSQLITE_TEST_CHECK(2 == metrics.rows);
+	ICUSQLITE_TEST_CHECK(0 == metrics.transactions);
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ROLLBACK;"));
+	ICUSQLITE_TEST_CHECK(0 == Count(db, "SELECT count(*) FROM t;"));
+}
+
+//
+//	NDJSON binds by key with per-value types; unknown keys are ignored
+//
+static void TestNdjson(IcuSqlite3Database& db)
+{
+	db.ExecuteUpdate("DROP TABLE IF EXISTS j;");
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE j (a, b, c, d);"));
+
+	std::string json;
+	for(int i = 0; i < 500; ++i) {
+		json += "{\"a\": " + std::to_string(i) + ", \"b\": \"x\\u00e9\\\"q\", \"z\": 1, \"c\": [1, {\"k\": \"]\"}], \"d\": -1.5e3}\n";
+	}
+	json += "{\"b\": true, \"d\": null}\n";
+
+	IcuSqlite3ImportOptions options;
+	options.format		= ICUSQLITE_IMPORT_NDJSON;
+	options.chunkBytes	= 100;
+	options.threads		= 2;
+
+	IcuSqlite3Importer importer(db);
+	ICUSQLITE_TEST_CHECK(importer.Import(json.data(), json.size(), "j", options));
+	ICUSQLITE_TEST_CHECK(501 == Count(db, "SELECT count(*) FROM j;"));
+	ICUSQLITE_TEST_CHECK("integer|x\xC3\xA9\"q|[1, {\"k\": \"]\"}]|real" ==
+		Text(db, "SELECT typeof(a) || '|' || b || '|' || c || '|' || typeof(d) FROM j WHERE a = 7;"));
+	ICUSQLITE_TEST_CHECK(-1500 == Count(db, "SELECT d FROM j WHERE a = 7;"));
+	ICUSQLITE_TEST_CHECK(1 == Count(db, "SELECT count(*) FROM j WHERE a IS NULL AND b = 1 AND d IS NULL;"));
+
+	//	a malformed line with no allowance fails the whole import
+	const std::string bad = json + "{\"a\": \n";
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("DELETE FROM j;"));
+	ICUSQLITE_TEST_CHECK(!importer.Import(bad.data(), bad.size(), "j", options));
+	ICUSQLITE_TEST_CHECK(0 == Count(db, "SELECT count(*) FROM j;"));
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-import.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-import.db"));
+	TestCsvQuotingAcrossChunks(db);
+	TestCsvBomAndHeader(db);
+	TestBadRowLimit(db);
+	TestCallersTransaction(db);
+	TestNdjson(db);
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-import.db");
+	return IcuSqlite3TestResult("TestImport");
+}
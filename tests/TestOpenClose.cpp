@@ -0,0 +1,115 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Open / Close bookkeeping: connection counts and threading modes
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+static int OpenCount()
+{
+	return IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED) +
+		IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SINGLE_OWNER);
+}
+
+//
+//	A failed Open() must not decrement a count it never took
+//
+static void TestFailedOpenKeepsCount()
+{
+	const int before = OpenCount();
+	{
+		IcuSqlite3Database db;
+		ICUSQLITE_TEST_CHECK(!db.Open("no-such-dir/test-open.db", ICUSQLITE_OPEN_READWRITE));
+		ICUSQLITE_TEST_CHECK(!db.IsOpen());
+		ICUSQLITE_TEST_CHECK(before == OpenCount());
+		db.Close();
+	}
+	ICUSQLITE_TEST_CHECK(before == OpenCount());
+}
+
+static void TestOpenCloseCounts()
+{
+	IcuSqlite3TestRemoveDb("test-open.db");
+
+	const int before = IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED);
+	{
+		IcuSqlite3Database db;
+		ICUSQLITE_TEST_CHECK(db.Open("test-open.db"));
+		ICUSQLITE_TEST_CHECK(before + 1 == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED));
+		db.Close();
+		db.Close();
+		ICUSQLITE_TEST_CHECK(before == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED));
+	}
+	ICUSQLITE_TEST_CHECK(before == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED));
+
+	IcuSqlite3TestRemoveDb("test-open.db");
+}
+
+//
+//	ICUSQLITE_OPEN_NOMUTEX picks single owner mode for one connection only
+//
+static void TestNoMutexIsPerConnection()
+{
+	IcuSqlite3TestRemoveDb("test-open.db");
+
+	const int serialized	= IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED);
+	const int singleOwner	= IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SINGLE_OWNER);
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-open.db", 
+		ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE | ICUSQLITE_OPEN_NOMUTEX));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_THREADING_SINGLE_OWNER == db.GetThreadingMode());
+	ICUSQLITE_TEST_CHECK(singleOwner + 1 == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SINGLE_OWNER));
+	db.Close();
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_THREADING_SERIALIZED == db.GetThreadingMode());
+
+	ICUSQLITE_TEST_CHECK(db.Open("test-open.db", 
+		ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE | ICUSQLITE_OPEN_FULLMUTEX));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_THREADING_SERIALIZED == db.GetThreadingMode());
+	ICUSQLITE_TEST_CHECK(serialized + 1 == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED));
+	ICUSQLITE_TEST_CHECK(singleOwner == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SINGLE_OWNER));
+	db.Close();
+
+	//	an explicit SetThreadingMode() sticks across opens
+	ICUSQLITE_TEST_CHECK(db.SetThreadingMode(ICUSQLITE_THREADING_SINGLE_OWNER));
+	ICUSQLITE_TEST_CHECK(db.Open("test-open.db"));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_THREADING_SINGLE_OWNER == db.GetThreadingMode());
+	db.Close();
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_THREADING_SINGLE_OWNER == db.GetThreadingMode());
+
+	ICUSQLITE_TEST_CHECK(serialized == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SERIALIZED));
+	ICUSQLITE_TEST_CHECK(singleOwner == IcuSqlite3Database::GetOpenConnectionCount(ICUSQLITE_THREADING_SINGLE_OWNER));
+
+	IcuSqlite3TestRemoveDb("test-open.db");
+}
+
+int main()
+{
+	TestFailedOpenKeepsCount();
+	TestOpenCloseCounts();
+	TestNoMutexIsPerConnection();
+	return IcuSqlite3TestResult("TestOpenClose");
+}
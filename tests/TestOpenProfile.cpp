@@ -0,0 +1,127 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Open profiles: the PRAGMA batch run by Open() and ApplyOpenProfile()
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+static int64_t Pragma(IcuSqlite3Database& db, const char* sql)
+{
+	int64_t value = -12345;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+static void TestEmptyProfile()
+{
+	IcuSqlite3OpenProfile profile;
+	ICUSQLITE_TEST_CHECK(profile.IsEmpty());
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_PRAGMA_UNSET == profile.synchronous);
+
+	profile.cacheSize = -1024;
+	ICUSQLITE_TEST_CHECK(!profile.IsEmpty());
+
+	ICUSQLITE_TEST_CHECK(!IcuSqlite3OpenProfile::BulkLoad().IsEmpty());
+	ICUSQLITE_TEST_CHECK(!IcuSqlite3OpenProfile::OLTP().IsEmpty());
+	ICUSQLITE_TEST_CHECK(!IcuSqlite3OpenProfile::ReadMostlyAnalytics().IsEmpty());
+}
+
+//
+//	Open() applies the profile, including page_size on a new database
+//
+static void TestOpenWithProfile()
+{
+	IcuSqlite3TestRemoveDb("test-profile.db");
+
+	const IcuSqlite3OpenProfile bulk = IcuSqlite3OpenProfile::BulkLoad();
+
+	IcuSqlite3Database db;
+	db.SetOpenProfile(bulk);
+	ICUSQLITE_TEST_CHECK(db.Open("test-profile.db"));
+	ICUSQLITE_TEST_CHECK(bulk.synchronous == Pragma(db, "PRAGMA synchronous;"));
+	ICUSQLITE_TEST_CHECK(bulk.cacheSize == Pragma(db, "PRAGMA cache_size;"));
+	ICUSQLITE_TEST_CHECK(bulk.tempStore == Pragma(db, "PRAGMA temp_store;"));
+	ICUSQLITE_TEST_CHECK(bulk.pageSize == Pragma(db, "PRAGMA page_size;"));
+	ICUSQLITE_TEST_CHECK(bulk.journalSizeLimit == Pragma(db, "PRAGMA journal_size_limit;"));
+
+	UnicodeString lockingMode;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("PRAGMA locking_mode;", lockingMode));
+	ICUSQLITE_TEST_CHECK(lockingMode.caseCompare("exclusive", 0) == 0);
+
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a);"));
+	db.Close();
+
+	//	page_size is fixed once the database exists; the rest re-applies
+	IcuSqlite3OpenProfile oltp = IcuSqlite3OpenProfile::OLTP();
+	oltp.pageSize = 4096;
+	db.SetOpenProfile(oltp);
+	ICUSQLITE_TEST_CHECK(db.Open("test-profile.db"));
+	ICUSQLITE_TEST_CHECK(bulk.pageSize == Pragma(db, "PRAGMA page_size;"));
+	ICUSQLITE_TEST_CHECK(oltp.synchronous == Pragma(db, "PRAGMA synchronous;"));
+	ICUSQLITE_TEST_CHECK(oltp.cacheSize == Pragma(db, "PRAGMA cache_size;"));
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-profile.db");
+}
+
+//
+//	ApplyOpenProfile() re-tunes an open connection and reports what took
+//
+static void TestApplyOpenProfile()
+{
+	IcuSqlite3TestRemoveDb("test-profile.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-profile.db"));
+
+	const IcuSqlite3OpenProfile oltp = IcuSqlite3OpenProfile::OLTP();
+	IcuSqlite3OpenProfile effective;
+	ICUSQLITE_TEST_CHECK(db.ApplyOpenProfile(oltp, &effective));
+	ICUSQLITE_TEST_CHECK(oltp.synchronous == effective.synchronous);
+	ICUSQLITE_TEST_CHECK(oltp.cacheSize == effective.cacheSize);
+	ICUSQLITE_TEST_CHECK(oltp.tempStore == effective.tempStore);
+	ICUSQLITE_TEST_CHECK(oltp.cacheSize == Pragma(db, "PRAGMA cache_size;"));
+
+	//	only the members that are set are touched
+	IcuSqlite3OpenProfile partial;
+	partial.cacheSize = 123;
+	ICUSQLITE_TEST_CHECK(db.ApplyOpenProfile(partial));
+	ICUSQLITE_TEST_CHECK(123 == Pragma(db, "PRAGMA cache_size;"));
+	ICUSQLITE_TEST_CHECK(oltp.synchronous == Pragma(db, "PRAGMA synchronous;"));
+
+	db.Close();
+	ICUSQLITE_TEST_CHECK(!db.ApplyOpenProfile(oltp));
+
+	IcuSqlite3TestRemoveDb("test-profile.db");
+}
+
+int main()
+{
+	TestEmptyProfile();
+	TestOpenWithProfile();
+	TestApplyOpenProfile();
+	return IcuSqlite3TestResult("TestOpenProfile");
+}
@@ -0,0 +1,104 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Prefetching result sets against the lifetime of their connection
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Prefetch.h"
+
+static void Fill(IcuSqlite3Database& db, const int rows)
+{
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a INTEGER, b TEXT);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate(IcuSqlite3StatementBuffer().Format(
+		"WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < %d) "
+		"INSERT INTO t SELECT i, 'row ' || i FROM n;", rows)));
+}
+
+//
+//	Close() stops a producer still stepping on the connection
+//
+static void TestCloseStopsPrefetch()
+{
+	IcuSqlite3TestRemoveDb("test-prefetch.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-prefetch.db"));
+	Fill(db, 20000);
+
+	IcuSqlite3PrefetchOptions options;
+	options.rowsPerChunk	= 16;
+	options.queuedChunks	= 2;
+
+	IcuSqlite3PrefetchResultSet first(db);
+	IcuSqlite3PrefetchResultSet second(db);
+	ICUSQLITE_TEST_CHECK(first.Execute("SELECT a, b FROM t;", options));
+	ICUSQLITE_TEST_CHECK(second.Execute("SELECT b FROM t ORDER BY a DESC;", options));
+	ICUSQLITE_TEST_CHECK(first.NextRow());
+	ICUSQLITE_TEST_CHECK(1 == first.GetInt(0));
+
+	db.Close();
+
+	ICUSQLITE_TEST_CHECK(!db.IsOpen());
+	ICUSQLITE_TEST_CHECK(first.Eof());
+	ICUSQLITE_TEST_CHECK(!first.NextRow());
+	ICUSQLITE_TEST_CHECK(!second.NextRow());
+	ICUSQLITE_TEST_CHECK(!first.Execute("SELECT 1;"));
+
+	IcuSqlite3TestRemoveDb("test-prefetch.db");
+}
+
+//
+//	A result set finalized before Close() is forgotten by the connection
+//
+static void TestFinalizeBeforeClose()
+{
+	IcuSqlite3TestRemoveDb("test-prefetch.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-prefetch.db"));
+	Fill(db, 100);
+
+	{
+		IcuSqlite3PrefetchResultSet rows(db);
+		ICUSQLITE_TEST_CHECK(rows.Execute("SELECT a FROM t;"));
+		int count = 0;
+		while(rows.NextRow()) {
+			++count;
+		}
+		ICUSQLITE_TEST_CHECK(100 == count);
+		ICUSQLITE_TEST_CHECK(rows.IsOk());
+	}
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-prefetch.db");
+}
+
+int main()
+{
+	TestCloseStopsPrefetch();
+	TestFinalizeBeforeClose();
+	return IcuSqlite3TestResult("TestPrefetch");
+}
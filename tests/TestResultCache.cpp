@@ -0,0 +1,176 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	IcuSqlite3ResultCache: hits, and invalidation on local writes, other
+//	connections' commits and schema changes
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Cache.h"
+
+//
+//	Runs |sql| and checks where the single value came from
+//
+static int64_t Query(IcuSqlite3ResultCache& cache, const char* sql, const bool expectHit,
+	const IcuSqlite3QueryParams& params = IcuSqlite3QueryParams())
+{
+	IcuSqlite3CachedResult result = cache.ExecuteQuery(sql, params);
+	ICUSQLITE_TEST_CHECK(result.IsOk());
+	ICUSQLITE_TEST_CHECK(expectHit == result.IsFromCache());
+	ICUSQLITE_TEST_CHECK(result.NextRow());
+	const int64_t value = result.GetInt64(0);
+	ICUSQLITE_TEST_CHECK(!result.NextRow());
+	return value;
+}
+
+static const char* kSumT	= "SELECT sum(a) FROM t;";
+static const char* kSumU	= "SELECT sum(b) FROM u;";
+
+static void TestHits(IcuSqlite3ResultCache& cache)
+{
+	ICUSQLITE_TEST_CHECK(6 == Query(cache, kSumT, false));
+	ICUSQLITE_TEST_CHECK(6 == Query(cache, kSumT, true));
+
+	//	comments and whitespace don't change the key
+	ICUSQLITE_TEST_CHECK(6 == Query(cache, "SELECT  sum(a)\n\tFROM t -- total\n;", true));
+
+	//	bindings do
+	IcuSqlite3QueryParams one;
+	one.Bind(1, 1);
+	IcuSqlite3QueryParams two;
+	two.Bind(1, 2);
+	const char* filtered = "SELECT count(*) FROM t WHERE a > ?;";
+	ICUSQLITE_TEST_CHECK(2 == Query(cache, filtered, false, one));
+	ICUSQLITE_TEST_CHECK(1 == Query(cache, filtered, false, two));
+	ICUSQLITE_TEST_CHECK(2 == Query(cache, filtered, true, one));
+
+	IcuSqlite3ResultCacheMetrics metrics;
+	cache.GetMetrics(metrics);
+	ICUSQLITE_TEST_CHECK(3 == metrics.hits);
+	ICUSQLITE_TEST_CHECK(3 == metrics.misses);
+	ICUSQLITE_TEST_CHECK(3 == metrics.entries);
+}
+
+//
+//	A write on this connection drops only entries reading that table
+//
+static void TestLocalWrites(IcuSqlite3Database& db, IcuSqlite3ResultCache& cache)
+{
+	ICUSQLITE_TEST_CHECK(6 == Query(cache, kSumT, true));
+	ICUSQLITE_TEST_CHECK(10 == Query(cache, kSumU, false));
+
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (4);"));
+	ICUSQLITE_TEST_CHECK(10 == Query(cache, kSumT, false));
+	ICUSQLITE_TEST_CHECK(10 == Query(cache, kSumU, true));
+
+	//	DELETE of every row skips the update hook; everything goes
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("DELETE FROM u;"));
+	ICUSQLITE_TEST_CHECK(0 == Query(cache, "SELECT count(*) FROM u;", false));
+	ICUSQLITE_TEST_CHECK(10 == Query(cache, kSumT, false));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO u VALUES (10);"));
+
+	//	explicit invalidation
+	ICUSQLITE_TEST_CHECK(10 == Query(cache, kSumT, true));
+	cache.InvalidateTable("t");
+	ICUSQLITE_TEST_CHECK(10 == Query(cache, kSumT, false));
+}
+
+static void TestOtherConnection(IcuSqlite3Database& other, IcuSqlite3ResultCache& cache)
+{
+	ICUSQLITE_TEST_CHECK(10 == Query(cache, kSumT, true));
+	ICUSQLITE_TEST_CHECK(1 == other.ExecuteUpdate("INSERT INTO t VALUES (5);"));
+	ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, false));
+	ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, true));
+}
+
+static void TestSchemaChange(IcuSqlite3Database& db, IcuSqlite3ResultCache& cache)
+{
+	ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, true));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("ALTER TABLE u ADD COLUMN c INTEGER;"));
+	ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, false));
+
+	IcuSqlite3ResultCacheMetrics metrics;
+	cache.GetMetrics(metrics);
+	ICUSQLITE_TEST_CHECK(metrics.flushes >= 2);
+}
+
+static void TestUncacheable(IcuSqlite3Database& db, IcuSqlite3ResultCache& cache)
+{
+	const char* volatileSql = "SELECT random() IS NOT NULL;";
+	ICUSQLITE_TEST_CHECK(1 == Query(cache, volatileSql, false));
+	ICUSQLITE_TEST_CHECK(1 == Query(cache, volatileSql, false));
+
+	//	inside a transaction hits are served, misses are not kept
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, true));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (6);"));
+	ICUSQLITE_TEST_CHECK(21 == Query(cache, kSumT, false));
+	ICUSQLITE_TEST_CHECK(21 == Query(cache, kSumT, false));
+	ICUSQLITE_TEST_CHECK(db.Rollback());
+	ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, false));
+
+	IcuSqlite3ResultCacheMetrics metrics;
+	cache.GetMetrics(metrics);
+	ICUSQLITE_TEST_CHECK(metrics.uncacheable >= 4);
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-cache.db");
+
+	IcuSqlite3Database db;
+	IcuSqlite3Database other;
+	ICUSQLITE_TEST_CHECK(db.Open("test-cache.db"));
+	ICUSQLITE_TEST_CHECK(other.Open("test-cache.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a INTEGER);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE u (b INTEGER);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("INSERT INTO t VALUES (1), (2), (3);"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("INSERT INTO u VALUES (10);"));
+
+	{
+		IcuSqlite3ResultCache cache(db);
+		ICUSQLITE_TEST_CHECK(cache.Attach());
+		ICUSQLITE_TEST_CHECK(cache.IsAttached());
+
+		TestHits(cache);
+		TestLocalWrites(db, cache);
+		TestOtherConnection(other, cache);
+		TestSchemaChange(db, cache);
+		TestUncacheable(db, cache);
+
+		//	detached, queries just execute
+		cache.Detach();
+		ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, false));
+		ICUSQLITE_TEST_CHECK(15 == Query(cache, kSumT, false));
+
+		ICUSQLITE_TEST_CHECK(cache.Attach());
+		db.Close();
+		ICUSQLITE_TEST_CHECK(!cache.IsAttached());
+	}
+
+	other.Close();
+	IcuSqlite3TestRemoveDb("test-cache.db");
+	return IcuSqlite3TestResult("TestResultCache");
+}
@@ -0,0 +1,237 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	RunInTransaction(): error classification and which failures are retried
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//
+//	SQLite result codes, spelled out since tests don't include sqlite3.h
+//
+static const int kOk				= 0;
+static const int kError				= 1;
+static const int kBusy				= 5;
+static const int kLocked			= 6;
+static const int kConstraint		= 19;
+static const int kDone				= 101;
+static const int kBusyRecovery		= kBusy | (1 << 8);
+static const int kBusySnapshot		= kBusy | (2 << 8);
+static const int kLockedSharedCache	= kLocked | (1 << 8);
+
+static void TestClassifyError()
+{
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_NONE == IcuSqlite3Database::ClassifyError(kOk));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_NONE == IcuSqlite3Database::ClassifyError(kDone));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_CONFLICT == IcuSqlite3Database::ClassifyError(kBusySnapshot));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_BUSY == IcuSqlite3Database::ClassifyError(kBusy));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_BUSY == IcuSqlite3Database::ClassifyError(kBusyRecovery));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_BUSY == IcuSqlite3Database::ClassifyError(kLocked));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_BUSY == IcuSqlite3Database::ClassifyError(kLockedSharedCache));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_FATAL == IcuSqlite3Database::ClassifyError(kError));
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_ERROR_CLASS_FATAL == IcuSqlite3Database::ClassifyError(kConstraint));
+}
+
+static IcuSqlite3RetryPolicy FastPolicy()
+{
+	IcuSqlite3RetryPolicy policy;
+	policy.maxAttempts		= 3;
+	policy.initialDelayMs	= 1;
+	policy.maxDelayMs		= 2;
+	return policy;
+}
+
+static int64_t Count(IcuSqlite3Database& db)
+{
+	int64_t count = -1;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT count(*) FROM t;", count));
+	return count;
+}
+
+//
+//	Lock contention is retried; the other writer finishes during attempt 1
+//
+static void TestBusyRetried(IcuSqlite3Database& db, IcuSqlite3Database& other)
+{
+	const int64_t before = Count(db);
+	ICUSQLITE_TEST_CHECK(other.Begin(ICUSQLITE_TRANSACTION_IMMEDIATE));
+	ICUSQLITE_TEST_CHECK(1 == other.ExecuteUpdate("INSERT INTO t VALUES (1);"));
+
+	db.ResetRetryMetrics();
+	int calls = 0;
+	ICUSQLITE_TEST_CHECK(db.RunInTransaction([&](IcuSqlite3Database& conn) {
+		const bool ok = (1 == conn.ExecuteUpdate("INSERT INTO t VALUES (2);"));
+		if(1 == ++calls) {
+			ICUSQLITE_TEST_CHECK(!ok);
+			ICUSQLITE_TEST_CHECK(other.Commit());
+		}
+		return ok;
+	}, FastPolicy()));
+	ICUSQLITE_TEST_CHECK(2 == calls);
+	ICUSQLITE_TEST_CHECK(before + 2 == Count(db));
+
+	IcuSqlite3RetryMetrics metrics;
+	ICUSQLITE_TEST_CHECK(db.GetRetryMetrics(metrics));
+	ICUSQLITE_TEST_CHECK(1 == metrics.transactions);
+	ICUSQLITE_TEST_CHECK(1 == metrics.commits);
+	ICUSQLITE_TEST_CHECK(2 == metrics.attempts);
+	ICUSQLITE_TEST_CHECK(1 == metrics.retries);
+	ICUSQLITE_TEST_CHECK(1 == metrics.busy);
+	ICUSQLITE_TEST_CHECK(0 == metrics.failures);
+	ICUSQLITE_TEST_CHECK(kBusy == (metrics.lastErrorCode & 0xff));
+}
+
+//
+//	Contention that outlasts maxAttempts gives up
+//
+static void TestBusyGivesUp(IcuSqlite3Database& db, IcuSqlite3Database& other)
+{
+	const int64_t before = Count(db);
+	ICUSQLITE_TEST_CHECK(other.Begin(ICUSQLITE_TRANSACTION_IMMEDIATE));
+
+	db.ResetRetryMetrics();
+	int calls = 0;
+	ICUSQLITE_TEST_CHECK(!db.RunInTransaction([&](IcuSqlite3Database& conn) {
+		++calls;
+		return 1 == conn.ExecuteUpdate("INSERT INTO t VALUES (3);");
+	}, FastPolicy()));
+	ICUSQLITE_TEST_CHECK(3 == calls);
+	ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+	ICUSQLITE_TEST_CHECK(other.Commit());
+	ICUSQLITE_TEST_CHECK(before == Count(db));
+
+	IcuSqlite3RetryMetrics metrics;
+	ICUSQLITE_TEST_CHECK(db.GetRetryMetrics(metrics));
+	ICUSQLITE_TEST_CHECK(3 == metrics.attempts);
+	ICUSQLITE_TEST_CHECK(2 == metrics.retries);
+	ICUSQLITE_TEST_CHECK(1 == metrics.failures);
+	ICUSQLITE_TEST_CHECK(0 == metrics.commits);
+}
+
+//
+//	A deferred read-then-write whose snapshot went stale is a conflict;
+//	the retry begins IMMEDIATE
+//
+static void TestConflictEscalates(IcuSqlite3Database& db, IcuSqlite3Database& other)
+{
+	db.ResetRetryMetrics();
+	int calls = 0;
+	ICUSQLITE_TEST_CHECK(db.RunInTransaction([&](IcuSqlite3Database& conn) {
+		const int64_t seen = Count(conn);
+		if(1 == ++calls) {
+			ICUSQLITE_TEST_CHECK(1 == other.ExecuteUpdate("INSERT INTO t VALUES (4);"));
+		}
+		return seen >= 0 && 1 == conn.ExecuteUpdate("INSERT INTO t VALUES (5);");
+	}, FastPolicy()));
+	ICUSQLITE_TEST_CHECK(2 == calls);
+
+	IcuSqlite3RetryMetrics metrics;
+	ICUSQLITE_TEST_CHECK(db.GetRetryMetrics(metrics));
+	ICUSQLITE_TEST_CHECK(1 == metrics.conflicts);
+	ICUSQLITE_TEST_CHECK(1 == metrics.escalations);
+	ICUSQLITE_TEST_CHECK(1 == metrics.commits);
+	ICUSQLITE_TEST_CHECK(kBusySnapshot == metrics.lastErrorCode);
+}
+
+//
+//	Fatal errors and plain false are not retried, and roll back
+//
+static void TestNotRetried(IcuSqlite3Database& db)
+{
+	db.ResetRetryMetrics();
+	const int64_t before = Count(db);
+
+	int calls = 0;
+	ICUSQLITE_TEST_CHECK(!db.RunInTransaction([&](IcuSqlite3Database& conn) {
+		++calls;
+		conn.ExecuteUpdate("INSERT INTO t VALUES (6);");
+		return 1 == conn.ExecuteUpdate("INSERT INTO no_such_table VALUES (6);");
+	}, FastPolicy()));
+	ICUSQLITE_TEST_CHECK(1 == calls);
+
+	ICUSQLITE_TEST_CHECK(!db.RunInTransaction([&](IcuSqlite3Database& conn) {
+		++calls;
+		conn.ExecuteUpdate("INSERT INTO t VALUES (7);");
+		return false;
+	}, FastPolicy()));
+	ICUSQLITE_TEST_CHECK(2 == calls);
+	ICUSQLITE_TEST_CHECK(before == Count(db));
+	ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+
+	IcuSqlite3RetryMetrics metrics;
+	ICUSQLITE_TEST_CHECK(db.GetRetryMetrics(metrics));
+	ICUSQLITE_TEST_CHECK(2 == metrics.attempts);
+	ICUSQLITE_TEST_CHECK(0 == metrics.retries);
+	ICUSQLITE_TEST_CHECK(2 == metrics.failures);
+}
+
+//
+//	Inside someone else's transaction the work runs once, in a savepoint
+//
+static void TestNested(IcuSqlite3Database& db)
+{
+	const int64_t before = Count(db);
+
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(db.RunInTransaction([](IcuSqlite3Database& conn) {
+		return 1 == conn.ExecuteUpdate("INSERT INTO t VALUES (8);");
+	}));
+	ICUSQLITE_TEST_CHECK(!db.RunInTransaction([](IcuSqlite3Database& conn) {
+		conn.ExecuteUpdate("INSERT INTO t VALUES (9);");
+		return false;
+	}));
+	ICUSQLITE_TEST_CHECK(!db.IsAutoCommitMode());
+	ICUSQLITE_TEST_CHECK(before + 1 == Count(db));
+	ICUSQLITE_TEST_CHECK(db.Commit());
+	ICUSQLITE_TEST_CHECK(before + 1 == Count(db));
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-retry.db");
+
+	TestClassifyError();
+
+	IcuSqlite3Database db;
+	IcuSqlite3Database other;
+	ICUSQLITE_TEST_CHECK(db.Open("test-retry.db",
+		ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE, ICUSQLITE_EXT_OPEN_DEFAULT | ICUSQLITE_EXT_OPEN_WAL));
+	ICUSQLITE_TEST_CHECK(other.Open("test-retry.db",
+		ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE, ICUSQLITE_EXT_OPEN_DEFAULT | ICUSQLITE_EXT_OPEN_WAL));
+	ICUSQLITE_TEST_CHECK(db.SetBusyTimeout(0));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a INTEGER);"));
+
+	TestBusyRetried(db, other);
+	TestBusyGivesUp(db, other);
+	TestConflictEscalates(db, other);
+	TestNotRetried(db);
+	TestNested(db);
+
+	other.Close();
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-retry.db");
+	return IcuSqlite3TestResult("TestRetry");
+}
@@ -0,0 +1,168 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	IcuSqlite3Savepoint: nesting, partial rollback and commit on destroy
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+static std::string Rows(IcuSqlite3Database& db)
+{
+	std::string rows;
+	db.ExecuteScalar("SELECT ifnull(group_concat(a, ','), '') FROM (SELECT a FROM t ORDER BY a);", rows);
+	return rows;
+}
+
+static void Reset(IcuSqlite3Database& db)
+{
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("DELETE FROM t;"));
+}
+
+static void TestNesting(IcuSqlite3Database& db)
+{
+	Reset(db);
+	{
+		IcuSqlite3Savepoint outer(&db);
+		ICUSQLITE_TEST_CHECK(outer.IsOpen());
+		ICUSQLITE_TEST_CHECK(outer.IsOutermost());
+		ICUSQLITE_TEST_CHECK(!db.IsAutoCommitMode());
+		ICUSQLITE_TEST_CHECK(outer.Execute("INSERT INTO t VALUES (1);"));
+
+		int innerLevel = 0;
+		{
+			IcuSqlite3Savepoint inner(&db);
+			innerLevel = inner.GetLevel();
+			ICUSQLITE_TEST_CHECK(!inner.IsOutermost());
+			ICUSQLITE_TEST_CHECK(inner.Execute("INSERT INTO t VALUES (2);"));
+			{
+				IcuSqlite3Savepoint innermost(&db);
+				ICUSQLITE_TEST_CHECK(innerLevel < innermost.GetLevel());
+				ICUSQLITE_TEST_CHECK(innermost.Execute("INSERT INTO t VALUES (3);"));
+			}
+			ICUSQLITE_TEST_CHECK("1,2,3" == Rows(db));
+
+			//	a failure in this scope undoes 2 and the released 3 with it
+			ICUSQLITE_TEST_CHECK(!inner.Execute("INSERT INTO no_such_table VALUES (4);"));
+			ICUSQLITE_TEST_CHECK(!inner.IsOk());
+		}
+		ICUSQLITE_TEST_CHECK("1" == Rows(db));
+		ICUSQLITE_TEST_CHECK(outer.IsOk());
+
+		{
+			IcuSqlite3Savepoint inner(&db);
+			ICUSQLITE_TEST_CHECK(innerLevel == inner.GetLevel());	//	level reused
+			ICUSQLITE_TEST_CHECK(inner.Execute("INSERT INTO t VALUES (5);"));
+		}
+	}
+	ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+	ICUSQLITE_TEST_CHECK("1,5" == Rows(db));
+}
+
+static void TestExplicitEnd(IcuSqlite3Database& db)
+{
+	Reset(db);
+	{
+		IcuSqlite3Savepoint outer(&db);
+		ICUSQLITE_TEST_CHECK(outer.Execute("INSERT INTO t VALUES (1);"));
+
+		IcuSqlite3Savepoint inner(&db);
+		ICUSQLITE_TEST_CHECK(inner.Execute("INSERT INTO t VALUES (2);"));
+		ICUSQLITE_TEST_CHECK(inner.Rollback());
+		ICUSQLITE_TEST_CHECK(!inner.IsOpen());
+		ICUSQLITE_TEST_CHECK("1" == Rows(db));
+
+		//	ending a scope twice is harmless
+		ICUSQLITE_TEST_CHECK(!inner.Commit());
+
+		ICUSQLITE_TEST_CHECK(outer.Commit());
+		ICUSQLITE_TEST_CHECK(!outer.IsOpen());
+		ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+	}
+	ICUSQLITE_TEST_CHECK("1" == Rows(db));
+
+	//	the outermost rollback drops inner work that was released
+	{
+		IcuSqlite3Savepoint outer(&db);
+		{
+			IcuSqlite3Savepoint inner(&db);
+			ICUSQLITE_TEST_CHECK(inner.Execute("INSERT INTO t VALUES (2);"));
+		}
+		ICUSQLITE_TEST_CHECK(outer.Rollback());
+	}
+	ICUSQLITE_TEST_CHECK("1" == Rows(db));
+
+	//	without commitOnDestroy a scope rolls back
+	{
+		IcuSqlite3Savepoint outer(&db, ICUSQLITE_TRANSACTION_IMMEDIATE, false);
+		ICUSQLITE_TEST_CHECK(outer.Execute("INSERT INTO t VALUES (3);"));
+	}
+	ICUSQLITE_TEST_CHECK("1" == Rows(db));
+}
+
+//
+//	Inside a transaction begun elsewhere even the first scope is a
+//	savepoint; the transaction's owner still decides
+//
+static void TestInsideTransaction(IcuSqlite3Database& db)
+{
+	Reset(db);
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (1);"));
+	{
+		IcuSqlite3Savepoint scope(&db);
+		ICUSQLITE_TEST_CHECK(!scope.IsOutermost());
+		ICUSQLITE_TEST_CHECK(scope.Execute("INSERT INTO t VALUES (2);"));
+		ICUSQLITE_TEST_CHECK(scope.Rollback());
+	}
+	ICUSQLITE_TEST_CHECK(!db.IsAutoCommitMode());
+	{
+		IcuSqlite3Savepoint scope(&db);
+		ICUSQLITE_TEST_CHECK(scope.Execute("INSERT INTO t VALUES (3);"));
+	}
+	ICUSQLITE_TEST_CHECK(!db.IsAutoCommitMode());
+	ICUSQLITE_TEST_CHECK(db.Rollback());
+	ICUSQLITE_TEST_CHECK("" == Rows(db));
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-savepoint.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-savepoint.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a INTEGER);"));
+	TestNesting(db);
+	TestExplicitEnd(db);
+	TestInsideTransaction(db);
+	db.Close();
+
+	//	control statements are prepared afresh after a reopen
+	ICUSQLITE_TEST_CHECK(db.Open("test-savepoint.db"));
+	TestNesting(db);
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-savepoint.db");
+	return IcuSqlite3TestResult("TestSavepoint");
+}
@@ -0,0 +1,206 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Session extension: record, ship, apply, invert and resolve conflicts
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Session.h"
+
+#if ICUSQLITE_HAVE_SESSION
+
+#include <string.h>
+
+class IcuSqlite3TestResolver : public IcuSqlite3ChangesetConflictHandler
+{
+public:
+	IcuSqlite3TestResolver(const EIcuSqlite3ChangesetResolution resolution, const bool filter = true)
+		: conflicts(0), lastConflict(ICUSQLITE_CHANGESET_DATA), m_resolution(resolution), m_filter(filter)
+	{
+	}
+
+	virtual bool Filter(const char* /*table*/) { return m_filter; }
+
+	virtual EIcuSqlite3ChangesetResolution OnConflict(
+		const EIcuSqlite3ChangesetConflict conflict,
+		const IcuSqlite3ChangesetChange& change)
+	{
+		++conflicts;
+		lastConflict = conflict;
+		ICUSQLITE_TEST_CHECK(0 == strcmp("t", change.GetTable()));
+		ICUSQLITE_TEST_CHECK(2 == change.GetColumnCount());
+
+		IcuSqlite3ChangesetValueView current;
+		if(change.GetValue(ICUSQLITE_CHANGESET_CURRENT, 1, current)) {
+			lastCurrent.assign(reinterpret_cast<const char*>(current.blob.data), current.blob.length);
+		}
+		return m_resolution;
+	}
+
+	int								conflicts;
+	EIcuSqlite3ChangesetConflict	lastConflict;
+	std::string						lastCurrent;
+
+private:
+	EIcuSqlite3ChangesetResolution	m_resolution;
+	bool							m_filter;
+};
+
+static bool OpenReplica(IcuSqlite3Database& db)
+{
+	return db.Open(":memory:") &&
+		-1 != db.ExecuteUpdate("CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT);");
+}
+
+static std::string Dump(IcuSqlite3Database& db)
+{
+	std::string rows;
+	db.ExecuteScalar("SELECT ifnull(group_concat(id || '=' || v, ','), '') FROM (SELECT * FROM t ORDER BY id);", rows);
+	return rows;
+}
+
+static void TestReplicate()
+{
+	IcuSqlite3Database master;
+	IcuSqlite3Database replica;
+	ICUSQLITE_TEST_CHECK(OpenReplica(master));
+	ICUSQLITE_TEST_CHECK(OpenReplica(replica));
+
+	IcuSqlite3Session session(master);
+	ICUSQLITE_TEST_CHECK(session.Open());
+	ICUSQLITE_TEST_CHECK(session.Attach());
+	ICUSQLITE_TEST_CHECK(session.IsEmpty());
+
+	//	one changeset per transaction
+	ICUSQLITE_TEST_CHECK(master.Begin());
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("INSERT INTO t VALUES (1, 'one');"));
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("INSERT INTO t VALUES (2, 'two');"));
+	ICUSQLITE_TEST_CHECK(master.Commit());
+
+	IcuSqlite3Changeset first;
+	ICUSQLITE_TEST_CHECK(session.TakeChangeset(first));
+	ICUSQLITE_TEST_CHECK(!first.IsEmpty());
+	ICUSQLITE_TEST_CHECK(session.IsEmpty());
+
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("UPDATE t SET v = 'TWO' WHERE id = 2;"));
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("DELETE FROM t WHERE id = 1;"));
+
+	IcuSqlite3Changeset second;
+	ICUSQLITE_TEST_CHECK(session.TakeChangeset(second));
+
+	//	over the wire: a copy of the bytes applies the same
+	IcuSqlite3Changeset wire;
+	ICUSQLITE_TEST_CHECK(wire.Assign(first.GetData(), first.GetSize()));
+	ICUSQLITE_TEST_CHECK(wire.Apply(replica));
+	ICUSQLITE_TEST_CHECK("1=one,2=two" == Dump(replica));
+	ICUSQLITE_TEST_CHECK(second.Apply(replica));
+	ICUSQLITE_TEST_CHECK(Dump(master) == Dump(replica));
+
+	//	the inverse undoes the second transaction
+	IcuSqlite3Changeset inverse;
+	ICUSQLITE_TEST_CHECK(second.Invert(inverse));
+	ICUSQLITE_TEST_CHECK(inverse.Apply(replica));
+	ICUSQLITE_TEST_CHECK("1=one,2=two" == Dump(replica));
+
+	//	patchsets carry no old values, so can't be inverted
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("UPDATE t SET v = 'deux' WHERE id = 2;"));
+	IcuSqlite3Changeset patch;
+	ICUSQLITE_TEST_CHECK(session.TakeChangeset(patch, true));
+	ICUSQLITE_TEST_CHECK(patch.IsPatchset());
+	ICUSQLITE_TEST_CHECK(!patch.Invert(inverse));
+
+	//	both transactions as one
+	IcuSqlite3Changeset both;
+	ICUSQLITE_TEST_CHECK(IcuSqlite3Changeset::Concat(first, second, both));
+	IcuSqlite3Database fresh;
+	ICUSQLITE_TEST_CHECK(OpenReplica(fresh));
+	ICUSQLITE_TEST_CHECK(both.Apply(fresh));
+	ICUSQLITE_TEST_CHECK("2=TWO" == Dump(fresh));
+	fresh.Close();
+
+	session.Close();
+	master.Close();
+	replica.Close();
+}
+
+static void TestConflicts()
+{
+	IcuSqlite3Database master;
+	ICUSQLITE_TEST_CHECK(OpenReplica(master));
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("INSERT INTO t VALUES (2, 'two');"));
+
+	IcuSqlite3Session session(master);
+	ICUSQLITE_TEST_CHECK(session.Open());
+	ICUSQLITE_TEST_CHECK(session.Attach("t"));
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("INSERT INTO t VALUES (1, 'one');"));
+	ICUSQLITE_TEST_CHECK(1 == master.ExecuteUpdate("UPDATE t SET v = 'TWO' WHERE id = 2;"));
+
+	IcuSqlite3Changeset changes;
+	ICUSQLITE_TEST_CHECK(session.TakeChangeset(changes));
+	session.Close();
+
+	//	the replica changed row 2 itself
+	IcuSqlite3Database replica;
+	ICUSQLITE_TEST_CHECK(OpenReplica(replica));
+	ICUSQLITE_TEST_CHECK(1 == replica.ExecuteUpdate("INSERT INTO t VALUES (2, 'mine');"));
+
+	//	no handler: the conflict aborts everything
+	ICUSQLITE_TEST_CHECK(!changes.Apply(replica));
+	ICUSQLITE_TEST_CHECK("2=mine" == Dump(replica));
+
+	//	filtered out: nothing applies, no conflict raised
+	IcuSqlite3TestResolver skip(ICUSQLITE_CHANGESET_ABORT, false);
+	ICUSQLITE_TEST_CHECK(changes.Apply(replica, &skip));
+	ICUSQLITE_TEST_CHECK(0 == skip.conflicts);
+	ICUSQLITE_TEST_CHECK("2=mine" == Dump(replica));
+
+	//	omitted: the rest applies, row 2 stays
+	IcuSqlite3TestResolver omit(ICUSQLITE_CHANGESET_OMIT);
+	ICUSQLITE_TEST_CHECK(changes.Apply(replica, &omit));
+	ICUSQLITE_TEST_CHECK(1 == omit.conflicts);
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_CHANGESET_DATA == omit.lastConflict);
+	ICUSQLITE_TEST_CHECK("mine" == omit.lastCurrent);
+	ICUSQLITE_TEST_CHECK("1=one,2=mine" == Dump(replica));
+
+	//	replaced: the master's row wins (row 1 now conflicts too)
+	IcuSqlite3TestResolver replace(ICUSQLITE_CHANGESET_REPLACE);
+	ICUSQLITE_TEST_CHECK(changes.Apply(replica, &replace));
+	ICUSQLITE_TEST_CHECK(2 == replace.conflicts);
+	ICUSQLITE_TEST_CHECK("1=one,2=TWO" == Dump(replica));
+
+	master.Close();
+	replica.Close();
+}
+
+#endif	//	ICUSQLITE_HAVE_SESSION
+
+int main()
+{
+#if ICUSQLITE_HAVE_SESSION
+	TestReplicate();
+	TestConflicts();
+#endif	//	ICUSQLITE_HAVE_SESSION
+	return IcuSqlite3TestResult("TestSession");
+}
@@ -0,0 +1,168 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Shard executor: streamed merges and SUM overflow
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+#include "ICUSQLite3Shard.h"
+
+//	STL
+#include <climits>
+
+static const int SHARDS	= 4;
+static const int ROWS	= 20000;	//	per shard, many chunks each
+
+static void MakeShards()
+{
+	for(int shard = 0; shard < SHARDS; ++shard) {
+		char filename[32];
+		snprintf(filename, sizeof(filename), "test-shard-%d.db", shard);
+		IcuSqlite3TestRemoveDb(filename);
+
+		IcuSqlite3Database db;
+		ICUSQLITE_TEST_CHECK(db.Open(filename));
+		ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (k INTEGER, big INTEGER);"));
+		ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate(IcuSqlite3StatementBuffer().Format(
+			"WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM n WHERE i < %d) "
+			"INSERT INTO t SELECT i * %d + %d, %lld FROM n;", ROWS - 1, SHARDS, shard, (long long)(LLONG_MAX / 2))));
+		db.Close();
+	}
+}
+
+static void RemoveShards()
+{
+	for(int shard = 0; shard < SHARDS; ++shard) {
+		char filename[32];
+		snprintf(filename, sizeof(filename), "test-shard-%d.db", shard);
+		IcuSqlite3TestRemoveDb(filename);
+	}
+}
+
+static void AddShards(IcuSqlite3ShardExecutor& shards)
+{
+	for(int shard = 0; shard < SHARDS; ++shard) {
+		char filename[32];
+		snprintf(filename, sizeof(filename), "test-shard-%d.db", shard);
+		ICUSQLITE_TEST_CHECK(shards.AddShard(filename));
+	}
+}
+
+//
+//	One worker thread, more shards than threads: ORDERED needs every
+//	shard under way at once, which only works if shards that run ahead
+//	give their thread up
+//
+static void TestOrderedOneThread()
+{
+	IcuSqlite3ShardExecutor shards(1);
+	AddShards(shards);
+
+	IcuSqlite3ShardQuery query;
+	query.merge = ICUSQLITE_SHARD_MERGE_ORDERED;
+	query.orderBy.push_back(IcuSqlite3ShardSortKey(0));
+
+	IcuSqlite3ShardResult rows = shards.ExecuteQuery("SELECT k FROM t ORDER BY k;", query);
+	int64_t expect = 0;
+	bool ordered = true;
+	while(rows.NextRow()) {
+		ordered = ordered && (expect == rows.GetInt64(0));
+		++expect;
+	}
+	ICUSQLITE_TEST_CHECK(rows.IsOk());
+	ICUSQLITE_TEST_CHECK(ordered);
+	ICUSQLITE_TEST_CHECK(SHARDS * ROWS == expect);
+}
+
+//
+//	Two results open on the same shards, read in turn on one thread,
+//	plus a shard listed twice in one query
+//
+static void TestInterleaved()
+{
+	IcuSqlite3ShardExecutor shards(1);
+	AddShards(shards);
+
+	IcuSqlite3ShardQuery twice;
+	twice.shards.push_back(1);
+	twice.shards.push_back(1);
+
+	IcuSqlite3ShardResult first = shards.ExecuteQuery("SELECT k FROM t;");
+	IcuSqlite3ShardResult second = shards.ExecuteQuery("SELECT k FROM t;", twice);
+
+	int firstRows = 0;
+	int secondRows = 0;
+	while(second.NextRow()) {
+		++secondRows;
+	}
+	while(first.NextRow()) {
+		++firstRows;
+	}
+	ICUSQLITE_TEST_CHECK(first.IsOk() && second.IsOk());
+	ICUSQLITE_TEST_CHECK(SHARDS * ROWS == firstRows);
+	ICUSQLITE_TEST_CHECK(2 * ROWS == secondRows);
+
+	//	a result dropped part way doesn't hold its shards up
+	{
+		IcuSqlite3ShardResult dropped = shards.ExecuteQuery("SELECT k FROM t;");
+		ICUSQLITE_TEST_CHECK(dropped.NextRow());
+	}
+	IcuSqlite3ShardResult after = shards.ExecuteQuery("SELECT COUNT(*) FROM t;");
+	int64_t total = 0;
+	while(after.NextRow()) {
+		total += after.GetInt64(0);
+	}
+	ICUSQLITE_TEST_CHECK(SHARDS * ROWS == total);
+}
+
+//
+//	Partial SUMs past the int64 range continue in floating point
+//
+static void TestSumOverflow()
+{
+	IcuSqlite3ShardExecutor shards;
+	AddShards(shards);
+
+	IcuSqlite3ShardQuery query;
+	query.merge = ICUSQLITE_SHARD_MERGE_AGGREGATE;
+
+	//	each shard's own SUM() fits: LLONG_MAX / 2 once per shard
+	IcuSqlite3ShardResult rows = shards.ExecuteQuery("SELECT SUM(big) FROM t WHERE k < 4;", query);
+	ICUSQLITE_TEST_CHECK(rows.NextRow());
+	ICUSQLITE_TEST_CHECK(ICUSQLITE_COLUMN_TYPE_FLOAT == rows.GetColumnType(0));
+	const double expect = static_cast<double>(LLONG_MAX / 2) * SHARDS;
+	ICUSQLITE_TEST_CHECK(rows.GetDouble(0) > expect * 0.999 && rows.GetDouble(0) < expect * 1.001);
+	ICUSQLITE_TEST_CHECK(!rows.NextRow() && rows.IsOk());
+}
+
+int main()
+{
+	MakeShards();
+	TestOrderedOneThread();
+	TestInterleaved();
+	TestSumOverflow();
+	RemoveShards();
+	return IcuSqlite3TestResult("TestShard");
+}
@@ -0,0 +1,114 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Begin() / Commit() / Rollback() through the prepared control statements
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+static int64_t Count(IcuSqlite3Database& db)
+{
+	int64_t count = -1;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar("SELECT count(*) FROM t;", count));
+	return count;
+}
+
+static void TestTypes(IcuSqlite3Database& db)
+{
+	const EIcuSqlite3TransTypes types[] = {
+		ICUSQLITE_TRANSACTION_DEFAULT,
+		ICUSQLITE_TRANSACTION_DEFERRED,
+		ICUSQLITE_TRANSACTION_IMMEDIATE,
+		ICUSQLITE_TRANSACTION_EXCLUSIVE,
+	};
+
+	for(size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+		const int64_t before = Count(db);
+
+		ICUSQLITE_TEST_CHECK(db.Begin(types[i]));
+		ICUSQLITE_TEST_CHECK(!db.IsAutoCommitMode());
+		ICUSQLITE_TEST_CHECK(!db.Begin(types[i]));		//	no nesting
+		ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (1);"));
+		ICUSQLITE_TEST_CHECK(db.Commit());
+		ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+		ICUSQLITE_TEST_CHECK(before + 1 == Count(db));
+
+		ICUSQLITE_TEST_CHECK(db.Begin(types[i]));
+		ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (2);"));
+		ICUSQLITE_TEST_CHECK(db.Rollback());
+		ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+		ICUSQLITE_TEST_CHECK(before + 1 == Count(db));
+	}
+}
+
+static void TestOutsideTransaction(IcuSqlite3Database& db)
+{
+	ICUSQLITE_TEST_CHECK(db.IsAutoCommitMode());
+	ICUSQLITE_TEST_CHECK(!db.Commit());
+	ICUSQLITE_TEST_CHECK(!db.Rollback());
+
+	//	the statements are reset after a failure and still usable
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(db.Commit());
+}
+
+//
+//	Named savepoints share the control statement cache
+//
+static void TestNamedRollback(IcuSqlite3Database& db)
+{
+	const int64_t before = Count(db);
+
+	ICUSQLITE_TEST_CHECK(db.Begin());
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (1);"));
+	ICUSQLITE_TEST_CHECK(db.Savepoint("sp"));
+	ICUSQLITE_TEST_CHECK(1 == db.ExecuteUpdate("INSERT INTO t VALUES (2);"));
+	ICUSQLITE_TEST_CHECK(db.Rollback("sp"));
+	ICUSQLITE_TEST_CHECK(db.ReleaseSavepoint("sp"));
+	ICUSQLITE_TEST_CHECK(!db.IsAutoCommitMode());
+	ICUSQLITE_TEST_CHECK(db.Commit());
+	ICUSQLITE_TEST_CHECK(before + 1 == Count(db));
+}
+
+int main()
+{
+	IcuSqlite3TestRemoveDb("test-transaction.db");
+
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open("test-transaction.db"));
+	ICUSQLITE_TEST_CHECK(-1 != db.ExecuteUpdate("CREATE TABLE t (a INTEGER);"));
+	TestTypes(db);
+	TestOutsideTransaction(db);
+	TestNamedRollback(db);
+	db.Close();
+
+	//	finalized by Close(), prepared again on the next use
+	ICUSQLITE_TEST_CHECK(db.Open("test-transaction.db"));
+	TestTypes(db);
+	db.Close();
+
+	IcuSqlite3TestRemoveDb("test-transaction.db");
+	return IcuSqlite3TestResult("TestTransaction");
+}
@@ -0,0 +1,144 @@
+/*
+ Copyright (c) 2010 Bryan Ashby
+
+ This software is provided 'as-is', without any express or implied
+ warranty. In no event will the authors be held liable for any damages
+ arising from the use of this software.
+
+ Permission is granted to anyone to use this software for any purpose,
+ including commercial applications, and to alter it and redistribute it
+ freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+//
+//	Typed CreateFunction<R(Args...)>(): argument and result conversions,
+//	integers of any width, on UTF-8 and UTF-16 databases
+//
+
+#include "IcuSqlite3Test.h"
+#include "ICUSQLite3.h"
+
+//	STL
+#include <string>
+
+static int64_t Int(IcuSqlite3Database& db, const char* sql)
+{
+	int64_t value = -12345;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+static std::string Text(IcuSqlite3Database& db, const char* sql)
+{
+	std::string value;
+	ICUSQLITE_TEST_CHECK(db.ExecuteScalar(sql, value));
+	return value;
+}
+
+static void Register(IcuSqlite3Database& db)
+{
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<int64_t(int64_t, int64_t)>("add64",
+		[](int64_t a, int64_t b) { return a + b; }, ICUSQLITE_FUNCTION_DETERMINISTIC));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<int32_t(int32_t, int32_t)>("add32",
+		[](int32_t a, int32_t b) { return a + b; }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<double(double)>("half",
+		[](double d) { return d / 2; }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<bool(bool)>("negate",
+		[](bool b) { return !b; }));
+
+	//	integer types without an exact overload
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<long long(long long, long long)>("mulll",
+		[](long long a, long long b) { return a * b; }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<short(short)>("negshort",
+		[](short s) { return static_cast<short>(-s); }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<int(unsigned char)>("low8",
+		[](unsigned char c) { return static_cast<int>(c); }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<unsigned long long()>("bigunsigned",
+		[]() { return 1ULL << 63; }));
+
+	//	text and blobs
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<size_t(const std::string&)>("bytes",
+		[](const std::string& s) { return s.size(); }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<bool(const char*)>("isnullptr",
+		[](const char* s) { return nullptr == s; }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<int64_t(IcuSqlite3Utf8View)>("viewbytes",
+		[](IcuSqlite3Utf8View v) { return static_cast<int64_t>(v.IsNull() ? -1 : v.length); }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<int64_t(IcuSqlite3BlobView)>("blobbytes",
+		[](IcuSqlite3BlobView v) { return static_cast<int64_t>(v.null ? -1 : v.length); }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<std::string(std::string, const char*)>("glue",
+		[](std::string a, const char* b) { return a + "|" + ((nullptr != b) ? b : "null"); }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<UnicodeString(const UnicodeString&)>("upper16",
+		[](const UnicodeString& s) { UnicodeString upper(s); return upper.toUpper(Locale::getRoot()); }));
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<int64_t(UnicodeString)>("units16",
+		[](UnicodeString s) { return static_cast<int64_t>(s.length()); }));
+
+	ICUSQLITE_TEST_CHECK(db.CreateFunction<void(int64_t)>("sink",
+		[](int64_t) {}));
+}
+
+static void TestConversions(IcuSqlite3Database& db)
+{
+	Register(db);
+
+	ICUSQLITE_TEST_CHECK(5 == Int(db, "SELECT add64(2, 3);"));
+	ICUSQLITE_TEST_CHECK(5000000000LL == Int(db, "SELECT add64(2500000000, 2500000000);"));
+	ICUSQLITE_TEST_CHECK(-1 == Int(db, "SELECT add32(1, -2);"));
+	ICUSQLITE_TEST_CHECK("1.25" == Text(db, "SELECT half(2.5);"));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT negate(0);"));
+	ICUSQLITE_TEST_CHECK("integer" == Text(db, "SELECT typeof(negate(7));"));
+
+	ICUSQLITE_TEST_CHECK(6000000000LL == Int(db, "SELECT mulll(3000000000, 2);"));
+	ICUSQLITE_TEST_CHECK("integer" == Text(db, "SELECT typeof(mulll(3, 2));"));
+	ICUSQLITE_TEST_CHECK(-300 == Int(db, "SELECT negshort(300);"));
+	ICUSQLITE_TEST_CHECK(44 == Int(db, "SELECT low8(300);"));		//	truncated like a cast
+	ICUSQLITE_TEST_CHECK("real" == Text(db, "SELECT typeof(bigunsigned());"));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT bigunsigned() = 9223372036854775808.0;"));
+
+	//	"é\U0001F600" is 6 bytes of UTF-8 and 3 UTF-16 units
+	ICUSQLITE_TEST_CHECK(6 == Int(db, "SELECT bytes(char(233, 128512));"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT bytes(NULL);"));
+	ICUSQLITE_TEST_CHECK(6 == Int(db, "SELECT viewbytes(char(233, 128512));"));
+	ICUSQLITE_TEST_CHECK(-1 == Int(db, "SELECT viewbytes(NULL);"));
+	ICUSQLITE_TEST_CHECK(3 == Int(db, "SELECT units16(char(233, 128512));"));
+	ICUSQLITE_TEST_CHECK(3 == Int(db, "SELECT blobbytes(x'0102ff');"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT blobbytes(x'');"));
+	ICUSQLITE_TEST_CHECK(-1 == Int(db, "SELECT blobbytes(NULL);"));
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT isnullptr(NULL);"));
+	ICUSQLITE_TEST_CHECK(0 == Int(db, "SELECT isnullptr('');"));
+
+	ICUSQLITE_TEST_CHECK("a|b" == Text(db, "SELECT glue('a', 'b');"));
+	ICUSQLITE_TEST_CHECK("\xC3\xA9|null" == Text(db, "SELECT glue(char(233), NULL);"));
+	ICUSQLITE_TEST_CHECK("\xC3\x89T\xC3\x89" == Text(db, "SELECT upper16(char(233) || 't' || char(233));"));
+
+	ICUSQLITE_TEST_CHECK(1 == Int(db, "SELECT sink(1) IS NULL;"));
+
+	//	arity is checked by SQLite
+	ICUSQLITE_TEST_CHECK(-1 == db.ExecuteUpdate("SELECT add64(1);"));
+}
+
+int main()
+{
+	IcuSqlite3Database db;
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:"));
+	TestConversions(db);
+	db.Close();
+
+	ICUSQLITE_TEST_CHECK(db.Open(":memory:", ICUSQLITE_OPEN_READWRITE | ICUSQLITE_OPEN_CREATE,
+		ICUSQLITE_EXT_OPEN_DEFAULT | ICUSQLITE_EXT_OPEN_UTF16));
+	ICUSQLITE_TEST_CHECK("UTF-16le" == Text(db, "PRAGMA encoding;"));
+	TestConversions(db);
+	db.Close();
+
+	return IcuSqlite3TestResult("TestTypedFunction");
+}